@@ -10,5 +10,6 @@ exec_mysql()
 }
 
 exec_mysql < "$(dirname $0)/drop.sql"
-sed 's/"\([a-z]*\)"/`\1`/' "$(dirname $0)/schema.sql" | exec_mysql
+# columns commented as binary are compared byte by byte, not by collation
+sed -e 's/"\([a-z]*\)"/`\1`/' -e 's/varchar(\([0-9]*\))\(.*-- binary\)/varbinary(\1)\2/' "$(dirname $0)/schema.sql" | exec_mysql
 exec_mysql < "$(dirname $0)/data.sql"
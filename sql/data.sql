@@ -1,5 +1,8 @@
 insert into prefix values (0, 'system', '#');
 insert into type values (0, 0, 'blob');
+insert into type values (1, 0, 'integer');
+insert into type values (2, 0, 'double');
+insert into type values (3, 0, 'timestamp');
 
 insert into ids values (0, 'prefix', 1);
-insert into ids values (1, 'type', 1);
+insert into ids values (1, 'type', 4);
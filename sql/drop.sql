@@ -2,9 +2,22 @@ drop table if exists pool;
 drop table if exists file;
 drop table if exists content_type;
 drop table if exists `blob`;
+drop table if exists blob_content;
+drop table if exists pack;
+drop table if exists blob_pack;
+drop table if exists blob_checksum;
+drop table if exists blob_tier;
+drop table if exists blob_codec;
+drop table if exists blob_access;
+drop table if exists blob_leftover;
 drop table if exists prefix;
 drop table if exists type;
+drop table if exists term;
 drop table if exists metadata;
+drop table if exists metadata_log;
+drop table if exists text_word;
+drop table if exists text_posting;
+drop table if exists text_document;
 drop table if exists handle;
 drop table if exists session;
 drop table if exists journal;
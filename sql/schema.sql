@@ -14,10 +14,12 @@ create table file (
 
 create table content_type (
   id integer not null,
-  mime varchar(64) not null, -- unique
+  mime varchar(64) not null,
   primary key (id)
 );
 
+create unique index content_type_mime on content_type (mime);
+
 create table "blob" (
   id integer not null,
   file_id integer not null, -- references file (id)
@@ -28,31 +30,144 @@ create table "blob" (
   -- unique (file_id, name)
 );
 
+create table blob_content (
+  blob_id integer not null, -- references blob (id)
+  content longblob not null,
+  primary key (blob_id)
+);
+
+create table pack (
+  id integer not null,
+  size bigint not null, -- committed length of the pack file
+  primary key (id)
+);
+
+create table blob_pack (
+  blob_id integer not null, -- references blob (id)
+  pack_id integer not null, -- references pack (id)
+  start bigint not null,
+  length bigint not null,
+  primary key (blob_id)
+);
+
+create index blob_pack_pack on blob_pack (pack_id);
+
+create table blob_checksum (
+  blob_id integer not null, -- references blob (id)
+  size bigint not null,
+  crc32c bigint not null, -- of the contents, not of what is stored
+  primary key (blob_id)
+);
+
+create table blob_tier (
+  blob_id integer not null, -- references blob (id)
+  tier varchar(64) not null, -- absent for the default tier
+  primary key (blob_id)
+);
+
+create table blob_codec (
+  blob_id integer not null, -- references blob (id)
+  codec varchar(16) not null, -- absent if stored as it is
+  primary key (blob_id)
+);
+
+create table blob_access (
+  blob_id integer not null, -- references blob (id)
+  accessed bigint not null, -- seconds since 1970, absent if not read since stored
+  primary key (blob_id)
+);
+
+create table blob_leftover (
+  id integer not null,
+  tier varchar(64) not null, -- the old copy of a migrated blob is kept there for a while
+  uuid varchar(36) not null,
+  name varchar(256) not null,
+  moved bigint not null, -- seconds since 1970
+  primary key (id)
+);
+
 create table prefix (
   id integer not null,
-  name varchar(64) not null, -- unique
+  name varchar(64) not null,
   uri varchar(256) not null,
   primary key (id)
 );
 
+create unique index prefix_name on prefix (name);
+
 create table type (
   id integer not null,
   prefix_id integer not null,
-  name varchar(64) not null
-  -- unique (prefix_id, name)
+  name varchar(64) not null,
+  primary key (id)
+);
+
+create unique index type_name on type (prefix_id, name);
+
+create table term (
+  id integer not null,
+  value varchar(256) not null, -- binary, case and trailing spaces matter
+  primary key (id)
 );
 
+create unique index term_value on term (value);
+
 create table metadata (
   id integer not null,
   blob_id integer not null, -- references blob (id)
   predicate_prefix_id integer not null, -- references prefix (id)
-  predicate varchar(256) not null,
+  predicate_id integer not null, -- references term (id)
   object_type_id integer, -- references type (id)
-  object varchar(256) not null,
+  object_id integer not null, -- references term (id)
+  object_blob_id integer, -- references blob (id), set for blob objects only
+  object_integer bigint, -- set for system:integer objects only
+  object_double double precision, -- set for system:double objects only
+  object_timestamp bigint, -- microseconds since 1970 (UTC), set for system:timestamp objects only
   visible smallint not null,
   primary key (id)
 );
 
+create index metadata_blob on metadata (blob_id);
+create index metadata_predicate on metadata (predicate_prefix_id, predicate_id, object_id);
+create index metadata_predicate_blob on metadata (predicate_prefix_id, predicate_id, blob_id, object_id, visible);
+create index metadata_object_blob on metadata (object_blob_id);
+create index metadata_integer on metadata (predicate_prefix_id, predicate_id, object_integer);
+create index metadata_double on metadata (predicate_prefix_id, predicate_id, object_double);
+create index metadata_timestamp on metadata (predicate_prefix_id, predicate_id, object_timestamp);
+
+create table metadata_log (
+  generation integer not null, -- one per commit changing metadata
+  relation integer not null, -- metadata, or blob for removed blobs
+  relation_id integer not null,
+  operation integer not null
+);
+
+create index metadata_log_generation on metadata_log (generation);
+
+create table text_word (
+  id integer not null,
+  value varchar(64) not null, -- binary, lowercased
+  primary key (id)
+);
+
+create unique index text_word_value on text_word (value);
+
+create table text_posting (
+  word_id integer not null, -- references text_word (id)
+  blob_id integer not null, -- references blob (id), with a text/* content type
+  frequency integer not null,
+  positions longtext not null, -- of the word within the blob, separated by spaces
+  primary key (word_id, blob_id)
+);
+
+create index text_posting_blob on text_posting (blob_id);
+
+create table text_document (
+  blob_id integer not null, -- references blob (id)
+  length integer not null, -- in words
+  primary key (blob_id)
+);
+
 create table handle (
   id integer not null,
   relation integer not null,
@@ -77,6 +192,8 @@ create table journal (
   primary key (id)
 );
 
+create index journal_session on journal (session_id, relation, operation, relation_id);
+
 create table ids (
   id integer not null,
   table_name varchar(32) not null, -- unique
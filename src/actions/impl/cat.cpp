@@ -33,7 +33,7 @@ namespace associative
 				return 1;
 			
 			auto file = env.getFile(vm["uuid"].as<std::string>());
-			readFile(file->getBlob(vm["blob-name"].as<std::string>())->getPath(), std::cout);
+			file->getBlob(vm["blob-name"].as<std::string>())->copyTo(std::cout);
 			return 0;
 		}
 	};
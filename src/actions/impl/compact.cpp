@@ -0,0 +1,43 @@
+#include "../action.hpp"
+#include "../../env/vfs.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class CompactAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("compact options");
+			desc->add_options()
+				("garbage", value<double>(), "fraction of dead data which makes a pack rewritten (default from store.conf)");
+			return desc;
+		}
+		
+	public:
+		CompactAction()
+		: Action("compact")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>&, Environment& env)
+		{
+			auto& vfs = env.getVFS();
+			auto garbage = vm.count("garbage") ? vm["garbage"].as<double>() : vfs.getSettings().packGarbage;
+			if (garbage <= 0 || garbage > 1)
+				return 1;
+			
+			std::cout << vfs.compactPacks(env, garbage) << " packs rewritten" << std::endl;
+			return 0;
+		}
+
+	};
+	
+}
+
+COMMANDLINE_DEF(Compact);
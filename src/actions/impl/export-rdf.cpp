@@ -0,0 +1,46 @@
+#include "../action.hpp"
+#include "../../objects/rdf.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class ExportRDFAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("export-rdf options");
+			desc->add_options()
+				("format", value<std::string>()->default_value("nt"), "nt (N-Triples) or ttl (Turtle)")
+				("verbose", "Increase verbosity");
+			return desc;
+		}
+		
+	public:
+		ExportRDFAction()
+		: Action("export-rdf")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>&, Environment& env)
+		{
+			auto format = vm["format"].as<std::string>();
+			if (format != "nt" && format != "ttl")
+				return 1;
+			
+			RDFWriter writer(env, format == "nt" ? RDF::Format::NTriples : RDF::Format::Turtle);
+			auto count = writer.write(std::cout);
+			if (vm.count("verbose"))
+				std::cerr << count << " triples written" << std::endl;
+			return 0;
+		}
+	
+	};
+	
+}
+
+COMMANDLINE_DEF(ExportRDF);
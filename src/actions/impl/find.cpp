@@ -0,0 +1,93 @@
+#include "../action.hpp"
+#include "../../objects/file.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class FindAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("find options (conditions: prefix:predicate, prefix:predicate=object, prefix:predicate^=start, prefix:predicate>=from or prefix:predicate<=to, values optionally typed by ^^prefix:type)");
+			desc->add_options()
+				("limit", value<uint64_t>(), "maximum number of blobs (0 finds nothing)");
+			return desc;
+		}
+		
+	public:
+		FindAction()
+		: Action("find")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>& parameters, Environment& env)
+		{
+			if (parameters.empty())
+				return 1;
+			
+			std::vector<TripleFilter> filters;
+			for (auto iter = parameters.begin(); iter != parameters.end(); ++iter)
+			{
+				auto colon = iter->find(':');
+				if (colon == std::string::npos)
+					return 1;
+				
+				TripleFilter filter;
+				auto& conn = env.getConnection();
+				filter.predicatePrefix = Prefix::get(conn, iter->substr(0, colon), boost::none);
+				auto equals = iter->find('=', colon);
+				if (equals == std::string::npos)
+				{
+					filter.predicate = iter->substr(colon + 1);
+					filters.push_back(filter);
+					continue;
+				}
+				
+				// ranges of integers, doubles and timestamps need their type
+				auto value = iter->substr(equals + 1);
+				auto typed = value.rfind("^^");
+				if (typed != std::string::npos)
+				{
+					auto type = value.substr(typed + 2);
+					auto typeColon = type.find(':');
+					if (typeColon == std::string::npos)
+						return 1;
+					// an unknown type has no triples, and a lookup doesn't add it
+					filter.objectType = Type::find(conn, type.substr(typeColon + 1), Prefix::get(conn, type.substr(0, typeColon), boost::none));
+					if (!filter.objectType)
+						return 0;
+					value.erase(typed);
+				}
+				
+				auto op = equals > colon + 1 ? (*iter)[equals - 1] : '=';
+				filter.predicate = iter->substr(colon + 1, equals - colon - (op == '^' || op == '>' || op == '<' ? 2 : 1));
+				if (op == '^')
+					filter.objectPrefix = value;
+				else if (op == '>')
+					filter.objectFrom = value;
+				else if (op == '<')
+					filter.objectTo = value;
+				else
+					filter.object = value;
+				filters.push_back(filter);
+			}
+			
+			auto limit = vm.count("limit") ? boost::make_optional(vm["limit"].as<uint64_t>()) : boost::none;
+			env.findBlobs(filters, [](const std::string& uuid, const std::string& name) {
+				std::cout << uuid << " " << name << std::endl;
+				return true;
+			}, limit);
+			
+			return 0;
+		}
+	
+	};
+	
+}
+
+COMMANDLINE_DEF(Find);
@@ -0,0 +1,44 @@
+#include "../action.hpp"
+#include "../../env/vfs.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class GCAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("gc options");
+			desc->add_options()
+				("rate", value<unsigned>(), "maximum number of files removed per second, 0 for no limit (default from store.conf)")
+				("min-age", value<unsigned>(), "minimum age in seconds of files not belonging to a session (default from store.conf)");
+			return desc;
+		}
+		
+	public:
+		GCAction()
+		: Action("gc")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>&, Environment& env)
+		{
+			auto& vfs = env.getVFS();
+			auto rate = vm.count("rate") ? vm["rate"].as<unsigned>() : vfs.getSettings().gcRate;
+			auto minAge = vm.count("min-age") ? vm["min-age"].as<unsigned>() : vfs.getSettings().gcMinAge;
+			
+			auto statistics = vfs.collectGarbage(env, rate, minAge);
+			std::cout << statistics.removed << " of " << statistics.examined << " temporary files removed" << std::endl;
+			return 0;
+		}
+
+	};
+	
+}
+
+COMMANDLINE_DEF(GC);
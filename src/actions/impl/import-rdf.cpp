@@ -0,0 +1,57 @@
+#include <fstream>
+
+#include "../action.hpp"
+#include "../../objects/rdf.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class ImportRDFAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("import-rdf options (N-Triples or Turtle with one statement per line, subjects and blob objects as <urn:uuid:UUID#name>)");
+			desc->add_options()
+				("input", value<std::string>(), "file to read instead of the standard input")
+				("batch-size", value<uint64_t>()->default_value(100000), "maximum number of triples per commit, all but the last at the default isolation level (0: a single commit)")
+				("verbose", "Increase verbosity");
+			return desc;
+		}
+		
+	public:
+		ImportRDFAction()
+		: Action("import-rdf")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>&, Environment& env)
+		{
+			RDFReader reader(env, vm["batch-size"].as<uint64_t>());
+			uint64_t count;
+			if (vm.count("input"))
+			{
+				std::ifstream stream(vm["input"].as<std::string>());
+				if (!stream)
+					throw formatException(boost::format("couldn't open %1%") % vm["input"].as<std::string>());
+				count = reader.read(stream);
+			}
+			else
+			{
+				count = reader.read(std::cin);
+			}
+			
+			if (vm.count("verbose"))
+				std::cerr << count << " triples added" << std::endl;
+			return 0;
+		}
+	
+	};
+	
+}
+
+COMMANDLINE_DEF(ImportRDF);
@@ -10,6 +10,20 @@ namespace associative
 	{
 		COMMANDLINE_DECL;
 		
+	private:
+		// triples added per commit by add-bulk, all but the last one at the
+		// default isolation level (as import-rdf does)
+		static const std::size_t bulkSize = 10000;
+		
+		// splits prefix:name resp. uuid:name at the first colon
+		static boost::optional<std::pair<std::string, std::string> > splitName(const std::string& name)
+		{
+			auto colon = name.find(':');
+			if (colon == std::string::npos || colon == 0 || colon + 1 == name.size())
+				return boost::none;
+			return std::make_pair(name.substr(0, colon), name.substr(colon + 1));
+		}
+		
 	protected:
 		virtual options_description* desc()
 		{
@@ -24,6 +38,12 @@ namespace associative
 				("object", value<std::string>(), "object")
 				("object-uuid", value<std::string>(), "UUID of the file of the object blob")
 				("object-blob-name", value<std::string>(), "object blob name")
+				("object-starts-with", value<std::string>(), "prefix of the object (list only)")
+				("object-from", value<std::string>(), "lower bound of the object (list only)")
+				("object-to", value<std::string>(), "upper bound of the object (list only)")
+				("limit", value<uint64_t>(), "maximum number of triples (list only)")
+				("direction", value<std::string>()->default_value("out"), "out, in or both (neighbors and traverse only)")
+				("depth", value<unsigned>()->default_value(1), "maximum number of hops (traverse only)")
 				("verbose", "Increase verbosity");
 			return desc;
 		}
@@ -45,8 +65,34 @@ namespace associative
 			
 			if (op == "list")
 			{
+				auto& conn = env.getConnection();
+				TripleFilter filter;
+				if (vm.count("predicate-prefix"))
+					filter.predicatePrefix = Prefix::get(conn, vm["predicate-prefix"].as<std::string>(), boost::none);
+				if (vm.count("predicate"))
+					filter.predicate = vm["predicate"].as<std::string>();
+				if (vm.count("object-type") != vm.count("object-prefix"))
+					return 1;
+				if (vm.count("object-type"))
+				{
+					// an unknown type has no triples, and a lookup doesn't add it
+					filter.objectType = Type::find(conn, vm["object-type"].as<std::string>(), Prefix::get(conn, vm["object-prefix"].as<std::string>(), boost::none));
+					if (!filter.objectType)
+						return 0;
+				}
+				if (vm.count("object"))
+					filter.object = vm["object"].as<std::string>();
+				if (vm.count("object-starts-with"))
+					filter.objectPrefix = vm["object-starts-with"].as<std::string>();
+				if (vm.count("object-from"))
+					filter.objectFrom = vm["object-from"].as<std::string>();
+				if (vm.count("object-to"))
+					filter.objectTo = vm["object-to"].as<std::string>();
+				if (vm.count("limit"))
+					filter.limit = vm["limit"].as<uint64_t>();
+				
 				std::cout << collToString(
-					blob->getTriples(TripleFilter()),
+					blob->getTriples(filter),
 					ConvertingCollFormat<std::vector<Triple> >("", "", "\n",
 						verbose ? &Triple::toVerboseString : &Triple::toSimpleString
 					)
@@ -77,6 +123,87 @@ namespace associative
 					blob->addTriple(predicatePrefix, predicate, *blobObject);
 				}
 			}
+			else if (op == "add-bulk")
+			{
+				// One triple per line, "prefix:predicate<tab>prefix:type<tab>value"
+				// or "prefix:predicate<tab>uuid:name" for blobs as objects.
+				auto& conn = env.getConnection();
+				std::vector<NewTriple> triples;
+				uint64_t count = 0;
+				std::string line;
+				while (std::getline(std::cin, line))
+				{
+					if (line.empty())
+						continue;
+					// the value may contain tabs itself
+					std::vector<std::string> fields;
+					std::size_t start = 0;
+					for (auto tab = line.find('\t'); tab != std::string::npos && fields.size() < 2; tab = line.find('\t', start))
+					{
+						fields.push_back(line.substr(start, tab - start));
+						start = tab + 1;
+					}
+					fields.push_back(line.substr(start));
+					auto predicate = fields.size() >= 2 ? splitName(fields[0]) : boost::none;
+					if (!predicate)
+						throw formatException(boost::format("malformed triple %1%") % line);
+					auto predicatePrefix = Prefix::get(conn, predicate->first);
+					
+					if (fields.size() == 3)
+					{
+						auto type = splitName(fields[1]);
+						if (!type)
+							throw formatException(boost::format("malformed type %1%") % fields[1]);
+						auto objectType = Type::get(conn, type->second, Prefix::get(conn, type->first));
+						triples.push_back(NewTriple(predicatePrefix, predicate->second, objectType, fields[2]));
+					}
+					else
+					{
+						auto object = splitName(fields[1]);
+						if (!object)
+							throw formatException(boost::format("malformed blob %1%") % fields[1]);
+						triples.push_back(NewTriple(predicatePrefix, predicate->second, *env.getFile(object->first)->getBlob(object->second)));
+					}
+					
+					if (triples.size() == bulkSize)
+					{
+						count += blob->addTriples(triples).size();
+						triples.clear();
+						// a single session would journal all of stdin
+						env.commitSession(IsolationLevel::getIsolationLevel());
+						env.startSession();
+						blob = env.getFile(vm["uuid"].as<std::string>())->getBlob(vm["blob-name"].as<std::string>());
+					}
+				}
+				count += blob->addTriples(triples).size();
+				if (verbose)
+					std::cerr << count << " triples added" << std::endl;
+			}
+			else if (op == "neighbors" || op == "traverse")
+			{
+				auto direction = vm["direction"].as<std::string>();
+				if (direction != "out" && direction != "in" && direction != "both")
+					return 1;
+				
+				TripleFilter filter;
+				if (vm.count("predicate-prefix"))
+					filter.predicatePrefix = Prefix::get(env.getConnection(), vm["predicate-prefix"].as<std::string>(), boost::none);
+				if (vm.count("predicate"))
+					filter.predicate = vm["predicate"].as<std::string>();
+				
+				auto print = [verbose](const Traversal::Node& node) {
+					std::cout << node.depth << "\t" << node.uuid << ":" << node.name;
+					if (verbose)
+						std::cout << "\t" << node.parent << "\t" << node.tripleID;
+					std::cout << std::endl;
+					return true;
+				};
+				auto way = direction == "out" ? Traversal::Direction::Outgoing : direction == "in" ? Traversal::Direction::Incoming : Traversal::Direction::Both;
+				if (op == "neighbors")
+					forEach(blob->neighbors(way, filter), print);
+				else
+					blob->traverse(way, filter, vm["depth"].as<unsigned>(), print);
+			}
 			else
 			{
 				return 1;
@@ -84,7 +211,7 @@ namespace associative
 			
 			return 0;
 		}
-
+	
 	};
 	
 }
@@ -0,0 +1,40 @@
+#include "../action.hpp"
+#include "../../env/vfs.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class MigrateAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("migrate options");
+			desc->add_options()
+				("threads", value<unsigned>()->default_value(defaultThreadCount()), "number of threads copying blobs")
+				("rate", value<unsigned>()->default_value(0), "maximum MiB copied per second (0: no limit)");
+			return desc;
+		}
+		
+	public:
+		MigrateAction()
+		: Action("migrate")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>&, Environment& env)
+		{
+			auto count = env.getVFS().migrate(env, vm["threads"].as<unsigned>(), static_cast<uint64_t>(vm["rate"].as<unsigned>()) << 20);
+			std::cout << count << " blobs migrated" << std::endl;
+			return 0;
+		}
+
+	};
+	
+}
+
+COMMANDLINE_DEF(Migrate);
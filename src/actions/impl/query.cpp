@@ -0,0 +1,54 @@
+#include "../action.hpp"
+#include "../../objects/query.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class QueryAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("query options (e. g. ?blob prefix:predicate \"value\" . ?blob prefix:other ?object)");
+			desc->add_options()
+				("limit", value<uint64_t>(), "maximum number of solutions");
+			return desc;
+		}
+		
+	public:
+		QueryAction()
+		: Action("query")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>& parameters, Environment& env)
+		{
+			if (parameters.empty())
+				return 1;
+			
+			Query query(env, collToString(parameters, SimpleCollFormat<std::vector<std::string> >("", "", " ")));
+			std::cout << collToString(query.getVariables(), SimpleCollFormat<std::vector<std::string> >("?", "", "\t?")) << std::endl;
+			
+			uint64_t count = 0;
+			auto limit = vm.count("limit") ? boost::make_optional(vm["limit"].as<uint64_t>()) : boost::none;
+			if (limit && !*limit)
+				return 0;
+			query.execute([&](const std::vector<Query::Term>& terms) {
+				for (auto iter = terms.begin(); iter != terms.end(); ++iter)
+					std::cout << (iter == terms.begin() ? "" : "\t") << iter->text;
+				std::cout << std::endl;
+				return !limit || ++count < *limit;
+			});
+			
+			return 0;
+		}
+	
+	};
+	
+}
+
+COMMANDLINE_DEF(Query);
@@ -0,0 +1,43 @@
+#include "../action.hpp"
+#include "../../env/vfs.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class ReshardAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("reshard options");
+			desc->add_options()
+				("levels", value<unsigned>(), "number of directory levels below blobs/")
+				("width", value<unsigned>()->default_value(2), "number of UUID characters per level")
+				("threads", value<unsigned>()->default_value(defaultThreadCount()), "number of threads moving directories");
+			return desc;
+		}
+		
+	public:
+		ReshardAction()
+		: Action("reshard")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>&, Environment& env)
+		{
+			if (!vm.count("levels"))
+				return 1;
+			
+			env.getVFS().reshard(env, vm["levels"].as<unsigned>(), vm["width"].as<unsigned>(), vm["threads"].as<unsigned>());
+			return 0;
+		}
+
+	};
+	
+}
+
+COMMANDLINE_DEF(Reshard);
@@ -0,0 +1,50 @@
+#include "../action.hpp"
+#include "../../env/scrub.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class ScrubAction : public Action
+	{
+		COMMANDLINE_DECL;
+		
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("scrub options");
+			desc->add_options()
+				("threads", value<unsigned>()->default_value(defaultThreadCount()), "number of threads reading blobs")
+				("rate", value<unsigned>()->default_value(0), "maximum MiB read per second (0: no limit)")
+				("restart", "start from scratch instead of continuing an interrupted run");
+			return desc;
+		}
+		
+	public:
+		ScrubAction()
+		: Action("scrub")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>&, Environment& env)
+		{
+			Scrubber scrubber(env, vm["threads"].as<unsigned>(), static_cast<uint64_t>(vm["rate"].as<unsigned>()) << 20);
+			auto statistics = scrubber.run(vm.count("restart"), [](const Scrubber::Problem& problem) {
+				static const char* kinds[] = { "missing", "mismatch", "unreadable" };
+				std::cout << kinds[problem.kind] << " " << problem.uuid << " " << problem.name;
+				if (!problem.detail.empty())
+					std::cout << ": " << problem.detail;
+				std::cout << std::endl;
+			});
+			
+			std::cout << statistics.verified << " blobs verified, " << statistics.unchecked << " without checksum, "
+				<< statistics.problems << " problems" << std::endl;
+			return statistics.problems ? 1 : 0;
+		}
+
+	};
+	
+}
+
+COMMANDLINE_DEF(Scrub);
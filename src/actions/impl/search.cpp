@@ -0,0 +1,52 @@
+#include <boost/lexical_cast.hpp>
+
+#include "../action.hpp"
+#include "../../env/search.hpp"
+
+using namespace po;
+
+namespace associative
+{
+	
+	class SearchAction : public Action
+	{
+		COMMANDLINE_DECL;
+	
+	protected:
+		virtual options_description* desc()
+		{
+			auto desc = new options_description("search options (words, phrases in double quotes)");
+			desc->add_options()
+				("limit", value<unsigned>()->default_value(10), "maximum number of blobs")
+				("reindex", "index all text blobs anew, e.g. those stored before indexing was enabled");
+			return desc;
+		}
+	
+	public:
+		SearchAction()
+		: Action("search")
+		{
+		}
+		
+		virtual int perform(const variables_map& vm, const std::vector<std::string>& parameters, Environment& env)
+		{
+			if (vm.count("reindex"))
+				env.getVFS().reindex(env);
+			if (parameters.empty())
+				return vm.count("reindex") ? 0 : 1;
+			
+			std::string query;
+			for (auto iter = parameters.begin(); iter != parameters.end(); ++iter)
+				query += (iter == parameters.begin() ? "" : " ") + *iter;
+			
+			auto results = TextIndex::search(env.getConnection(), query, vm["limit"].as<unsigned>());
+			for (auto iter = results.begin(); iter != results.end(); ++iter)
+				std::cout << iter->uuid << " " << iter->name << " " << iter->score << std::endl;
+			return 0;
+		}
+	
+	};
+
+}
+
+COMMANDLINE_DEF(Search);
@@ -39,7 +39,11 @@ namespace associative
 			if (!file->hasBlob(name))
 				file->addBlob(name, vm["content-type"].as<std::string>());
 			
-			storeFile(file->getBlob(name)->getPath(true), std::cin);
+			auto writer = file->getBlob(name)->openWrite(BlobWriter::Mode::Truncate);
+			char buffer[65536];
+			while (std::cin.read(buffer, sizeof(buffer)) || std::cin.gcount())
+				writer->write(buffer, std::cin.gcount());
+			writer->close();
 			return 0;
 		}
 	};
@@ -12,10 +12,14 @@ set(ASSOCIATIVE_MAX_LOCK_TIME 10 CACHE STRING "maximum wait time for shared memo
 # should be the name of an isolation level in env/isolation_impl
 set(ASSOCIATIVE_DEFAULT_ISOLEVEL "almost-full" CACHE STRING "default isolation level to use")
 
+# should be one of none, commit or group
+set(ASSOCIATIVE_DEFAULT_DURABILITY "commit" CACHE STRING "default durability policy of new stores")
+
 # should be a path
 set(ASSOCIATIVE_DEFAULT_LOG "/var/local/log/associative-fs" CACHE FILEPATH "default log file")
 
 set(ASSOCIATIVE_WITH_SQLITE true CACHE BOOL "build with SQLite support")
 set(ASSOCIATIVE_WITH_MYSQL true CACHE BOOL "build with MySQL support")
+set(ASSOCIATIVE_WITH_URING true CACHE BOOL "build with io_uring support (Linux only)")
 
 configure_file(cmake/config.hpp.in gen/config.hpp)
@@ -36,23 +36,25 @@ void associative::TransactionHandle::end(bool commit)
 		throw DBException("transaction already ended");
 	
 	ended = true;
-	conn->endTransaction(commit);
+	conn->endTransactions(commit);
 }
 
 associative::TransactionHandle::TransactionHandle(associative::Connection* conn)
 : ended(false), conn(conn)
 {
 	conn->startTransaction();
+	boost::lock_guard<boost::mutex> guard(conn->commitMutex);
+	++conn->transactions;
 }
 
 associative::TransactionHandle::~TransactionHandle()
 {
 	if (!ended)
-		conn->endTransaction(false);
+		conn->endTransactions(false);
 }
 
 associative::Connection::Connection(bool buffer)
-: buffer(buffer)
+: transactions(0), buffer(buffer)
 {
 }
 
@@ -60,6 +62,11 @@ associative::Connection::~Connection()
 {
 }
 
+const std::string& associative::Connection::getDataSource() const
+{
+	return dataSource;
+}
+
 boost::shared_ptr<associative::PreparedQuery> associative::Connection::prepareQuery(const std::string& query, const boost::optional<std::string>& key)
 {
 	auto func = lambda::bind(lambda::constructor<boost::shared_ptr<PreparedQuery> >(), lambda::bind(&Connection::_prepareQuery, this, query));
@@ -79,12 +86,57 @@ boost::shared_ptr<associative::TransactionHandle> associative::Connection::trans
 	return boost::shared_ptr<TransactionHandle>(new TransactionHandle(this));
 }
 
+void associative::Connection::endTransactions(bool commit)
+{
+	std::vector<std::function<void()> > actions;
+	try
+	{
+		endTransaction(commit);
+	}
+	catch (...)
+	{
+		boost::lock_guard<boost::mutex> guard(commitMutex);
+		--transactions;
+		commitActions.clear();
+		throw;
+	}
+	
+	{
+		boost::lock_guard<boost::mutex> guard(commitMutex);
+		--transactions;
+		if (commit)
+			actions.swap(commitActions);
+		else
+			commitActions.clear();
+	}
+	for (auto iter = actions.begin(); iter != actions.end(); ++iter)
+		(*iter)();
+}
+
+void associative::Connection::onCommit(const std::function<void()>& action)
+{
+	{
+		boost::lock_guard<boost::mutex> guard(commitMutex);
+		if (transactions)
+		{
+			commitActions.push_back(action);
+			return;
+		}
+	}
+	action();
+}
+
 boost::shared_ptr<associative::TransactionHandle> associative::Connection::use()
 {
 	return transaction();
 }
 
 uint64_t associative::Connection::nextID(const std::string& table)
+{
+	return nextIDs(table, 1);
+}
+
+uint64_t associative::Connection::nextIDs(const std::string& table, uint64_t count)
 {
 	auto result = prepareQuery(
 		"select next_id from ids where table_name = ?", 
@@ -106,15 +158,15 @@ uint64_t associative::Connection::nextID(const std::string& table)
 		
 		id = 0;
 		prepareStatement(
-			"insert into ids values (?, ?, 1)", 
-		std::string("connection.next_id.insert"))->execute(convertAll(entryID, table));
+			"insert into ids values (?, ?, ?)", 
+		std::string("connection.next_id.insert"))->execute(convertAll(entryID, table, count));
 	}
 	else
 	{
 		id = boost::lexical_cast<uint64_t>(result.rows.front().at(0));
 		prepareStatement(
-			"update ids set next_id = next_id + 1 where table_name = ?", 
-		std::string("connection.next_id.update"))->execute(convertAll(table));
+			"update ids set next_id = next_id + ? where table_name = ?", 
+		std::string("connection.next_id.update"))->execute(convertAll(count, table));
 	}
 	return id;
 }
@@ -156,7 +208,9 @@ associative::Connection* associative::ConnectionProvider::dispatch(const std::st
 	if (!containsKey(manager().modules(), provider))
 		throw formatException(boost::format("%1% is not a valid connection provider") % provider);
 	
-	return manager().modules()[provider]->createConnection(dataSource.substr(pos + 1), process, logger);
+	auto conn = manager().modules()[provider]->createConnection(dataSource.substr(pos + 1), process, logger);
+	conn->dataSource = dataSource;
+	return conn;
 }
 
 associative::DBException::DBException()
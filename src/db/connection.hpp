@@ -1,6 +1,11 @@
 #ifndef ASSOCIATIVE_CONNECTION_HPP
 #define ASSOCIATIVE_CONNECTION_HPP
 
+#include <functional>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
 #include "../env/process.hpp"
 #include "../util/format.hpp"
 #include "../util/modules.hpp"
@@ -14,6 +19,9 @@
 
 // TODO where to put them?
 #define ASSOCIATIVE_SYS_BLOB_TYPE 0
+#define ASSOCIATIVE_SYS_INTEGER_TYPE 1
+#define ASSOCIATIVE_SYS_DOUBLE_TYPE 2
+#define ASSOCIATIVE_SYS_TIMESTAMP_TYPE 3
 #define ASSOCIATIVE_SYS_PREFIX 0
 
 namespace associative
@@ -80,10 +88,17 @@ namespace associative
 	class Connection : public Resource<TransactionHandle>
 	{
 		friend class TransactionHandle;
+		friend class ConnectionProvider;
 		
 	private:
 		Buffer<boost::shared_ptr<PreparedStatement> > statementBuffer;
 		Buffer<boost::shared_ptr<PreparedQuery> > queryBuffer;
+		std::string dataSource;
+		boost::mutex commitMutex;
+		unsigned transactions;
+		std::vector<std::function<void()> > commitActions;
+		
+		void endTransactions(bool commit);
 		
 	protected:
 		const bool buffer;
@@ -109,6 +124,9 @@ namespace associative
 		
 		virtual ~Connection();
 		
+		// as given to ConnectionProvider::dispatch, identifies the database
+		const std::string& getDataSource() const;
+		
 		virtual uint64_t executeStatement(const std::string& statement) = 0;
 		virtual QueryResult executeQuery(const std::string& query) = 0;
 		boost::shared_ptr<PreparedStatement> prepareStatement(const std::string& statement, const boost::optional<std::string>& key = boost::none);
@@ -116,8 +134,14 @@ namespace associative
 		
 		boost::shared_ptr<TransactionHandle> use();
 		boost::shared_ptr<TransactionHandle> transaction();
+		// Runs 'action' once the current transaction has been committed, or
+		// right away outside of transactions. Dropped on rollback, so that
+		// caches don't keep what never made it into the database.
+		void onCommit(const std::function<void()>& action);
 		
 		uint64_t nextID(const std::string& table);
+		// reserves 'count' consecutive IDs, returns the first one
+		uint64_t nextIDs(const std::string& table, uint64_t count);
 		uint64_t openHandle(int relation, uint64_t id, uint64_t sessionID);
 		void closeHandle(uint64_t handleID);
 	};
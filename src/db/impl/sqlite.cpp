@@ -61,7 +61,7 @@ namespace associative
 				sqlite3_clear_bindings(stmt);
 				int i = 1;
 				for (auto iter = parameters.begin(); iter != parameters.end(); ++iter, ++i)
-					sqlite3_bind_text(stmt, i, iter->c_str(), -1, 0);
+					sqlite3_bind_text(stmt, i, iter->data(), iter->size(), 0);
 			}
 			
 		};
@@ -134,9 +134,9 @@ namespace associative
 					std::vector<std::string> row(colCount);
 					for (int i = 0; i < colCount; ++i)
 					{
-						// TODO fix
+						// by length, as blobs may contain null bytes
 						auto entry = reinterpret_cast<const char*>(sqlite3_column_text(stmt, i));
-						row[i] = entry ? entry : "";
+						row[i] = entry ? std::string(entry, sqlite3_column_bytes(stmt, i)) : "";
 					}
 					rows.push_back(row);
 				}
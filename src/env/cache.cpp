@@ -0,0 +1,494 @@
+#include <map>
+#include <algorithm>
+#include <tuple>
+#include <unordered_set>
+
+#include <boost/lexical_cast.hpp>
+
+#include "cache.hpp"
+#include "../objects/blob.hpp"
+
+namespace
+{
+	
+	const char* const counterName = "metadata-generation";
+	
+	// the caches of the process by store, alive as long as an environment
+	// uses them
+	boost::mutex cachesMutex;
+	std::map<std::string, boost::weak_ptr<associative::TripleCache> > caches;
+	
+	// rows are loaded in chunks of IDs, so that the result sets stay small
+	const uint64_t chunkSize = 65536;
+	
+	// orders of the permutations, and of their prefixes used for ranges
+	struct SPO
+	{
+		template<typename Entry>
+		bool operator()(const Entry& a, const Entry& b) const
+		{
+			return std::tie(a.subject, a.predicate, a.object, a.id) < std::tie(b.subject, b.predicate, b.object, b.id);
+		}
+	};
+	
+	struct POS
+	{
+		template<typename Entry>
+		bool operator()(const Entry& a, const Entry& b) const
+		{
+			return std::tie(a.predicate, a.object, a.subject, a.id) < std::tie(b.predicate, b.object, b.subject, b.id);
+		}
+	};
+	
+	struct OSP
+	{
+		template<typename Entry>
+		bool operator()(const Entry& a, const Entry& b) const
+		{
+			return std::tie(a.object, a.subject, a.predicate, a.id) < std::tie(b.object, b.subject, b.predicate, b.id);
+		}
+	};
+	
+	template<typename Entry, typename Order>
+	void merge(std::vector<Entry>& entries, std::vector<Entry> added, const std::function<bool(const Entry&)>& removed, const Order& order)
+	{
+		entries.erase(std::remove_if(entries.begin(), entries.end(), removed), entries.end());
+		added.erase(std::remove_if(added.begin(), added.end(), removed), added.end());
+		std::sort(added.begin(), added.end(), order);
+		auto middle = entries.size();
+		entries.insert(entries.end(), added.begin(), added.end());
+		std::inplace_merge(entries.begin(), entries.begin() + middle, entries.end(), order);
+	}
+
+}
+
+associative::TripleCache::TripleCache(const boost::shared_ptr<Process>& process, const boost::shared_ptr<Logger>& logger)
+: process(process), logger(logger), counter(process->getCounter(counterName)), loaded(false), next(0), seen(0)
+{
+}
+
+boost::shared_ptr<associative::TripleCache> associative::TripleCache::get(const fs::path& root, const boost::shared_ptr<Process>& process, const boost::shared_ptr<Logger>& logger)
+{
+	boost::lock_guard<boost::mutex> guard(cachesMutex);
+	auto& weak = caches[fs::canonical(root).string()];
+	auto cache = weak.lock();
+	if (!cache)
+	{
+		cache.reset(new TripleCache(process, logger));
+		weak = cache;
+	}
+	return cache;
+}
+
+std::string associative::TripleCache::getTermKey(uint64_t ref, const std::string& value)
+{
+	return toString(ref) + ":" + value;
+}
+
+uint32_t associative::TripleCache::intern(uint64_t ref, uint64_t id, const std::string& value)
+{
+	auto key = getTermKey(ref, value);
+	auto iter = termIDs.find(key);
+	if (iter != termIDs.end())
+		return iter->second;
+	
+	Term term = { ref, id, value, 0 };
+	uint32_t index = terms.size();
+	if (freeTerms.empty())
+	{
+		terms.push_back(term);
+	}
+	else
+	{
+		index = freeTerms.back();
+		freeTerms.pop_back();
+		terms[index] = term;
+	}
+	termIDs[key] = index;
+	termValues.insert(std::make_pair(value, index));
+	return index;
+}
+
+void associative::TripleCache::reference(const Entry& entry)
+{
+	++terms[entry.predicate].references;
+	++terms[entry.object].references;
+}
+
+void associative::TripleCache::release(const Entry& entry, std::vector<uint32_t>& unused)
+{
+	for (auto term : { entry.predicate, entry.object })
+		if (!--terms[term].references)
+			unused.push_back(term);
+}
+
+void associative::TripleCache::drop(uint32_t term)
+{
+	// a term might be used again, or be dropped already
+	auto& dropped = terms[term];
+	auto iter = termIDs.find(getTermKey(dropped.ref, dropped.value));
+	if (dropped.references || iter == termIDs.end() || iter->second != term)
+		return;
+	
+	termIDs.erase(iter);
+	auto values = termValues.equal_range(dropped.value);
+	for (auto value = values.first; value != values.second; ++value)
+		if (value->second == term)
+		{
+			termValues.erase(value);
+			break;
+		}
+	std::string().swap(dropped.value);
+	freeTerms.push_back(term);
+}
+
+void associative::TripleCache::sync(Connection& conn)
+{
+	auto now = boost::posix_time::microsec_clock::universal_time();
+	auto published = counter->load();
+	if (loaded && published == seen && now - checked < boost::posix_time::seconds(1))
+		return;
+	
+	// Callers may hold a transaction already, so there is none here. Applying
+	// the log is idempotent, which makes up for commits done in between.
+	if (!loaded)
+		load(conn);
+	else
+		apply(conn);
+	
+	seen = published;
+	checked = now;
+}
+
+void associative::TripleCache::load(Connection& conn)
+{
+	terms.clear();
+	termIDs.clear();
+	termValues.clear();
+	freeTerms.clear();
+	spo.clear();
+	blobs.clear();
+	applied.clear();
+	
+	// what is in the log before reading the metadata is part of it
+	auto query = conn.prepareQuery("select distinct generation from metadata_log order by generation", std::string("cache.log.generations"));
+	auto generations = query->execute(convertAll());
+	if (generations.rows.empty())
+	{
+		query = conn.prepareQuery("select next_id from ids where table_name = ?", std::string("cache.log.next"));
+		auto result = query->execute(convertAll("metadata_log"));
+		next = result.rows.empty() ? 0 : boost::lexical_cast<uint64_t>(result.rows.front().at(0));
+	}
+	else
+	{
+		next = boost::lexical_cast<uint64_t>(generations.rows.front().at(0));
+		for (auto iter = generations.rows.begin(); iter != generations.rows.end(); ++iter)
+			applied.insert(boost::lexical_cast<uint64_t>(iter->at(0)));
+		while (applied.erase(next))
+			++next;
+	}
+	
+	query = conn.prepareQuery("select max(id) from metadata", std::string("cache.max"));
+	auto max = query->execute(convertAll());
+	auto maxID = max.rows.front().at(0).empty() ? 0 : boost::lexical_cast<uint64_t>(max.rows.front().at(0));
+	
+	// metadata of removed blobs is left behind, but isn't visible
+	query = conn.prepareQuery(
+		"select m.id, m.blob_id, m.predicate_prefix_id, pt.value, m.object_type_id, ot.value, file.uuid, blob.name, m.predicate_id, m.object_id "
+		"from metadata m "
+		"inner join term pt on pt.id = m.predicate_id "
+		"inner join term ot on ot.id = m.object_id "
+		"inner join `blob` on blob.id = m.blob_id "
+		"inner join file on file.id = blob.file_id "
+		"where m.visible = 1 and m.id >= ? and m.id < ?",
+	std::string("cache.load"));
+	for (uint64_t from = 0; from <= maxID; from += chunkSize)
+	{
+		auto result = query->execute(convertAll(from, from + chunkSize));
+		for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		{
+			auto& row = *iter;
+			Entry entry = {
+				boost::lexical_cast<uint64_t>(row[1]),
+				intern(boost::lexical_cast<uint64_t>(row[2]), boost::lexical_cast<uint64_t>(row[8]), row[3]),
+				intern(boost::lexical_cast<uint64_t>(row[4]), boost::lexical_cast<uint64_t>(row[9]), row[5]),
+				boost::lexical_cast<uint64_t>(row[0])
+			};
+			reference(entry);
+			spo.push_back(entry);
+			blobs[entry.subject] = std::make_pair(row[6], row[7]);
+		}
+	}
+	
+	pos = osp = spo;
+	std::sort(spo.begin(), spo.end(), SPO());
+	std::sort(pos.begin(), pos.end(), POS());
+	std::sort(osp.begin(), osp.end(), OSP());
+	
+	loaded = true;
+	logger->info() << "cached " << spo.size() << " triples with " << terms.size() << " terms";
+}
+
+void associative::TripleCache::apply(Connection& conn)
+{
+	// Commits may become visible out of order, so take whatever is in the
+	// log but hasn't been applied yet, rather than what follows the latest.
+	auto query = conn.prepareQuery("select distinct generation from metadata_log order by generation", std::string("cache.log.generations"));
+	auto generations = query->execute(convertAll());
+	if (generations.rows.empty())
+		return;
+	
+	// the log has been trimmed past what has been applied
+	if (boost::lexical_cast<uint64_t>(generations.rows.front().at(0)) > next)
+	{
+		load(conn);
+		return;
+	}
+	
+	std::set<uint64_t> missing;
+	for (auto iter = generations.rows.begin(); iter != generations.rows.end(); ++iter)
+	{
+		auto generation = boost::lexical_cast<uint64_t>(iter->at(0));
+		if (generation >= next && !containsKey(applied, generation))
+			missing.insert(generation);
+	}
+	if (missing.empty())
+		return;
+	
+	query = conn.prepareQuery(
+		"select l.generation, l.relation, l.relation_id, l.operation, "
+		"m.id, m.blob_id, m.predicate_prefix_id, pt.value, m.object_type_id, ot.value, file.uuid, blob.name, m.predicate_id, m.object_id "
+		"from metadata_log l "
+		"left join metadata m on l.relation = ? and l.operation = ? and m.id = l.relation_id "
+		"left join term pt on pt.id = m.predicate_id "
+		"left join term ot on ot.id = m.object_id "
+		"left join `blob` on blob.id = m.blob_id "
+		"left join file on file.id = blob.file_id "
+		"where l.generation >= ? "
+		"order by l.generation",
+	std::string("cache.log.apply"));
+	auto result = query->execute(convertAll(Connection::Relation::Metadata, Triple::Operation::Add, *missing.begin()));
+	
+	std::vector<Entry> added;
+	std::unordered_set<uint64_t> removedTriples;
+	std::unordered_set<uint64_t> removedBlobs;
+	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+	{
+		auto& row = *iter;
+		if (!containsKey(missing, boost::lexical_cast<uint64_t>(row[0])))
+			continue;
+		auto relation = boost::lexical_cast<int>(row[1]);
+		auto id = boost::lexical_cast<uint64_t>(row[2]);
+		auto operation = boost::lexical_cast<int>(row[3]);
+		if (relation == Connection::Relation::Blob)
+		{
+			removedBlobs.insert(id);
+			blobs[id] = boost::none;
+		}
+		else if (operation == Triple::Operation::Remove)
+		{
+			removedTriples.insert(id);
+		}
+		else if (!row[4].empty() && !row[10].empty())
+		{
+			Entry entry = {
+				boost::lexical_cast<uint64_t>(row[5]),
+				intern(boost::lexical_cast<uint64_t>(row[6]), boost::lexical_cast<uint64_t>(row[12]), row[7]),
+				intern(boost::lexical_cast<uint64_t>(row[8]), boost::lexical_cast<uint64_t>(row[13]), row[9]),
+				id
+			};
+			// loaded already if committed before loading
+			if (std::binary_search(spo.begin(), spo.end(), entry, SPO()))
+				continue;
+			blobs[entry.subject] = std::make_pair(row[10], row[11]);
+			added.push_back(entry);
+		}
+	}
+	
+	applied.insert(missing.begin(), missing.end());
+	while (applied.erase(next))
+		++next;
+	
+	std::function<bool(const Entry&)> removed = [&](const Entry& entry) {
+		return containsKey(removedTriples, entry.id) || containsKey(removedBlobs, entry.subject);
+	};
+	std::vector<uint32_t> unused;
+	for (auto iter = added.begin(); iter != added.end(); ++iter)
+		reference(*iter);
+	for (auto iter = added.begin(); iter != added.end(); ++iter)
+		if (removed(*iter))
+			release(*iter, unused);
+	if (!removedTriples.empty() || !removedBlobs.empty())
+		for (auto iter = spo.begin(); iter != spo.end(); ++iter)
+			if (removed(*iter))
+				release(*iter, unused);
+	
+	merge(spo, added, removed, SPO());
+	merge(pos, added, removed, POS());
+	merge(osp, added, removed, OSP());
+	for (auto iter = unused.begin(); iter != unused.end(); ++iter)
+		drop(*iter);
+}
+
+bool associative::TripleCache::matches(const TripleFilter& filter, const Entry& entry) const
+{
+	auto& predicate = terms[entry.predicate];
+	auto& object = terms[entry.object];
+	if (filter.predicatePrefix && predicate.ref != filter.predicatePrefix->id)
+		return false;
+	if (filter.predicate && predicate.value != *filter.predicate)
+		return false;
+	if (filter.objectType && object.ref != filter.objectType->id)
+		return false;
+	return filter.matchesObject(object.ref, object.value);
+}
+
+void associative::TripleCache::forEach(const TripleFilter& filter, const boost::optional<uint64_t>& subject, const std::function<void(const Entry&)>& function) const
+{
+	// terms which have never been seen can't match anything, a predicate
+	// without prefix is any of those with its name
+	std::vector<boost::optional<uint32_t> > predicates;
+	if (filter.predicatePrefix && filter.predicate)
+	{
+		auto iter = termIDs.find(getTermKey(filter.predicatePrefix->id, *filter.predicate));
+		if (iter == termIDs.end())
+			return;
+		predicates.push_back(iter->second);
+	}
+	else if (filter.predicate)
+	{
+		auto values = termValues.equal_range(*filter.predicate);
+		for (auto iter = values.first; iter != values.second; ++iter)
+			predicates.push_back(iter->second);
+		if (predicates.empty())
+			return;
+	}
+	else
+	{
+		predicates.push_back(boost::none);
+	}
+	boost::optional<uint32_t> object;
+	if (filter.objectType && filter.object)
+	{
+		auto iter = termIDs.find(getTermKey(filter.objectType->id, *filter.object));
+		if (iter == termIDs.end())
+			return;
+		object = iter->second;
+	}
+	
+	for (auto predicate = predicates.begin(); predicate != predicates.end(); ++predicate)
+	{
+		Entry key = { subject ? *subject : 0, *predicate ? **predicate : 0, object ? *object : 0, 0 };
+		std::pair<std::vector<Entry>::const_iterator, std::vector<Entry>::const_iterator> range(spo.begin(), spo.end());
+		if (subject && *predicate)
+			range = std::equal_range(spo.begin(), spo.end(), key, [](const Entry& a, const Entry& b) { return std::tie(a.subject, a.predicate) < std::tie(b.subject, b.predicate); });
+		else if (subject)
+			range = std::equal_range(spo.begin(), spo.end(), key, [](const Entry& a, const Entry& b) { return a.subject < b.subject; });
+		else if (*predicate && object)
+			range = std::equal_range(pos.begin(), pos.end(), key, [](const Entry& a, const Entry& b) { return std::tie(a.predicate, a.object) < std::tie(b.predicate, b.object); });
+		else if (*predicate)
+			range = std::equal_range(pos.begin(), pos.end(), key, [](const Entry& a, const Entry& b) { return a.predicate < b.predicate; });
+		else if (object)
+			range = std::equal_range(osp.begin(), osp.end(), key, [](const Entry& a, const Entry& b) { return a.object < b.object; });
+		
+		for (auto iter = range.first; iter != range.second; ++iter)
+			if ((!subject || iter->subject == *subject) && matches(filter, *iter))
+				function(*iter);
+	}
+}
+
+std::vector<associative::TripleCache::Match> associative::TripleCache::getTriples(Connection& conn, const TripleFilter& filter, const boost::optional<uint64_t>& subject)
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	sync(conn);
+	
+	std::vector<Entry> found;
+	forEach(filter, subject, [&found](const Entry& entry) { found.push_back(entry); });
+	std::sort(found.begin(), found.end(), [](const Entry& a, const Entry& b) { return a.id < b.id; });
+	
+	std::vector<Match> matches;
+	for (auto iter = found.begin(); iter != found.end(); ++iter)
+	{
+		auto& predicate = terms[iter->predicate];
+		auto& object = terms[iter->object];
+		Match match = { iter->id, iter->subject, predicate.ref, predicate.id, predicate.value, object.ref, object.id, object.value };
+		matches.push_back(match);
+	}
+	return matches;
+}
+
+uint64_t associative::TripleCache::count(Connection& conn, const TripleFilter& filter, const boost::optional<uint64_t>& subject)
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	sync(conn);
+	
+	uint64_t count = 0;
+	forEach(filter, subject, [&count](const Entry&) { ++count; });
+	return count;
+}
+
+std::vector<uint64_t> associative::TripleCache::findBlobs(Connection& conn, const TripleFilter& filter)
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	sync(conn);
+	
+	std::vector<uint64_t> found;
+	forEach(filter, boost::none, [&found](const Entry& entry) { found.push_back(entry.subject); });
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+	return found;
+}
+
+boost::optional<std::pair<std::string, std::string> > associative::TripleCache::getBlob(Connection& conn, uint64_t id)
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	sync(conn);
+	
+	auto iter = blobs.find(id);
+	if (iter != blobs.end())
+		return iter->second;
+	
+	// blobs which are objects only, or not committed yet
+	auto query = conn.prepareQuery(
+		"select file.uuid, blob.name from `blob` inner join file on file.id = blob.file_id where blob.id = ? and blob.visible = 1",
+	std::string("cache.blob"));
+	auto result = query->execute(convertAll(id));
+	if (result.rows.empty())
+		return boost::none;
+	auto name = std::make_pair(result.rows.front().at(0), result.rows.front().at(1));
+	blobs[id] = name;
+	return name;
+}
+
+boost::optional<uint64_t> associative::TripleCache::log(Connection& conn, uint64_t sessionID, unsigned logSize)
+{
+	auto query = conn.prepareQuery(
+		"select count(*) from journal where session_id = ? and (relation = ? or relation = ? and operation = ?)",
+	std::string("cache.log.count"));
+	auto result = query->execute(convertAll(sessionID, Connection::Relation::Metadata, Connection::Relation::Blob, Blob::Operation::Remove));
+	if (boost::lexical_cast<uint64_t>(result.rows.front().at(0)) == 0)
+		return boost::none;
+	
+	auto generation = conn.nextID("metadata_log");
+	auto stmt = conn.prepareStatement(
+		"insert into metadata_log select ?, relation, relation_id, operation from journal "
+		"where session_id = ? and (relation = ? or relation = ? and operation = ?)",
+	std::string("cache.log.insert"));
+	stmt->execute(convertAll(generation, sessionID, Connection::Relation::Metadata, Connection::Relation::Blob, Blob::Operation::Remove));
+	
+	if (generation >= logSize)
+	{
+		stmt = conn.prepareStatement("delete from metadata_log where generation <= ?", std::string("cache.log.trim"));
+		stmt->execute(convertAll(generation - logSize));
+	}
+	return generation;
+}
+
+void associative::TripleCache::publish(Process& process, uint64_t generation)
+{
+	// counters only grow, unless the shared memory has been cleared
+	auto counter = process.getCounter(counterName);
+	auto value = counter->load();
+	while (value < generation + 1 && !counter->compare_exchange_weak(value, generation + 1))
+		;
+}
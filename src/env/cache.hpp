@@ -0,0 +1,137 @@
+#ifndef ASSOCIATIVE_CACHE_HPP
+#define ASSOCIATIVE_CACHE_HPP
+
+#include <set>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "process.hpp"
+#include "../db/connection.hpp"
+#include "../objects/triple.hpp"
+#include "../util/log.hpp"
+
+namespace associative
+{
+	
+	// The committed metadata of a store in memory. Predicates and objects are
+	// replaced by IDs of a term dictionary, and the triples are kept sorted in
+	// three orders (subject, predicate, object; predicate, object, subject;
+	// object, subject, predicate), so any pattern with constants is a range
+	// found by binary search. Commits log the journal entries of metadata and
+	// removed blobs, which the cache applies whenever a shared counter tells
+	// that there are new ones (or at least once a second, for processes on
+	// other hosts). All environments of a process using the same store
+	// share one cache.
+	class TripleCache
+	{
+	public:
+		// a committed triple, with the IDs of the prefix and the type
+		struct Match
+		{
+			uint64_t id;
+			uint64_t subject;
+			uint64_t predicatePrefix;
+			uint64_t predicateID;
+			std::string predicate;
+			uint64_t objectType;
+			uint64_t objectID;
+			std::string object;
+		};
+		
+	private:
+		struct Entry
+		{
+			uint64_t subject;
+			uint32_t predicate;
+			uint32_t object;
+			uint64_t id;
+		};
+		
+		// 'ref' is the prefix of a predicate resp. the type of an object, 'id'
+		// the one in the term table
+		struct Term
+		{
+			uint64_t ref;
+			uint64_t id;
+			std::string value;
+			// the number of cached triples using it
+			uint64_t references;
+		};
+		
+		// keeps the shared memory of the counter mapped
+		boost::shared_ptr<Process> process;
+		boost::shared_ptr<Logger> logger;
+		std::atomic<uint64_t>* const counter;
+		boost::mutex mutex;
+		bool loaded;
+		// Generations are taken before committing, so they don't necessarily
+		// become visible in order. All generations before 'next' have been
+		// applied, so have those in 'applied'.
+		uint64_t next;
+		std::set<uint64_t> applied;
+		// the counter's value when checking the last time
+		uint64_t seen;
+		boost::posix_time::ptime checked;
+		
+		// Terms no triple uses any more are dropped, and their slots in
+		// 'terms' are reused.
+		std::vector<Term> terms;
+		std::unordered_map<std::string, uint32_t> termIDs;
+		// by value only, for predicates without prefix
+		std::unordered_multimap<std::string, uint32_t> termValues;
+		std::vector<uint32_t> freeTerms;
+		std::vector<Entry> spo;
+		std::vector<Entry> pos;
+		std::vector<Entry> osp;
+		// UUID and name, none for removed blobs
+		std::unordered_map<uint64_t, boost::optional<std::pair<std::string, std::string> > > blobs;
+		
+		static std::string getTermKey(uint64_t ref, const std::string& value);
+		uint32_t intern(uint64_t ref, uint64_t id, const std::string& value);
+		// counts the use of an entry's terms resp. drops the terms unused
+		void reference(const Entry& entry);
+		void release(const Entry& entry, std::vector<uint32_t>& unused);
+		void drop(uint32_t term);
+		
+		void sync(Connection& conn);
+		void load(Connection& conn);
+		void apply(Connection& conn);
+		
+		bool matches(const TripleFilter& filter, const Entry& entry) const;
+		// calls 'function' for each entry matching, using the best order
+		void forEach(const TripleFilter& filter, const boost::optional<uint64_t>& subject, const std::function<void(const Entry&)>& function) const;
+		
+		TripleCache(const boost::shared_ptr<Process>& process, const boost::shared_ptr<Logger>& logger);
+	
+	public:
+		TripleCache(TripleCache&) = delete;
+		TripleCache& operator=(TripleCache&) = delete;
+		
+		// the cache of the store in 'root', created unless another
+		// environment of the process uses it already
+		static boost::shared_ptr<TripleCache> get(const fs::path& root, const boost::shared_ptr<Process>& process, const boost::shared_ptr<Logger>& logger);
+		
+		// the matching triples ordered by ID, the filter's limit is ignored
+		std::vector<Match> getTriples(Connection& conn, const TripleFilter& filter, const boost::optional<uint64_t>& subject = boost::none);
+		uint64_t count(Connection& conn, const TripleFilter& filter, const boost::optional<uint64_t>& subject = boost::none);
+		// the blobs having a matching triple, sorted
+		std::vector<uint64_t> findBlobs(Connection& conn, const TripleFilter& filter);
+		
+		// UUID and name of a blob, none if it doesn't exist (any more)
+		boost::optional<std::pair<std::string, std::string> > getBlob(Connection& conn, uint64_t id);
+		
+		// Logs the metadata changes of a session while committing it,
+		// returns the generation logged (if any).
+		static boost::optional<uint64_t> log(Connection& conn, uint64_t sessionID, unsigned logSize);
+		// tells all caches about a generation once it has been committed
+		static void publish(Process& process, uint64_t generation);
+	};
+
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <zlib.h>
+
+#include "codec.hpp"
+#include "../util/io.hpp"
+
+namespace
+{
+	
+	const char magic[8] = { '\x89', 'A', 'S', 'C', '\r', '\n', '\x1a', '\n' };
+	
+	// magic, codec, 7 reserved bytes, decoded size (little endian)
+	const std::size_t headerSize = 24;
+	const std::size_t chunkSize = 65536;
+	
+	void writeHeader(std::ostream& stream, const associative::Codec::Type& type, uint64_t size)
+	{
+		char header[headerSize] = {};
+		std::memcpy(header, magic, sizeof(magic));
+		header[8] = static_cast<char>(type);
+		for (int i = 0; i < 8; ++i)
+			header[16 + i] = static_cast<char>(size >> (8 * i));
+		stream.write(header, headerSize);
+	}
+	
+	bool readHeader(std::istream& stream, associative::Codec::Type& type)
+	{
+		char header[headerSize];
+		if (!stream.read(header, headerSize) || std::memcmp(header, magic, sizeof(magic)))
+			return false;
+		type = static_cast<associative::Codec::Type>(header[8]);
+		return true;
+	}
+	
+	void checkZlib(int ret, z_stream& stream)
+	{
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			throw associative::formatException(boost::format("zlib failed: %1%") % (stream.msg ? stream.msg : "unknown error"));
+	}
+	
+	// Deflates 'in' into 'out', gives up once the output grows beyond 'limit'.
+	bool deflateStream(std::istream& in, std::ostream& out, int level, uint64_t limit)
+	{
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+		checkZlib(deflateInit(&stream, level), stream);
+		
+		std::vector<char> input(chunkSize), output(chunkSize);
+		uint64_t written = 0;
+		bool worthwhile = true;
+		int flush = Z_NO_FLUSH;
+		try
+		{
+			while (worthwhile && flush != Z_FINISH)
+			{
+				in.read(input.data(), input.size());
+				flush = in.gcount() < static_cast<std::streamsize>(input.size()) ? Z_FINISH : Z_NO_FLUSH;
+				stream.next_in = reinterpret_cast<Bytef*>(input.data());
+				stream.avail_in = in.gcount();
+				do
+				{
+					stream.next_out = reinterpret_cast<Bytef*>(output.data());
+					stream.avail_out = output.size();
+					checkZlib(deflate(&stream, flush), stream);
+					std::size_t produced = output.size() - stream.avail_out;
+					out.write(output.data(), produced);
+					written += produced;
+				}
+				while (stream.avail_out == 0);
+				
+				worthwhile = written < limit;
+			}
+		}
+		catch (...)
+		{
+			deflateEnd(&stream);
+			throw;
+		}
+		deflateEnd(&stream);
+		return worthwhile;
+	}
+	
+	void inflateStream(std::istream& in, std::ostream& out)
+	{
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+		checkZlib(inflateInit(&stream), stream);
+		
+		std::vector<char> input(chunkSize), output(chunkSize);
+		int ret = Z_OK;
+		try
+		{
+			while (ret != Z_STREAM_END)
+			{
+				in.read(input.data(), input.size());
+				if (!in.gcount())
+					throw associative::Exception("compressed blob is truncated");
+				stream.next_in = reinterpret_cast<Bytef*>(input.data());
+				stream.avail_in = in.gcount();
+				do
+				{
+					stream.next_out = reinterpret_cast<Bytef*>(output.data());
+					stream.avail_out = output.size();
+					ret = inflate(&stream, Z_NO_FLUSH);
+					if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+						throw associative::formatException(boost::format("couldn't decompress blob: %1%") % (stream.msg ? stream.msg : "corrupt data"));
+					out.write(output.data(), output.size() - stream.avail_out);
+				}
+				while (stream.avail_out == 0 && ret != Z_STREAM_END);
+			}
+		}
+		catch (...)
+		{
+			inflateEnd(&stream);
+			throw;
+		}
+		inflateEnd(&stream);
+	}
+	
+}
+
+associative::Codec::Type associative::Codec::parse(const std::string& name)
+{
+	if (name == "none")
+		return Type::None;
+	else if (name == "zlib")
+		return Type::Zlib;
+	else
+		throw formatException(boost::format("%1% is not a valid codec") % name);
+}
+
+std::string associative::Codec::name(const Type& type)
+{
+	switch (type)
+	{
+		case Type::None: return "none";
+		case Type::Zlib: return "zlib";
+	}
+	throw Exception("internal error: unknown codec");
+}
+
+bool associative::Codec::encode(const fs::path& src, const fs::path& dest, const Type& type, int level)
+{
+	// a blob which has never been written doesn't need any encoding
+	if (!fs::exists(src))
+		return false;
+	
+	if (type == Type::None)
+		return false;
+	
+	auto size = fs::file_size(src);
+	std::ifstream in(src.string(), std::ios_base::binary);
+	std::ofstream out(dest.string(), std::ios_base::binary | std::ios_base::trunc);
+	if (!in || !out)
+		throw formatException(boost::format("couldn't encode %1%") % src);
+	
+	writeHeader(out, type, size);
+	// not worth it unless at least an eighth is saved
+	if (!deflateStream(in, out, level, size - size / 8))
+	{
+		out.close();
+		fs::remove(dest);
+		return false;
+	}
+	
+	out.close();
+	if (!out)
+		throw formatException(boost::format("couldn't encode %1%") % src);
+	return true;
+}
+
+void associative::Codec::decode(const fs::path& src, const fs::path& dest)
+{
+	std::ofstream out(dest.string(), std::ios_base::binary | std::ios_base::trunc);
+	decode(src, out);
+	
+	out.close();
+	if (!out)
+		throw formatException(boost::format("couldn't decode %1%") % src);
+}
+
+void associative::Codec::decode(const fs::path& src, std::ostream& out)
+{
+	std::ifstream in(src.string(), std::ios_base::binary);
+	Type type;
+	if (!readHeader(in, type))
+		throw formatException(boost::format("%1% is not encoded") % src);
+	
+	switch (type)
+	{
+		case Type::None: copyStreams(in, out); break;
+		case Type::Zlib: inflateStream(in, out); break;
+		default: throw formatException(boost::format("%1% uses an unknown codec") % src);
+	}
+}
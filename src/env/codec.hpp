@@ -0,0 +1,34 @@
+#ifndef ASSOCIATIVE_CODEC_HPP
+#define ASSOCIATIVE_CODEC_HPP
+
+#include "../util/util.hpp"
+
+namespace associative
+{
+	
+	// Committed blobs may be stored encoded, e. g. compressed. Encoded files
+	// start with a header telling how to decode them, the database records
+	// which blobs are encoded (so plain contents may look like a header).
+	class Codec
+	{
+	public:
+		enum Type
+		{
+			None,
+			Zlib
+		};
+		
+		static Type parse(const std::string& name);
+		static std::string name(const Type& type);
+		
+		// Encodes 'src' into 'dest'. Returns false without creating 'dest' if
+		// 'src' had better be stored as it is, e. g. because it doesn't shrink.
+		static bool encode(const fs::path& src, const fs::path& dest, const Type& type, int level);
+		
+		static void decode(const fs::path& src, const fs::path& dest);
+		static void decode(const fs::path& src, std::ostream& out);
+	};
+	
+}
+
+#endif
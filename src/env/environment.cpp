@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <iterator>
 #include <vector>
 
 #include <boost/uuid/uuid_io.hpp>
@@ -5,7 +7,7 @@
 #include "environment.hpp"
 
 associative::Environment::Environment(const boost::shared_ptr<Process>& process, const boost::shared_ptr<VFS>& vfs, const boost::shared_ptr<Connection>& conn, const boost::shared_ptr<Logger>& logger)
-: id(boost::none), process(process), vfs(vfs), conn(conn), logger(logger)
+: id(boost::none), process(process), vfs(vfs), conn(conn), logger(logger), terms(*conn)
 {
 }
 
@@ -24,11 +26,64 @@ associative::Connection& associative::Environment::getConnection()
 	return *conn;
 }
 
+associative::TripleCache* associative::Environment::getTripleCache()
+{
+	if (!vfs->getSettings().metadataCache)
+		return nullptr;
+	if (!tripleCache)
+		tripleCache = TripleCache::get(vfs->root, process, logger);
+	return tripleCache.get();
+}
+
+associative::TermDictionary& associative::Environment::getTerms()
+{
+	return terms;
+}
+
 boost::optional<uint64_t> associative::Environment::getSessionID()
 {
 	return id;
 }
 
+std::string associative::Environment::getMetadataVisibility(const std::string& table, std::vector<std::string>& parameters, bool uncommitted)
+{
+	std::string journal =
+		"exists ("
+		"  select * from journal where journal.session_id = ? and journal.relation = ? and journal.relation_id = " + table + ".id and journal.operation = ?"
+		")";
+	if (uncommitted)
+	{
+		auto visibility = convertAll(*id, Connection::Relation::Metadata, Triple::Operation::Add);
+		parameters.insert(parameters.end(), visibility.begin(), visibility.end());
+		return table + ".visible = 0 and " + journal;
+	}
+	if (!id)
+		return table + ".visible = 1";
+	
+	// the session's own changes aren't committed yet
+	auto visibility = convertAll(
+		*id, Connection::Relation::Metadata, Triple::Operation::Remove,
+		*id, Connection::Relation::Metadata, Triple::Operation::Add
+	);
+	parameters.insert(parameters.end(), visibility.begin(), visibility.end());
+	return "(" + table + ".visible = 1 and not " + journal + " or " + table + ".visible = 0 and " + journal + ")";
+}
+
+std::unordered_set<uint64_t> associative::Environment::getRemovedTriples()
+{
+	std::unordered_set<uint64_t> removed;
+	if (!id)
+		return removed;
+	
+	auto query = conn->prepareQuery(
+		"select relation_id from journal where session_id = ? and relation = ? and operation = ?",
+	std::string("env.metadata.removed"));
+	auto result = query->execute(convertAll(*id, Connection::Relation::Metadata, Triple::Operation::Remove));
+	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		removed.insert(boost::lexical_cast<uint64_t>(iter->at(0)));
+	return removed;
+}
+
 void associative::Environment::cleanSessions(bool)
 {
 	auto t = conn->transaction();
@@ -48,6 +103,13 @@ void associative::Environment::startSession()
 	if (id)
 		throw Exception("already in a session");
 	
+	// A reshard can't happen while the session is open (see VFS::reshard),
+	// but might have happened since the previous one. Unlike the session
+	// lock, commits don't take the reshard lock, so this doesn't wait for
+	// them.
+	auto lock = process->getMemLock("reshard")->timedLockOrThrow();
+	vfs->updateLayout();
+	
 	auto t = conn->transaction();
 	id = conn->nextID("session");
 	auto stmt = conn->prepareStatement("insert into session values (?, 0, ?)", std::string("env.session.add"));
@@ -87,10 +149,10 @@ void associative::Environment::commitSession(const associative::IsolationLevel&
 			"on journal.relation = ? and journal.relation_id = metadata.id "
 			"where journal.session_id = ? and ("
 			"  not exists (select * from `blob` where blob.id = metadata.blob_id) or "
-			"  (metadata.object_type_id = ? and not exists (select * from `blob` where blob.id = metadata.object))"
+			"  (metadata.object_blob_id is not null and not exists (select * from `blob` where blob.id = metadata.object_blob_id))"
 			")",
 		std::string("env.session.invalid"));
-		if (query->execute(convertAll(*id, Connection::Relation::Blob, Blob::Operation::Store, Connection::Relation::Metadata, *id, ASSOCIATIVE_SYS_BLOB_TYPE)).rows.size())
+		if (query->execute(convertAll(*id, Connection::Relation::Blob, Blob::Operation::Store, Connection::Relation::Metadata, *id)).rows.size())
 			reason = CommitException::Reason::Invalidated;
 	}
 	else
@@ -104,74 +166,174 @@ void associative::Environment::commitSession(const associative::IsolationLevel&
 		throw CommitException((boost::format("session %1% cannot be commited") % *id).str(), *reason);
 	
 	auto vfsT = vfs->apply(*this);
+	boost::optional<uint64_t> generation;
 	
-	dbT = conn->transaction();
-	
-	// Step 1: Make new files visible
-	stmt = conn->prepareStatement(
-		"update file set visible = 1 where exists ("
-		"  select * from journal "
-		"  where journal.relation_id = file.id and journal.relation = ? "
-		"  and journal.operation = ? and journal.session_id = ? "
-		")",
-	std::string("env.session.file.add"));
-	stmt->execute(convertAll(Connection::Relation::File, File::Operation::Add, *id));
-	
-	// Step 2: Make new blobs visible
-	stmt = conn->prepareStatement(
-		"update `blob` set visible = 1 where exists ("
-		"  select * from journal "
-		"  where journal.relation_id = blob.id and journal.relation = ? "
-		"  and journal.operation = ? and journal.session_id = ? "
-		")",
-	std::string("env.session.blob.add"));
-	stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Add, *id));
-	
-	// Step 3: Remove blobs
-	stmt = conn->prepareStatement(
-		"delete from `blob` where exists ("
-		"  select * from journal "
-		"  where journal.relation_id = blob.id and journal.relation = ? "
-		"  and journal.operation = ? and journal.session_id = ? "
-		")",
-	std::string("env.session.blob.remove"));
-	stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
-	
-	// Step 4: Make new metadata visible
-	stmt = conn->prepareStatement(
-		"update metadata set visible = 1 where exists ("
-		"  select * from journal "
-		"  where journal.relation_id = metadata.id and journal.relation = ? "
-		"  and journal.operation = ? and journal.session_id = ? "
-		")",
-	std::string("env.session.metadata.add"));
-	stmt->execute(convertAll(Connection::Relation::Metadata, Triple::Operation::Add, *id));
-	
-	// Step 5: Remove metadata
-	stmt = conn->prepareStatement(
-		"delete from metadata where exists ("
-		"  select * from journal "
-		"  where journal.relation_id = metadata.id and journal.relation = ? "
-		"  and journal.operation = ? and journal.session_id = ? "
-		")",
-	std::string("env.session.blob.remove"));
-	stmt->execute(convertAll(Connection::Relation::Metadata, Triple::Operation::Remove, *id));
-	
-	// Step 6: Flush journal
-	stmt = conn->prepareStatement("delete from journal where session_id = ?", std::string("env.session.journal.flush"));
-	stmt->execute(convertAll(*id));
-	
-	// Step 7: Remove session
-	stmt = conn->prepareStatement("delete from session where id = ?", std::string("env.session.remove"));
-	stmt->execute(convertAll(*id));
-	
-	dbT->commit();
+	try
+	{
+		// The new contents must be durable before the database refers to them.
+		vfsT->sync();
+		
+		dbT = conn->transaction();
+		
+		// Step 0.4: Store tiny blobs and pack ranges
+		vfsT->updateDatabase(*conn);
+		
+		// Step 1: Make new files visible
+		stmt = conn->prepareStatement(
+			"update file set visible = 1 where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = file.id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.file.add"));
+		stmt->execute(convertAll(Connection::Relation::File, File::Operation::Add, *id));
+		
+		// Step 2: Make new blobs visible
+		stmt = conn->prepareStatement(
+			"update `blob` set visible = 1 where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob.id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.add"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Add, *id));
+		
+		// Step 3: Remove blobs
+		stmt = conn->prepareStatement(
+			"delete from text_posting where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = text_posting.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-postings"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from text_document where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = text_document.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-document"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from blob_content where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob_content.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-content"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from blob_pack where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob_pack.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-pack"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from blob_checksum where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob_checksum.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-checksum"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from blob_tier where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob_tier.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-tier"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from blob_codec where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob_codec.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-codec"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from blob_access where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob_access.blob_id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove-access"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		stmt = conn->prepareStatement(
+			"delete from `blob` where exists ("
+			"  select * from journal "
+			"  where journal.relation_id = blob.id and journal.relation = ? "
+			"  and journal.operation = ? and journal.session_id = ? "
+			")",
+		std::string("env.session.blob.remove"));
+		stmt->execute(convertAll(Connection::Relation::Blob, Blob::Operation::Remove, *id));
+		
+		// Step 4: Make new metadata visible
+		// (found by the session's journal, the metadata table may be huge)
+		stmt = conn->prepareStatement(
+			"update metadata set visible = 1 where id in ("
+			"  select relation_id from journal "
+			"  where session_id = ? and relation = ? and operation = ?"
+			")",
+		std::string("env.session.metadata.add"));
+		stmt->execute(convertAll(*id, Connection::Relation::Metadata, Triple::Operation::Add));
+		
+		// Step 5: Remove metadata
+		stmt = conn->prepareStatement(
+			"delete from metadata where id in ("
+			"  select relation_id from journal "
+			"  where session_id = ? and relation = ? and operation = ?"
+			")",
+		std::string("env.session.metadata.remove"));
+		stmt->execute(convertAll(*id, Connection::Relation::Metadata, Triple::Operation::Remove));
+		
+		// Step 5.1: Log the metadata changes for the caches
+		if (vfs->getSettings().metadataCache)
+			generation = TripleCache::log(*conn, *id, vfs->getSettings().metadataLogSize);
+		
+		// Step 6: Flush journal
+		stmt = conn->prepareStatement("delete from journal where session_id = ?", std::string("env.session.journal.flush"));
+		stmt->execute(convertAll(*id));
+		
+		// Step 7: Remove session
+		stmt = conn->prepareStatement("delete from session where id = ?", std::string("env.session.remove"));
+		stmt->execute(convertAll(*id));
+		
+		dbT->commit();
+		
+		if (generation)
+			TripleCache::publish(*process, *generation);
+	}
+	catch (...)
+	{
+		// Put the previous versions back, so that the session may be
+		// committed again later on.
+		dbT.reset();
+		vfsT->rollback();
+		stmt = conn->prepareStatement("update journal set executed = 0 where session_id = ?", std::string("env.session.journal.reset"));
+		stmt->execute(convertAll(*id));
+		throw;
+	}
 	
 	vfsT->finish();
 	
 	buffer.clear();
 	
 	id = boost::none;
+	
+	vfs->collectIncrementally(*this);
 }
 
 void associative::Environment::rollbackSession()
@@ -181,6 +343,9 @@ void associative::Environment::rollbackSession()
 	
 	buffer.clear();
 	
+	// nothing will refer to the session's temporary files any more
+	vfs->discard(*this);
+	
 	auto t = conn->transaction();
 	auto stmt = conn->prepareStatement(
 		"delete from file where exists ("
@@ -235,6 +400,79 @@ associative::WeakPtr<associative::File> associative::Environment::getFile(const
 	return buffer.getOrElse(uuid, func);
 }
 
+void associative::Environment::findBlobs(const std::vector<TripleFilter>& filters, const std::function<bool(const std::string&, const std::string&)>& callback, const boost::optional<uint64_t>& limit)
+{
+	if (filters.empty())
+		throw Exception("no filter given");
+	if (limit && !*limit)
+		return;
+	
+	uint64_t count = 0;
+	if (auto cache = getTripleCache())
+	{
+		auto found = cache->findBlobs(*conn, filters.front());
+		for (std::size_t i = 1; i < filters.size() && !found.empty(); ++i)
+		{
+			auto others = cache->findBlobs(*conn, filters[i]);
+			std::vector<uint64_t> both;
+			std::set_intersection(found.begin(), found.end(), others.begin(), others.end(), std::back_inserter(both));
+			found.swap(both);
+		}
+		for (auto iter = found.begin(); iter != found.end(); ++iter)
+		{
+			auto name = cache->getBlob(*conn, *iter);
+			if (name && (!callback(name->first, name->second) || (limit && ++count == *limit)))
+				return;
+		}
+		return;
+	}
+	
+	// the first filter's conditions are evaluated directly, the others are
+	// intersected with its results
+	std::vector<std::string> parameters;
+	std::string conditions = filters.front().getConditions("m0", parameters);
+	std::string shape = filters.front().getShape();
+	for (std::size_t i = 1; i < filters.size(); ++i)
+	{
+		auto table = "m" + toString(i);
+		conditions += " and exists (select * from metadata " + table + " where " + table + ".blob_id = m0.blob_id and " + table + ".visible = 1" +
+			filters[i].getConditions(table, parameters) + ")";
+		shape += "," + filters[i].getShape();
+	}
+	
+	// Results are fetched in pages after the last blob ID seen, so memory
+	// stays bounded however many blobs match, and the triples of a blob
+	// matching more than once follow each other. Only if the first filter
+	// fixes predicate prefix and predicate do they come in the order of
+	// metadata_predicate_blob, otherwise every page is sorted.
+	static const uint64_t pageSize = 1000;
+	auto query = conn->prepareQuery(
+		"select m0.blob_id, file.uuid, blob.name from metadata m0 "
+		"inner join `blob` on blob.id = m0.blob_id "
+		"inner join file on file.id = blob.file_id "
+		"where m0.visible = 1 and blob.visible = 1 and m0.blob_id > ?" + conditions + " "
+		"order by m0.blob_id limit " + toString(pageSize),
+	"env.blobs.find" + shape);
+	
+	parameters.insert(parameters.begin(), "-1");
+	for (;;)
+	{
+		auto result = query->execute(parameters);
+		std::string last;
+		for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		{
+			if (iter->at(0) == last)
+				continue;
+			last = iter->at(0);
+			if (!callback(iter->at(1), iter->at(2)) || (limit && ++count == *limit))
+				return;
+		}
+		if (result.rows.size() < pageSize)
+			return;
+		parameters.front() = result.rows.back().at(0);
+	}
+}
+
 associative::CommitException::CommitException(const std::string& message, const associative::CommitException::Reason& reason)
 : Exception(message), reason(reason)
 {
@@ -1,13 +1,17 @@
 #ifndef ASSOCIATIVE_ENVIRONMENT_HPP
 #define ASSOCIATIVE_ENVIRONMENT_HPP
 
+#include <unordered_set>
+
 #include <boost/uuid/uuid.hpp>
 
 #include "vfs.hpp"
 #include "process.hpp"
+#include "cache.hpp"
 #include "../isolation/isolation.hpp"
 #include "../db/connection.hpp"
 #include "../objects/file.hpp"
+#include "../objects/term.hpp"
 #include "../util/log.hpp"
 
 namespace associative
@@ -25,6 +29,8 @@ namespace associative
 		boost::shared_ptr<VFS> vfs;
 		boost::shared_ptr<Connection> conn;
 		boost::shared_ptr<Logger> logger;
+		boost::shared_ptr<TripleCache> tripleCache;
+		TermDictionary terms;
 		
 	public:
 		Environment(const boost::shared_ptr<Process>& process, const boost::shared_ptr<VFS>& vfs, const boost::shared_ptr<Connection>& conn, const boost::shared_ptr<Logger>& logger);
@@ -34,9 +40,19 @@ namespace associative
 		
 		VFS& getVFS();
 		Connection& getConnection();
+		// the cache of committed metadata, if enabled in the store's settings
+		TripleCache* getTripleCache();
+		TermDictionary& getTerms();
 		
 		boost::optional<uint64_t> getSessionID();
 		
+		// Conditions on the triples in 'table' for a where clause, making
+		// visible what the current session sees, resp. only the triples it
+		// added if 'uncommitted'.
+		std::string getMetadataVisibility(const std::string& table, std::vector<std::string>& parameters, bool uncommitted = false);
+		// the triples removed by the current session, which are still cached
+		std::unordered_set<uint64_t> getRemovedTriples();
+		
 		void cleanSessions(bool forceRollback = false);
 		
 		void startSession();
@@ -46,6 +62,13 @@ namespace associative
 		WeakPtr<File> createFile();
 		WeakPtr<File> getFile(const std::string& uuid);
 		
+		// Calls 'callback' with the UUID and name of each committed blob which
+		// has a triple matching every filter, in the order of their IDs and
+		// until it returns false or 'limit' blobs have been found (none at all
+		// for a limit of 0). The first filter drives the lookup, so it should be the
+		// most selective one. Limits of the filters are ignored.
+		void findBlobs(const std::vector<TripleFilter>& filters, const std::function<bool(const std::string&, const std::string&)>& callback, const boost::optional<uint64_t>& limit = boost::none);
+		
 	};
 	
 	class CommitException : public Exception
@@ -0,0 +1,321 @@
+#include "gen/config.hpp"
+
+extern "C"
+{
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+#ifdef ASSOCIATIVE_WITH_URING
+	#include <sys/mman.h>
+	#include <linux/io_uring.h>
+#endif
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "executor.hpp"
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+associative::FileRequest::FileRequest(const Type& type, const fs::path& path, const fs::path& target)
+: type(type), path(path), target(target), result(0)
+{
+}
+
+void associative::FileRequest::perform()
+{
+	int ret = 0;
+	switch (type)
+	{
+		case Type::MakeDirectory: ret = mkdir(path.c_str(), 0777); break;
+		case Type::Rename: ret = rename(path.c_str(), target.c_str()); break;
+#ifdef SYS_renameat2
+		case Type::Exchange: ret = syscall(SYS_renameat2, AT_FDCWD, path.c_str(), AT_FDCWD, target.c_str(), RENAME_EXCHANGE); break;
+#else
+		case Type::Exchange: ret = -1; errno = ENOSYS; break;
+#endif
+		case Type::Unlink: ret = unlink(path.c_str()); break;
+	}
+	result = ret ? -errno : 0;
+}
+
+void associative::FileRequest::throwError() const
+{
+	if (type == Type::Rename)
+		throw formatException(boost::format("couldn't rename %1% to %2%: %3%") % path % target % std::strerror(-result));
+	else if (type == Type::Exchange)
+		throw formatException(boost::format("couldn't exchange %1% and %2%: %3%") % path % target % std::strerror(-result));
+	else
+		throw formatException(boost::format("couldn't %1% %2%: %3%") % (type == Type::Unlink ? "remove" : "create") % path % std::strerror(-result));
+}
+
+associative::Executor::~Executor()
+{
+}
+
+associative::ThreadPoolExecutor::ThreadPoolExecutor(unsigned threads)
+: threads(threads), stopping(false)
+{
+	if (threads > 1)
+		for (unsigned i = 0; i < threads; ++i)
+			workers.create_thread([this]() { this->work(); });
+}
+
+associative::ThreadPoolExecutor::~ThreadPoolExecutor()
+{
+	{
+		boost::lock_guard<boost::mutex> guard(mutex);
+		stopping = true;
+	}
+	available.notify_all();
+	workers.join_all();
+}
+
+void associative::ThreadPoolExecutor::work()
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	for (;;)
+	{
+		available.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (queue.empty())
+			return;
+		
+		auto request = queue.front();
+		queue.pop_front();
+		lock.unlock();
+		request.first->perform();
+		lock.lock();
+		if (!--*request.second)
+			finished.notify_all();
+	}
+}
+
+void associative::ThreadPoolExecutor::execute(std::vector<FileRequest>& batch)
+{
+	if (threads <= 1 || batch.size() <= 1)
+	{
+		std::for_each(batch.begin(), batch.end(), boost::mem_fn(&FileRequest::perform));
+		return;
+	}
+	
+	std::size_t remaining = batch.size();
+	boost::unique_lock<boost::mutex> lock(mutex);
+	for (auto iter = batch.begin(); iter != batch.end(); ++iter)
+		queue.push_back(std::make_pair(&*iter, &remaining));
+	available.notify_all();
+	finished.wait(lock, [&remaining]() { return !remaining; });
+}
+
+#ifdef ASSOCIATIVE_WITH_URING
+
+namespace associative
+{
+	
+	// Minimal io_uring binding on top of the raw system calls, see
+	// io_uring(7). Submission and completion happen in the calling thread,
+	// the kernel performs the requests concurrently.
+	class URingExecutor : public Executor
+	{
+	private:
+		int fd;
+		io_uring_params params;
+		
+		void* sqRing;
+		std::size_t sqRingSize;
+		void* cqRing;
+		std::size_t cqRingSize;
+		io_uring_sqe* sqes;
+		
+		unsigned* sqTail;
+		unsigned* sqMask;
+		unsigned* sqArray;
+		unsigned* cqHead;
+		unsigned* cqTail;
+		unsigned* cqMask;
+		io_uring_cqe* cqes;
+		
+		template<typename T>
+		T* at(void* ring, unsigned offset)
+		{
+			return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+		}
+		
+		void prepare(io_uring_sqe& sqe, const FileRequest& request, std::size_t index)
+		{
+			std::memset(&sqe, 0, sizeof(sqe));
+			sqe.fd = AT_FDCWD;
+			sqe.addr = reinterpret_cast<uint64_t>(request.path.c_str());
+			sqe.user_data = index;
+			switch (request.type)
+			{
+				case FileRequest::Type::MakeDirectory:
+					sqe.opcode = IORING_OP_MKDIRAT;
+					sqe.len = 0777;
+					break;
+				case FileRequest::Type::Rename:
+				case FileRequest::Type::Exchange:
+					sqe.opcode = IORING_OP_RENAMEAT;
+					sqe.len = AT_FDCWD;
+					sqe.off = reinterpret_cast<uint64_t>(request.target.c_str());
+					if (request.type == FileRequest::Type::Exchange)
+						sqe.rename_flags = RENAME_EXCHANGE;
+					break;
+				case FileRequest::Type::Unlink:
+					sqe.opcode = IORING_OP_UNLINKAT;
+					break;
+			}
+		}
+		
+		// submits up to one ring full of requests and waits for them
+		void executeChunk(std::vector<FileRequest>& batch, std::size_t begin, std::size_t end)
+		{
+			unsigned tail = *sqTail;
+			for (std::size_t i = begin; i < end; ++i, ++tail)
+			{
+				unsigned index = tail & *sqMask;
+				prepare(sqes[index], batch[i], i);
+				sqArray[index] = index;
+			}
+			__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+			
+			unsigned pending = end - begin;
+			unsigned toSubmit = pending;
+			while (pending)
+			{
+				int ret = syscall(__NR_io_uring_enter, fd, toSubmit, 1, IORING_ENTER_GETEVENTS, 0, 0);
+				if (ret < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					throw formatException(boost::format("io_uring_enter failed: %1%") % std::strerror(errno));
+				}
+				toSubmit -= std::min<unsigned>(toSubmit, ret);
+				
+				unsigned head = *cqHead;
+				for (; head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE); ++head, --pending)
+				{
+					auto& cqe = cqes[head & *cqMask];
+					batch[cqe.user_data].result = cqe.res;
+				}
+				__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+			}
+		}
+	
+	public:
+		URingExecutor(unsigned entries)
+		: fd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+		{
+			std::memset(&params, 0, sizeof(params));
+			fd = syscall(__NR_io_uring_setup, entries, &params);
+			if (fd < 0)
+				throw formatException(boost::format("io_uring_setup failed: %1%") % std::strerror(errno));
+			
+			sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+				sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+			
+			sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+				cqRing = sqRing;
+			else
+				cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			sqes = static_cast<io_uring_sqe*>(mmap(0, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+			
+			if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED)
+			{
+				int error = errno;
+				release();
+				throw formatException(boost::format("couldn't map io_uring: %1%") % std::strerror(error));
+			}
+			
+			sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+			sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+			sqArray = at<unsigned>(sqRing, params.sq_off.array);
+			cqHead = at<unsigned>(cqRing, params.cq_off.head);
+			cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+			cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+			cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+		}
+		
+		URingExecutor(URingExecutor&) = delete;
+		URingExecutor& operator=(URingExecutor&) = delete;
+		
+		void release()
+		{
+			if (sqes != MAP_FAILED)
+				munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+			if (cqRing != MAP_FAILED && cqRing != sqRing)
+				munmap(cqRing, cqRingSize);
+			if (sqRing != MAP_FAILED)
+				munmap(sqRing, sqRingSize);
+			if (fd >= 0)
+				close(fd);
+		}
+		
+		virtual ~URingExecutor()
+		{
+			release();
+		}
+		
+		virtual void execute(std::vector<FileRequest>& batch)
+		{
+			for (std::size_t begin = 0; begin < batch.size(); begin += params.sq_entries)
+				executeChunk(batch, begin, std::min<std::size_t>(batch.size(), begin + params.sq_entries));
+		}
+		
+		// Renaming and friends have only been added in Linux 5.11 resp. 5.15,
+		// older kernels complete them with EINVAL.
+		bool isSupported()
+		{
+			std::vector<FileRequest> probe;
+			probe.push_back(FileRequest(FileRequest::Type::MakeDirectory, "/"));
+			probe.push_back(FileRequest(FileRequest::Type::Unlink, ""));
+			probe.push_back(FileRequest(FileRequest::Type::Rename, "", ""));
+			execute(probe);
+			for (auto iter = probe.begin(); iter != probe.end(); ++iter)
+				if (iter->result == -EINVAL || iter->result == -EOPNOTSUPP)
+					return false;
+			return true;
+		}
+	};
+	
+}
+
+#endif
+
+boost::shared_ptr<associative::Executor> associative::Executor::create(const std::string& type, unsigned threads)
+{
+	if (type != "auto" && type != "uring" && type != "threads")
+		throw formatException(boost::format("%1% is not a valid executor") % type);
+	
+#ifdef ASSOCIATIVE_WITH_URING
+	if (type != "threads")
+	{
+		try
+		{
+			boost::shared_ptr<URingExecutor> executor(new URingExecutor(256));
+			if (executor->isSupported())
+				return executor;
+			if (type == "uring")
+				throw Exception("kernel doesn't support file system operations with io_uring");
+		}
+		catch (const Exception&)
+		{
+			// e. g. disabled by seccomp or an old kernel
+			if (type == "uring")
+				throw;
+		}
+	}
+#else
+	if (type == "uring")
+		throw Exception("built without io_uring support");
+#endif
+	
+	return boost::shared_ptr<Executor>(new ThreadPoolExecutor(threads));
+}
@@ -0,0 +1,81 @@
+#ifndef ASSOCIATIVE_EXECUTOR_HPP
+#define ASSOCIATIVE_EXECUTOR_HPP
+
+#include <deque>
+#include <vector>
+
+#include "../util/util.hpp"
+#include "../util/threads.hpp"
+
+namespace associative
+{
+	
+	// a primitive file system operation
+	class FileRequest
+	{
+	public:
+		enum Type
+		{
+			MakeDirectory,
+			Rename,
+			// atomically swaps 'path' and 'target', both have to exist
+			Exchange,
+			Unlink
+		};
+		
+		Type type;
+		fs::path path;
+		fs::path target;
+		
+		// 0 on success, negated errno otherwise
+		int result;
+		
+		FileRequest(const Type& type, const fs::path& path, const fs::path& target = fs::path());
+		
+		void perform();
+		void throwError() const;
+	};
+	
+	class Executor
+	{
+	public:
+		virtual ~Executor();
+		
+		// Performs all requests and stores their results. The requests must be
+		// independent of each other, i. e. they may be performed in any order.
+		virtual void execute(std::vector<FileRequest>& batch) = 0;
+		
+		// io_uring if requested and supported by the kernel, threads otherwise
+		static boost::shared_ptr<Executor> create(const std::string& type, unsigned threads);
+	};
+	
+	// Workers started once and fed by a queue shared by all batches, those
+	// with less than two requests are performed by the calling thread.
+	class ThreadPoolExecutor : public Executor
+	{
+	private:
+		const unsigned threads;
+		boost::mutex mutex;
+		// notifies the workers of new requests resp. the callers of finished ones
+		boost::condition_variable available;
+		boost::condition_variable finished;
+		// the requests with the number of those of their batch not yet performed
+		std::deque<std::pair<FileRequest*, std::size_t*> > queue;
+		bool stopping;
+		boost::thread_group workers;
+		
+		void work();
+	
+	public:
+		ThreadPoolExecutor(unsigned threads);
+		virtual ~ThreadPoolExecutor();
+		
+		ThreadPoolExecutor(ThreadPoolExecutor&) = delete;
+		ThreadPoolExecutor& operator=(ThreadPoolExecutor&) = delete;
+		
+		virtual void execute(std::vector<FileRequest>& batch);
+	};
+	
+}
+
+#endif
@@ -0,0 +1,137 @@
+extern "C"
+{
+	#include <sys/stat.h>
+}
+
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "gc.hpp"
+
+associative::GarbageCollector::GarbageCollector(const std::vector<fs::path>& tempPaths, const fs::path& cachePath, const std::function<bool(const fs::path&)>& isMapped, const boost::shared_ptr<Logger>& logger)
+: cachePath(cachePath), isMapped(isMapped), directories(tempPaths), logger(logger), nextSession(0), running(false), directory(0)
+{
+	directories.push_back(cachePath);
+}
+
+bool associative::GarbageCollector::isRunning() const
+{
+	return running;
+}
+
+void associative::GarbageCollector::begin(Connection& conn)
+{
+	sessions.clear();
+	targets.clear();
+	
+	auto t = conn.transaction();
+	
+	auto query = conn.prepareQuery("select next_id from ids where table_name = ?", std::string("gc.session.next"));
+	auto next = query->execute(convertAll("session"));
+	nextSession = next.rows.empty() ? 0 : boost::lexical_cast<uint64_t>(next.rows.front().at(0));
+	
+	query = conn.prepareQuery("select id from session", std::string("gc.sessions"));
+	auto live = query->execute(convertAll());
+	for (auto iter = live.rows.begin(); iter != live.rows.end(); ++iter)
+		sessions.insert(boost::lexical_cast<uint64_t>(iter->at(0)));
+	
+	query = conn.prepareQuery("select target from journal where target is not null", std::string("gc.targets"));
+	auto referenced = query->execute(convertAll());
+	for (auto iter = referenced.rows.begin(); iter != referenced.rows.end(); ++iter)
+	{
+		// the name of the temporary file, whatever its tier
+		auto& target = iter->at(0);
+		targets.insert(target.substr(target.find(':') + 1));
+	}
+	
+	t->commit();
+	
+	running = true;
+	directory = 0;
+	position = fs::directory_iterator(directories.front());
+}
+
+bool associative::GarbageCollector::isGarbage(const fs::path& path, unsigned minAge) const
+{
+	auto isOld = [&path, minAge]() {
+		struct stat st;
+		if (lstat(path.c_str(), &st))
+			return false;
+		return std::time(0) - st.st_mtime >= (std::time_t) minAge;
+	};
+	
+	// <session ID>-<PID>-<counter>-<seed>, maybe with a suffix of a derived file
+	auto name = path.filename().string();
+	
+	// Everything else in the cache is named after what it contains. Such
+	// copies are garbage once they haven't been used for a while (using
+	// touches them) and aren't mapped, readers which opened them already
+	// keep them alive.
+	if (path.parent_path() == cachePath && (!boost::algorithm::starts_with(name, "0-") || std::count(name.begin(), name.end(), '-') < 3))
+		return isOld() && !isMapped(path);
+	
+	auto dash = name.find('-');
+	uint64_t session;
+	try
+	{
+		session = boost::lexical_cast<uint64_t>(name.substr(0, dash));
+	}
+	catch (const boost::bad_lexical_cast&)
+	{
+		return false;
+	}
+	if (dash == std::string::npos || session >= nextSession || containsKey(sessions, session))
+		return false;
+	
+	for (auto suffix : { ".old", ".z" })
+		if (boost::algorithm::ends_with(name, suffix))
+			name.erase(name.size() - std::strlen(suffix));
+	if (containsKey(targets, name))
+		return false;
+	
+	if (session == 0)
+		return isOld();
+	return true;
+}
+
+bool associative::GarbageCollector::collect(Connection& conn, std::size_t limit, unsigned rate, unsigned minAge, Statistics& statistics)
+{
+	if (!running)
+		begin(conn);
+	
+	RateLimiter limiter(rate);
+	fs::directory_iterator end;
+	for (std::size_t examined = 0; !limit || examined < limit; ++examined)
+	{
+		while (position == end)
+		{
+			if (++directory == directories.size())
+			{
+				running = false;
+				return true;
+			}
+			position = fs::directory_iterator(directories[directory]);
+		}
+		
+		auto path = position->path();
+		++position;
+		++statistics.examined;
+		if (!isGarbage(path, minAge))
+			continue;
+		
+		limiter.acquire();
+		boost::system::error_code error;
+		fs::remove(path, error);
+		if (error && error != boost::system::errc::no_such_file_or_directory)
+		{
+			logger->warn() << "couldn't remove " << path.string() << ": " << error.message();
+			continue;
+		}
+		++statistics.removed;
+		logger->debug() << "removed orphaned " << path.string();
+	}
+	return false;
+}
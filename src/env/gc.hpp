@@ -0,0 +1,65 @@
+#ifndef ASSOCIATIVE_GC_HPP
+#define ASSOCIATIVE_GC_HPP
+
+#include <set>
+#include <vector>
+#include <functional>
+
+#include "../util/util.hpp"
+#include "../util/log.hpp"
+#include "../util/threads.hpp"
+#include "../db/connection.hpp"
+
+namespace associative
+{
+	
+	// Removes temporary files nobody refers to any more, i.e. leftovers of
+	// crashed processes and of sessions which ended without cleaning up.
+	// Temporary names start with the session ID, so an entry is garbage if
+	// its session doesn't exist and no journal entry refers to it. Scratch
+	// files (session ID 0, e. g. unfinished cache entries) only have their
+	// age to go by, as do the copies in the cache, unless they are mapped.
+	class GarbageCollector
+	{
+	public:
+		struct Statistics
+		{
+			uint64_t examined;
+			uint64_t removed;
+		};
+		
+	private:
+		const fs::path cachePath;
+		const std::function<bool(const fs::path&)> isMapped;
+		std::vector<fs::path> directories;
+		boost::shared_ptr<Logger> logger;
+		
+		// what has been alive when the current pass started, sessions from
+		// 'nextSession' on have been started later on
+		std::set<uint64_t> sessions;
+		uint64_t nextSession;
+		std::set<std::string> targets;
+		
+		bool running;
+		std::size_t directory;
+		fs::directory_iterator position;
+		
+		void begin(Connection& conn);
+		bool isGarbage(const fs::path& path, unsigned minAge) const;
+		
+	public:
+		// 'tempPaths' are the temporary directories of all tiers
+		// 'isMapped' tells whether this process maps a file in the cache
+		GarbageCollector(const std::vector<fs::path>& tempPaths, const fs::path& cachePath, const std::function<bool(const fs::path&)>& isMapped, const boost::shared_ptr<Logger>& logger);
+		
+		// whether a pass has been started but not completed yet
+		bool isRunning() const;
+		
+		// Examines up to 'limit' entries (0: all), continuing the pass the
+		// previous call didn't finish. Returns whether the pass is complete.
+		bool collect(Connection& conn, std::size_t limit, unsigned rate, unsigned minAge, Statistics& statistics);
+	};
+	
+}
+
+#endif
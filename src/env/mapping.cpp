@@ -0,0 +1,147 @@
+extern "C"
+{
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+}
+
+#include <cerrno>
+#include <cstring>
+
+#include "mapping.hpp"
+
+associative::Mapping::Mapping(const fs::path& path)
+: path(path), immutable(false), mapped(false), address(0), mappedLength(0), start(0), length(0), device(0), inode(0), modified()
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		// a blob which has never been written is empty
+		if (errno == ENOENT)
+			return;
+		throw formatException(boost::format("couldn't open %1%: %2%") % path % std::strerror(errno));
+	}
+	
+	struct stat st;
+	if (fstat(fd, &st))
+	{
+		int error = errno;
+		close(fd);
+		throw formatException(boost::format("couldn't stat %1%: %2%") % path % std::strerror(error));
+	}
+	device = st.st_dev;
+	inode = st.st_ino;
+	modified = st.st_mtim;
+	length = st.st_size;
+	
+	// mmap refuses empty mappings
+	if (length)
+	{
+		address = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+		if (address == MAP_FAILED)
+		{
+			int error = errno;
+			close(fd);
+			throw formatException(boost::format("couldn't map %1%: %2%") % path % std::strerror(error));
+		}
+		mappedLength = length;
+		start = static_cast<const char*>(address);
+		mapped = true;
+	}
+	
+	// the mapping keeps the file alive on its own
+	close(fd);
+}
+
+associative::Mapping::Mapping(const fs::path& path, uint64_t offset, std::size_t length)
+: path(path), immutable(true), mapped(false), address(0), mappedLength(0), start(0), length(length), device(0), inode(0), modified()
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw formatException(boost::format("couldn't open %1%: %2%") % path % std::strerror(errno));
+	
+	if (length)
+	{
+		// mappings have to start at a page boundary
+		uint64_t pageSize = sysconf(_SC_PAGESIZE);
+		uint64_t aligned = offset - offset % pageSize;
+		mappedLength = length + (offset - aligned);
+		address = mmap(0, mappedLength, PROT_READ, MAP_SHARED, fd, aligned);
+		if (address == MAP_FAILED)
+		{
+			int error = errno;
+			close(fd);
+			throw formatException(boost::format("couldn't map %1%: %2%") % path % std::strerror(error));
+		}
+		start = static_cast<const char*>(address) + (offset - aligned);
+		mapped = true;
+	}
+	
+	close(fd);
+}
+
+associative::Mapping::Mapping(const std::string& content)
+: content(content), immutable(true), mapped(false), address(0), mappedLength(0), start(this->content.data()), length(this->content.size()), device(0), inode(0), modified()
+{
+}
+
+associative::Mapping::~Mapping()
+{
+	if (mapped)
+		munmap(address, mappedLength);
+}
+
+const fs::path& associative::Mapping::getPath() const
+{
+	return path;
+}
+
+const char* associative::Mapping::data() const
+{
+	return start;
+}
+
+std::size_t associative::Mapping::size() const
+{
+	return length;
+}
+
+const char* associative::Mapping::begin() const
+{
+	return start;
+}
+
+const char* associative::Mapping::end() const
+{
+	return start + length;
+}
+
+void associative::Mapping::advise(const Advice& advice) const
+{
+	if (!mapped)
+		return;
+	
+	int flag = MADV_NORMAL;
+	switch (advice)
+	{
+		case Advice::Normal: flag = MADV_NORMAL; break;
+		case Advice::Sequential: flag = MADV_SEQUENTIAL; break;
+		case Advice::Random: flag = MADV_RANDOM; break;
+		case Advice::WillNeed: flag = MADV_WILLNEED; break;
+	}
+	// merely a hint, failing is harmless
+	madvise(address, mappedLength, flag);
+}
+
+bool associative::Mapping::isCurrent() const
+{
+	if (immutable)
+		return true;
+	
+	struct stat st;
+	if (stat(path.c_str(), &st))
+		return !inode && errno == ENOENT;
+	return st.st_dev == device && st.st_ino == inode && st.st_mtim.tv_sec == modified.tv_sec && st.st_mtim.tv_nsec == modified.tv_nsec &&
+		static_cast<std::size_t>(st.st_size) == length;
+}
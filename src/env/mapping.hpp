@@ -0,0 +1,69 @@
+#ifndef ASSOCIATIVE_MAPPING_HPP
+#define ASSOCIATIVE_MAPPING_HPP
+
+extern "C"
+{
+	#include <sys/types.h>
+	#include <time.h>
+}
+
+#include "../util/util.hpp"
+
+namespace associative
+{
+	
+	// A read-only view of a file (or a part of it). It stays valid as long as it exists,
+	// even if the file is replaced or removed in the meantime.
+	class Mapping
+	{
+	private:
+		const fs::path path;
+		const std::string content;
+		// contents in memory and ranges of packs never change
+		const bool immutable;
+		bool mapped;
+		// the whole mapping, which might begin before 'start'
+		void* address;
+		std::size_t mappedLength;
+		const char* start;
+		std::size_t length;
+		dev_t device;
+		ino_t inode;
+		timespec modified;
+		
+	public:
+		enum Advice
+		{
+			Normal,
+			Sequential,
+			Random,
+			WillNeed
+		};
+		
+		Mapping(const fs::path& path);
+		// a range within a file which is never modified, just appended to
+		Mapping(const fs::path& path, uint64_t offset, std::size_t length);
+		// contents which are in memory already
+		Mapping(const std::string& content);
+		
+		Mapping(Mapping&) = delete;
+		Mapping& operator=(Mapping&) = delete;
+		
+		~Mapping();
+		
+		const fs::path& getPath() const;
+		const char* data() const;
+		std::size_t size() const;
+		const char* begin() const;
+		const char* end() const;
+		
+		// hints the kernel about the intended access pattern
+		void advise(const Advice& advice) const;
+		
+		// whether the file at 'path' is still the one which has been mapped
+		bool isCurrent() const;
+	};
+	
+}
+
+#endif
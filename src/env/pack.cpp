@@ -0,0 +1,327 @@
+extern "C"
+{
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+}
+
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "pack.hpp"
+#include "../util/io.hpp"
+
+namespace
+{
+	
+	int openOrThrow(const fs::path& path, int flags)
+	{
+		int fd = open(path.c_str(), flags, 0666);
+		if (fd < 0)
+			throw associative::formatException(boost::format("couldn't open %1%: %2%") % path % std::strerror(errno));
+		return fd;
+	}
+	
+	uint64_t sizeOrThrow(int fd, const fs::path& path)
+	{
+		struct stat st;
+		if (fstat(fd, &st))
+			throw associative::formatException(boost::format("couldn't stat %1%: %2%") % path % std::strerror(errno));
+		return st.st_size;
+	}
+	
+	void copyRange(int in, uint64_t start, uint64_t length, int out, uint64_t outStart)
+	{
+		std::vector<char> buffer(std::min<uint64_t>(length, 1 << 20));
+		for (uint64_t done = 0; done < length; )
+		{
+			auto ret = pread(in, buffer.data(), std::min<uint64_t>(buffer.size(), length - done), start + done);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				throw associative::formatException(boost::format("couldn't read from pack: %1%") % (ret ? std::strerror(errno) : "unexpected end of file"));
+			for (ssize_t written = 0; written < ret; )
+			{
+				auto w = pwrite(out, buffer.data() + written, ret - written, outStart + done + written);
+				if (w < 0 && errno == EINTR)
+					continue;
+				if (w < 0)
+					throw associative::formatException(boost::format("couldn't write to pack: %1%") % std::strerror(errno));
+				written += w;
+			}
+			done += ret;
+		}
+	}
+	
+}
+
+associative::PackStore::Appender::Appender(uint64_t pack, const fs::path& path, bool created)
+: pack(pack), path(path), created(created), fd(openOrThrow(path, O_RDWR | O_CREAT)), initialSize(0), size(0)
+{
+	try
+	{
+		// whatever a crashed commit left behind is garbage, but harmless
+		initialSize = size = sizeOrThrow(fd, path);
+	}
+	catch (...)
+	{
+		close(fd);
+		throw;
+	}
+}
+
+associative::PackStore::Appender::~Appender()
+{
+	close(fd);
+}
+
+const fs::path& associative::PackStore::Appender::getPath() const
+{
+	return path;
+}
+
+uint64_t associative::PackStore::Appender::getSize() const
+{
+	return size;
+}
+
+bool associative::PackStore::Appender::isCreated() const
+{
+	return created;
+}
+
+associative::PackStore::Location associative::PackStore::Appender::append(const fs::path& src)
+{
+	int in = openOrThrow(src, O_RDONLY);
+	Location location = { pack, size, 0 };
+	try
+	{
+		location.length = sizeOrThrow(in, src);
+		copyRange(in, 0, location.length, fd, size);
+	}
+	catch (...)
+	{
+		close(in);
+		throw;
+	}
+	close(in);
+	
+	size += location.length;
+	return location;
+}
+
+void associative::PackStore::Appender::updateDatabase(Connection& conn)
+{
+	if (created)
+	{
+		auto stmt = conn.prepareStatement("insert into pack values (?, ?)", std::string("pack.insert"));
+		stmt->execute(convertAll(pack, size));
+	}
+	else
+	{
+		auto stmt = conn.prepareStatement("update pack set size = ? where id = ?", std::string("pack.update"));
+		stmt->execute(convertAll(size, pack));
+	}
+}
+
+void associative::PackStore::Appender::rollback()
+{
+	if (created)
+	{
+		unlink(path.c_str());
+	}
+	else if (ftruncate(fd, initialSize))
+	{
+		throw formatException(boost::format("couldn't truncate %1%: %2%") % path % std::strerror(errno));
+	}
+	size = initialSize;
+}
+
+associative::PackStore::PackStore(const fs::path& root, const boost::shared_ptr<Logger>& logger)
+: root(root), logger(logger)
+{
+	fs::create_directories(root);
+}
+
+fs::path associative::PackStore::getPackPath(uint64_t pack) const
+{
+	return root / (boost::format("%1%.pack") % pack).str();
+}
+
+boost::optional<associative::PackStore::Location> associative::PackStore::find(Connection& conn, uint64_t blobID)
+{
+	auto query = conn.prepareQuery("select pack_id, start, length from blob_pack where blob_id = ?", std::string("pack.find"));
+	auto result = query->execute(convertAll(blobID));
+	if (result.rows.empty())
+		return boost::none;
+	
+	auto& row = result.rows.front();
+	Location location = { boost::lexical_cast<uint64_t>(row[0]), boost::lexical_cast<uint64_t>(row[1]), boost::lexical_cast<uint64_t>(row[2]) };
+	return location;
+}
+
+void associative::PackStore::extract(const Location& location, const fs::path& dest) const
+{
+	int in = openOrThrow(getPackPath(location.pack), O_RDONLY);
+	int out = -1;
+	try
+	{
+		out = openOrThrow(dest, O_WRONLY | O_CREAT | O_TRUNC);
+		copyRange(in, location.start, location.length, out, 0);
+	}
+	catch (...)
+	{
+		if (out >= 0)
+			close(out);
+		close(in);
+		throw;
+	}
+	close(out);
+	close(in);
+}
+
+boost::shared_ptr<associative::PackStore::Appender> associative::PackStore::append(Connection& conn, uint64_t maxSize)
+{
+	auto query = conn.prepareQuery("select id, size from pack order by id desc limit 1", std::string("pack.current"));
+	auto result = query->execute(convertAll());
+	if (!result.rows.empty())
+	{
+		auto pack = boost::lexical_cast<uint64_t>(result.rows.front()[0]);
+		boost::shared_ptr<Appender> appender(new Appender(pack, getPackPath(pack), false));
+		if (appender->size < maxSize)
+			return appender;
+	}
+	
+	return create(conn);
+}
+
+boost::shared_ptr<associative::PackStore::Appender> associative::PackStore::create(Connection& conn)
+{
+	auto t = conn.transaction();
+	auto pack = conn.nextID("pack");
+	t->commit();
+	return boost::shared_ptr<Appender>(new Appender(pack, getPackPath(pack), true));
+}
+
+unsigned associative::PackStore::compact(Connection& conn, double garbage, uint64_t maxSize, const std::function<boost::shared_ptr<HandleBase>()>& lock)
+{
+	auto query = conn.prepareQuery(
+		"select pack.id, pack.size, sum(blob_pack.length) from pack "
+		"left join blob_pack on blob_pack.pack_id = pack.id "
+		"group by pack.id, pack.size order by pack.id",
+	std::string("pack.usage"));
+	auto result = query->execute(convertAll());
+	
+	// ID and size of the packs to rewrite
+	std::vector<std::pair<uint64_t, uint64_t> > candidates;
+	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+	{
+		auto size = boost::lexical_cast<uint64_t>((*iter)[1]);
+		auto live = (*iter)[2].empty() ? 0 : boost::lexical_cast<uint64_t>((*iter)[2]);
+		if (size == 0 || size - live >= garbage * size)
+			candidates.push_back(std::make_pair(boost::lexical_cast<uint64_t>((*iter)[0]), size));
+	}
+	if (candidates.empty())
+		return 0;
+	
+	// Copy the live ranges into fresh packs. That takes long, so it happens
+	// while commits go on, which is fine as long as they don't append to
+	// the packs being rewritten (see below).
+	std::vector<boost::shared_ptr<Appender> > appenders;
+	struct Move
+	{
+		uint64_t blobID;
+		Location from;
+		Location to;
+	};
+	std::list<Move> moved;
+	std::vector<uint64_t> removed;
+	auto ranges = conn.prepareQuery("select blob_id, start, length from blob_pack where pack_id = ? order by start", std::string("pack.ranges"));
+	try
+	{
+		for (auto pack = candidates.begin(); pack != candidates.end(); ++pack)
+		{
+			auto path = getPackPath(pack->first);
+			int in = openOrThrow(path, O_RDONLY);
+			try
+			{
+				auto rows = ranges->execute(convertAll(pack->first)).rows;
+				for (auto iter = rows.begin(); iter != rows.end(); ++iter)
+				{
+					auto start = boost::lexical_cast<uint64_t>((*iter)[1]);
+					auto length = boost::lexical_cast<uint64_t>((*iter)[2]);
+					if (appenders.empty() || (appenders.back()->size && appenders.back()->size + length > maxSize))
+						appenders.push_back(create(conn));
+					
+					auto& appender = *appenders.back();
+					copyRange(in, start, length, appender.fd, appender.size);
+					Move move = { boost::lexical_cast<uint64_t>((*iter)[0]), { pack->first, start, length }, { appender.pack, appender.size, length } };
+					appender.size += length;
+					moved.push_back(move);
+				}
+			}
+			catch (...)
+			{
+				close(in);
+				throw;
+			}
+			close(in);
+		}
+		
+		forEach(appenders, [](const boost::shared_ptr<Appender>& appender) { syncFile(appender->getPath()); });
+		if (!appenders.empty())
+			syncDirectory(root);
+		
+		auto handle = lock();
+		auto t = conn.transaction();
+		
+		// A pack which has grown meanwhile has ranges which haven't been
+		// copied, and one which is gone has been compacted by someone else.
+		// Such packs are left as they are.
+		auto sizeQuery = conn.prepareQuery("select size from pack where id = ?", std::string("pack.size"));
+		for (auto pack = candidates.begin(); pack != candidates.end(); ++pack)
+		{
+			auto rows = sizeQuery->execute(convertAll(pack->first)).rows;
+			if (!rows.empty() && boost::lexical_cast<uint64_t>(rows.front()[0]) == pack->second)
+				removed.push_back(pack->first);
+		}
+		if (removed.empty())
+		{
+			t->rollback();
+			forEach(appenders, [](const boost::shared_ptr<Appender>& appender) { appender->rollback(); });
+			return 0;
+		}
+		
+		// ranges of blobs overwritten or removed meanwhile don't match any more
+		forEach(appenders, [&conn](const boost::shared_ptr<Appender>& appender) { appender->updateDatabase(conn); });
+		auto stmt = conn.prepareStatement(
+			"update blob_pack set pack_id = ?, start = ? "
+			"where blob_id = ? and pack_id = ? and start = ? and length = ?",
+		std::string("pack.move"));
+		for (auto iter = moved.begin(); iter != moved.end(); ++iter)
+			if (std::find(removed.begin(), removed.end(), iter->from.pack) != removed.end())
+				stmt->execute(convertAll(iter->to.pack, iter->to.start, iter->blobID, iter->from.pack, iter->from.start, iter->from.length));
+		stmt = conn.prepareStatement("delete from pack where id = ?", std::string("pack.delete"));
+		for (auto iter = removed.begin(); iter != removed.end(); ++iter)
+			stmt->execute(convertAll(*iter));
+		t->commit();
+	}
+	catch (...)
+	{
+		forEach(appenders, [](const boost::shared_ptr<Appender>& appender) { appender->rollback(); });
+		throw;
+	}
+	
+	// readers which are still using the old packs keep them alive
+	for (auto iter = removed.begin(); iter != removed.end(); ++iter)
+	{
+		boost::system::error_code error;
+		fs::remove(getPackPath(*iter), error);
+		if (error)
+			logger->warn() << "couldn't remove pack " << getPackPath(*iter).string() << ": " << error.message();
+	}
+	
+	return removed.size();
+}
@@ -0,0 +1,86 @@
+#ifndef ASSOCIATIVE_PACK_HPP
+#define ASSOCIATIVE_PACK_HPP
+
+#include <functional>
+
+#include "../util/util.hpp"
+#include "../util/resource.hpp"
+#include "../util/log.hpp"
+#include "../db/connection.hpp"
+
+namespace associative
+{
+	
+	// Small blobs may be appended to shared pack files instead of getting a
+	// file of their own. The database maps each packed blob to its range.
+	// Packs are never modified except for appending, so a range stays valid
+	// until the pack is compacted (and thereby removed).
+	class PackStore
+	{
+	public:
+		struct Location
+		{
+			uint64_t pack;
+			uint64_t start;
+			uint64_t length;
+		};
+		
+		// appends to the current pack during a commit
+		class Appender
+		{
+			friend class PackStore;
+			
+		private:
+			const uint64_t pack;
+			const fs::path path;
+			const bool created;
+			int fd;
+			uint64_t initialSize;
+			uint64_t size;
+			
+			Appender(uint64_t pack, const fs::path& path, bool created);
+			
+		public:
+			Appender(Appender&) = delete;
+			Appender& operator=(Appender&) = delete;
+			
+			~Appender();
+			
+			const fs::path& getPath() const;
+			uint64_t getSize() const;
+			// whether the pack has been started by this appender
+			bool isCreated() const;
+			
+			Location append(const fs::path& src);
+			void updateDatabase(Connection& conn);
+			// cuts off everything appended so far
+			void rollback();
+		};
+		
+	private:
+		const fs::path root;
+		boost::shared_ptr<Logger> logger;
+		
+	public:
+		PackStore(const fs::path& root, const boost::shared_ptr<Logger>& logger);
+		
+		fs::path getPackPath(uint64_t pack) const;
+		boost::optional<Location> find(Connection& conn, uint64_t blobID);
+		// copies a range into a new file
+		void extract(const Location& location, const fs::path& dest) const;
+		
+		// continues the newest pack unless it has reached 'maxSize' already
+		boost::shared_ptr<Appender> append(Connection& conn, uint64_t maxSize);
+		// starts a new pack
+		boost::shared_ptr<Appender> create(Connection& conn);
+		
+		// Rewrites all packs in which at least 'garbage' (a fraction) of the
+		// contents belong to removed or overwritten blobs. The contents are
+		// copied while commits go on, 'lock' has to keep them out while the
+		// ranges are replaced. Packs appended to meanwhile are skipped.
+		unsigned compact(Connection& conn, double garbage, uint64_t maxSize, const std::function<boost::shared_ptr<HandleBase>()>& lock);
+	};
+	
+}
+
+#endif
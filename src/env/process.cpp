@@ -85,6 +85,12 @@ associative::MemLock* associative::Process::getMemLock(const std::string& name,
 	return findMemLock(name, create);
 }
 
+std::atomic<uint64_t>* associative::Process::getCounter(const std::string& name)
+{
+	// constructing is atomic with respect to other processes
+	return sharedMemory->find_or_construct<std::atomic<uint64_t> >(name.c_str())(0);
+}
+
 associative::FileLock* associative::Process::getFileLock()
 {
 	return fileLock;
@@ -6,6 +6,8 @@ extern "C"
 	#include <unistd.h>
 }
 
+#include <atomic>
+
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
@@ -51,6 +53,8 @@ namespace associative
 		~Process();
 		
 		MemLock* getMemLock(const std::string& name, bool create = true);
+		// a counter shared by all processes using the same database, 0 initially
+		std::atomic<uint64_t>* getCounter(const std::string& name);
 		FileLock* getFileLock();
 		
 		static void clearSharedMemory(const std::string& dataSource);
@@ -0,0 +1,186 @@
+#include <fstream>
+
+#include "scrub.hpp"
+#include "../util/io.hpp"
+#include "../util/checksum.hpp"
+
+associative::Scrubber::Scrubber(Environment& env, unsigned threads, uint64_t rate)
+: env(env), vfs(env.getVFS()), threads(threads), limiter(rate), statePath(vfs.root / "scrub.state"), bytes(0)
+{
+}
+
+std::vector<associative::Scrubber::Task> associative::Scrubber::load(uint64_t from, uint64_t to)
+{
+	auto query = env.getConnection().prepareQuery(
+		"select blob.id, file.uuid, blob.name, blob_checksum.size, blob_checksum.crc32c, "
+		"blob_content.blob_id, blob_content.content, blob_pack.pack_id, blob_pack.start, blob_pack.length, blob_tier.tier, blob_codec.codec from `blob` "
+		"inner join file on file.id = blob.file_id "
+		"left join blob_checksum on blob_checksum.blob_id = blob.id "
+		"left join blob_content on blob_content.blob_id = blob.id "
+		"left join blob_pack on blob_pack.blob_id = blob.id "
+		"left join blob_tier on blob_tier.blob_id = blob.id "
+		"left join blob_codec on blob_codec.blob_id = blob.id "
+		"where blob.visible = 1 and blob.id >= ? and blob.id < ? "
+		"order by blob.id",
+	std::string("scrub.blobs"));
+	auto result = query->execute(convertAll(from, to));
+	
+	std::vector<Task> tasks;
+	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+	{
+		auto& row = *iter;
+		Task task;
+		task.blobID = boost::lexical_cast<uint64_t>(row[0]);
+		task.uuid = row[1];
+		task.name = row[2];
+		if (!row[3].empty())
+		{
+			task.size = boost::lexical_cast<uint64_t>(row[3]);
+			task.checksum = boost::lexical_cast<uint32_t>(row[4]);
+		}
+		if (!row[5].empty())
+			task.content = row[6];
+		if (!row[7].empty())
+		{
+			PackStore::Location location = { boost::lexical_cast<uint64_t>(row[7]), boost::lexical_cast<uint64_t>(row[8]), boost::lexical_cast<uint64_t>(row[9]) };
+			task.location = location;
+		}
+		task.path = vfs.getBlobDirectory(row[10].empty() ? StoreSettings::defaultTier : row[10], task.uuid) / task.name;
+		task.encoded = !row[11].empty();
+		tasks.push_back(task);
+	}
+	return tasks;
+}
+
+void associative::Scrubber::verify(Task& task)
+{
+	task.problem = boost::none;
+	if (!task.checksum)
+		return;
+	
+	Problem problem = { Problem::Kind::Mismatch, task.blobID, task.uuid, task.name, "" };
+	ChecksumBuffer buffer([this](std::size_t count) {
+		limiter.acquire(count);
+		bytes += count;
+	});
+	std::ostream stream(&buffer);
+	try
+	{
+		if (task.content)
+		{
+			stream.write(task.content->data(), task.content->size());
+		}
+		else if (task.location)
+		{
+			BlobReader reader(vfs.packs.getPackPath(task.location->pack), task.location->start, task.location->length);
+			std::vector<char> chunk(65536);
+			for (std::size_t count; (count = reader.read(chunk.data(), chunk.size())); )
+				stream.write(chunk.data(), count);
+		}
+		else if (!fs::exists(task.path))
+		{
+			problem.kind = Problem::Kind::Missing;
+			task.problem = problem;
+			return;
+		}
+		else if (task.encoded)
+		{
+			Codec::decode(task.path, stream);
+		}
+		else
+		{
+			std::ifstream in(task.path.string(), std::ios_base::binary);
+			if (!in)
+				throw formatException(boost::format("couldn't open %1%") % task.path);
+			copyStreams(in, stream);
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		problem.kind = Problem::Kind::Unreadable;
+		problem.detail = ex.what();
+		task.problem = problem;
+		return;
+	}
+	
+	auto size = buffer.size();
+	auto checksum = buffer.checksum();
+	if (size != *task.size || checksum != *task.checksum)
+	{
+		problem.detail = (boost::format("expected %1% bytes with CRC-32C %2$08x, found %3% bytes with %4$08x") % *task.size % *task.checksum % size % checksum).str();
+		task.problem = problem;
+	}
+}
+
+boost::optional<uint64_t> associative::Scrubber::loadState() const
+{
+	std::ifstream in(statePath.string());
+	uint64_t blobID;
+	if (!(in >> blobID))
+		return boost::none;
+	return blobID;
+}
+
+void associative::Scrubber::saveState(uint64_t blobID) const
+{
+	auto temp = fs::path(statePath.string() + ".new");
+	{
+		std::ofstream out(temp.string(), std::ios_base::trunc);
+		out << blobID << std::endl;
+		if (!out)
+			throw formatException(boost::format("couldn't write %1%") % temp);
+	}
+	fs::rename(temp, statePath);
+}
+
+associative::Scrubber::Statistics associative::Scrubber::run(bool restart, const Report& report, std::size_t chunkSize)
+{
+	Statistics statistics = { 0, 0, 0, 0 };
+	bytes = 0;
+	
+	auto state = restart ? boost::none : loadState();
+	if (state)
+		vfs.logger->info() << "resuming scrub at blob " << *state;
+	
+	auto result = env.getConnection().executeQuery("select max(id) from `blob`");
+	auto& last = result.rows.front().at(0);
+	auto end = last.empty() ? 0 : boost::lexical_cast<uint64_t>(last) + 1;
+	
+	for (uint64_t from = state ? *state : 0; from < end; from += chunkSize)
+	{
+		auto tasks = load(from, from + chunkSize);
+		parallelForEach(tasks, [this](Task& task) { this->verify(task); }, threads);
+		
+		for (auto iter = tasks.begin(); iter != tasks.end(); ++iter)
+		{
+			if (!iter->checksum)
+			{
+				++statistics.unchecked;
+				continue;
+			}
+			++statistics.verified;
+			if (!iter->problem)
+				continue;
+			
+			// a concurrent commit might have replaced or removed the blob
+			auto again = load(iter->blobID, iter->blobID + 1);
+			if (again.empty())
+				continue;
+			verify(again.front());
+			if (!again.front().problem)
+				continue;
+			
+			++statistics.problems;
+			report(*again.front().problem);
+		}
+		
+		saveState(from + chunkSize);
+	}
+	
+	// the next run starts from scratch
+	fs::remove(statePath);
+	
+	statistics.bytes = bytes;
+	vfs.logger->info() << "scrubbed " << statistics.verified << " blobs (" << statistics.bytes << " bytes), " << statistics.problems << " problems";
+	return statistics;
+}
@@ -0,0 +1,86 @@
+#ifndef ASSOCIATIVE_SCRUB_HPP
+#define ASSOCIATIVE_SCRUB_HPP
+
+#include <atomic>
+
+#include "vfs.hpp"
+#include "../util/threads.hpp"
+
+namespace associative
+{
+	
+	// Verifies the contents of all committed blobs against their stored
+	// checksums. Blobs are processed in chunks of consecutive IDs, and the
+	// progress is recorded after each chunk, so an interrupted run may be
+	// resumed later on.
+	class Scrubber
+	{
+	public:
+		struct Problem
+		{
+			enum Kind
+			{
+				Missing,
+				Mismatch,
+				Unreadable
+			};
+			
+			Kind kind;
+			uint64_t blobID;
+			std::string uuid;
+			std::string name;
+			std::string detail;
+		};
+		
+		typedef boost::function<void (const Problem&)> Report;
+		
+		struct Statistics
+		{
+			uint64_t verified;
+			// blobs without stored checksum, e. g. committed by older versions
+			uint64_t unchecked;
+			uint64_t bytes;
+			uint64_t problems;
+		};
+		
+	private:
+		// where the committed contents of a blob live
+		struct Task
+		{
+			uint64_t blobID;
+			std::string uuid;
+			std::string name;
+			boost::optional<uint64_t> size;
+			boost::optional<uint32_t> checksum;
+			boost::optional<std::string> content;
+			boost::optional<PackStore::Location> location;
+			fs::path path;
+			bool encoded;
+			boost::optional<Problem> problem;
+		};
+		
+		Environment& env;
+		VFS& vfs;
+		const unsigned threads;
+		RateLimiter limiter;
+		const fs::path statePath;
+		std::atomic<uint64_t> bytes;
+		
+		// blobs with IDs from 'from' up to (excluding) 'to'
+		std::vector<Task> load(uint64_t from, uint64_t to);
+		void verify(Task& task);
+		
+		boost::optional<uint64_t> loadState() const;
+		void saveState(uint64_t blobID) const;
+		
+	public:
+		// 'rate' limits the bytes read per second (0: no limit)
+		Scrubber(Environment& env, unsigned threads, uint64_t rate);
+		
+		// continues an interrupted run unless 'restart' is set
+		Statistics run(bool restart, const Report& report, std::size_t chunkSize = 4096);
+	};
+	
+}
+
+#endif
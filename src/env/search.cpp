@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
+#include <boost/lexical_cast.hpp>
+
+#include "search.hpp"
+#include "../objects/term.hpp"
+
+const std::size_t associative::TextIndex::maxWordLength = 64;
+
+associative::TextIndex::Tokenizer::Tokenizer()
+{
+	document.length = 0;
+}
+
+void associative::TextIndex::Tokenizer::flush()
+{
+	// skipped words still take their position, so that the words around
+	// them don't become adjacent
+	if (!word.empty() && word.size() <= maxWordLength)
+		document.postings[word].push_back(document.length);
+	if (!word.empty())
+		++document.length;
+	word.clear();
+}
+
+void associative::TextIndex::Tokenizer::add(const char* data, std::size_t size)
+{
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		auto c = static_cast<unsigned char>(data[i]);
+		if (c >= 0x80 || std::isalnum(c))
+			word += static_cast<char>(c < 0x80 ? std::tolower(c) : c);
+		else
+			flush();
+	}
+}
+
+associative::TextIndex::Document associative::TextIndex::Tokenizer::finish()
+{
+	flush();
+	return document;
+}
+
+bool associative::TextIndex::isIndexed(const std::string& contentType)
+{
+	return contentType.compare(0, 5, "text/") == 0;
+}
+
+associative::TextIndex::Document associative::TextIndex::tokenize(const fs::path& path)
+{
+	std::ifstream stream(path.string(), std::ios_base::binary);
+	if (!stream)
+		throw formatException(boost::format("couldn't open %1%") % path);
+	
+	Tokenizer tokenizer;
+	std::vector<char> buffer(65536);
+	while (stream.read(buffer.data(), buffer.size()) || stream.gcount())
+		tokenizer.add(buffer.data(), stream.gcount());
+	return tokenizer.finish();
+}
+
+void associative::TextIndex::add(Connection& conn, uint64_t blobID, const Document& document)
+{
+	std::vector<std::string> words;
+	for (auto iter = document.postings.begin(); iter != document.postings.end(); ++iter)
+		words.push_back(iter->first);
+	TermDictionary dictionary(conn, "text_word");
+	auto wordIDs = dictionary.ensure(words);
+	
+	// rows per statement, well within the parameter limits of both databases
+	static const std::size_t batchSize = 100;
+	auto iter = document.postings.begin();
+	for (std::size_t start = 0; start < words.size(); start += batchSize)
+	{
+		auto count = std::min(batchSize, words.size() - start);
+		std::string rows = "(?, ?, ?, ?)";
+		for (std::size_t i = 1; i < count; ++i)
+			rows += ", (?, ?, ?, ?)";
+		
+		std::vector<std::string> parameters;
+		for (std::size_t i = start; i < start + count; ++i, ++iter)
+		{
+			auto row = convertAll(wordIDs[i], blobID, iter->second.size(),
+				collToString(iter->second, SimpleCollFormat<std::vector<uint32_t> >("", "", " ")));
+			parameters.insert(parameters.end(), row.begin(), row.end());
+		}
+		conn.prepareStatement("insert into text_posting values " + rows, "search.postings.add." + toString(count))->execute(parameters);
+	}
+	
+	conn.prepareStatement("insert into text_document values (?, ?)", std::string("search.document.add"))->execute(convertAll(blobID, document.length));
+}
+
+void associative::TextIndex::remove(Connection& conn, uint64_t blobID)
+{
+	conn.prepareStatement("delete from text_posting where blob_id = ?", std::string("search.postings.remove"))->execute(convertAll(blobID));
+	conn.prepareStatement("delete from text_document where blob_id = ?", std::string("search.document.remove"))->execute(convertAll(blobID));
+}
+
+std::vector<associative::TextIndex::Result> associative::TextIndex::search(Connection& conn, const std::string& query, unsigned limit)
+{
+	// the words outside of quotes and the phrases within
+	std::vector<std::vector<std::string> > phrases;
+	std::vector<std::string> words;
+	bool quoted = false;
+	std::size_t start = 0;
+	for (std::size_t i = 0; i <= query.size(); ++i)
+	{
+		if (i < query.size() && query[i] != '"')
+			continue;
+		
+		Tokenizer tokenizer;
+		tokenizer.add(query.data() + start, i - start);
+		auto document = tokenizer.finish();
+		std::vector<std::string> phrase(document.length);
+		for (auto iter = document.postings.begin(); iter != document.postings.end(); ++iter)
+			for (auto position = iter->second.begin(); position != iter->second.end(); ++position)
+				phrase[*position] = iter->first;
+		words.insert(words.end(), phrase.begin(), phrase.end());
+		if (quoted && phrase.size() > 1)
+			phrases.push_back(phrase);
+		quoted = !quoted;
+		start = i + 1;
+	}
+	std::sort(words.begin(), words.end());
+	words.erase(std::unique(words.begin(), words.end()), words.end());
+	words.erase(std::remove(words.begin(), words.end(), std::string()), words.end());
+	
+	std::vector<Result> results;
+	auto t = conn.transaction();
+	auto totals = conn.prepareQuery("select count(*), sum(length) from text_document", std::string("search.totals"))->execute(convertAll());
+	auto documents = boost::lexical_cast<double>(totals.rows.front().at(0));
+	if (words.empty() || !documents)
+		return results;
+	auto averageLength = boost::lexical_cast<double>(totals.rows.front().at(1)) / documents;
+	
+	struct Posting
+	{
+		uint64_t blobID;
+		std::string positions;
+	};
+	std::unordered_map<std::string, std::vector<Posting> > postings;
+	std::unordered_map<uint64_t, double> scores;
+	auto select = conn.prepareQuery(
+		"select p.blob_id, p.frequency, d.length, p.positions from text_posting p "
+		"inner join text_document d on d.blob_id = p.blob_id "
+		"where p.word_id = (select id from text_word where value = ?)",
+	std::string("search.postings"));
+	for (auto word = words.begin(); word != words.end(); ++word)
+	{
+		auto result = select->execute(convertAll(*word));
+		// BM25 with the usual parameters
+		static const double k1 = 1.2, b = 0.75;
+		double idf = std::log(1 + (documents - result.rows.size() + 0.5) / (result.rows.size() + 0.5));
+		for (auto row = result.rows.begin(); row != result.rows.end(); ++row)
+		{
+			auto blobID = boost::lexical_cast<uint64_t>(row->at(0));
+			auto frequency = boost::lexical_cast<double>(row->at(1));
+			auto length = boost::lexical_cast<double>(row->at(2));
+			scores[blobID] += idf * frequency * (k1 + 1) / (frequency + k1 * (1 - b + b * length / averageLength));
+			Posting posting = { blobID, row->at(3) };
+			postings[*word].push_back(posting);
+		}
+	}
+	
+	// each phrase needs its words at consecutive positions, words too long
+	// to be indexed match any word
+	for (auto phrase = phrases.begin(); phrase != phrases.end(); ++phrase)
+	{
+		std::unordered_map<uint64_t, std::unordered_set<uint32_t> > starts;
+		bool first = true;
+		for (std::size_t i = 0; i < phrase->size(); ++i)
+		{
+			if ((*phrase)[i].empty())
+				continue;
+			
+			std::unordered_map<uint64_t, std::unordered_set<uint32_t> > next;
+			auto& list = postings[(*phrase)[i]];
+			for (auto posting = list.begin(); posting != list.end(); ++posting)
+			{
+				auto previous = starts.find(posting->blobID);
+				if (!first && previous == starts.end())
+					continue;
+				std::istringstream stream(posting->positions);
+				uint32_t position;
+				while (stream >> position)
+					if (position >= i && (first || containsKey(previous->second, position - i)))
+						next[posting->blobID].insert(position - i);
+			}
+			starts.swap(next);
+			first = false;
+		}
+		for (auto iter = scores.begin(); iter != scores.end(); )
+			iter = containsKey(starts, iter->first) ? std::next(iter) : scores.erase(iter);
+	}
+	
+	std::vector<std::pair<double, uint64_t> > ranked;
+	for (auto iter = scores.begin(); iter != scores.end(); ++iter)
+		ranked.push_back(std::make_pair(-iter->second, iter->first));
+	std::sort(ranked.begin(), ranked.end());
+	
+	auto name = conn.prepareQuery(
+		"select file.uuid, blob.name from `blob` inner join file on file.id = blob.file_id where blob.id = ? and blob.visible = 1",
+	std::string("search.blob"));
+	for (auto iter = ranked.begin(); iter != ranked.end() && results.size() < limit; ++iter)
+	{
+		auto result = name->execute(convertAll(iter->second));
+		if (result.rows.empty())
+			continue;
+		Result found = { result.rows.front().at(0), result.rows.front().at(1), -iter->first };
+		results.push_back(found);
+	}
+	t->commit();
+	return results;
+}
@@ -0,0 +1,72 @@
+#ifndef ASSOCIATIVE_SEARCH_HPP
+#define ASSOCIATIVE_SEARCH_HPP
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "../util/util.hpp"
+#include "../db/connection.hpp"
+
+namespace associative
+{
+	
+	// An inverted index of the words in blobs with text/* content types,
+	// kept in the database along with the blobs. The postings of a word list
+	// the blobs containing it and where (the how-manieth word). Words are
+	// kept apart from the terms of the metadata, in a dictionary of their
+	// own. Commits index the blobs they store and drop the postings of those
+	// they remove, nothing else is touched.
+	class TextIndex
+	{
+	public:
+		// the words of a text and their positions
+		struct Document
+		{
+			std::unordered_map<std::string, std::vector<uint32_t> > postings;
+			uint32_t length;
+		};
+		
+		// Splits text fed in chunks into words, runs of letters and digits
+		// (any non-ASCII byte counts as a letter), lowercased. Words longer
+		// than 'maxWordLength' are skipped, but take their position.
+		class Tokenizer
+		{
+		private:
+			Document document;
+			std::string word;
+			
+			void flush();
+		
+		public:
+			Tokenizer();
+			
+			void add(const char* data, std::size_t size);
+			Document finish();
+		};
+		
+		struct Result
+		{
+			std::string uuid;
+			std::string name;
+			double score;
+		};
+		
+		static const std::size_t maxWordLength;
+		
+		static bool isIndexed(const std::string& contentType);
+		static Document tokenize(const fs::path& path);
+		
+		// adds the postings of a blob which has none yet, within the
+		// caller's transaction
+		static void add(Connection& conn, uint64_t blobID, const Document& document);
+		static void remove(Connection& conn, uint64_t blobID);
+		
+		// Committed blobs containing any word of 'query', best first by
+		// BM25. Phrases in double quotes have to occur as such.
+		static std::vector<Result> search(Connection& conn, const std::string& query, unsigned limit);
+	};
+
+}
+
+#endif
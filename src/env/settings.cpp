@@ -0,0 +1,233 @@
+#include <fstream>
+
+#include "settings.hpp"
+#include "../util/config.hpp"
+
+const std::string associative::StoreSettings::defaultTier("default");
+
+#define ASSOCIATIVE_SETTINGS_FILE "store.conf"
+
+po::options_description associative::StoreSettings::description()
+{
+	po::options_description desc;
+	desc.add_options()
+		("layout.levels", po::value<unsigned>()->default_value(0), "number of directory levels below blobs/")
+		("layout.width", po::value<unsigned>()->default_value(2), "number of UUID characters per level")
+		("vfs.durability", po::value<std::string>()->default_value(Configuration::defaultDurability()), "durability policy (none, commit or group)")
+		("vfs.executor", po::value<std::string>()->default_value("auto"), "executor for commits (auto, uring or threads)")
+		("vfs.threads", po::value<unsigned>()->default_value(0), "number of worker threads (0: one per core)")
+		("vfs.compression-level", po::value<int>()->default_value(6), "zlib compression level (1 to 9)")
+		("vfs.inline-threshold", po::value<uint64_t>()->default_value(0), "maximum size of blobs stored in the database (0: none)")
+		("vfs.cache-size", po::value<uint64_t>()->default_value(1 << 30), "size of decoded copies kept in cache/ (0: no limit)")
+		("pack.threshold", po::value<uint64_t>()->default_value(0), "maximum size of blobs stored in packs (0: none)")
+		("pack.size", po::value<uint64_t>()->default_value(256 << 20), "size at which a new pack is started")
+		("pack.garbage", po::value<double>()->default_value(0.5), "fraction of dead data which makes compaction rewrite a pack")
+		("gc.batch", po::value<unsigned>()->default_value(64), "temporary files examined after each commit (0: none)")
+		("gc.rate", po::value<unsigned>()->default_value(1000), "maximum number of files removed per second (0: no limit)")
+		("gc.min-age", po::value<unsigned>()->default_value(3600), "minimum age in seconds of files not belonging to a session")
+		("tiering.large-size", po::value<uint64_t>()->default_value(0), "size above which blobs go to the large tier (0: none)")
+		("tiering.large-tier", po::value<std::string>()->default_value(defaultTier), "tier for large blobs")
+		("tiering.cold-after", po::value<unsigned>()->default_value(0), "seconds without access after which blobs are migrated to the cold tier (0: never)")
+		("tiering.cold-tier", po::value<std::string>()->default_value(defaultTier), "tier for blobs not accessed recently")
+		("metadata.cache", po::value<bool>()->default_value(false), "keep the committed metadata in memory")
+		("metadata.log-size", po::value<unsigned>()->default_value(1024), "number of commits logged for metadata caches")
+		("search.index", po::value<bool>()->default_value(false), "index the words of text blobs when committing")
+		("search.max-size", po::value<uint64_t>()->default_value(64 << 20), "largest text blob indexed");
+	return desc;
+}
+
+associative::StoreSettings::StoreSettings()
+: layoutLevels(0), layoutWidth(2), durability(parseDurability(Configuration::defaultDurability())),
+  executor("auto"), threads(0), compressionLevel(6), inlineThreshold(0), cacheSize(1 << 30),
+  packThreshold(0), packSize(256 << 20), packGarbage(0.5),
+  gcBatch(64), gcRate(1000), gcMinAge(3600),
+  largeSize(0), largeTier(defaultTier), coldAfter(0), coldTier(defaultTier),
+  metadataCache(false), metadataLogSize(1024), textIndex(false), textIndexMaxSize(64 << 20)
+{
+}
+
+void associative::StoreSettings::validate() const
+{
+	// the first group of a UUID has 8 hex digits, don't run into the dash
+	if (layoutLevels * layoutWidth > 8)
+		throw formatException(boost::format("layout with %1% levels of width %2% exceeds the first UUID group") % layoutLevels % layoutWidth);
+	if (layoutLevels && !layoutWidth)
+		throw Exception("layout width must be positive");
+	if (compressionLevel < 1 || compressionLevel > 9)
+		throw formatException(boost::format("compression level %1% is out of range") % compressionLevel);
+	if (packGarbage <= 0 || packGarbage > 1)
+		throw formatException(boost::format("pack garbage fraction %1% is out of range") % packGarbage);
+	if (!metadataLogSize)
+		throw Exception("metadata log size must be positive");
+	
+	for (auto iter = tiers.begin(); iter != tiers.end(); ++iter)
+		if (iter->first == defaultTier || iter->first.empty() || iter->first.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789-_") != std::string::npos)
+			throw formatException(boost::format("%1% is not a valid tier name") % iter->first);
+	auto check = [this](const std::string& tier) {
+		if (tier != defaultTier && !containsKey(tiers, tier))
+			throw formatException(boost::format("unknown tier %1%") % tier);
+	};
+	check(largeTier);
+	check(coldTier);
+	for (auto iter = placement.begin(); iter != placement.end(); ++iter)
+		check(iter->second);
+}
+
+associative::StoreSettings associative::StoreSettings::load(const fs::path& root)
+{
+	StoreSettings settings;
+	auto path = root / ASSOCIATIVE_SETTINGS_FILE;
+	if (!fs::exists(path))
+		return settings;
+	
+	std::ifstream stream(path.string());
+	po::variables_map vm;
+	// the [compression] and [placement] sections are keyed by content
+	// types, the [tier] section by tier names
+	auto desc = description();
+	auto parsed = po::parse_config_file(stream, desc, true);
+	po::store(parsed, vm);
+	po::notify(vm);
+	
+	for (auto iter = parsed.options.begin(); iter != parsed.options.end(); ++iter)
+	{
+		if (!iter->unregistered)
+			continue;
+		
+		auto dot = iter->string_key.find('.');
+		auto section = iter->string_key.substr(0, dot);
+		auto key = dot == std::string::npos ? std::string() : iter->string_key.substr(dot + 1);
+		if (key.empty() || iter->value.size() != 1)
+			throw formatException(boost::format("unknown setting %1%") % iter->string_key);
+		else if (section == "compression")
+			settings.compression[key] = Codec::parse(iter->value.front());
+		else if (section == "placement")
+			settings.placement[key] = iter->value.front();
+		else if (section == "tier")
+			settings.tiers[key] = iter->value.front();
+		else
+			throw formatException(boost::format("unknown setting %1%") % iter->string_key);
+	}
+	
+	settings.layoutLevels = vm["layout.levels"].as<unsigned>();
+	settings.layoutWidth = vm["layout.width"].as<unsigned>();
+	settings.durability = parseDurability(vm["vfs.durability"].as<std::string>());
+	settings.executor = vm["vfs.executor"].as<std::string>();
+	settings.threads = vm["vfs.threads"].as<unsigned>();
+	settings.compressionLevel = vm["vfs.compression-level"].as<int>();
+	settings.inlineThreshold = vm["vfs.inline-threshold"].as<uint64_t>();
+	settings.cacheSize = vm["vfs.cache-size"].as<uint64_t>();
+	settings.packThreshold = vm["pack.threshold"].as<uint64_t>();
+	settings.packSize = vm["pack.size"].as<uint64_t>();
+	settings.packGarbage = vm["pack.garbage"].as<double>();
+	settings.gcBatch = vm["gc.batch"].as<unsigned>();
+	settings.gcRate = vm["gc.rate"].as<unsigned>();
+	settings.gcMinAge = vm["gc.min-age"].as<unsigned>();
+	settings.largeSize = vm["tiering.large-size"].as<uint64_t>();
+	settings.largeTier = vm["tiering.large-tier"].as<std::string>();
+	settings.coldAfter = vm["tiering.cold-after"].as<unsigned>();
+	settings.coldTier = vm["tiering.cold-tier"].as<std::string>();
+	settings.metadataCache = vm["metadata.cache"].as<bool>();
+	settings.metadataLogSize = vm["metadata.log-size"].as<unsigned>();
+	settings.textIndex = vm["search.index"].as<bool>();
+	settings.textIndexMaxSize = vm["search.max-size"].as<uint64_t>();
+	settings.validate();
+	return settings;
+}
+
+void associative::StoreSettings::save(const fs::path& root) const
+{
+	validate();
+	
+	// write to a temporary file first, so that readers never see a partial file
+	auto path = root / ASSOCIATIVE_SETTINGS_FILE;
+	auto temp = root / (ASSOCIATIVE_SETTINGS_FILE ".new");
+	{
+		std::ofstream stream(temp.string(), std::ios_base::trunc);
+		stream << "[layout]" << std::endl;
+		stream << "levels = " << layoutLevels << std::endl;
+		stream << "width = " << layoutWidth << std::endl;
+		stream << "[vfs]" << std::endl;
+		stream << "durability = " << durabilityName(durability) << std::endl;
+		stream << "executor = " << executor << std::endl;
+		stream << "threads = " << threads << std::endl;
+		stream << "compression-level = " << compressionLevel << std::endl;
+		stream << "inline-threshold = " << inlineThreshold << std::endl;
+		stream << "cache-size = " << cacheSize << std::endl;
+		stream << "[pack]" << std::endl;
+		stream << "threshold = " << packThreshold << std::endl;
+		stream << "size = " << packSize << std::endl;
+		stream << "garbage = " << packGarbage << std::endl;
+		stream << "[gc]" << std::endl;
+		stream << "batch = " << gcBatch << std::endl;
+		stream << "rate = " << gcRate << std::endl;
+		stream << "min-age = " << gcMinAge << std::endl;
+		stream << "[tiering]" << std::endl;
+		stream << "large-size = " << largeSize << std::endl;
+		stream << "large-tier = " << largeTier << std::endl;
+		stream << "cold-after = " << coldAfter << std::endl;
+		stream << "cold-tier = " << coldTier << std::endl;
+		stream << "[metadata]" << std::endl;
+		stream << "cache = " << (metadataCache ? "true" : "false") << std::endl;
+		stream << "log-size = " << metadataLogSize << std::endl;
+		stream << "[search]" << std::endl;
+		stream << "index = " << (textIndex ? "true" : "false") << std::endl;
+		stream << "max-size = " << textIndexMaxSize << std::endl;
+		stream << "[compression]" << std::endl;
+		for (auto iter = compression.begin(); iter != compression.end(); ++iter)
+			stream << iter->first << " = " << Codec::name(iter->second) << std::endl;
+		stream << "[placement]" << std::endl;
+		for (auto iter = placement.begin(); iter != placement.end(); ++iter)
+			stream << iter->first << " = " << iter->second << std::endl;
+		stream << "[tier]" << std::endl;
+		for (auto iter = tiers.begin(); iter != tiers.end(); ++iter)
+			stream << iter->first << " = " << iter->second.string() << std::endl;
+	}
+	fs::rename(temp, path);
+}
+
+associative::Codec::Type associative::StoreSettings::getCodec(const std::string& contentType) const
+{
+	auto iter = compression.find(contentType);
+	if (iter == compression.end())
+		iter = compression.find(contentType.substr(0, contentType.find('/')) + "/*");
+	if (iter == compression.end())
+		iter = compression.find("*");
+	return iter == compression.end() ? Codec::Type::None : iter->second;
+}
+
+std::string associative::StoreSettings::getTier(const std::string& contentType, const boost::optional<uint64_t>& size) const
+{
+	if (largeSize && size && *size > largeSize)
+		return largeTier;
+	
+	auto iter = placement.find(contentType);
+	if (iter == placement.end())
+		iter = placement.find(contentType.substr(0, contentType.find('/')) + "/*");
+	if (iter == placement.end())
+		iter = placement.find("*");
+	return iter == placement.end() ? defaultTier : iter->second;
+}
+
+associative::StoreSettings::Durability associative::StoreSettings::parseDurability(const std::string& name)
+{
+	if (name == "none")
+		return Durability::None;
+	else if (name == "commit")
+		return Durability::Commit;
+	else if (name == "group")
+		return Durability::Group;
+	else
+		throw formatException(boost::format("%1% is not a valid durability policy") % name);
+}
+
+std::string associative::StoreSettings::durabilityName(const Durability& durability)
+{
+	switch (durability)
+	{
+		case Durability::None: return "none";
+		case Durability::Commit: return "commit";
+		case Durability::Group: return "group";
+	}
+	throw Exception("internal error: unknown durability policy");
+}
@@ -0,0 +1,108 @@
+#ifndef ASSOCIATIVE_SETTINGS_HPP
+#define ASSOCIATIVE_SETTINGS_HPP
+
+#include "codec.hpp"
+#include "../util/util.hpp"
+
+namespace associative
+{
+	
+	// Settings which are fixed per store (as opposed to per process) and
+	// hence are persisted in the target directory
+	class StoreSettings
+	{
+	private:
+		static po::options_description description();
+		
+	public:
+		enum Durability
+		{
+			// never sync, leave it to the operating system
+			None,
+			// sync every stored blob and each touched directory once
+			Commit,
+			// sync the whole file system once
+			Group
+		};
+		
+		// blobs/<level 1>/.../<level n>/<uuid>/<name>, where each level
+		// consists of the next 'layoutWidth' characters of the UUID
+		unsigned layoutLevels;
+		unsigned layoutWidth;
+		
+		Durability durability;
+		
+		// how to perform file system operations when committing
+		std::string executor;
+		unsigned threads;
+		
+		// codec per content type, the most specific of "type/subtype",
+		// "type/*" and "*" applies
+		std::map<std::string, Codec::Type> compression;
+		int compressionLevel;
+		
+		// blobs up to this size are stored in the database (0: never)
+		uint64_t inlineThreshold;
+		
+		// Decoded copies of encoded, inline and packed blobs are kept in
+		// cache/ up to this total size (0: no limit), the least recently
+		// used ones are evicted first.
+		uint64_t cacheSize;
+		
+		// blobs up to this size are appended to shared packs (0: never),
+		// compaction rewrites packs with at least 'packGarbage' dead data
+		uint64_t packThreshold;
+		uint64_t packSize;
+		double packGarbage;
+		
+		// Orphaned temporary files are collected incrementally, examining
+		// 'gcBatch' entries after each commit (0: only by the gc action),
+		// removing at most 'gcRate' files per second (0: no limit). Files
+		// not belonging to any session have to be 'gcMinAge' seconds old.
+		unsigned gcBatch;
+		unsigned gcRate;
+		unsigned gcMinAge;
+		
+		// Additional storage roots by name, each with blobs/ and temp/ of its
+		// own. The store's directory itself is the default tier. New contents
+		// larger than 'largeSize' go to 'largeTier', otherwise the tier per
+		// content type applies (as for compression). The migrator moves blobs
+		// which haven't been read for 'coldAfter' seconds to 'coldTier'.
+		std::map<std::string, fs::path> tiers;
+		std::map<std::string, std::string> placement;
+		uint64_t largeSize;
+		std::string largeTier;
+		unsigned coldAfter;
+		std::string coldTier;
+		
+		// Whether processes keep the committed metadata in memory, see
+		// TripleCache. Commits log which triples they changed, the last
+		// 'metadataLogSize' commits are kept for caches to catch up.
+		bool metadataCache;
+		unsigned metadataLogSize;
+		
+		// whether commits index the words of text/* blobs up to
+		// 'textIndexMaxSize' bytes for searching, see TextIndex
+		bool textIndex;
+		uint64_t textIndexMaxSize;
+		
+		StoreSettings();
+		
+		void validate() const;
+		
+		static StoreSettings load(const fs::path& root);
+		void save(const fs::path& root) const;
+		
+		Codec::Type getCodec(const std::string& contentType) const;
+		// where to put new contents, 'size' is unknown before committing
+		std::string getTier(const std::string& contentType, const boost::optional<uint64_t>& size) const;
+		
+		static const std::string defaultTier;
+		
+		static Durability parseDurability(const std::string& name);
+		static std::string durabilityName(const Durability& durability);
+	};
+	
+}
+
+#endif
@@ -0,0 +1,307 @@
+extern "C"
+{
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+}
+
+#include <cerrno>
+#include <cstring>
+
+#include "stream.hpp"
+#include "../util/checksum.hpp"
+
+namespace
+{
+	
+	uint64_t fileSize(int fd, const fs::path& path)
+	{
+		struct stat st;
+		if (fstat(fd, &st))
+			throw associative::formatException(boost::format("couldn't stat %1%: %2%") % path % std::strerror(errno));
+		return st.st_size;
+	}
+	
+}
+
+associative::BlobReader::BlobReader(const fs::path& path, std::size_t bufferSize)
+: fd(open(path.c_str(), O_RDONLY)), base(0), length(0), position(0), buffer(bufferSize), bufferOffset(0), bufferLength(0)
+{
+	if (fd < 0)
+	{
+		// a blob which has never been written is empty
+		if (errno == ENOENT)
+			return;
+		throw formatException(boost::format("couldn't open %1%: %2%") % path % std::strerror(errno));
+	}
+	
+	try
+	{
+		length = fileSize(fd, path);
+	}
+	catch (...)
+	{
+		::close(fd);
+		throw;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+associative::BlobReader::BlobReader(const fs::path& path, uint64_t start, uint64_t length, std::size_t bufferSize)
+: fd(open(path.c_str(), O_RDONLY)), base(start), length(length), position(0), buffer(bufferSize), bufferOffset(0), bufferLength(0)
+{
+	if (fd < 0)
+		throw formatException(boost::format("couldn't open %1%: %2%") % path % std::strerror(errno));
+}
+
+associative::BlobReader::BlobReader(const std::string& content)
+: fd(-1), base(0), length(content.size()), position(0), buffer(content.begin(), content.end()), bufferOffset(0), bufferLength(content.size())
+{
+}
+
+associative::BlobReader::~BlobReader()
+{
+	if (fd >= 0)
+		::close(fd);
+}
+
+uint64_t associative::BlobReader::size() const
+{
+	return length;
+}
+
+uint64_t associative::BlobReader::tell() const
+{
+	return position;
+}
+
+void associative::BlobReader::seek(uint64_t offset)
+{
+	position = offset;
+}
+
+std::size_t associative::BlobReader::read(char* data, std::size_t count)
+{
+	std::size_t done = 0;
+	while (done < count && position < length)
+	{
+		if (position < bufferOffset || position >= bufferOffset + bufferLength)
+		{
+			// large reads don't profit from the buffer
+			if (count - done >= buffer.size())
+			{
+				auto ret = pread(data + done, count - done, position);
+				position += ret;
+				return done + ret;
+			}
+			
+			bufferOffset = position;
+			bufferLength = pread(buffer.data(), buffer.size(), position);
+			if (!bufferLength)
+				break;
+		}
+		
+		auto available = std::min<uint64_t>(count - done, bufferOffset + bufferLength - position);
+		std::memcpy(data + done, buffer.data() + (position - bufferOffset), available);
+		done += available;
+		position += available;
+	}
+	return done;
+}
+
+std::size_t associative::BlobReader::pread(char* data, std::size_t count, uint64_t offset) const
+{
+	if (fd < 0)
+	{
+		// everything there is has been buffered already
+		if (offset >= bufferLength)
+			return 0;
+		count = std::min<uint64_t>(count, bufferLength - offset);
+		std::memcpy(data, buffer.data() + offset, count);
+		return count;
+	}
+	
+	// never read beyond the range
+	if (offset >= length)
+		return 0;
+	count = std::min<uint64_t>(count, length - offset);
+	
+	std::size_t done = 0;
+	while (done < count)
+	{
+		auto ret = ::pread(fd, data + done, count - done, base + offset + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			throw formatException(boost::format("couldn't read blob: %1%") % std::strerror(errno));
+		if (!ret)
+			break;
+		done += ret;
+	}
+	return done;
+}
+
+associative::WriteExtent::WriteExtent()
+: begin(0), end(0), size(0), checksum()
+{
+}
+
+bool associative::WriteExtent::isEmpty() const
+{
+	return begin == end;
+}
+
+associative::BlobWriter::BlobWriter(const fs::path& path, const Mode& mode, const WriteExtent& previous, const Callback& onClose, std::size_t bufferSize)
+: fd(open(path.c_str(), O_WRONLY | O_CREAT | (mode == Mode::Truncate ? O_TRUNC : 0), 0666)), position(0), bufferOffset(0), onClose(onClose)
+{
+	if (fd < 0)
+		throw formatException(boost::format("couldn't open %1%: %2%") % path % std::strerror(errno));
+	buffer.reserve(bufferSize);
+	
+	try
+	{
+		extent.size = fileSize(fd, path);
+	}
+	catch (...)
+	{
+		::close(fd);
+		throw;
+	}
+	
+	// the checksum of the existing contents is only known if they haven't
+	// been changed behind our back
+	if (mode == Mode::Truncate)
+		extent.checksum = 0;
+	else if (previous.checksum && previous.size == extent.size)
+		extent.checksum = previous.checksum;
+	
+	if (mode == Mode::Append)
+		position = extent.size;
+	extent.begin = extent.end = position;
+}
+
+associative::BlobWriter::~BlobWriter()
+{
+	try
+	{
+		close();
+	}
+	catch (...)
+	{
+	}
+}
+
+uint64_t associative::BlobWriter::size() const
+{
+	return extent.size;
+}
+
+uint64_t associative::BlobWriter::tell() const
+{
+	return position;
+}
+
+void associative::BlobWriter::seek(uint64_t offset)
+{
+	position = offset;
+}
+
+void associative::BlobWriter::account(const char* data, std::size_t count, uint64_t offset)
+{
+	if (!count)
+		return;
+	
+	// a running checksum survives appending only
+	if (extent.checksum && offset == extent.size)
+		extent.checksum = crc32c(*extent.checksum, data, count);
+	else
+		extent.checksum = boost::none;
+	
+	if (extent.isEmpty())
+	{
+		extent.begin = offset;
+		extent.end = offset + count;
+	}
+	else
+	{
+		extent.begin = std::min(extent.begin, offset);
+		extent.end = std::max(extent.end, offset + count);
+	}
+	extent.size = std::max(extent.size, offset + count);
+}
+
+void associative::BlobWriter::writeThrough(const char* data, std::size_t count, uint64_t offset)
+{
+	std::size_t done = 0;
+	while (done < count)
+	{
+		auto ret = ::pwrite(fd, data + done, count - done, offset + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			throw formatException(boost::format("couldn't write blob: %1%") % std::strerror(errno));
+		done += ret;
+	}
+}
+
+void associative::BlobWriter::write(const char* data, std::size_t count)
+{
+	if (fd < 0)
+		throw Exception("writer has been closed");
+	
+	account(data, count, position);
+	
+	if (!buffer.empty() && position != bufferOffset + buffer.size())
+		flush();
+	
+	if (count >= buffer.capacity())
+	{
+		flush();
+		writeThrough(data, count, position);
+	}
+	else
+	{
+		if (buffer.empty())
+			bufferOffset = position;
+		if (buffer.size() + count > buffer.capacity())
+		{
+			flush();
+			bufferOffset = position;
+		}
+		buffer.insert(buffer.end(), data, data + count);
+	}
+	position += count;
+}
+
+void associative::BlobWriter::pwrite(const char* data, std::size_t count, uint64_t offset)
+{
+	if (fd < 0)
+		throw Exception("writer has been closed");
+	
+	account(data, count, offset);
+	flush();
+	writeThrough(data, count, offset);
+}
+
+void associative::BlobWriter::flush()
+{
+	if (buffer.empty())
+		return;
+	writeThrough(buffer.data(), buffer.size(), bufferOffset);
+	buffer.clear();
+}
+
+void associative::BlobWriter::close()
+{
+	if (fd < 0)
+		return;
+	
+	flush();
+	int ret = ::close(fd);
+	fd = -1;
+	if (ret)
+		throw formatException(boost::format("couldn't close blob: %1%") % std::strerror(errno));
+	
+	if (onClose)
+		onClose(extent);
+}
@@ -0,0 +1,117 @@
+#ifndef ASSOCIATIVE_STREAM_HPP
+#define ASSOCIATIVE_STREAM_HPP
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include "../util/util.hpp"
+
+namespace associative
+{
+	
+	// buffered sequential and positional reads of a blob's contents
+	class BlobReader
+	{
+	private:
+		int fd;
+		// where the contents start within the file
+		uint64_t base;
+		uint64_t length;
+		uint64_t position;
+		std::vector<char> buffer;
+		uint64_t bufferOffset;
+		std::size_t bufferLength;
+		
+	public:
+		BlobReader(const fs::path& path, std::size_t bufferSize = 65536);
+		// a range within a larger file, which has to exist
+		BlobReader(const fs::path& path, uint64_t start, uint64_t length, std::size_t bufferSize = 65536);
+		// contents which are in memory already
+		BlobReader(const std::string& content);
+		
+		BlobReader(BlobReader&) = delete;
+		BlobReader& operator=(BlobReader&) = delete;
+		
+		~BlobReader();
+		
+		uint64_t size() const;
+		uint64_t tell() const;
+		void seek(uint64_t offset);
+		
+		// reads up to 'count' bytes at the current position, returns 0 at the end
+		std::size_t read(char* data, std::size_t count);
+		
+		// reads up to 'count' bytes at 'offset' without moving the position
+		std::size_t pread(char* data, std::size_t count, uint64_t offset) const;
+	};
+	
+	// The range of a blob's contents written through one BlobWriter. The
+	// checksum covers the whole contents and is known as long as the writer
+	// started from known contents and only ever appended.
+	struct WriteExtent
+	{
+		uint64_t begin;
+		uint64_t end;
+		uint64_t size;
+		boost::optional<uint32_t> checksum;
+		
+		WriteExtent();
+		
+		bool isEmpty() const;
+	};
+	
+	class BlobWriter
+	{
+	public:
+		enum Mode
+		{
+			// start with empty contents
+			Truncate,
+			// keep the current contents and start writing at their end
+			Append,
+			// keep the current contents and start writing at their beginning
+			Update
+		};
+		
+		typedef boost::function<void (const WriteExtent&)> Callback;
+		
+	private:
+		int fd;
+		uint64_t position;
+		std::vector<char> buffer;
+		uint64_t bufferOffset;
+		WriteExtent extent;
+		Callback onClose;
+		
+		void account(const char* data, std::size_t count, uint64_t offset);
+		void writeThrough(const char* data, std::size_t count, uint64_t offset);
+		
+	public:
+		// 'previous' is the extent recorded for the current contents, if any
+		BlobWriter(const fs::path& path, const Mode& mode, const WriteExtent& previous, const Callback& onClose, std::size_t bufferSize = 65536);
+		
+		BlobWriter(BlobWriter&) = delete;
+		BlobWriter& operator=(BlobWriter&) = delete;
+		
+		~BlobWriter();
+		
+		uint64_t size() const;
+		uint64_t tell() const;
+		void seek(uint64_t offset);
+		
+		// writes at the current position
+		void write(const char* data, std::size_t count);
+		
+		// writes at 'offset' without moving the position
+		void pwrite(const char* data, std::size_t count, uint64_t offset);
+		
+		void flush();
+		
+		// flushes and reports the written extent, implied by destruction
+		void close();
+	};
+	
+}
+
+#endif
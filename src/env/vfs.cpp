@@ -1,16 +1,114 @@
+extern "C"
+{
+	#include <fcntl.h>
+	#include <sys/stat.h>
+}
+
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unordered_set>
+
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/functional.hpp>
 #include <boost/lambda/construct.hpp>
 
 #include "vfs.hpp"
 #include "../util/io.hpp"
+#include "../util/checksum.hpp"
+
+namespace
+{
+	
+	struct Encoding
+	{
+		fs::path src;
+		// encoded resp. plain contents in the temporary directory of the
+		// tier the blob goes to, unless it's the one of 'src' already
+		fs::path dest;
+		fs::path staged;
+		std::string tier;
+		associative::Codec::Type type;
+		bool encoded;
+		// set if stored in the database instead
+		boost::optional<std::string> content;
+		// set if appended to a pack instead
+		bool packed;
+		// of the contents as written, known already if written by a BlobWriter
+		boost::optional<uint32_t> checksum;
+		uint64_t size;
+		// the words of text blobs, if to be indexed
+		bool indexed;
+		boost::optional<associative::TextIndex::Document> document;
+		
+		Encoding(const fs::path& src, const fs::path& destPath, const std::string& tier, const associative::Codec::Type& type)
+		: src(src), dest(destPath / (src.filename().string() + ".z")),
+		  staged(destPath == src.parent_path() ? fs::path() : destPath / src.filename()),
+		  tier(tier), type(type), encoded(false), packed(false), size(0), indexed(false)
+		{
+		}
+	};
+	
+	bool isUUID(const std::string& str)
+	{
+		if (str.size() != 36)
+			return false;
+		try
+		{
+			boost::lexical_cast<boost::uuids::uuid>(str);
+			return true;
+		}
+		catch (const boost::bad_lexical_cast&)
+		{
+			return false;
+		}
+	}
+	
+	// removes shard directories below 'dir' which don't contain any blob
+	// directory (any more), returns whether 'dir' itself is empty afterwards
+	bool pruneShards(const fs::path& dir)
+	{
+		bool empty = true;
+		std::list<fs::path> prunable;
+		for (fs::directory_iterator iter(dir), end; iter != end; ++iter)
+		{
+			if (!fs::is_directory(iter->status()) || isUUID(iter->path().filename().string()) || !pruneShards(iter->path()))
+				empty = false;
+			else
+				prunable.push_back(iter->path());
+		}
+		associative::forEach(prunable, [](const fs::path& path) { fs::remove(path); });
+		return empty;
+	}
+	
+	std::map<std::string, associative::VFS::Tier> makeTiers(const fs::path& tempPath, const fs::path& blobPath, const associative::StoreSettings& settings)
+	{
+		std::map<std::string, associative::VFS::Tier> tiers;
+		associative::VFS::Tier tier = { associative::StoreSettings::defaultTier, tempPath, blobPath };
+		tiers[tier.name] = tier;
+		for (auto iter = settings.tiers.begin(); iter != settings.tiers.end(); ++iter)
+		{
+			associative::VFS::Tier tier = { iter->first, iter->second / "temp", iter->second / "blobs" };
+			tiers[tier.name] = tier;
+		}
+		return tiers;
+	}
+	
+}
 
 associative::VFS::Operation::~Operation()
 {
 }
 
-associative::VFS::Move::Move(const fs::path& src, const fs::path& dest, const boost::optional<fs::path>& destTemp)
-: src(src), dest(dest), destTemp(destTemp)
+void associative::VFS::Operation::addDirectories(std::set<fs::path>&) const
+{
+}
+
+associative::VFS::Move::Move(const fs::path& src, const fs::path& dest, bool exchange)
+: exchange(exchange), backedUp(false), moved(false), src(src), dest(dest),
+  // the temporary file is unique already, so is anything derived from it
+  backup(exchange ? src : fs::path(src.string() + ".old"))
 {
 }
 
@@ -18,29 +116,85 @@ associative::VFS::Move::~Move()
 {
 }
 
-void associative::VFS::Move::apply()
+const fs::path& associative::VFS::Move::getTarget() const
+{
+	return dest;
+}
+
+void associative::VFS::Move::addDirectories(std::set<fs::path>& directories) const
 {
-	if (destTemp)
-		fs::rename(dest, *destTemp);
-	fs::create_directories(dest.parent_path());
-	fs::rename(src, dest);
+	directories.insert(dest.parent_path());
+}
+
+boost::optional<associative::FileRequest> associative::VFS::Move::apply(unsigned step)
+{
+	switch (step)
+	{
+		// rather than checking whether there is an old version, just try
+		case 0:
+			if (exchange)
+				return FileRequest(FileRequest::Type::Exchange, src, dest);
+			return FileRequest(FileRequest::Type::Rename, dest, backup);
+		case 1:
+			if (moved)
+				return boost::none;
+			return FileRequest(FileRequest::Type::Rename, src, dest);
+		default:
+			return boost::none;
+	}
+}
+
+void associative::VFS::Move::applied(unsigned step, const FileRequest& request)
+{
+	if (step == 0 && request.result == -ENOENT)
+		return;
+	if (request.result)
+		request.throwError();
+	
+	if (step == 0)
+		backedUp = true;
+	if (step == 1 || exchange)
+		moved = true;
 }
 
 void associative::VFS::Move::unapply()
 {
-	fs::rename(dest, src);
-	if (destTemp)
-		fs::rename(*destTemp, dest);
+	if (exchange && backedUp)
+	{
+		FileRequest request(FileRequest::Type::Exchange, dest, src);
+		request.perform();
+		if (request.result)
+			request.throwError();
+		moved = backedUp = false;
+		return;
+	}
+	
+	if (moved)
+		fs::rename(dest, src);
+	moved = false;
+	if (backedUp)
+		fs::rename(backup, dest);
+	backedUp = false;
 }
 
-void associative::VFS::Move::finish()
+boost::optional<associative::FileRequest> associative::VFS::Move::finish()
 {
-	if (destTemp)
-		fs::remove(*destTemp);
+	if (backedUp)
+		return FileRequest(FileRequest::Type::Unlink, backup);
+	return boost::none;
+}
+
+void associative::VFS::Move::addSyncTargets(std::set<fs::path>& files, std::list<fs::path>& paths) const
+{
+	files.insert(dest);
+	paths.push_back(dest);
+	paths.push_back(src);
+	if (backedUp)
+		paths.push_back(backup);
 }
 
 associative::VFS::Remove::Remove(const fs::path& target, const fs::path& backup)
-: target(target), backup(backup)
+: removed(false), target(target), backup(backup)
 {
 }
 
@@ -48,55 +202,378 @@ associative::VFS::Remove::~Remove()
 {
 }
 
-void associative::VFS::Remove::apply()
+const fs::path& associative::VFS::Remove::getTarget() const
+{
+	return target;
+}
+
+boost::optional<associative::FileRequest> associative::VFS::Remove::apply(unsigned step)
+{
+	if (step == 0)
+		return FileRequest(FileRequest::Type::Rename, target, backup);
+	return boost::none;
+}
+
+void associative::VFS::Remove::applied(unsigned, const FileRequest& request)
 {
-	fs::create_directories(backup.parent_path());
-	if (fs::exists(target))
-		fs::rename(target, backup);
+	// a blob which has never been written does not exist
+	if (request.result == -ENOENT)
+		return;
+	if (request.result)
+		request.throwError();
+	removed = true;
 }
 
 void associative::VFS::Remove::unapply()
 {
-	if (fs::exists(backup))
+	if (removed)
 		fs::rename(backup, target);
+	removed = false;
+}
+
+boost::optional<associative::FileRequest> associative::VFS::Remove::finish()
+{
+	if (removed)
+		return FileRequest(FileRequest::Type::Unlink, backup);
+	return boost::none;
+}
+
+void associative::VFS::Remove::addSyncTargets(std::set<fs::path>&, std::list<fs::path>& paths) const
+{
+	if (!removed)
+		return;
+	paths.push_back(target);
+	paths.push_back(backup);
 }
 
-void associative::VFS::Remove::finish()
+associative::VFS::Transaction::Transaction(VFS* const parent, uint64_t sessionID)
+: parent(parent), sessionID(sessionID)
 {
-	if (fs::exists(backup))
-		fs::remove(backup);
 }
 
-associative::VFS::Transaction::Transaction(VFS* const parent)
-: parent(parent)
+associative::VFS::Transaction::~Transaction()
 {
+	forEach(operations, lambda::delete_ptr());
 }
 
 void associative::VFS::Transaction::move(const fs::path& src, const fs::path& dest)
 {
-	auto m = new Move(src, dest, fs::exists(dest) ? boost::make_optional(parent->tempPath / parent->getTempPath(dest.filename().string())) : boost::none);
-	operations.push_back(m);
-	m->apply();
+	operations.push_back(new Move(src, dest, parent->exchange));
 }
 
-void associative::VFS::Transaction::remove(const fs::path& target)
+void associative::VFS::Transaction::remove(const fs::path& target, const std::string& tier)
 {
-	auto r = new Remove(target, parent->tempPath / parent->getTempPath(target.filename().string()));
-	operations.push_back(r);
-	r->apply();
+	operations.push_back(new Remove(target, parent->getTier(tier).tempPath / parent->getTempPath(sessionID, target.filename().string())));
+}
+
+void associative::VFS::Transaction::execute()
+{
+	// Operations on the same path have to be applied in journal order, all
+	// others are independent of each other. Hence, split them into batches
+	// with at most one operation per path.
+	std::vector<std::vector<Operation*> > batches;
+	std::map<fs::path, std::size_t> nextBatch;
+	for (auto iter = operations.begin(); iter != operations.end(); ++iter)
+	{
+		auto& index = nextBatch[(*iter)->getTarget()];
+		if (index == batches.size())
+			batches.push_back(std::vector<Operation*>());
+		batches[index++].push_back(*iter);
+	}
+	
+	for (auto batch = batches.begin(); batch != batches.end(); ++batch)
+	{
+		makeDirectories(*batch);
+		
+		for (unsigned step = 0; ; ++step)
+		{
+			std::vector<FileRequest> requests;
+			std::vector<Operation*> issuers;
+			for (auto iter = batch->begin(); iter != batch->end(); ++iter)
+			{
+				auto request = (*iter)->apply(step);
+				if (request)
+				{
+					requests.push_back(*request);
+					issuers.push_back(*iter);
+				}
+			}
+			
+			if (requests.empty())
+				break;
+			
+			parent->executor->execute(requests);
+			
+			// record all outcomes before failing, so that a rollback knows
+			// exactly what has been applied
+			std::exception_ptr error;
+			for (std::size_t i = 0; i < requests.size(); ++i)
+			{
+				try
+				{
+					issuers[i]->applied(step, requests[i]);
+				}
+				catch (const Exception&)
+				{
+					if (!error)
+						error = std::current_exception();
+				}
+			}
+			if (error)
+				std::rethrow_exception(error);
+		}
+	}
+}
+
+void associative::VFS::Transaction::makeDirectories(const std::vector<Operation*>& batch)
+{
+	std::set<fs::path> directories;
+	for (auto iter = batch.begin(); iter != batch.end(); ++iter)
+		(*iter)->addDirectories(directories);
+	
+	// parents first, but all directories of the same depth at once
+	std::map<std::size_t, std::set<fs::path> > levels;
+	for (auto iter = directories.begin(); iter != directories.end(); ++iter)
+		for (auto dir = *iter; !dir.empty() && !parent->isTierDirectory(dir); dir = dir.parent_path())
+			levels[std::distance(dir.begin(), dir.end())].insert(dir);
+	
+	for (auto level = levels.begin(); level != levels.end(); ++level)
+	{
+		std::vector<FileRequest> requests;
+		for (auto iter = level->second.begin(); iter != level->second.end(); ++iter)
+			requests.push_back(FileRequest(FileRequest::Type::MakeDirectory, *iter));
+		
+		parent->executor->execute(requests);
+		
+		for (auto iter = requests.begin(); iter != requests.end(); ++iter)
+			if (iter->result && iter->result != -EEXIST)
+				iter->throwError();
+	}
+}
+
+void associative::VFS::Transaction::addSyncDirectories(std::set<fs::path>& directories, const fs::path& path) const
+{
+	// Newly created directories need their parent synced as well, hence
+	// take all ancestors below the root (there are only a few per blob and
+	// they are shared between blobs).
+	for (auto dir = path.parent_path(); !dir.empty(); dir = dir.parent_path())
+	{
+		directories.insert(dir);
+		if (parent->isTierDirectory(dir))
+			break;
+	}
+}
+
+void associative::VFS::Transaction::sync()
+{
+	std::set<fs::path> files;
+	std::set<fs::path> directories;
+	std::list<fs::path> paths;
+	
+	switch (parent->settings.durability)
+	{
+		case StoreSettings::Durability::None:
+			break;
+		case StoreSettings::Durability::Commit:
+			forEach(operations, [&](Operation* operation) { operation->addSyncTargets(files, paths); });
+			forEach(appenders, [&](const boost::shared_ptr<PackStore::Appender>& appender) {
+				files.insert(appender->getPath());
+				// a new pack needs its directory entry as well
+				if (appender->isCreated())
+					directories.insert(appender->getPath().parent_path());
+			});
+			forEach(paths, [&](const fs::path& path) { this->addSyncDirectories(directories, path); });
+			// concurrent requests give the device a chance to merge them
+			parallelForEach(files, &syncFile);
+			forEach(directories, &syncDirectory);
+			break;
+		case StoreSettings::Durability::Group:
+		{
+			// once for each file system written to, tiers may be on others
+			// than the root (which has the packs)
+			std::set<fs::path> roots;
+			roots.insert(parent->root);
+			forEach(operations, [&](Operation* operation) { operation->addSyncTargets(files, paths); });
+			for (auto iter = paths.begin(); iter != paths.end(); ++iter)
+				for (auto dir = iter->parent_path(); !dir.empty(); dir = dir.parent_path())
+					if (parent->isTierDirectory(dir))
+					{
+						roots.insert(dir);
+						break;
+					}
+			
+			std::set<dev_t> devices;
+			for (auto iter = roots.begin(); iter != roots.end(); ++iter)
+			{
+				struct stat status;
+				if (stat(iter->c_str(), &status))
+					throw formatException(boost::format("couldn't stat %1%: %2%") % *iter % std::strerror(errno));
+				if (devices.insert(status.st_dev).second)
+					syncFileSystem(*iter);
+			}
+			break;
+		}
+	}
+}
+
+void associative::VFS::Transaction::updateDatabase(Connection& conn)
+{
+	// drop previous inline contents and pack ranges of everything stored, no
+	// matter where to
+	auto stmt = conn.prepareStatement(
+		"delete from blob_content where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.inline.delete"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	stmt = conn.prepareStatement(
+		"delete from blob_pack where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.pack.delete"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	stmt = conn.prepareStatement(
+		"delete from blob_checksum where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.checksum.delete"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	stmt = conn.prepareStatement("insert into blob_checksum values (?, ?, ?)", std::string("vfs.checksum.insert"));
+	for (auto iter = checksums.begin(); iter != checksums.end(); ++iter)
+		stmt->execute(convertAll(iter->blobID, iter->size, iter->crc));
+	
+	stmt = conn.prepareStatement(
+		"delete from blob_tier where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.tier.delete"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	// new contents haven't been read yet, the time they are written applies
+	stmt = conn.prepareStatement(
+		"delete from blob_access where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.access.delete-stored"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	// the default tier is implied
+	stmt = conn.prepareStatement("insert into blob_tier values (?, ?)", std::string("vfs.tier.insert"));
+	for (auto iter = placed.begin(); iter != placed.end(); ++iter)
+		if (iter->second != StoreSettings::defaultTier)
+			stmt->execute(convertAll(iter->first, iter->second));
+	
+	stmt = conn.prepareStatement(
+		"delete from blob_codec where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.codec.delete"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	stmt = conn.prepareStatement("insert into blob_codec values (?, ?)", std::string("vfs.codec.insert"));
+	for (auto iter = encoded.begin(); iter != encoded.end(); ++iter)
+		stmt->execute(convertAll(iter->first, Codec::name(iter->second)));
+	
+	// the words of text blobs are indexed anew, whatever they were before
+	stmt = conn.prepareStatement(
+		"delete from text_posting where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.search.postings.delete"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	stmt = conn.prepareStatement(
+		"delete from text_document where blob_id in ("
+		"  select relation_id from journal "
+		"  where session_id = ? and relation = ? and operation = ?"
+		")",
+	std::string("vfs.search.documents.delete"));
+	stmt->execute(convertAll(sessionID, Connection::Relation::Blob, Blob::Operation::Store));
+	
+	// a blob stored more than once within the session counts once
+	std::unordered_set<uint64_t> documents;
+	for (auto iter = indexed.rbegin(); iter != indexed.rend(); ++iter)
+		if (documents.insert(iter->first).second)
+			TextIndex::add(conn, iter->first, iter->second);
+	
+	stmt = conn.prepareStatement("insert into blob_content values (?, ?)", std::string("vfs.inline.insert"));
+	for (auto iter = inlined.begin(); iter != inlined.end(); ++iter)
+		stmt->execute(convertAll(iter->first, iter->second));
+	
+	stmt = conn.prepareStatement("insert into blob_pack values (?, ?, ?, ?)", std::string("vfs.pack.insert"));
+	for (auto iter = packed.begin(); iter != packed.end(); ++iter)
+		stmt->execute(convertAll(iter->first, iter->second.pack, iter->second.start, iter->second.length));
+	forEach(appenders, [&conn](const boost::shared_ptr<PackStore::Appender>& appender) { appender->updateDatabase(conn); });
 }
 
 void associative::VFS::Transaction::finish()
 {
-	forEach(operations, boost::mem_fun(&Operation::finish));
-	forEach(operations, lambda::delete_ptr());
+	std::vector<FileRequest> requests;
+	for (auto iter = operations.begin(); iter != operations.end(); ++iter)
+	{
+		auto request = (*iter)->finish();
+		if (request)
+			requests.push_back(*request);
+	}
+	for (auto iter = obsolete.begin(); iter != obsolete.end(); ++iter)
+		requests.push_back(FileRequest(FileRequest::Type::Unlink, *iter));
+	parent->executor->execute(requests);
+	
+	// The transaction has been committed already, so a leftover backup is
+	// merely a waste of space.
+	for (auto iter = requests.begin(); iter != requests.end(); ++iter)
+		if (iter->result)
+			parent->logger->warn() << "couldn't remove backup " << iter->path.string() << ": " << std::strerror(-iter->result);
+	
 	parent->modified.clear();
+	parent->extents.clear();
+	parent->mappings.clear();
 	parent->transaction.reset(); // self-destruction, beep bopp
 }
 
 void associative::VFS::Transaction::rollback()
 {
-	forEach(operations, boost::mem_fun(&Operation::unapply));
+	for (auto iter = operations.rbegin(); iter != operations.rend(); ++iter)
+	{
+		try
+		{
+			(*iter)->unapply();
+		}
+		catch (const std::exception& ex)
+		{
+			parent->logger->error() << "couldn't undo operation on " << (*iter)->getTarget().string() << ": " << ex.what();
+		}
+	}
+	
+	// the session still has its plain temporary files
+	boost::system::error_code error;
+	for (auto iter = artifacts.begin(); iter != artifacts.end(); ++iter)
+		fs::remove(*iter, error);
+	
+	for (auto iter = appenders.begin(); iter != appenders.end(); ++iter)
+	{
+		try
+		{
+			(*iter)->rollback();
+		}
+		catch (const std::exception& ex)
+		{
+			// the database doesn't refer to the tail, so it's just wasted
+			parent->logger->error() << ex.what();
+		}
+	}
+	
+	parent->transaction.reset();
 }
 
 associative::WeakPtr<associative::VFS::Transaction> associative::VFS::apply(Environment& env)
@@ -104,99 +581,1074 @@ associative::WeakPtr<associative::VFS::Transaction> associative::VFS::apply(Envi
 	if (!env.getSessionID())
 		throw Exception("not in a session");
 	
-	transaction = boost::shared_ptr<Transaction>(new Transaction(this));
+	transaction = boost::shared_ptr<Transaction>(new Transaction(this, *env.getSessionID()));
 	
 	auto& conn = env.getConnection();
 	auto query = conn.prepareQuery(
-		"select journal.id, journal.operation, journal.target, file.uuid, blob.name from journal "
+		"select journal.id, journal.operation, journal.target, file.uuid, blob.name, content_type.mime, journal.relation_id, blob_tier.tier from journal "
 		"inner join `blob` on blob.id = journal.relation_id "
 		"inner join file on file.id = blob.file_id "
+		"inner join content_type on content_type.id = blob.content_type_id "
+		"left join blob_tier on blob_tier.blob_id = blob.id "
 		"where journal.session_id = ? and journal.relation = ? and journal.operation in (?, ?) and journal.executed = 0 "
 		"order by journal.id asc",
 	std::string("vfs.journal.select"));
 	
 	auto result = query->execute(convertAll(*env.getSessionID(), Connection::Relation::Blob, Blob::Operation::Store, Blob::Operation::Remove));
 	
-	auto stmt = conn.prepareStatement("update journal set executed = 1 where id = ?");
+	// Tiny blobs go to the database and small ones to a pack instead,
+	// everything else is compressed first resp. copied to its tier (blobs
+	// are independent of each other). The session's own temporary files
+	// stay untouched until finishing.
+	std::vector<Encoding> encodings;
+	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+	{
+		if ((*iter)[1] != toString(Blob::Operation::Store))
+			continue;
+		
+		auto src = getTempFile((*iter)[2]);
+		boost::system::error_code error;
+		auto size = fs::file_size(src, error);
+		auto tier = settings.getTier((*iter)[5], error ? boost::none : boost::make_optional(size));
+		Encoding encoding(src, getTier(tier).tempPath, tier, settings.getCodec((*iter)[5]));
+		if (settings.inlineThreshold && !error && size <= settings.inlineThreshold)
+		{
+			std::ostringstream content;
+			readFile(encoding.src, content);
+			encoding.content = content.str();
+		}
+		else if (settings.packThreshold && !error && size <= settings.packThreshold)
+		{
+			encoding.packed = true;
+		}
+		encoding.indexed = settings.textIndex && TextIndex::isIndexed((*iter)[5]) && !error && size <= settings.textIndexMaxSize;
+		
+		// writers keep track of the checksum as long as they only append
+		auto extent = extents.find(Blob::Identifier(boost::lexical_cast<boost::uuids::uuid>((*iter)[3]), (*iter)[4]));
+		if (!error && extent != extents.end() && extent->second.checksum && extent->second.size == size)
+		{
+			encoding.checksum = extent->second.checksum;
+			encoding.size = size;
+		}
+		encodings.push_back(encoding);
+	}
 	
+	try
+	{
+		parallelForEach(encodings, [this](Encoding& encoding) {
+			if (!encoding.checksum && encoding.content)
+			{
+				encoding.checksum = crc32c(0, encoding.content->data(), encoding.content->size());
+				encoding.size = encoding.content->size();
+			}
+			else if (!encoding.checksum && fs::exists(encoding.src))
+			{
+				ChecksumBuffer buffer;
+				std::ostream stream(&buffer);
+				readFile(encoding.src, stream);
+				encoding.checksum = buffer.checksum();
+				encoding.size = buffer.size();
+			}
+			
+			// the words are taken from the plain contents as well
+			if (encoding.indexed && encoding.content)
+			{
+				TextIndex::Tokenizer tokenizer;
+				tokenizer.add(encoding.content->data(), encoding.content->size());
+				encoding.document = tokenizer.finish();
+			}
+			else if (encoding.indexed)
+			{
+				encoding.document = TextIndex::tokenize(encoding.src);
+			}
+			
+			if (!encoding.content && !encoding.packed)
+				encoding.encoded = Codec::encode(encoding.src, encoding.dest, encoding.type, settings.compressionLevel);
+			if (!encoding.content && !encoding.packed && !encoding.encoded && !encoding.staged.empty() && fs::exists(encoding.src))
+				cloneFile(encoding.src, encoding.staged);
+		}, settings.threads ? settings.threads : defaultThreadCount());
+	}
+	catch (...)
+	{
+		forEach(encodings, [](const Encoding& encoding) {
+			fs::remove(encoding.dest);
+			if (!encoding.staged.empty())
+				fs::remove(encoding.staged);
+		});
+		transaction.reset();
+		throw;
+	}
+	
+	try
+	{
+		auto encoding = encodings.begin();
+		for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		{
+			auto current = (*iter)[7].empty() ? StoreSettings::defaultTier : (*iter)[7];
+			auto path = getBlobDirectory(current, (*iter)[3]) / (*iter)[4];
+			if ((*iter)[1] == toString(Blob::Operation::Store))
+			{
+				auto blobID = boost::lexical_cast<uint64_t>((*iter)[6]);
+				auto dest = getBlobDirectory(encoding->tier, (*iter)[3]) / (*iter)[4];
+				if (encoding->content || encoding->packed || dest != path)
+				{
+					// a previous version might have been a file elsewhere
+					transaction->remove(path, current);
+				}
+				if (!encoding->content && !encoding->packed)
+					transaction->placed.push_back(std::make_pair(blobID, encoding->tier));
+				
+				if (encoding->checksum)
+				{
+					Transaction::Checksum checksum = { blobID, encoding->size, *encoding->checksum };
+					transaction->checksums.push_back(checksum);
+				}
+				if (encoding->document)
+					transaction->indexed.push_back(std::make_pair(blobID, *encoding->document));
+				
+				if (encoding->content)
+				{
+					transaction->inlined.push_back(std::make_pair(blobID, *encoding->content));
+					transaction->obsolete.push_back(encoding->src);
+				}
+				else if (encoding->packed)
+				{
+					// a large commit fills more than one pack
+					auto& appenders = transaction->appenders;
+					if (appenders.empty())
+						appenders.push_back(packs.append(conn, settings.packSize));
+					else if (appenders.back()->getSize() >= settings.packSize)
+						appenders.push_back(packs.create(conn));
+					transaction->packed.push_back(std::make_pair(blobID, appenders.back()->append(encoding->src)));
+					transaction->obsolete.push_back(encoding->src);
+				}
+				else if (encoding->encoded)
+				{
+					transaction->encoded.push_back(std::make_pair(blobID, encoding->type));
+					transaction->move(encoding->dest, dest);
+					transaction->obsolete.push_back(encoding->src);
+					transaction->artifacts.push_back(encoding->dest);
+				}
+				else if (!encoding->staged.empty())
+				{
+					transaction->move(encoding->staged, dest);
+					transaction->obsolete.push_back(encoding->src);
+					transaction->artifacts.push_back(encoding->staged);
+				}
+				else
+				{
+					transaction->move(encoding->src, dest);
+				}
+				++encoding;
+			}
+			else if ((*iter)[1] == toString(Blob::Operation::Remove))
+			{
+				transaction->remove(path, current);
+			}
+		}
+		
+		transaction->execute();
+	}
+	catch (...)
+	{
+		transaction->rollback();
+		throw;
+	}
+	
+	auto stmt = conn.prepareStatement(
+		"update journal set executed = 1 "
+		"where session_id = ? and relation = ? and operation in (?, ?) and executed = 0",
+	std::string("vfs.journal.executed"));
+	stmt->execute(convertAll(*env.getSessionID(), Connection::Relation::Blob, Blob::Operation::Store, Blob::Operation::Remove));
+	
+	return transaction;
+}
+
+void associative::VFS::discard(Environment& env)
+{
+	if (!env.getSessionID())
+		throw Exception("not in a session");
+	
+	auto query = env.getConnection().prepareQuery(
+		"select target from journal "
+		"where session_id = ? and relation = ? and operation = ? and target is not null",
+	std::string("vfs.journal.discard"));
+	auto result = query->execute(convertAll(*env.getSessionID(), Connection::Relation::Blob, Blob::Operation::Store));
+	
+	// mappings keep their contents, no matter whether the file is gone
+	boost::system::error_code error;
 	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		fs::remove(getTempFile(iter->at(0)), error);
+	
+	modified.clear();
+	extents.clear();
+	mappings.clear();
+}
+
+void associative::VFS::collectIncrementally(Environment& env)
+{
+	if (!settings.gcBatch)
+		return;
+	
+	// the session has been committed already, so don't fail it
+	try
 	{
-		auto path = blobPath / (*iter)[3] / (*iter)[4];
-		if ((*iter)[1] == toString(Blob::Operation::Store))
-			transaction->move(tempPath / (*iter)[2], path);
-		else if ((*iter)[1] == toString(Blob::Operation::Remove))
-			transaction->remove(path);
-		stmt->execute(convertAll((*iter)[0]));
+		GarbageCollector::Statistics statistics = { 0, 0 };
+		collector.collect(env.getConnection(), settings.gcBatch, settings.gcRate, settings.gcMinAge, statistics);
 	}
+	catch (const std::exception& ex)
+	{
+		logger->warn() << "collecting garbage failed: " << ex.what();
+	}
+}
 
-	return transaction;
+fs::path associative::VFS::getTempPath(uint64_t sessionID, const std::string& seed)
+{
+	// The session ID is unique across all processes sharing the database
+	// (and, unlike the PID, survives crashes), and the counter is unique
+	// within this process. Hence, no lock and no probing is needed.
+	return fs::path((boost::format("%1%-%2%-%3%-%4%") % sessionID % process->pid % tempCounter++ % seed).str());
+}
+
+fs::path associative::VFS::getTempFile(const std::string& target) const
+{
+	auto colon = target.find(':');
+	if (colon == std::string::npos)
+		return tempPath / target;
+	return getTier(target.substr(0, colon)).tempPath / target.substr(colon + 1);
+}
+
+std::string associative::VFS::getTempTarget(const std::string& tier, const fs::path& name) const
+{
+	return tier == StoreSettings::defaultTier ? name.string() : tier + ":" + name.string();
 }
 
-fs::path associative::VFS::getTempPath(const std::string& seed)
+const associative::VFS::Tier& associative::VFS::getTier(const std::string& name) const
 {
-	auto handle = process->getFileLock()->timedLockOrThrow();
+	auto iter = tiers.find(name);
+	if (iter == tiers.end())
+		throw formatException(boost::format("unknown tier %1%") % name);
+	return iter->second;
+}
+
+std::vector<fs::path> associative::VFS::getTempDirectories() const
+{
+	std::vector<fs::path> directories;
+	for (auto iter = tiers.begin(); iter != tiers.end(); ++iter)
+		directories.push_back(iter->second.tempPath);
+	return directories;
+}
+
+bool associative::VFS::isTierDirectory(const fs::path& dir) const
+{
+	for (auto iter = tiers.begin(); iter != tiers.end(); ++iter)
+		if (dir == iter->second.blobPath || dir == iter->second.tempPath)
+			return true;
+	return false;
+}
+
+std::string associative::VFS::getBlobTier(Environment& env, Blob& blob)
+{
+	auto query = env.getConnection().prepareQuery("select tier from blob_tier where blob_id = ?", std::string("vfs.tier.select"));
+	auto result = query->execute(convertAll(blob.getID()));
+	return result.rows.empty() ? StoreSettings::defaultTier : result.rows.front().at(0);
+}
+
+void associative::VFS::recordAccess(Environment& env, Blob& blob)
+{
+	if (!settings.coldAfter)
+		return;
+	auto now = time(nullptr);
+	auto iter = accessed.find(blob.getID());
+	if (iter != accessed.end() && now - iter->second < settings.coldAfter / 16)
+		return;
+	// forgetting only means recording again
+	if (accessed.size() >= 65536)
+		accessed.clear();
+	accessed[blob.getID()] = now;
 	
-	fs::path prefix(root / "temp");
-	fs::create_directory(prefix);
-	for (int i = 0; i < std::numeric_limits<int>::max(); ++i)
+	auto& conn = env.getConnection();
+	try
 	{
-		fs::path candidate(seed + toString(i));
-		if (!fs::exists(prefix / candidate))
-			return candidate;
+		auto t = conn.transaction();
+		auto stmt = conn.prepareStatement("delete from blob_access where blob_id = ?", std::string("vfs.access.delete"));
+		stmt->execute(convertAll(blob.getID()));
+		stmt = conn.prepareStatement("insert into blob_access values (?, ?)", std::string("vfs.access.insert"));
+		stmt->execute(convertAll(blob.getID(), now));
+		t->commit();
 	}
-	throw formatException(boost::format("VFS %1% couldn't allocate temporary file") % root.string());
+	catch (DBException& ex)
+	{
+		// e. g. recorded by another process in the meantime, not worth failing the read
+		logger->warn() << "couldn't record reading blob " << blob.getID() << ": " << ex.what();
+	}
+}
+
+associative::Codec::Type associative::VFS::getBlobCodec(Environment& env, Blob& blob)
+{
+	auto query = env.getConnection().prepareQuery("select codec from blob_codec where blob_id = ?", std::string("vfs.codec.select"));
+	auto result = query->execute(convertAll(blob.getID()));
+	return result.rows.empty() ? Codec::Type::None : Codec::parse(result.rows.front().at(0));
+}
+
+fs::path associative::VFS::getBlobDirectory(const std::string& tier, const std::string& uuid, const StoreSettings& layout) const
+{
+	auto dir = getTier(tier).blobPath;
+	for (unsigned i = 0; i < layout.layoutLevels; ++i)
+		dir /= uuid.substr(i * layout.layoutWidth, layout.layoutWidth);
+	return dir / uuid;
+}
+
+fs::path associative::VFS::getBlobDirectory(const std::string& tier, const std::string& uuid) const
+{
+	return getBlobDirectory(tier, uuid, settings);
 }
 
-fs::path associative::VFS::getBlobPath(Environment& env, Blob& blob, bool write)
+fs::path associative::VFS::getBlobPath(Environment& env, Blob& blob, bool write, bool keep)
 {	
 	Blob::Identifier pair(blob.getFile().uuid, blob.name);
+	
+	// raw writes are out of sight
+	if (write)
+		extents.erase(pair);
+	
 	if (containsKey(modified, pair))
 	{
 		// we don't care about writing here, because it's already a new destination
-		return tempPath / modified[pair];
+		auto temp = modified[pair];
+		auto file = getTempFile(temp);
+		if (write && isMapped(file))
+		{
+			// Someone still reads the current contents, so write to a copy
+			// (in the same tier) instead of changing them underneath.
+			auto name = getTempPath(*env.getSessionID(), boost::lexical_cast<std::string>(blob.getFile().uuid));
+			auto copy = temp.substr(0, temp.find(':') + 1) + name.string();
+			if (keep)
+				cloneFile(file, getTempFile(copy));
+			
+			auto& conn = env.getConnection();
+			auto stmt = conn.prepareStatement(
+				"update journal set target = ? "
+				"where session_id = ? and relation = ? and relation_id = ? and operation = ? and target = ?",
+			std::string("vfs.journal.retarget"));
+			stmt->execute(convertAll(copy, *env.getSessionID(), Connection::Relation::Blob, blob.getID(), Blob::Operation::Store, temp));
+			
+			// the mapping keeps the old contents alive
+			fs::remove(file);
+			mappings.erase(file);
+			modified[pair] = temp = copy;
+			file = getTempFile(temp);
+		}
+		return file;
 	}
 	else
 	{
 		auto& conn = env.getConnection();
 		
-		auto path = fs::path(toString(blob.getFile().uuid)) / blob.name;
-		bool exists = fs::exists(blobPath / path);
-		if (!exists || write)
+		auto path = getBlobDirectory(getBlobTier(env, blob), toString(blob.getFile().uuid)) / blob.name;
+		bool exists = fs::exists(path);
+		auto content = exists ? boost::none : getInlineContent(env, blob);
+		auto location = exists || content ? boost::none : packs.find(conn, blob.getID());
+		if ((!exists && !content && !location) || write)
 		{
 			if (!env.getSessionID())
 				throw Exception("not in a session");
 			
 			// if not exists, we know that we have a new file (even if caller doesn't intend to write)
-			// if caller intends to write, we have to copy the old contents
+			// if caller intends to write, we have to copy the old contents (unless they are replaced anyway)
 			
-			// in any case, create a temporary storage first
-			auto temp = getTempPath(boost::lexical_cast<std::string>(blob.getFile().uuid));
+			// in any case, create a temporary storage first, in the tier the
+			// contents will most likely go to (their size is yet unknown)
+			auto tier = settings.getTier(blob.contentType, boost::none);
+			auto name = getTempPath(*env.getSessionID(), boost::lexical_cast<std::string>(blob.getFile().uuid));
+			auto temp = getTempTarget(tier, name);
+			auto file = getTier(tier).tempPath / name;
 			modified[pair] = temp;
 			
-			if (write && exists)
+			if (write && content && keep)
+			{
+				std::istringstream stream(*content);
+				storeFile(file, stream);
+			}
+			else if (write && location && keep)
+			{
+				readPacked(env, blob, *location, [&](const PackStore::Location& location) {
+					packs.extract(location, file);
+					return true;
+				});
+			}
+			else if (write && exists && keep)
 			{
-				std::ifstream in((blobPath / path).c_str(), std::ios_base::binary);
-				std::ofstream out((tempPath / temp).c_str(), std::ios_base::binary);
-				copyStreams(in, out);
+				if (getBlobCodec(env, blob) != Codec::Type::None)
+					Codec::decode(path, file);
+				else
+					cloneFile(path, file);
 			}
 			
 			auto t = conn.transaction();
 			auto stmt = conn.prepareStatement("insert into journal values (?, ?, ?, ?, ?, ?, 0)", std::string("vfs.journal.move"));
-			
-			// TODO temp instead of temp.c_str() somehow produces quotes
-			stmt->execute(convertAll(conn.nextID("journal"), *env.getSessionID(), Connection::Relation::Blob, blob.getID(), Blob::Operation::Store, temp.c_str()));
+			stmt->execute(convertAll(conn.nextID("journal"), *env.getSessionID(), Connection::Relation::Blob, blob.getID(), Blob::Operation::Store, temp));
 			t->commit();
 			
-			return tempPath / temp;
+			return file;
+		}
+		else if (content)
+		{
+			return materialize(blob.getID(), *content);
 		}
-		else
+		else if (location)
 		{
-			return blobPath / path;
+			return materialize(env, blob, *location);
 		}
+		
+		recordAccess(env, blob);
+		if (getBlobCodec(env, blob) != Codec::Type::None)
+			return materialize(path);
+		return path;
 	}
 }
 
+boost::optional<std::string> associative::VFS::getInlineContent(Environment& env, Blob& blob)
+{
+	auto query = env.getConnection().prepareQuery("select content from blob_content where blob_id = ?", std::string("vfs.inline.select"));
+	auto result = query->execute(convertAll(blob.getID()));
+	if (result.rows.empty())
+		return boost::none;
+	return result.rows.begin()->at(0);
+}
+
+fs::path associative::VFS::materialize(uint64_t blobID, const std::string& content)
+{
+	// Inline contents are never changed, only replaced. Hence, name the copy
+	// after the contents.
+	auto cached = cachePath / (boost::format("inline-%1%-%2$08x-%3%") % blobID % crc32c(0, content.data(), content.size()) % content.size()).str();
+	if (!isCached(cached))
+	{
+		auto temp = cachePath / getTempPath(0, cached.filename().string());
+		std::istringstream stream(content);
+		storeFile(temp, stream);
+		fs::rename(temp, cached);
+		evictCached(cached);
+	}
+	return cached;
+}
+
+fs::path associative::VFS::materialize(const fs::path& path)
+{
+	// The decoded copy is named after the exact version of the file, hence
+	// it never has to be invalidated and may be shared between processes.
+	auto version = [&path]() {
+		struct stat st;
+		if (stat(path.c_str(), &st))
+			throw formatException(boost::format("couldn't stat %1%: %2%") % path % std::strerror(errno));
+		return (boost::format("%1%-%2%-%3%.%4%") % st.st_dev % st.st_ino % st.st_mtim.tv_sec % st.st_mtim.tv_nsec).str();
+	};
+	
+	for (;;)
+	{
+		auto name = version();
+		auto cached = cachePath / name;
+		if (isCached(cached))
+			return cached;
+		
+		auto temp = cachePath / getTempPath(0, name);
+		try
+		{
+			Codec::decode(path, temp);
+		}
+		catch (...)
+		{
+			fs::remove(temp);
+			throw;
+		}
+		
+		// another session might have committed meanwhile, decode once more
+		if (version() != name)
+		{
+			fs::remove(temp);
+			continue;
+		}
+		fs::rename(temp, cached);
+		evictCached(cached);
+		return cached;
+	}
+}
+
+fs::path associative::VFS::materialize(Environment& env, Blob& blob, const PackStore::Location& location)
+{
+	return readPacked(env, blob, location, [this](const PackStore::Location& location) {
+		// ranges of packs are never changed, and compaction picks new pack IDs
+		auto cached = cachePath / (boost::format("pack-%1%-%2%-%3%") % location.pack % location.start % location.length).str();
+		if (!isCached(cached))
+		{
+			auto temp = cachePath / getTempPath(0, cached.filename().string());
+			try
+			{
+				packs.extract(location, temp);
+			}
+			catch (...)
+			{
+				fs::remove(temp);
+				throw;
+			}
+			fs::rename(temp, cached);
+			evictCached(cached);
+		}
+		return cached;
+	});
+}
+
+bool associative::VFS::isCached(const fs::path& cached) const
+{
+	// the modification time tells when a copy has been used last
+	return !utimensat(AT_FDCWD, cached.c_str(), nullptr, 0);
+}
+
+void associative::VFS::evictCached(const fs::path& added)
+{
+	if (!settings.cacheSize)
+		return;
+	
+	// Copies used within the minimum age stay, another process might be
+	// about to open them. So do scratch files (session ID 0, see
+	// getTempPath), they are still being written.
+	std::multimap<std::time_t, std::pair<fs::path, uint64_t> > evictable;
+	uint64_t size = 0;
+	for (fs::directory_iterator iter(cachePath), end; iter != end; ++iter)
+	{
+		struct stat st;
+		auto name = iter->path().filename().string();
+		if (lstat(iter->path().c_str(), &st) || !S_ISREG(st.st_mode))
+			continue;
+		size += st.st_size;
+		if (iter->path() != added && (name.compare(0, 2, "0-") || std::count(name.begin(), name.end(), '-') < 3) &&
+			time(nullptr) - st.st_mtime >= (std::time_t) settings.gcMinAge)
+			evictable.insert(std::make_pair(st.st_mtime, std::make_pair(iter->path(), st.st_size)));
+	}
+	
+	// least recently used first, readers which opened a copy keep it alive
+	for (auto iter = evictable.begin(); iter != evictable.end() && size > settings.cacheSize; ++iter)
+	{
+		boost::system::error_code error;
+		fs::remove(iter->second.first, error);
+		if (!error)
+			size -= iter->second.second;
+	}
+}
+
+template<typename Function>
+auto associative::VFS::readPacked(Environment& env, Blob& blob, PackStore::Location location, const Function& function) -> decltype(function(location))
+{
+	for (;;)
+	{
+		try
+		{
+			return function(location);
+		}
+		catch (const Exception&)
+		{
+			auto current = packs.find(env.getConnection(), blob.getID());
+			if (!current || (current->pack == location.pack && current->start == location.start))
+				throw;
+			location = *current;
+		}
+	}
+}
+
+bool associative::VFS::isStoredElsewhere(Environment& env, Blob& blob)
+{
+	return !containsKey(modified, Blob::Identifier(blob.getFile().uuid, blob.name)) &&
+		!fs::exists(getBlobDirectory(getBlobTier(env, blob), toString(blob.getFile().uuid)) / blob.name);
+}
+
+boost::shared_ptr<associative::BlobReader> associative::VFS::openRead(Environment& env, Blob& blob)
+{
+	// inline and packed contents don't need a file of their own
+	if (isStoredElsewhere(env, blob))
+	{
+		auto content = getInlineContent(env, blob);
+		if (content)
+			return boost::shared_ptr<BlobReader>(new BlobReader(*content));
+		
+		auto location = packs.find(env.getConnection(), blob.getID());
+		if (location)
+			return readPacked(env, blob, *location, [this](const PackStore::Location& location) {
+				return boost::shared_ptr<BlobReader>(new BlobReader(packs.getPackPath(location.pack), location.start, location.length));
+			});
+	}
+	return boost::shared_ptr<BlobReader>(new BlobReader(getBlobPath(env, blob)));
+}
+
+boost::shared_ptr<associative::BlobWriter> associative::VFS::openWrite(Environment& env, Blob& blob, const BlobWriter::Mode& mode)
+{
+	Blob::Identifier pair(blob.getFile().uuid, blob.name);
+	WriteExtent previous;
+	if (containsKey(extents, pair))
+		previous = extents[pair];
+	
+	auto path = getBlobPath(env, blob, true, mode != BlobWriter::Mode::Truncate);
+	auto temp = modified[pair];
+	
+	return boost::shared_ptr<BlobWriter>(new BlobWriter(path, mode, previous, [this, pair, temp](const WriteExtent& extent) {
+		// the session might have ended or moved on to another copy meanwhile
+		if (!containsKey(modified, pair) || modified[pair] != temp)
+			return;
+		
+		auto& recorded = extents[pair];
+		if (!recorded.isEmpty() && !extent.isEmpty())
+		{
+			recorded.begin = std::min(recorded.begin, extent.begin);
+			recorded.end = std::max(recorded.end, extent.end);
+		}
+		else if (!extent.isEmpty())
+		{
+			recorded.begin = extent.begin;
+			recorded.end = extent.end;
+		}
+		recorded.size = extent.size;
+		recorded.checksum = extent.checksum;
+	}));
+}
+
+std::atomic<uint64_t> associative::VFS::tempCounter(0);
+
 associative::VFS::VFS(const fs::path& root, const boost::shared_ptr<Process>& process, const boost::shared_ptr<Logger>& logger)
-: root(root), tempPath(root / "temp"), blobPath(root / "blobs"), transaction(), process(process), logger(logger)
+: root(root), tempPath(root / "temp"), blobPath(root / "blobs"), cachePath(root / "cache"), settings(StoreSettings::load(root)),
+  tiers(makeTiers(tempPath, blobPath, settings)), packs(root / "packs", logger), collector(getTempDirectories(), cachePath, [this](const fs::path& path) { return isMapped(path); }, logger),
+  transaction(), process(process), logger(logger),
+  executor(Executor::create(settings.executor, settings.threads ? settings.threads : defaultThreadCount())),
+  layoutVersion(process->getCounter("layout"))
+{
+	for (auto iter = tiers.begin(); iter != tiers.end(); ++iter)
+	{
+		fs::create_directories(iter->second.tempPath);
+		fs::create_directories(iter->second.blobPath);
+	}
+	fs::create_directories(cachePath);
+	
+	// exchanging is only used if all tiers support it
+	exchange = true;
+	for (auto iter = tiers.begin(); iter != tiers.end() && exchange; ++iter)
+		exchange = supportsExchange(iter->second);
+}
+
+bool associative::VFS::supportsExchange(const Tier& tier)
+{
+	// Whether swapping works depends on the file system (and kernel), so
+	// just try it on two scratch files.
+	auto a = tier.tempPath / getTempPath(0, "exchange");
+	auto b = tier.tempPath / getTempPath(0, "exchange");
+	createEmptyFile(a);
+	createEmptyFile(b);
+	
+	FileRequest request(FileRequest::Type::Exchange, a, b);
+	request.perform();
+	
+	fs::remove(a);
+	fs::remove(b);
+	
+	if (request.result == -EINVAL || request.result == -ENOSYS || request.result == -EOPNOTSUPP)
+	{
+		logger->info() << "file system doesn't support exchanging files, falling back to backups";
+		return false;
+	}
+	if (request.result)
+		request.throwError();
+	return true;
+}
+
+boost::shared_ptr<const associative::Mapping> associative::VFS::map(Environment& env, Blob& blob, const Mapping::Advice& advice)
+{
+	if (isStoredElsewhere(env, blob))
+	{
+		auto content = getInlineContent(env, blob);
+		if (content)
+			return boost::shared_ptr<const Mapping>(new Mapping(*content));
+		
+		auto location = packs.find(env.getConnection(), blob.getID());
+		if (location)
+		{
+			auto mapping = readPacked(env, blob, *location, [this](const PackStore::Location& location) {
+				return boost::shared_ptr<const Mapping>(new Mapping(packs.getPackPath(location.pack), location.start, location.length));
+			});
+			mapping->advise(advice);
+			return mapping;
+		}
+	}
+	
+	auto path = getBlobPath(env, blob);
+	
+	boost::shared_ptr<const Mapping> mapping;
+	auto iter = mappings.find(path);
+	if (iter != mappings.end())
+		mapping = iter->second.lock();
+	
+	// another session might have replaced the blob in the meantime
+	if (!mapping || !mapping->isCurrent())
+	{
+		mapping.reset(new Mapping(path));
+		mappings[path] = mapping;
+	}
+	
+	mapping->advise(advice);
+	return mapping;
+}
+
+void associative::VFS::copyTo(Environment& env, Blob& blob, std::ostream& out)
+{
+	// the session's own contents are plain, others can be mapped as they are
+	if (!containsKey(modified, Blob::Identifier(blob.getFile().uuid, blob.name)) && getBlobCodec(env, blob) != Codec::Type::None)
+	{
+		auto path = getBlobDirectory(getBlobTier(env, blob), toString(blob.getFile().uuid)) / blob.name;
+		if (fs::exists(path))
+		{
+			recordAccess(env, blob);
+			Codec::decode(path, out);
+			return;
+		}
+	}
+	
+	auto mapping = map(env, blob, Mapping::Advice::Sequential);
+	out.write(mapping->data(), mapping->size());
+}
+
+bool associative::VFS::isMapped(const fs::path& path) const
+{
+	auto iter = mappings.find(path);
+	return iter != mappings.end() && !iter->second.expired();
+}
+
+unsigned associative::VFS::compactPacks(Environment& env, double garbage)
 {
+	// compaction changes where packed blobs live, commits are kept out only
+	// while it does so
+	auto count = packs.compact(env.getConnection(), garbage, settings.packSize, [this]() -> boost::shared_ptr<HandleBase> {
+		return process->getMemLock("session")->timedLockOrThrow();
+	});
+	logger->info() << "compacted " << count << " packs";
+	return count;
+}
+
+associative::GarbageCollector::Statistics associative::VFS::collectGarbage(Environment& env, unsigned rate, unsigned minAge)
+{
+	GarbageCollector::Statistics statistics = { 0, 0 };
+	
+	// finish the pass in progress first, its snapshot might be outdated
+	if (collector.isRunning())
+		collector.collect(env.getConnection(), 0, rate, minAge, statistics);
+	collector.collect(env.getConnection(), 0, rate, minAge, statistics);
+	statistics.removed += removeLeftovers(env.getConnection(), minAge);
+	
+	logger->info() << "examined " << statistics.examined << " temporary files, removed " << statistics.removed;
+	return statistics;
+}
+
+uint64_t associative::VFS::removeLeftovers(Connection& conn, unsigned minAge)
+{
+	auto query = conn.prepareQuery("select id, tier, uuid, name from blob_leftover where moved <= ?", std::string("vfs.leftover.select"));
+	auto leftovers = query->execute(convertAll(time(nullptr) - minAge)).rows;
+	if (leftovers.empty())
+		return 0;
+	
+	// the blob might have been stored or migrated back to where the copy is
+	auto handle = process->getMemLock("session")->timedLockOrThrow();
+	auto tierQuery = conn.prepareQuery(
+		"select blob_tier.tier from `blob` "
+		"inner join file on file.id = blob.file_id "
+		"left join blob_tier on blob_tier.blob_id = blob.id "
+		"where file.uuid = ? and blob.name = ? and blob.visible = 1",
+	std::string("vfs.leftover.tier"));
+	auto stmt = conn.prepareStatement("delete from blob_leftover where id = ?", std::string("vfs.leftover.delete"));
+	uint64_t removed = 0;
+	for (auto iter = leftovers.begin(); iter != leftovers.end(); ++iter)
+	{
+		auto& row = *iter;
+		auto current = tierQuery->execute(convertAll(row[2], row[3]));
+		bool used = false;
+		for (auto tier = current.rows.begin(); tier != current.rows.end(); ++tier)
+			used |= (tier->at(0).empty() ? StoreSettings::defaultTier : tier->at(0)) == row[1];
+		if (!used && containsKey(tiers, row[1]) && fs::remove(getBlobDirectory(row[1], row[2]) / row[3]))
+			++removed;
+		stmt->execute(convertAll(row[0]));
+	}
+	return removed;
+}
+
+uint64_t associative::VFS::migrate(Environment& env, unsigned threads, uint64_t rate)
+{
+	struct Migration
+	{
+		uint64_t blobID;
+		std::string uuid;
+		std::string name;
+		std::string from;
+		std::string to;
+		fs::path src;
+		fs::path dest;
+		fs::path temp;
+		struct stat status;
+	};
+	
+	auto& conn = env.getConnection();
+	auto maxQuery = conn.prepareQuery("select max(id) from `blob`", std::string("vfs.migrate.max"));
+	auto maxResult = maxQuery->execute(convertAll());
+	if (maxResult.rows.empty() || maxResult.rows.front()[0].empty())
+		return 0;
+	auto maxID = boost::lexical_cast<uint64_t>(maxResult.rows.front()[0]);
+	
+	auto query = conn.prepareQuery(
+		"select blob.id, file.uuid, blob.name, content_type.mime, blob_tier.tier, blob_checksum.size, blob_access.accessed from `blob` "
+		"inner join file on file.id = blob.file_id "
+		"inner join content_type on content_type.id = blob.content_type_id "
+		"left join blob_tier on blob_tier.blob_id = blob.id "
+		"left join blob_checksum on blob_checksum.blob_id = blob.id "
+		"left join blob_access on blob_access.blob_id = blob.id "
+		"where blob.visible = 1 and blob.id >= ? and blob.id < ? "
+		"and not exists (select * from blob_content where blob_content.blob_id = blob.id) "
+		"and not exists (select * from blob_pack where blob_pack.blob_id = blob.id)",
+	std::string("vfs.migrate.blobs"));
+	
+	RateLimiter limiter(rate);
+	uint64_t migrated = 0;
+	static const uint64_t chunkSize = 1024;
+	for (uint64_t from = 0; from <= maxID; from += chunkSize)
+	{
+		auto result = query->execute(convertAll(from, from + chunkSize));
+		std::vector<Migration> migrations;
+		for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		{
+			auto& row = *iter;
+			Migration migration;
+			migration.blobID = boost::lexical_cast<uint64_t>(row[0]);
+			migration.uuid = row[1];
+			migration.name = row[2];
+			migration.from = row[4].empty() ? StoreSettings::defaultTier : row[4];
+			if (!containsKey(tiers, migration.from))
+				continue;
+			migration.src = getBlobDirectory(migration.from, row[1]) / row[2];
+			if (stat(migration.src.c_str(), &migration.status))
+				continue;
+			
+			// blobs not read since they have been stored go by when that was,
+			// which migrating keeps as the modification time
+			auto size = row[5].empty() ? static_cast<uint64_t>(migration.status.st_size) : boost::lexical_cast<uint64_t>(row[5]);
+			auto used = row[6].empty() ? migration.status.st_mtime : boost::lexical_cast<time_t>(row[6]);
+			if (settings.coldAfter && time(nullptr) - used >= settings.coldAfter)
+				migration.to = settings.coldTier;
+			else
+				migration.to = settings.getTier(row[3], size);
+			if (migration.to == migration.from)
+				continue;
+			
+			migration.dest = getBlobDirectory(migration.to, row[1]) / row[2];
+			migration.temp = getTier(migration.to).tempPath / getTempPath(0, "migrate");
+			migrations.push_back(migration);
+		}
+		if (migrations.empty())
+			continue;
+		
+		// copying takes long and happens outside of the lock, the copies are
+		// scratch files until renamed
+		parallelForEach(migrations, [&](Migration& migration) {
+			limiter.acquire(migration.status.st_size);
+			cloneFile(migration.src, migration.temp);
+			
+			timespec times[2] = { migration.status.st_atim, migration.status.st_mtim };
+			if (utimensat(AT_FDCWD, migration.temp.c_str(), times, 0))
+				throw formatException(boost::format("couldn't set times of %1%: %2%") % migration.temp % std::strerror(errno));
+			if (settings.durability != StoreSettings::Durability::None)
+				syncFile(migration.temp);
+		}, threads);
+		
+		auto handle = process->getMemLock("session")->timedLockOrThrow();
+		auto tierQuery = conn.prepareQuery("select tier from blob_tier where blob_id = ?", std::string("vfs.tier.select"));
+		for (auto iter = migrations.begin(); iter != migrations.end(); ++iter)
+		{
+			// skip blobs which have been changed or moved meanwhile
+			struct stat status;
+			auto current = tierQuery->execute(convertAll(iter->blobID));
+			if (stat(iter->src.c_str(), &status) || status.st_ino != iter->status.st_ino || status.st_size != iter->status.st_size ||
+				status.st_mtim.tv_sec != iter->status.st_mtim.tv_sec || status.st_mtim.tv_nsec != iter->status.st_mtim.tv_nsec ||
+				(current.rows.empty() ? StoreSettings::defaultTier : current.rows.front()[0]) != iter->from)
+			{
+				fs::remove(iter->temp);
+				continue;
+			}
+			
+			fs::create_directories(iter->dest.parent_path());
+			fs::rename(iter->temp, iter->dest);
+			if (settings.durability != StoreSettings::Durability::None)
+				syncDirectory(iter->dest.parent_path());
+			
+			try
+			{
+				auto t = conn.transaction();
+				auto stmt = conn.prepareStatement("delete from blob_tier where blob_id = ?", std::string("vfs.migrate.delete"));
+				stmt->execute(convertAll(iter->blobID));
+				if (iter->to != StoreSettings::defaultTier)
+				{
+					stmt = conn.prepareStatement("insert into blob_tier values (?, ?)", std::string("vfs.tier.insert"));
+					stmt->execute(convertAll(iter->blobID, iter->to));
+				}
+				stmt = conn.prepareStatement("insert into blob_leftover values (?, ?, ?, ?, ?)", std::string("vfs.leftover.insert"));
+				stmt->execute(convertAll(conn.nextID("blob_leftover"), iter->from, iter->uuid, iter->name, time(nullptr)));
+				t->commit();
+			}
+			catch (...)
+			{
+				fs::remove(iter->dest);
+				throw;
+			}
+			
+			// readers which found the old file before may still open it
+			++migrated;
+		}
+	}
+	
+	logger->info() << "migrated " << migrated << " blobs";
+	return migrated;
+}
+
+uint64_t associative::VFS::reindex(Environment& env)
+{
+	if (!settings.textIndex)
+		throw Exception("text blobs aren't indexed, see search.index");
+	
+	// A batch at a time, with commits kept out meanwhile, so that they
+	// don't index a blob anew in between reading and indexing it.
+	static const uint64_t batchSize = 64;
+	auto& conn = env.getConnection();
+	auto query = conn.prepareQuery(
+		"select blob.id, file.uuid, blob.name from `blob` "
+		"inner join file on file.id = blob.file_id "
+		"inner join content_type on content_type.id = blob.content_type_id "
+		"where blob.visible = 1 and content_type.mime like 'text/%' and blob.id >= ? "
+		"order by blob.id limit " + toString(batchSize),
+	std::string("vfs.reindex.blobs"));
+	
+	std::vector<char> buffer(65536);
+	uint64_t indexed = 0;
+	for (uint64_t from = 0; ; )
+	{
+		auto handle = process->getMemLock("session")->timedLockOrThrow();
+		auto result = query->execute(convertAll(from));
+		for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		{
+			auto blobID = boost::lexical_cast<uint64_t>(iter->at(0));
+			from = blobID + 1;
+			
+			// Those without contents (metadata only) would be created by
+			// reading them. Those too large are read no further, and not
+			// indexed (as when committing).
+			auto file = env.getFile(iter->at(1));
+			auto blob = file->getBlob(iter->at(2));
+			bool empty = isStoredElsewhere(env, *blob) && !getInlineContent(env, *blob) && !packs.find(conn, blobID);
+			TextIndex::Tokenizer tokenizer;
+			uint64_t size = 0;
+			std::size_t count;
+			auto reader = empty ? boost::shared_ptr<BlobReader>() : blob->openRead();
+			while (reader && size <= settings.textIndexMaxSize && (count = reader->read(buffer.data(), buffer.size())))
+			{
+				tokenizer.add(buffer.data(), count);
+				size += count;
+			}
+			
+			auto t = conn.transaction();
+			TextIndex::remove(conn, blobID);
+			if (!empty && size <= settings.textIndexMaxSize)
+			{
+				TextIndex::add(conn, blobID, tokenizer.finish());
+				++indexed;
+			}
+			t->commit();
+		}
+		if (result.rows.size() < batchSize)
+			break;
+	}
+	
+	logger->info() << "indexed " << indexed << " text blobs";
+	return indexed;
+}
+
+const associative::StoreSettings& associative::VFS::getSettings() const
+{
+	return settings;
+}
+
+void associative::VFS::updateLayout()
+{
+	// the settings might have been loaded before a reshard bumped the
+	// version, hence load them once more at first
+	auto version = layoutVersion->load();
+	if (layout && *layout == version)
+		return;
+	
+	auto current = StoreSettings::load(root);
+	settings.layoutLevels = current.layoutLevels;
+	settings.layoutWidth = current.layoutWidth;
+	layout = version;
+}
+
+void associative::VFS::reshard(Environment& env, unsigned levels, unsigned width, unsigned threads)
+{
+	// Commits move files into blobs/, so keep them out while reorganizing.
+	// Open sessions would keep looking for blobs in the old layout (and
+	// take those they don't find for new ones), new sessions start with
+	// the new layout.
+	auto handle = process->getMemLock("session")->timedLockOrThrow();
+	// New sessions wait for the new layout, and those started so far are
+	// counted below.
+	auto reshardHandle = process->getMemLock("reshard")->timedLockOrThrow();
+	// The caller's own session (the action runs in one) moves its files with
+	// the new layout on commit.
+	auto& conn = env.getConnection();
+	auto own = env.getSessionID();
+	auto result = own
+		? conn.prepareQuery("select count(*) from session where id <> ?", std::string("vfs.reshard.sessions.others"))->execute(convertAll(*own))
+		: conn.prepareQuery("select count(*) from session", std::string("vfs.reshard.sessions"))->execute(convertAll());
+	auto sessions = result.rows.front().at(0);
+	if (sessions != "0")
+		throw formatException(boost::format("can't reshard while %1% other sessions are open") % sessions);
+	updateLayout();
+	
+	StoreSettings target(settings);
+	target.layoutLevels = levels;
+	target.layoutWidth = width;
+	target.validate();
+	
+	// Collect the blob directories regardless of the depth they are currently
+	// at. That way, an interrupted run can simply be restarted.
+	std::list<std::pair<std::string, fs::path> > dirs;
+	for (auto tier = tiers.begin(); tier != tiers.end(); ++tier)
+		if (fs::exists(tier->second.blobPath))
+			for (fs::recursive_directory_iterator iter(tier->second.blobPath), end; iter != end; ++iter)
+				if (fs::is_directory(iter->status()) && isUUID(iter->path().filename().string()))
+				{
+					dirs.push_back(std::make_pair(tier->first, iter->path()));
+					iter.no_push();
+				}
+	
+	logger->info() << "resharding " << dirs.size() << " blob directories to " << levels << "x" << width;
+	
+	parallelForEach(dirs, [&](const std::pair<std::string, fs::path>& dir) {
+		auto dest = this->getBlobDirectory(dir.first, dir.second.filename().string(), target);
+		if (dest == dir.second)
+			return;
+		fs::create_directories(dest.parent_path());
+		fs::rename(dir.second, dest);
+	}, threads);
+	
+	// other processes might have changed the rest of the settings since
+	// these have been loaded
+	auto stored = StoreSettings::load(root);
+	stored.layoutLevels = levels;
+	stored.layoutWidth = width;
+	stored.save(root);
+	settings.layoutLevels = levels;
+	settings.layoutWidth = width;
+	layout = ++*layoutVersion;
+	
+	for (auto tier = tiers.begin(); tier != tiers.end(); ++tier)
+		if (fs::exists(tier->second.blobPath))
+			pruneShards(tier->second.blobPath);
 }
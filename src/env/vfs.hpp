@@ -2,10 +2,20 @@
 #define ASSOCIATIVE_VFS_HPP
 
 #include <deque>
+#include <unordered_map>
+#include <atomic>
 
 #include "environment.hpp"
 #include "process.hpp"
+#include "settings.hpp"
+#include "executor.hpp"
+#include "mapping.hpp"
+#include "stream.hpp"
+#include "pack.hpp"
+#include "gc.hpp"
+#include "search.hpp"
 #include "../util/util.hpp"
+#include "../util/threads.hpp"
 #include "../objects/blob.hpp"
 #include "../db/connection.hpp"
 
@@ -13,11 +23,13 @@ namespace associative
 {
 	
 	class Blob;
+	class Scrubber;
 	
 	class VFS
 	{
 		friend class Environment;
 		friend class Blob;
+		friend class Scrubber;
 		
 	public:
 		class Operation
@@ -25,29 +37,60 @@ namespace associative
 		public:
 			virtual ~Operation();
 			
-			virtual void apply() = 0;
+			// the path this operation modifies, operations on the same path
+			// are never applied concurrently
+			virtual const fs::path& getTarget() const = 0;
+			
+			// directories which have to exist before applying
+			virtual void addDirectories(std::set<fs::path>& directories) const;
+			
+			// Applying happens in steps of at most one request each. A step
+			// starts only after the previous step has been performed for all
+			// operations of a batch. 'applied' records the outcome and throws
+			// if the request failed.
+			virtual boost::optional<FileRequest> apply(unsigned step) = 0;
+			virtual void applied(unsigned step, const FileRequest& request) = 0;
+			
+			// undoes whatever has been applied so far
 			virtual void unapply() = 0;
-			virtual void finish() = 0;
+			virtual boost::optional<FileRequest> finish() = 0;
+			
+			// files whose contents resp. paths whose directory entries changed
+			virtual void addSyncTargets(std::set<fs::path>& files, std::list<fs::path>& paths) const = 0;
 		};
 		
+		// Replaces 'dest' by 'src'. If supported, both are exchanged in one
+		// step, leaving the old version at 'src' as backup.
 		class Move : public Operation
 		{
+		private:
+			const bool exchange;
+			bool backedUp;
+			bool moved;
+			
 		public:
 			const fs::path src;
 			const fs::path dest;
-			const boost::optional<fs::path> destTemp;
+			const fs::path backup;
 			
-			Move(const fs::path& src, const fs::path& dest, const boost::optional<fs::path>& destTemp);
+			Move(const fs::path& src, const fs::path& dest, bool exchange);
 			
 			virtual ~Move();
 			
-			virtual void apply();
+			virtual const fs::path& getTarget() const;
+			virtual void addDirectories(std::set<fs::path>& directories) const;
+			virtual boost::optional<FileRequest> apply(unsigned step);
+			virtual void applied(unsigned step, const FileRequest& request);
 			virtual void unapply();
-			virtual void finish();
+			virtual boost::optional<FileRequest> finish();
+			virtual void addSyncTargets(std::set<fs::path>& files, std::list<fs::path>& paths) const;
 		};
 		
 		class Remove : public Operation
 		{
+		private:
+			bool removed;
+			
 		public:
 			const fs::path target;
 			const fs::path backup;
@@ -56,9 +99,21 @@ namespace associative
 			
 			virtual ~Remove();
 			
-			virtual void apply();
+			virtual const fs::path& getTarget() const;
+			virtual boost::optional<FileRequest> apply(unsigned step);
+			virtual void applied(unsigned step, const FileRequest& request);
 			virtual void unapply();
-			virtual void finish();
+			virtual boost::optional<FileRequest> finish();
+			virtual void addSyncTargets(std::set<fs::path>& files, std::list<fs::path>& paths) const;
+		};
+		
+		// A storage root. Temporary files are created in the tier they are
+		// going to be moved to, so that moving them is just renaming.
+		struct Tier
+		{
+			std::string name;
+			fs::path tempPath;
+			fs::path blobPath;
 		};
 		
 		class Transaction
@@ -68,33 +123,154 @@ namespace associative
 		private:
 			VFS* const parent;
 			std::deque<Operation*> operations;
+			// files to remove once committed resp. once rolled back
+			std::list<fs::path> obsolete;
+			std::list<fs::path> artifacts;
+			// blob ID and contents of blobs stored in the database
+			std::list<std::pair<uint64_t, std::string> > inlined;
+			// blob ID and range of blobs appended to packs, the last one of
+			// which is continued
+			std::vector<boost::shared_ptr<PackStore::Appender> > appenders;
+			std::list<std::pair<uint64_t, PackStore::Location> > packed;
+			// size and CRC-32C of the contents of the blobs stored
+			struct Checksum
+			{
+				uint64_t blobID;
+				uint64_t size;
+				uint32_t crc;
+			};
+			std::list<Checksum> checksums;
+			// blob ID and tier of the blobs stored as files of their own
+			std::list<std::pair<uint64_t, std::string> > placed;
+			// blob ID and codec of those of them which are encoded
+			std::list<std::pair<uint64_t, Codec::Type> > encoded;
+			// blob ID and words of the text blobs stored
+			std::list<std::pair<uint64_t, TextIndex::Document> > indexed;
 			
-			Transaction(VFS* const parent);
+			const uint64_t sessionID;
+			
+			Transaction(VFS* const parent, uint64_t sessionID);
 			
 			void move(const fs::path& src, const fs::path& dest);
-			void remove(const fs::path& target);
+			// the backup goes to the temporary directory of the target's tier
+			void remove(const fs::path& target, const std::string& tier);
+			
+			void execute();
+			void makeDirectories(const std::vector<Operation*>& batch);
+			void addSyncDirectories(std::set<fs::path>& directories, const fs::path& path) const;
 			
 		public:
+			~Transaction();
+			
+			void sync();
+			// part of the database transaction making the session visible
+			void updateDatabase(Connection& conn);
 			void finish();
 			void rollback();
 		};
 		
 	private:
 		const fs::path root;
+		// those of the default tier
 		const fs::path tempPath;
 		const fs::path blobPath;
+		const fs::path cachePath;
+		StoreSettings settings;
+		std::map<std::string, Tier> tiers;
+		PackStore packs;
+		GarbageCollector collector;
 		boost::shared_ptr<Transaction> transaction;
 		boost::shared_ptr<Process> process;
 		boost::shared_ptr<Logger> logger;
-		std::map<Blob::Identifier, fs::path> modified;
+		boost::shared_ptr<Executor> executor;
+		bool exchange;
+		// bumped by every reshard, and its value when the layout in
+		// 'settings' has been loaded
+		std::atomic<uint64_t>* const layoutVersion;
+		boost::optional<uint64_t> layout;
+		// journal targets of the temporary files, see getTempFile
+		std::map<Blob::Identifier, std::string> modified;
+		std::map<fs::path, boost::weak_ptr<const Mapping> > mappings;
+		// what has been written through BlobWriters in this session
+		std::map<Blob::Identifier, WriteExtent> extents;
+		// when this process recorded reading a blob last, see recordAccess
+		std::unordered_map<uint64_t, time_t> accessed;
+		
+		static std::atomic<uint64_t> tempCounter;
 		
 		WeakPtr<Transaction> apply(Environment& env);
+		// removes the temporary files of a session which is rolled back
+		void discard(Environment& env);
+		// continues collecting garbage for a bit, after a commit
+		void collectIncrementally(Environment& env);
+		// picks up the layout of a reshard by another process, to be called
+		// under the reshard lock
+		void updateLayout();
 		
-		fs::path getTempPath(const std::string& seed);
-		fs::path getBlobPath(Environment& env, Blob& blob, bool write = false);
+		fs::path getTempPath(uint64_t sessionID, const std::string& seed);
+		// Journal targets are names of temporary files, prefixed by the tier
+		// and a colon unless in the default tier.
+		fs::path getTempFile(const std::string& target) const;
+		std::string getTempTarget(const std::string& tier, const fs::path& name) const;
+		bool supportsExchange(const Tier& tier);
+		const Tier& getTier(const std::string& name) const;
+		std::vector<fs::path> getTempDirectories() const;
+		bool isTierDirectory(const fs::path& dir) const;
+		// where the committed file of a blob is (if any)
+		std::string getBlobTier(Environment& env, Blob& blob);
+		// Records in blob_access that the committed file of a blob is read,
+		// which tiering goes by rather than by access times (which mounts
+		// update rarely, if ever). Like relatime, this happens only once in
+		// a while per blob.
+		void recordAccess(Environment& env, Blob& blob);
+		// removes the old copies of blobs migrated at least 'minAge' seconds ago
+		uint64_t removeLeftovers(Connection& conn, unsigned minAge);
+		Codec::Type getBlobCodec(Environment& env, Blob& blob);
+		fs::path getBlobDirectory(const std::string& tier, const std::string& uuid, const StoreSettings& layout) const;
+		fs::path getBlobDirectory(const std::string& tier, const std::string& uuid) const;
+		// 'keep' tells whether writing needs the current contents
+		fs::path getBlobPath(Environment& env, Blob& blob, bool write = false, bool keep = true);
+		fs::path materialize(const fs::path& path);
+		fs::path materialize(uint64_t blobID, const std::string& content);
+		fs::path materialize(Environment& env, Blob& blob, const PackStore::Location& location);
+		// whether a copy is in cache/, marking it as used if so
+		bool isCached(const fs::path& cached) const;
+		// keeps cache/ within its size after adding 'added'
+		void evictCached(const fs::path& added);
+		boost::optional<std::string> getInlineContent(Environment& env, Blob& blob);
+		// whether the committed contents aren't a file of their own
+		bool isStoredElsewhere(Environment& env, Blob& blob);
+		// retries with the new location if the pack has been compacted meanwhile
+		template<typename Function>
+		auto readPacked(Environment& env, Blob& blob, PackStore::Location location, const Function& function) -> decltype(function(location));
+		boost::shared_ptr<BlobReader> openRead(Environment& env, Blob& blob);
+		boost::shared_ptr<BlobWriter> openWrite(Environment& env, Blob& blob, const BlobWriter::Mode& mode);
+		boost::shared_ptr<const Mapping> map(Environment& env, Blob& blob, const Mapping::Advice& advice);
+		void copyTo(Environment& env, Blob& blob, std::ostream& out);
+		bool isMapped(const fs::path& path) const;
 		
 	public:
 		VFS(const fs::path& root, const boost::shared_ptr<Process>& process, const boost::shared_ptr<Logger>& logger);
+		
+		const StoreSettings& getSettings() const;
+		
+		// fails while any session but the caller's is open, including those of
+		// other processes
+		void reshard(Environment& env, unsigned levels, unsigned width, unsigned threads = defaultThreadCount());
+		// returns the number of packs rewritten
+		unsigned compactPacks(Environment& env, double garbage);
+		// a complete pass over all temporary files and the leftovers of
+		// migrations
+		GarbageCollector::Statistics collectGarbage(Environment& env, unsigned rate, unsigned minAge);
+		// Moves blobs whose tier doesn't match the placement policy (any more),
+		// e. g. because they haven't been read for a while. Returns the number
+		// of blobs moved. 'rate' limits the bytes copied per second (0: none).
+		// The old copies are left to collectGarbage, for readers which found
+		// them before.
+		uint64_t migrate(Environment& env, unsigned threads, uint64_t rate);
+		// Indexes all text blobs anew, e. g. those stored before indexing
+		// was enabled. Returns the number of blobs indexed.
+		uint64_t reindex(Environment& env);
 	};
 	
 }
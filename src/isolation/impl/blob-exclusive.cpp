@@ -33,13 +33,13 @@ namespace associative
 				"      inner join handle on handle.relation_id = blob.id and handle.relation = ? "
 				"      inner join metadata on ( "
 				"        metadata.blob_id = blob.id or "
-				"        (metadata.object = blob.id and metadata.object_type_id = ?)"
+				"        metadata.object_blob_id = blob.id"
 				"      )"
 				"    where handle.session_id != journal.session_id and journal.relation_id = metadata.id"
 				"  ))"
 				")",
 			std::string("isolation.blob-exclusive"));
-			return !query->execute(convertAll(sessionID, Connection::Relation::Blob, Connection::Relation::Metadata, Connection::Relation::Blob, ASSOCIATIVE_SYS_BLOB_TYPE)).rows.size();
+			return !query->execute(convertAll(sessionID, Connection::Relation::Blob, Connection::Relation::Metadata, Connection::Relation::Blob)).rows.size();
 		}
 	};
 
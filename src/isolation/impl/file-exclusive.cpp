@@ -42,7 +42,7 @@ namespace associative
 				"      inner join handle on handle.relation_id = file.id and handle.relation = ? "
 				"      inner join metadata on ( "
 				"        metadata.blob_id = blob.id or "
-				"        (metadata.object = blob.id and metadata.object_type_id = ?)"
+				"        metadata.object_blob_id = blob.id"
 				"      )"
 				"    where handle.session_id != journal.session_id and journal.relation_id = metadata.id"
 				"  ))"
@@ -50,7 +50,7 @@ namespace associative
 			std::string("isolation.file-exclusive"));
 			return !query->execute(convertAll(sessionID,
 				Connection::Relation::Blob, Connection::Relation::File,
-				Connection::Relation::Metadata, Connection::Relation::File, ASSOCIATIVE_SYS_BLOB_TYPE
+				Connection::Relation::Metadata, Connection::Relation::File
 				)).rows.size();
 		}
 	};
@@ -1,20 +1,53 @@
+#include <algorithm>
+
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/lexical_cast.hpp>
 
 #include "blob.hpp"
+#include "intern.hpp"
 #include "../env/environment.hpp"
 
 uint64_t associative::Blob::ensureContentType()
 {
 	auto& conn = env.getConnection();
+	auto& cache = InternCache::get(conn);
+	auto cached = cache.contentTypes.find(contentType);
+	if (cached)
+		return *cached;
+	
 	auto query = conn.prepareQuery("select id from content_type where mime = ?", std::string("blob.content-type"));
 	auto result = query->execute(convertAll(contentType));
+	auto mime = contentType;
 	if (result.rows.size())
-		return boost::lexical_cast<uint64_t>(result.rows.begin()->at(0));
-
+	{
+		// the row might have been inserted by the transaction it is read in
+		uint64_t id = boost::lexical_cast<uint64_t>(result.rows.begin()->at(0));
+		conn.onCommit([&cache, mime, id]()
+		{
+			cache.contentTypes.set(mime, id);
+		});
+		return id;
+	}
+	
 	auto stmt = conn.prepareStatement("insert into content_type values (?, ?)", std::string("blob.content-type.add"));
 	uint64_t id = conn.nextID("content_type");
-	stmt->execute(convertAll(id, contentType));
+	try
+	{
+		stmt->execute(convertAll(id, contentType));
+	}
+	catch (DBException&)
+	{
+		// added by another process in the meantime
+		auto existing = query->execute(convertAll(contentType));
+		if (existing.rows.empty())
+			throw;
+		return cache.contentTypes.set(contentType, boost::lexical_cast<uint64_t>(existing.rows.begin()->at(0)));
+	}
+	
+	conn.onCommit([&cache, mime, id]()
+	{
+		cache.contentTypes.set(mime, id);
+	});
 	return id;
 }
 
@@ -90,32 +123,66 @@ fs::path associative::Blob::getPath(bool write)
 	return env.getVFS().getBlobPath(env, *this, write);
 }
 
-std::vector<associative::Triple> associative::Blob::getTriples(const associative::TripleFilter&)
+boost::shared_ptr<const associative::Mapping> associative::Blob::map(const Mapping::Advice& advice)
+{
+	if (removed)
+		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
+	return env.getVFS().map(env, *this, advice);
+}
+
+boost::shared_ptr<associative::BlobReader> associative::Blob::openRead()
+{
+	if (removed)
+		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
+	return env.getVFS().openRead(env, *this);
+}
+
+void associative::Blob::copyTo(std::ostream& out)
+{
+	if (removed)
+		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
+	env.getVFS().copyTo(env, *this, out);
+}
+
+boost::shared_ptr<associative::BlobWriter> associative::Blob::openWrite(const BlobWriter::Mode& mode)
+{
+	if (removed)
+		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
+	return env.getVFS().openWrite(env, *this, mode);
+}
+
+std::vector<associative::Triple> associative::Blob::getTriples(const associative::TripleFilter& filter)
 {
 	if (removed)
 		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
-	
-	Buffer<boost::shared_ptr<Prefix> > prefixBuffer;
-	Buffer<boost::shared_ptr<Type> > typeBuffer;
 	
 	auto& conn = env.getConnection();
 	auto t = conn.transaction();
-	auto query = conn.prepareQuery(
-		"select pprefix.id, pprefix.name, pprefix.uri, "
-		"oprefix.id, oprefix.name, oprefix.uri, type.id, type.name, "
-		"metadata.id, metadata.blob_id, metadata.predicate, metadata.object "
-		"from metadata "
-		"inner join type on metadata.object_type_id = type.id "
-		"inner join prefix pprefix on metadata.predicate_prefix_id = pprefix.id "
-		"inner join prefix oprefix on type.prefix_id = oprefix.id "
-		"where metadata.visible = 1 and metadata.blob_id = ?",
-	std::string("blobs.triples.get"));
-	auto result = query->execute(convertAll(id));
-	
-	auto blobType = Type::getBlobType(conn);
-	typeBuffer.set(toString(blobType->id), blobType);
-	prefixBuffer.set(toString(blobType->prefix->id), blobType->prefix);
-	t->commit();
+	std::list<std::vector<std::string> > rows;
+	if (auto cache = env.getTripleCache())
+	{
+		// the same columns as selected from the database below
+		auto matches = cache->getTriples(conn, filter, id);
+		for (auto iter = matches.begin(); iter != matches.end(); ++iter)
+			rows.push_back(convertAll(iter->id, iter->predicatePrefix, iter->predicateID, iter->objectType, iter->objectID));
+	}
+	else
+	{
+		auto parameters = convertAll(id);
+		auto conditions = filter.getConditions("metadata", parameters);
+		// Triples removed in this session are still visible in the database.
+		// The limit is part of the statement, as not every database takes it
+		// as a string parameter.
+		auto limit = filter.limit ? toString(*filter.limit + removedTriples.size()) : std::string();
+		
+		auto query = conn.prepareQuery(
+			"select metadata.id, metadata.predicate_prefix_id, metadata.predicate_id, metadata.object_type_id, metadata.object_id "
+			"from metadata "
+			"where metadata.visible = 1 and metadata.blob_id = ?" + conditions +
+			(filter.limit ? " order by metadata.id limit " + limit : ""),
+		"blobs.triples.get" + filter.getShape() + (filter.limit ? ".limit" + limit : ""));
+		rows = query->execute(parameters).rows;
+	}
 	
 	// As Triple is immutable, there is no assignment operator available.
 	// Unfortunately, std::vector needs an assignment operator even if it is
@@ -124,45 +191,69 @@ std::vector<associative::Triple> associative::Blob::getTriples(const associative
 	// Instead, we're using a std::list instead to buffer all the triples.
 	std::list<Triple> triples;
 	
-	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+	// prefixes and types are interned, so hardly any of them is looked up
+	for (auto iter = rows.begin(); iter != rows.end(); ++iter)
 	{
-		auto tripleID = boost::lexical_cast<uint64_t>(iter->at(8));
+		auto tripleID = boost::lexical_cast<uint64_t>(iter->at(0));
 		if (containsKey(removedTriples, tripleID))
 			continue;
 		
-		// I'd rather use boost::lambda here, but that's not possible
-		// because Prefix::Prefix and Type::Type are private
-		auto predicatePrefix = prefixBuffer.getOrElse(iter->at(0), [&iter]() {
-			return boost::shared_ptr<Prefix>(new Prefix(
-				boost::lexical_cast<uint64_t>(iter->at(0)), iter->at(1), iter->at(2)
-			));
-		});
-		auto objectPrefix = prefixBuffer.getOrElse(iter->at(3), [&iter]() {
-			return boost::shared_ptr<Prefix>(new Prefix(
-				boost::lexical_cast<uint64_t>(iter->at(3)), iter->at(4), iter->at(5)
-			));
-		});
-		auto type = typeBuffer.getOrElse(iter->at(6), [&]() {
-			return boost::shared_ptr<Type>(new Type(
-				boost::lexical_cast<uint64_t>(iter->at(6)), iter->at(7), objectPrefix
-			));
-		});
-		
-		triples.push_back(Triple(tripleID, this, predicatePrefix, iter->at(10), type, iter->at(11)));
+		triples.push_back(Triple(
+			tripleID, this, &env.getTerms(),
+			Prefix::fromID(conn, boost::lexical_cast<uint64_t>(iter->at(1))), boost::lexical_cast<uint64_t>(iter->at(2)),
+			Type::fromID(conn, boost::lexical_cast<uint64_t>(iter->at(3))), boost::lexical_cast<uint64_t>(iter->at(4))
+		));
 	}
+	t->commit();
 	
-	triples.insert(triples.end(), newTriples.begin(), newTriples.end());
+	for (auto iter = newTriples.begin(); iter != newTriples.end(); ++iter)
+		if (filter.matches(*iter))
+			triples.push_back(*iter);
+	if (filter.limit && triples.size() > *filter.limit)
+		triples.erase(std::next(triples.begin(), *filter.limit), triples.end());
 	return std::vector<Triple>(triples.begin(), triples.end());
 }
 
-void associative::Blob::addTriple(const associative::Triple& triple)
+std::vector<associative::Traversal::Node> associative::Blob::neighbors(const associative::Traversal::Direction& direction, const associative::TripleFilter& filter)
+{
+	if (removed)
+		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
+	
+	return Traversal(env, direction, filter).neighbors(id);
+}
+
+void associative::Blob::traverse(const associative::Traversal::Direction& direction, const associative::TripleFilter& filter, unsigned maxDepth, const std::function<bool(const associative::Traversal::Node&)>& callback)
+{
+	if (removed)
+		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
+	
+	Traversal(env, direction, filter).walk(id, maxDepth, callback);
+}
+
+std::vector<std::string> associative::Blob::getObjectColumns(const uint64_t typeID, const std::string& object)
+{
+	std::vector<std::string> columns(4);
+	auto column = Type::getColumn(typeID);
+	if (typeID == ASSOCIATIVE_SYS_BLOB_TYPE)
+		columns[0] = object;
+	else if (column != Type::Column::None)
+		columns[column] = Type::getColumnValue(column, object);
+	return columns;
+}
+
+void associative::Blob::addTriple(const associative::Triple& triple, const std::vector<std::string>& objectColumns)
 {
 	Connection& conn = env.getConnection();
 	
-	auto stmt = conn.prepareStatement("insert into metadata values (?, ?, ?, ?, ?, ?, 0)", std::string("blob.triple.add"));
-	stmt->execute(convertAll(triple.id, this->id,
-		triple.predicatePrefix->id, triple.predicate,
-		triple.objectType->id, triple.object));
+	// parameters are bound as text, so an empty one stands for null
+	auto stmt = conn.prepareStatement(
+		"insert into metadata values (?, ?, ?, ?, ?, ?, nullif(?, ''), nullif(?, ''), nullif(?, ''), nullif(?, ''), 0)",
+	std::string("blob.triple.add"));
+	auto parameters = convertAll(triple.id, this->id,
+		triple.predicatePrefix->id, triple.predicateID,
+		triple.objectType->id, triple.objectID);
+	parameters.insert(parameters.end(), objectColumns.begin(), objectColumns.end());
+	stmt->execute(parameters);
 	
 	stmt = conn.prepareStatement("insert into journal values (?, ?, ?, ?, ?, null, 0)", std::string("blob.triple.journal.add"));
 	stmt->execute(convertAll(conn.nextID("journal"), *env.getSessionID(), Connection::Relation::Metadata, triple.id, Triple::Operation::Add));
@@ -179,8 +270,10 @@ associative::Triple associative::Blob::addTriple(
 	auto& conn = env.getConnection();
 	auto t = conn.transaction();
 	auto blobType = Type::getBlobType(conn);
-	Triple triple(conn.nextID("metadata"), this, predicatePrefix, predicate, blobType, toString(blobObject.id));
-	addTriple(triple);
+	auto& terms = env.getTerms();
+	auto object = toString(blobObject.id);
+	Triple triple(conn.nextID("metadata"), this, &terms, predicatePrefix, terms.ensure(predicate), blobType, terms.ensure(object));
+	addTriple(triple, getObjectColumns(blobType->id, object));
 	t->commit();
 	return triple;
 }
@@ -194,10 +287,81 @@ associative::Triple associative::Blob::addTriple(
 		throw Exception("cannot use a blob as an object for a tuple here, use other method instead");
 	
 	// TODO some duplicated code
+	auto columns = getObjectColumns(objectType->id, object);
 	auto& conn = env.getConnection();
 	auto t = conn.transaction();
-	Triple triple(conn.nextID("metadata"), this, predicatePrefix, predicate, objectType, object);
-	addTriple(triple);
+	auto& terms = env.getTerms();
+	Triple triple(conn.nextID("metadata"), this, &terms, predicatePrefix, terms.ensure(predicate), objectType, terms.ensure(object));
+	addTriple(triple, columns);
 	t->commit();
 	return triple;
 }
+
+std::vector<associative::Triple> associative::Blob::addTriples(const std::vector<associative::NewTriple>& values)
+{
+	if (removed)
+		throw formatException(boost::format("blob with name %1% from file with uuid %2% has been removed") % name % file.uuid);
+	if (!env.getSessionID())
+		throw Exception("not in a session");
+	if (values.empty())
+		return std::vector<Triple>();
+	
+	auto& conn = env.getConnection();
+	auto& terms = env.getTerms();
+	auto t = conn.transaction();
+	auto blobType = Type::getBlobType(conn);
+	
+	std::vector<std::string> strings;
+	std::vector<std::vector<std::string> > columns;
+	for (auto iter = values.begin(); iter != values.end(); ++iter)
+	{
+		strings.push_back(iter->predicate);
+		strings.push_back(iter->object);
+		columns.push_back(getObjectColumns(iter->objectType ? iter->objectType->id : blobType->id, iter->object));
+	}
+	auto termIDs = terms.ensure(strings);
+	auto metadataID = conn.nextIDs("metadata", values.size());
+	auto journalID = conn.nextIDs("journal", values.size());
+	
+	std::list<Triple> triples;
+	for (std::size_t i = 0; i < values.size(); ++i)
+	{
+		auto& value = values[i];
+		triples.push_back(Triple(
+			metadataID + i, this, &terms,
+			value.predicatePrefix, termIDs[2 * i],
+			value.objectType ? value.objectType : blobType, termIDs[2 * i + 1]
+		));
+	}
+	
+	// rows per statement, well within the parameter limits of both databases
+	static const std::size_t batchSize = 50;
+	auto iter = triples.begin();
+	for (std::size_t start = 0; start < values.size(); start += batchSize)
+	{
+		auto count = std::min(batchSize, values.size() - start);
+		std::string metadataRows = "(?, ?, ?, ?, ?, ?, nullif(?, ''), nullif(?, ''), nullif(?, ''), nullif(?, ''), 0)";
+		std::string journalRows = "(?, ?, ?, ?, ?, null, 0)";
+		for (std::size_t i = 1; i < count; ++i)
+		{
+			metadataRows += ", (?, ?, ?, ?, ?, ?, nullif(?, ''), nullif(?, ''), nullif(?, ''), nullif(?, ''), 0)";
+			journalRows += ", (?, ?, ?, ?, ?, null, 0)";
+		}
+		
+		std::vector<std::string> metadata, journal;
+		for (std::size_t i = start; i < start + count; ++i, ++iter)
+		{
+			auto row = convertAll(iter->id, id, iter->predicatePrefix->id, iter->predicateID, iter->objectType->id, iter->objectID);
+			metadata.insert(metadata.end(), row.begin(), row.end());
+			metadata.insert(metadata.end(), columns[i].begin(), columns[i].end());
+			row = convertAll(journalID + i, *env.getSessionID(), Connection::Relation::Metadata, iter->id, Triple::Operation::Add);
+			journal.insert(journal.end(), row.begin(), row.end());
+		}
+		conn.prepareStatement("insert into metadata values " + metadataRows, "blob.triples.add." + toString(count))->execute(metadata);
+		conn.prepareStatement("insert into journal values " + journalRows, "blob.triples.journal.add." + toString(count))->execute(journal);
+	}
+	t->commit();
+	
+	newTriples.insert(newTriples.end(), triples.begin(), triples.end());
+	return std::vector<Triple>(triples.begin(), triples.end());
+}
@@ -8,6 +8,9 @@
 #include "triple.hpp"
 #include "prefix.hpp"
 #include "type.hpp"
+#include "traversal.hpp"
+#include "../env/mapping.hpp"
+#include "../env/stream.hpp"
 
 namespace associative
 {
@@ -16,6 +19,7 @@ namespace associative
 	class Environment;
 	class Triple;
 	class TripleFilter;
+	class NewTriple;
 	class Prefix;
 	class Type;
 	
@@ -37,7 +41,11 @@ namespace associative
 		
 		Blob(Environment& env, File& file, const std::string& name, const std::string& contentType, boost::optional<uint64_t> id);
 		
-		void addTriple(const Triple& triple);
+		// The values of the columns object_blob_id, object_integer,
+		// object_double and object_timestamp, empty ones for null. Throws if
+		// 'object' isn't a value of its well-known type.
+		static std::vector<std::string> getObjectColumns(const uint64_t typeID, const std::string& object);
+		void addTriple(const Triple& triple, const std::vector<std::string>& objectColumns);
 		
 	public:
 		typedef std::pair<boost::uuids::uuid, std::string> Identifier;
@@ -63,6 +71,16 @@ namespace associative
 		bool isRemoved();
 		fs::path getPath(bool write = false);
 		
+		// Maps the current contents into memory. Mappings are shared between
+		// callers until the session writes to the blob.
+		boost::shared_ptr<const Mapping> map(const Mapping::Advice& advice = Mapping::Advice::Sequential);
+		
+		boost::shared_ptr<BlobReader> openRead();
+		// Writes the current contents to 'out'. Encoded blobs are decoded on
+		// the fly instead of into a copy, as reading their path would.
+		void copyTo(std::ostream& out);
+		boost::shared_ptr<BlobWriter> openWrite(const BlobWriter::Mode& mode = BlobWriter::Mode::Truncate);
+		
 		std::vector<Triple> getTriples(const TripleFilter& filter);
 		
 		Triple addTriple(
@@ -74,6 +92,16 @@ namespace associative
 			const boost::shared_ptr<Prefix>& predicatePrefix, const std::string& predicate, 
 			const boost::shared_ptr<Type>& objectType, const std::string& object
 		);
+		
+		// Adds many triples within one transaction, reserving their IDs in
+		// a block and inserting the rows in batches.
+		std::vector<Triple> addTriples(const std::vector<NewTriple>& triples);
+		
+		// the blobs linked to this one by triples with the predicate of
+		// 'filter' (any if not given)
+		std::vector<Traversal::Node> neighbors(const Traversal::Direction& direction, const TripleFilter& filter);
+		// all blobs reachable within 'maxDepth' hops, see Traversal::walk
+		void traverse(const Traversal::Direction& direction, const TripleFilter& filter, unsigned maxDepth, const std::function<bool(const Traversal::Node&)>& callback);
 	};
 	
 }
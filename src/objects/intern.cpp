@@ -0,0 +1,16 @@
+#include <map>
+
+#include "intern.hpp"
+
+associative::InternCache& associative::InternCache::get(const associative::Connection& conn)
+{
+	// never freed, connections may be used until the process exits
+	static boost::mutex mutex;
+	static std::map<std::string, InternCache*> caches;
+	
+	boost::lock_guard<boost::mutex> guard(mutex);
+	auto& cache = caches[conn.getDataSource()];
+	if (!cache)
+		cache = new InternCache();
+	return *cache;
+}
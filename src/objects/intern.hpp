@@ -0,0 +1,95 @@
+#ifndef ASSOCIATIVE_INTERN_HPP
+#define ASSOCIATIVE_INTERN_HPP
+
+#include <unordered_map>
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "../db/connection.hpp"
+#include "../util/util.hpp"
+
+namespace associative
+{
+	
+	class Prefix;
+	class Type;
+	
+	// Values by key, read concurrently. Keys which have been looked up in
+	// vain are remembered for a while, so that repeated lookups of something
+	// missing don't hit the database either.
+	template<typename Key, typename Value>
+	class InternTable
+	{
+	private:
+		boost::shared_mutex mutex;
+		std::unordered_map<Key, Value> values;
+		std::unordered_map<Key, boost::posix_time::ptime> misses;
+	
+	public:
+		boost::optional<Value> find(const Key& key)
+		{
+			boost::shared_lock<boost::shared_mutex> lock(mutex);
+			auto iter = values.find(key);
+			if (iter == values.end())
+				return boost::none;
+			return iter->second;
+		}
+		
+		// Keeps the value which came first if two threads race, so that
+		// everybody shares the same instance.
+		Value set(const Key& key, const Value& value)
+		{
+			boost::unique_lock<boost::shared_mutex> lock(mutex);
+			misses.erase(key);
+			return values.insert(std::make_pair(key, value)).first->second;
+		}
+		
+		bool missed(const Key& key)
+		{
+			boost::shared_lock<boost::shared_mutex> lock(mutex);
+			auto iter = misses.find(key);
+			return iter != misses.end() && boost::posix_time::microsec_clock::universal_time() - iter->second < boost::posix_time::seconds(1);
+		}
+		
+		void miss(const Key& key)
+		{
+			boost::unique_lock<boost::shared_mutex> lock(mutex);
+			misses[key] = boost::posix_time::microsec_clock::universal_time();
+		}
+		
+		// as soon as someone has added the key
+		void forget(const Key& key)
+		{
+			boost::unique_lock<boost::shared_mutex> lock(mutex);
+			misses.erase(key);
+		}
+	};
+	
+	// Prefixes, types and content types of a database, shared by all of its
+	// connections within the process. Their rows never change once inserted,
+	// so only lookups of unknown ones go to the database. Rows inserted by a
+	// connection are interned once they are committed, see
+	// Connection::onCommit.
+	class InternCache
+	{
+	private:
+		InternCache() = default;
+	
+	public:
+		InternCache(InternCache&) = delete;
+		InternCache& operator=(InternCache&) = delete;
+		
+		InternTable<std::string, boost::shared_ptr<Prefix> > prefixNames;
+		InternTable<uint64_t, boost::shared_ptr<Prefix> > prefixIDs;
+		// by prefix ID and name
+		InternTable<std::string, boost::shared_ptr<Type> > typeNames;
+		InternTable<uint64_t, boost::shared_ptr<Type> > typeIDs;
+		InternTable<std::string, uint64_t> contentTypes;
+		
+		static InternCache& get(const Connection& conn);
+	};
+
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "prefix.hpp"
+#include "intern.hpp"
 
 associative::Prefix::Prefix(const uint64_t id, const std::string& name, const std::string& uri)
 : id(id), name(name), uri(uri)
@@ -10,34 +11,103 @@ associative::Prefix::Prefix(const associative::Prefix& prefix)
 {
 }
 
+boost::shared_ptr<associative::Prefix> associative::Prefix::intern(associative::Connection& conn, const std::vector<std::string>& row)
+{
+	boost::shared_ptr<Prefix> prefix(new Prefix(boost::lexical_cast<uint64_t>(row.at(0)), row.at(1), row.at(2)));
+	auto& cache = InternCache::get(conn);
+	// the row might have been inserted by the transaction it is read in
+	conn.onCommit([&cache, prefix]()
+	{
+		cache.prefixIDs.set(prefix->id, cache.prefixNames.set(prefix->name, prefix));
+	});
+	// the shared instance, unless interning waits for the commit
+	auto interned = cache.prefixIDs.find(prefix->id);
+	return interned ? *interned : prefix;
+}
+
+boost::shared_ptr<associative::Prefix> associative::Prefix::select(associative::Connection& conn, const std::string& column, const std::string& value)
+{
+	auto query = conn.prepareQuery("select id, name, uri from prefix where " + column + " = ?", "prefix.select." + column);
+	auto result = query->execute(convertAll(value));
+	if (result.rows.empty())
+		return boost::shared_ptr<Prefix>();
+	return intern(conn, result.rows.front());
+}
+
 boost::shared_ptr<associative::Prefix> associative::Prefix::get(associative::Connection& conn, const std::string& name, const boost::optional<std::string>& uri)
 {
-	auto query = conn.prepareQuery("select id, name, uri from prefix where name = ?", std::string("prefix.select"));
-	auto result = query->execute(convertAll(name));
-	uint64_t id;
-	std::string actualURI;
+	auto& cache = InternCache::get(conn);
+	auto prefix = cache.prefixNames.find(name);
+	if (!prefix && (uri || !cache.prefixNames.missed(name)))
+	{
+		auto selected = select(conn, "name", name);
+		if (selected)
+			prefix = selected;
+	}
+	
+	if (prefix)
+	{
+		if (uri && *uri != (*prefix)->uri)
+			throw formatException(boost::format("the actual URI for prefix %1% is %2% instead of %3%") % name % (*prefix)->uri % *uri);
+		return *prefix;
+	}
 	
-	if (result.rows.size())
-	{
-		auto& firstRow = result.rows.front();
-		actualURI = firstRow.at(2);
-		if (uri && *uri != actualURI)
-			throw formatException(boost::format("the actual URI for prefix %1% is %2% instead of %3%") % name % actualURI % *uri);
-		
-		id = boost::lexical_cast<uint64_t>(firstRow.at(0));
+	if (!uri)
+	{
+		cache.prefixNames.miss(name);
+		throw formatException(boost::format("prefix %1% not existing and no URI specified") % name);
 	}
-	else
+	
+	auto id = conn.nextID("prefix");
+	try
 	{
-		if (!uri)
-			throw formatException(boost::format("prefix %1% not existing and no URI specified") % name);
-		
-		id = conn.nextID("prefix");
 		conn.prepareStatement(
 			"insert into prefix values (?, ?, ?)",
 		std::string("prefix.add"))->execute(convertAll(id, name, *uri));
-		
-		actualURI = *uri;
+	}
+	catch (DBException&)
+	{
+		// added by another process in the meantime
+		auto selected = select(conn, "name", name);
+		if (!selected)
+			throw;
+		if (*uri != selected->uri)
+			throw formatException(boost::format("the actual URI for prefix %1% is %2% instead of %3%") % name % selected->uri % *uri);
+		return selected;
 	}
 	
-	return boost::shared_ptr<Prefix>(new Prefix(id, name, actualURI));
+	boost::shared_ptr<Prefix> added(new Prefix(id, name, *uri));
+	conn.onCommit([&cache, added]()
+	{
+		cache.prefixIDs.set(added->id, cache.prefixNames.set(added->name, added));
+	});
+	return added;
+}
+
+boost::shared_ptr<associative::Prefix> associative::Prefix::fromID(associative::Connection& conn, const uint64_t id)
+{
+	auto& cache = InternCache::get(conn);
+	auto prefix = cache.prefixIDs.find(id);
+	if (prefix)
+		return *prefix;
+	
+	boost::shared_ptr<Prefix> selected;
+	if (!cache.prefixIDs.missed(id))
+		selected = select(conn, "id", toString(id));
+	if (!selected)
+	{
+		cache.prefixIDs.miss(id);
+		throw formatException(boost::format("prefix %1% doesn't exist") % id);
+	}
+	return selected;
+}
+
+std::vector<boost::shared_ptr<associative::Prefix> > associative::Prefix::getAll(associative::Connection& conn)
+{
+	auto query = conn.prepareQuery("select id, name, uri from prefix order by id", std::string("prefix.all"));
+	auto result = query->execute(convertAll());
+	std::vector<boost::shared_ptr<Prefix> > prefixes;
+	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		prefixes.push_back(intern(conn, *iter));
+	return prefixes;
 }
@@ -21,6 +21,12 @@ namespace associative
 	private:
 		Prefix(const uint64_t id, const std::string& name, const std::string& uri);
 		
+		// the prefix of a row (id, name, uri), shared by everybody once the
+		// transaction it is read in commits
+		static boost::shared_ptr<Prefix> intern(Connection& conn, const std::vector<std::string>& row);
+		// the prefix with 'column' = 'value', interned, or null
+		static boost::shared_ptr<Prefix> select(Connection& conn, const std::string& column, const std::string& value);
+		
 	public:
 		Prefix(const Prefix& prefix);
 		
@@ -28,7 +34,11 @@ namespace associative
 		const std::string name;
 		const std::string uri;
 		
+		// adds the prefix if it doesn't exist and 'uri' is given
 		static boost::shared_ptr<Prefix> get(Connection& conn, const std::string& name, const boost::optional<std::string>& uri = boost::none);
+		static boost::shared_ptr<Prefix> fromID(Connection& conn, const uint64_t id);
+		// all prefixes, ordered by ID
+		static std::vector<boost::shared_ptr<Prefix> > getAll(Connection& conn);
 	};
 	
 }
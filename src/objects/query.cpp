@@ -0,0 +1,522 @@
+#include <cctype>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "query.hpp"
+#include "../env/environment.hpp"
+
+namespace
+{
+	
+	struct Token
+	{
+		enum Kind
+		{
+			Word,
+			Literal,
+			Separator
+		};
+		
+		Kind kind;
+		std::string value;
+		// the type of a literal, if given
+		std::string type;
+	};
+	
+	std::vector<Token> tokenize(const std::string& text)
+	{
+		std::vector<Token> tokens;
+		for (std::size_t i = 0; i < text.size(); )
+		{
+			if (std::isspace(static_cast<unsigned char>(text[i])))
+			{
+				++i;
+				continue;
+			}
+			
+			Token token = { Token::Kind::Word, "", "" };
+			if (text[i] == '"')
+			{
+				token.kind = Token::Kind::Literal;
+				for (++i; i < text.size() && text[i] != '"'; ++i)
+				{
+					if (text[i] == '\\' && i + 1 < text.size())
+						++i;
+					token.value += text[i];
+				}
+				if (i++ == text.size())
+					throw associative::formatException(boost::format("unterminated literal %1%") % token.value);
+				if (text.compare(i, 2, "^^") == 0)
+					for (i += 2; i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])); ++i)
+						token.type += text[i];
+			}
+			else if (text[i] == '<')
+			{
+				auto end = text.find('>', i);
+				if (end == std::string::npos)
+					throw associative::formatException(boost::format("unterminated blob reference %1%") % text.substr(i));
+				token.value = text.substr(i, end + 1 - i);
+				i = end + 1;
+			}
+			else
+			{
+				for (; i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])); ++i)
+					token.value += text[i];
+			}
+			
+			// a dot right after a word ends the pattern as well
+			bool separated = token.kind == Token::Kind::Word && token.value.size() > 1 && token.value[token.value.size() - 1] == '.' && token.value[0] != '<';
+			if (separated)
+				token.value.erase(token.value.size() - 1);
+			if (token.kind == Token::Kind::Word && token.value == ".")
+				token.kind = Token::Kind::Separator;
+			tokens.push_back(token);
+			if (separated)
+			{
+				Token separator = { Token::Kind::Separator, ".", "" };
+				tokens.push_back(separator);
+			}
+		}
+		return tokens;
+	}
+	
+	std::pair<std::string, std::string> splitName(const std::string& name)
+	{
+		auto colon = name.find(':');
+		if (colon == std::string::npos || colon == 0 || colon + 1 == name.size())
+			throw associative::formatException(boost::format("expected prefix:name instead of %1%") % name);
+		return std::make_pair(name.substr(0, colon), name.substr(colon + 1));
+	}
+
+}
+
+const std::size_t associative::Query::batchSize = 500;
+
+associative::Query::Query(Environment& env, const std::string& text)
+: env(env)
+{
+	parse(text);
+}
+
+const std::vector<std::string>& associative::Query::getVariables() const
+{
+	return variables;
+}
+
+std::size_t associative::Query::getVariable(const std::string& name)
+{
+	if (name.size() < 2)
+		throw Exception("variable without name");
+	auto iter = std::find(variables.begin(), variables.end(), name.substr(1));
+	if (iter != variables.end())
+		return iter - variables.begin();
+	variables.push_back(name.substr(1));
+	return variables.size() - 1;
+}
+
+uint64_t associative::Query::getBlobID(const std::string& reference)
+{
+	// committed blobs and those added by the session, unless it removed them
+	auto name = splitName(reference.substr(1, reference.size() - 2));
+	auto parameters = convertAll(name.first, name.second);
+	std::string visibility = "blob.visible = 1";
+	if (auto session = env.getSessionID())
+	{
+		std::string journal = "exists (select * from journal where journal.session_id = ? and journal.relation = ? and journal.relation_id = blob.id and journal.operation = ?)";
+		visibility = "(blob.visible = 1 or " + journal + ") and not " + journal;
+		auto journaled = convertAll(*session, Connection::Relation::Blob, Blob::Operation::Add, *session, Connection::Relation::Blob, Blob::Operation::Remove);
+		parameters.insert(parameters.end(), journaled.begin(), journaled.end());
+	}
+	auto query = env.getConnection().prepareQuery(
+		"select blob.id from `blob` inner join file on file.id = blob.file_id where file.uuid = ? and blob.name = ? and " + visibility,
+	std::string(env.getSessionID() ? "query.blob.session" : "query.blob"));
+	auto result = query->execute(parameters);
+	if (result.rows.empty())
+		throw formatException(boost::format("blob %1% doesn't exist") % reference);
+	return boost::lexical_cast<uint64_t>(result.rows.front().at(0));
+}
+
+void associative::Query::parse(const std::string& text)
+{
+	auto& conn = env.getConnection();
+	auto tokens = tokenize(text);
+	for (auto iter = tokens.begin(); iter != tokens.end(); )
+	{
+		if (tokens.end() - iter < 3 || iter[0].kind == Token::Kind::Separator || iter[1].kind == Token::Kind::Separator || iter[2].kind == Token::Kind::Separator)
+			throw Exception("expected subject, predicate and object");
+		auto& subject = iter[0];
+		auto& predicate = iter[1];
+		auto& object = iter[2];
+		iter += 3;
+		if (iter != tokens.end() && iter++->kind != Token::Kind::Separator)
+			throw formatException(boost::format("expected . instead of %1%") % (iter - 1)->value);
+		
+		Pattern pattern;
+		pattern.literal = false;
+		pattern.unknownType = false;
+		pattern.estimate = 0;
+		
+		if (subject.kind == Token::Kind::Word && subject.value[0] == '?')
+			pattern.subjectVariable = getVariable(subject.value);
+		else if (subject.kind == Token::Kind::Word && subject.value[0] == '<')
+			pattern.subject = getBlobID(subject.value);
+		else
+			throw formatException(boost::format("subject %1% is neither a variable nor a blob") % subject.value);
+		
+		if (predicate.kind != Token::Kind::Word || predicate.value[0] == '<')
+			throw formatException(boost::format("predicate %1% is neither a variable nor prefix:name") % predicate.value);
+		if (predicate.value[0] == '?')
+		{
+			pattern.predicateVariable = getVariable(predicate.value);
+		}
+		else
+		{
+			auto name = splitName(predicate.value);
+			pattern.filter.predicatePrefix = Prefix::get(conn, name.first);
+			pattern.filter.predicate = name.second;
+		}
+		
+		if (object.kind == Token::Kind::Literal)
+		{
+			pattern.filter.object = object.value;
+			if (object.type.empty())
+			{
+				pattern.literal = true;
+			}
+			else
+			{
+				auto type = splitName(object.type);
+				pattern.filter.objectType = Type::find(conn, type.second, Prefix::get(conn, type.first));
+				pattern.unknownType = !pattern.filter.objectType;
+			}
+		}
+		else if (object.value[0] == '?')
+		{
+			pattern.objectVariable = getVariable(object.value);
+		}
+		else if (object.value[0] == '<')
+		{
+			pattern.filter.objectType = Type::getBlobType(conn);
+			pattern.filter.object = toString(getBlobID(object.value));
+		}
+		else
+		{
+			throw formatException(boost::format("object %1% is neither a variable, a blob nor a literal") % object.value);
+		}
+		
+		patterns.push_back(pattern);
+	}
+	
+	if (patterns.empty())
+		throw Exception("empty query");
+}
+
+std::string associative::Query::getConditions(const Pattern& pattern, std::vector<std::string>& parameters, bool uncommitted) const
+{
+	auto conditions = env.getMetadataVisibility("m", parameters, uncommitted);
+	conditions += pattern.filter.getConditions("m", parameters);
+	if (pattern.subject)
+	{
+		conditions += " and m.blob_id = ?";
+		parameters.push_back(toString(*pattern.subject));
+	}
+	if (pattern.literal)
+	{
+		conditions += " and m.object_type_id <> ?";
+		parameters.push_back(toString(ASSOCIATIVE_SYS_BLOB_TYPE));
+	}
+	return conditions;
+}
+
+std::string associative::Query::getShape(const Pattern& pattern, bool uncommitted) const
+{
+	return pattern.filter.getShape() + (pattern.subject ? "S" : "") + (pattern.literal ? "L" : "") + (uncommitted ? "U" : env.getSessionID() ? "V" : "");
+}
+
+void associative::Query::estimate(Pattern& pattern)
+{
+	if (auto cache = env.getTripleCache())
+	{
+		pattern.estimate = cache->count(env.getConnection(), pattern.filter, pattern.subject);
+		return;
+	}
+	
+	std::vector<std::string> parameters;
+	auto conditions = getConditions(pattern, parameters);
+	auto query = env.getConnection().prepareQuery("select count(*) from metadata m where " + conditions, "query.estimate" + getShape(pattern));
+	auto result = query->execute(parameters);
+	pattern.estimate = result.rows.empty() ? 0 : boost::lexical_cast<uint64_t>(result.rows.front().at(0));
+}
+
+boost::optional<associative::Query::Bindings> associative::Query::getBindings(const Pattern& pattern, const std::vector<Solution>& current) const
+{
+	for (auto object : { false, true })
+	{
+		auto& variable = object ? pattern.objectVariable : pattern.subjectVariable;
+		if (!variable || !current.front()[*variable])
+			continue;
+		
+		// literals aren't looked up by value
+		std::set<uint64_t> blobs;
+		bool literal = false;
+		for (auto solution = current.begin(); solution != current.end() && !literal; ++solution)
+		{
+			auto& term = (*solution)[*variable];
+			literal = !term->blob;
+			if (!literal)
+				blobs.insert(boost::lexical_cast<uint64_t>(term->key.substr(1)));
+		}
+		if (!literal && blobs.size() < pattern.estimate)
+		{
+			Bindings bindings = { object, std::vector<uint64_t>(blobs.begin(), blobs.end()) };
+			return bindings;
+		}
+	}
+	return boost::none;
+}
+
+std::list<std::vector<std::string> > associative::Query::fetch(const Pattern& pattern, const boost::optional<Bindings>& bindings, bool uncommitted)
+{
+	std::vector<std::string> conditionParameters;
+	auto conditions = getConditions(pattern, conditionParameters, uncommitted);
+	auto shape = getShape(pattern, uncommitted);
+	if (bindings)
+	{
+		std::string blobs = "?";
+		for (std::size_t i = 1; i < batchSize; ++i)
+			blobs += ", ?";
+		conditions += std::string(bindings->object ? " and m.object_blob_id" : " and m.blob_id") + " in (" + blobs + ")";
+		shape += bindings->object ? "O" : "I";
+	}
+	
+	auto query = env.getConnection().prepareQuery(
+		"select m.blob_id, sf.uuid, sb.name, m.predicate_prefix_id, p.name, pt.value, m.object_type_id, ot.value, obf.uuid, ob.name "
+		"from metadata m "
+		"inner join `blob` sb on sb.id = m.blob_id "
+		"inner join file sf on sf.id = sb.file_id "
+		"inner join prefix p on p.id = m.predicate_prefix_id "
+		"inner join term pt on pt.id = m.predicate_id "
+		"inner join term ot on ot.id = m.object_id "
+		"left join `blob` ob on ob.id = m.object_blob_id "
+		"left join file obf on obf.id = ob.file_id "
+		"where " + conditions,
+	"query.pattern" + shape);
+	if (!bindings)
+		return query->execute(conditionParameters).rows;
+	
+	std::list<std::vector<std::string> > rows;
+	auto& blobs = bindings->blobs;
+	for (std::size_t start = 0; start < blobs.size(); start += batchSize)
+	{
+		// the last batch is padded with its last blob, so that all of them
+		// share the same statement
+		auto parameters = conditionParameters;
+		for (std::size_t i = start; i < start + batchSize; ++i)
+			parameters.push_back(toString(blobs[std::min(i, blobs.size() - 1)]));
+		auto result = query->execute(parameters);
+		rows.insert(rows.end(), result.rows.begin(), result.rows.end());
+	}
+	return rows;
+}
+
+std::list<std::vector<std::string> > associative::Query::fetch(const Pattern& pattern, const boost::optional<Bindings>& bindings, TripleCache& cache, const std::unordered_set<uint64_t>& removed)
+{
+	auto& conn = env.getConnection();
+	std::vector<TripleCache::Match> matches;
+	if (!bindings)
+	{
+		matches = cache.getTriples(conn, pattern.filter, pattern.subject);
+	}
+	else
+	{
+		// the cache finds the triples of every blob by binary search
+		for (auto blob = bindings->blobs.begin(); blob != bindings->blobs.end(); ++blob)
+		{
+			auto filter = pattern.filter;
+			if (bindings->object)
+			{
+				filter.objectType = Type::getBlobType(conn);
+				filter.object = toString(*blob);
+			}
+			auto found = cache.getTriples(conn, filter, bindings->object ? pattern.subject : boost::make_optional(*blob));
+			matches.insert(matches.end(), found.begin(), found.end());
+		}
+	}
+	
+	// the same columns as fetched from the database
+	std::list<std::vector<std::string> > rows;
+	for (auto iter = matches.begin(); iter != matches.end(); ++iter)
+	{
+		bool blob = iter->objectType == ASSOCIATIVE_SYS_BLOB_TYPE;
+		if (containsKey(removed, iter->id) || (pattern.literal && blob))
+			continue;
+		auto subject = cache.getBlob(conn, iter->subject);
+		if (!subject)
+			continue;
+		boost::optional<std::pair<std::string, std::string> > object;
+		if (blob)
+			object = cache.getBlob(conn, boost::lexical_cast<uint64_t>(iter->object));
+		rows.push_back(convertAll(
+			iter->subject, subject->first, subject->second,
+			iter->predicatePrefix, Prefix::fromID(conn, iter->predicatePrefix)->name, iter->predicate,
+			iter->objectType, iter->object,
+			object ? object->first : std::string(), object ? object->second : std::string()
+		));
+	}
+	
+	// the session's own triples aren't cached
+	if (env.getSessionID())
+	{
+		auto uncommitted = fetch(pattern, bindings, true);
+		rows.splice(rows.end(), uncommitted);
+	}
+	return rows;
+}
+
+std::vector<std::size_t> associative::Query::getJoinOrder() const
+{
+	// Greedily the smallest pattern sharing a variable with those joined
+	// already, cross products only if there is no such pattern.
+	std::vector<std::size_t> order;
+	std::vector<bool> joined(patterns.size(), false);
+	std::vector<bool> bound(variables.size(), false);
+	while (order.size() < patterns.size())
+	{
+		boost::optional<std::size_t> best;
+		bool bestConnected = false;
+		for (std::size_t i = 0; i < patterns.size(); ++i)
+		{
+			if (joined[i])
+				continue;
+			auto& pattern = patterns[i];
+			bool connected =
+				(pattern.subjectVariable && bound[*pattern.subjectVariable]) ||
+				(pattern.predicateVariable && bound[*pattern.predicateVariable]) ||
+				(pattern.objectVariable && bound[*pattern.objectVariable]);
+			if (!best || (connected && !bestConnected) || (connected == bestConnected && pattern.estimate < patterns[*best].estimate))
+			{
+				best = i;
+				bestConnected = connected;
+			}
+		}
+		
+		joined[*best] = true;
+		order.push_back(*best);
+		auto& pattern = patterns[*best];
+		for (auto variable : { pattern.subjectVariable, pattern.predicateVariable, pattern.objectVariable })
+			if (variable)
+				bound[*variable] = true;
+	}
+	return order;
+}
+
+void associative::Query::execute(const std::function<bool(const std::vector<Term>&)>& callback)
+{
+	for (auto iter = patterns.begin(); iter != patterns.end(); ++iter)
+		if (iter->unknownType)
+			return;
+	
+	auto& conn = env.getConnection();
+	auto t = conn.transaction();
+	forEach(patterns, [this](Pattern& pattern) { this->estimate(pattern); });
+	auto order = getJoinOrder();
+	
+	// the cache only knows committed triples, so those removed within the
+	// session are skipped
+	auto cache = env.getTripleCache();
+	std::unordered_set<uint64_t> removed;
+	if (cache)
+		removed = env.getRemovedTriples();
+	
+	std::vector<Solution> current(1, Solution(variables.size()));
+	std::vector<bool> bound(variables.size(), false);
+	for (auto step = order.begin(); step != order.end(); ++step)
+	{
+		auto& pattern = patterns[*step];
+		bool last = step + 1 == order.end();
+		std::vector<boost::optional<std::size_t> > slots = { pattern.subjectVariable, pattern.predicateVariable, pattern.objectVariable };
+		
+		// the variables shared with the partial solutions are the join key
+		std::vector<std::size_t> shared;
+		for (auto slot = slots.begin(); slot != slots.end(); ++slot)
+			if (*slot && bound[**slot] && std::find(shared.begin(), shared.end(), **slot) == shared.end())
+				shared.push_back(**slot);
+		
+		std::unordered_multimap<std::string, std::size_t> index;
+		for (std::size_t i = 0; i < current.size(); ++i)
+		{
+			std::string key;
+			for (auto variable = shared.begin(); variable != shared.end(); ++variable)
+				key += current[i][*variable]->key + '\0';
+			index.insert(std::make_pair(key, i));
+		}
+		
+		auto bindings = getBindings(pattern, current);
+		auto rows = cache ? fetch(pattern, bindings, *cache, removed) : fetch(pattern, bindings);
+		
+		std::vector<Solution> next;
+		for (auto row = rows.begin(); row != rows.end(); ++row)
+		{
+			Term terms[3] = {
+				{ "b" + row->at(0), row->at(1) + ":" + row->at(2), true },
+				{ "p" + row->at(3) + ":" + row->at(5), row->at(4) + ":" + row->at(5), false },
+				{ "", "", false }
+			};
+			if (row->at(6) == toString(ASSOCIATIVE_SYS_BLOB_TYPE))
+				terms[2] = { "b" + row->at(7), row->at(8) + ":" + row->at(9), true };
+			else
+				terms[2] = { "l" + row->at(6) + ":" + row->at(7), row->at(7), false };
+			
+			// a variable used twice within the pattern has to match the same term
+			Solution local(variables.size());
+			bool consistent = true;
+			for (std::size_t i = 0; i < 3 && consistent; ++i)
+			{
+				if (!slots[i])
+					continue;
+				auto& term = local[*slots[i]];
+				consistent = !term || term->key == terms[i].key;
+				term = terms[i];
+			}
+			if (!consistent)
+				continue;
+			
+			std::string key;
+			for (auto variable = shared.begin(); variable != shared.end(); ++variable)
+				key += local[*variable]->key + '\0';
+			
+			auto matches = index.equal_range(key);
+			for (auto match = matches.first; match != matches.second; ++match)
+			{
+				Solution solution(current[match->second]);
+				for (std::size_t i = 0; i < 3; ++i)
+					if (slots[i])
+						solution[*slots[i]] = terms[i];
+				
+				if (!last)
+				{
+					next.push_back(solution);
+					continue;
+				}
+				
+				std::vector<Term> values;
+				for (auto term = solution.begin(); term != solution.end(); ++term)
+					values.push_back(**term);
+				if (!callback(values))
+				{
+					t->commit();
+					return;
+				}
+			}
+		}
+		
+		current.swap(next);
+		for (auto slot = slots.begin(); slot != slots.end(); ++slot)
+			if (*slot)
+				bound[**slot] = true;
+		if (current.empty())
+			break;
+	}
+	t->commit();
+}
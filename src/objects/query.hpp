@@ -0,0 +1,103 @@
+#ifndef ASSOCIATIVE_QUERY_HPP
+#define ASSOCIATIVE_QUERY_HPP
+
+#include <functional>
+#include <list>
+#include <unordered_set>
+
+#include "triple.hpp"
+
+namespace associative
+{
+	
+	class Environment;
+	class TripleCache;
+	
+	// A basic graph pattern: triple patterns separated by " . ", all of which
+	// have to match. Subjects are variables (?name) or blobs (<uuid:name>),
+	// predicates are variables or prefix:name, objects are variables, blobs
+	// or literals ("text", optionally typed by ^^prefix:type).
+	class Query
+	{
+	public:
+		// what a variable is bound to
+		struct Term
+		{
+			// unique among all terms, used for joining
+			std::string key;
+			// uuid:name for blobs, prefix:name for predicates, the value otherwise
+			std::string text;
+			bool blob;
+		};
+	
+	private:
+		struct Pattern
+		{
+			boost::optional<std::size_t> subjectVariable;
+			boost::optional<std::size_t> predicateVariable;
+			boost::optional<std::size_t> objectVariable;
+			boost::optional<uint64_t> subject;
+			// the constant predicate and object
+			TripleFilter filter;
+			// untyped literals don't match blobs
+			bool literal;
+			// the literal's type doesn't exist, so nothing matches
+			bool unknownType;
+			uint64_t estimate;
+		};
+		
+		// a partial solution, one term per variable
+		typedef std::vector<boost::optional<Term> > Solution;
+		
+		// the blobs a joined subject resp. object variable is bound to, so
+		// that only their triples are fetched
+		struct Bindings
+		{
+			bool object;
+			std::vector<uint64_t> blobs;
+		};
+		
+		// bindings are fetched with a single query per 'batchSize' blobs
+		static const std::size_t batchSize;
+		
+		Environment& env;
+		std::vector<std::string> variables;
+		std::vector<Pattern> patterns;
+		
+		std::size_t getVariable(const std::string& name);
+		uint64_t getBlobID(const std::string& reference);
+		void parse(const std::string& text);
+		
+		// Visibility within the current session and the constant parts of the
+		// pattern, only the triples added by the session if 'uncommitted'.
+		std::string getConditions(const Pattern& pattern, std::vector<std::string>& parameters, bool uncommitted = false) const;
+		std::string getShape(const Pattern& pattern, bool uncommitted = false) const;
+		void estimate(Pattern& pattern);
+		// the blobs of a variable of 'pattern' bound in all of 'current', if
+		// there are fewer of them than triples matching the pattern
+		boost::optional<Bindings> getBindings(const Pattern& pattern, const std::vector<Solution>& current) const;
+		// the matching triples, from the database resp. from the cache
+		std::list<std::vector<std::string> > fetch(const Pattern& pattern, const boost::optional<Bindings>& bindings, bool uncommitted = false);
+		std::list<std::vector<std::string> > fetch(const Pattern& pattern, const boost::optional<Bindings>& bindings, TripleCache& cache, const std::unordered_set<uint64_t>& removed);
+		std::vector<std::size_t> getJoinOrder() const;
+	
+	public:
+		// Throws if the query is malformed or refers to unknown or invisible
+		// blobs or to unknown prefixes. Unknown types aren't added, literals
+		// of them just don't match.
+		Query(Environment& env, const std::string& text);
+		
+		const std::vector<std::string>& getVariables() const;
+		
+		// Calls 'callback' with the terms of each solution (in the order of
+		// getVariables) until it returns false. Patterns are joined smallest
+		// first by hashing the bindings of their shared variables, and the
+		// last join hands out solutions as they are found. If the partial
+		// solutions are fewer than the triples of the next pattern, only the
+		// triples of their subjects resp. objects are fetched.
+		void execute(const std::function<bool(const std::vector<Term>&)>& callback);
+	};
+
+}
+
+#endif
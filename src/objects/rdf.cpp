@@ -0,0 +1,666 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "rdf.hpp"
+#include "../env/environment.hpp"
+#include "../util/threads.hpp"
+
+namespace
+{
+	
+	const std::string rdfType = "http://www.w3.org/1999/02/22-rdf-syntax-ns#type";
+	
+	// The XML schema types stored as the system types, only those written
+	// back as they are. Others such as xsd:int or xsd:decimal would lose
+	// their range or precision, hence they are types of their own.
+	const std::unordered_map<std::string, uint64_t> systemTypes = {
+		{ "integer", ASSOCIATIVE_SYS_INTEGER_TYPE },
+		{ "double", ASSOCIATIVE_SYS_DOUBLE_TYPE },
+		{ "dateTime", ASSOCIATIVE_SYS_TIMESTAMP_TYPE },
+		{ "date", ASSOCIATIVE_SYS_TIMESTAMP_TYPE }
+	};
+	
+	void appendUTF8(std::string& text, uint32_t c)
+	{
+		if (c < 0x80)
+		{
+			text += static_cast<char>(c);
+		}
+		else if (c < 0x800)
+		{
+			text += static_cast<char>(0xc0 | (c >> 6));
+			text += static_cast<char>(0x80 | (c & 0x3f));
+		}
+		else if (c < 0x10000)
+		{
+			text += static_cast<char>(0xe0 | (c >> 12));
+			text += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+			text += static_cast<char>(0x80 | (c & 0x3f));
+		}
+		else
+		{
+			text += static_cast<char>(0xf0 | (c >> 18));
+			text += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+			text += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+			text += static_cast<char>(0x80 | (c & 0x3f));
+		}
+	}
+	
+	std::string escapeUnicode(unsigned char c)
+	{
+		return (boost::format("\\u%04X") % static_cast<unsigned>(c)).str();
+	}
+	
+	std::string escapeIRI(const std::string& iri)
+	{
+		std::string escaped;
+		for (auto iter = iri.begin(); iter != iri.end(); ++iter)
+		{
+			auto c = static_cast<unsigned char>(*iter);
+			if (c <= 0x20 || std::strchr("<>\"{}|^`\\", c))
+				escaped += escapeUnicode(c);
+			else
+				escaped += *iter;
+		}
+		return escaped;
+	}
+	
+	std::string escapeLiteral(const std::string& value)
+	{
+		std::string escaped;
+		for (auto iter = value.begin(); iter != value.end(); ++iter)
+		{
+			auto c = static_cast<unsigned char>(*iter);
+			if (c == '"' || c == '\\')
+				escaped += std::string("\\") + *iter;
+			else if (c == '\n')
+				escaped += "\\n";
+			else if (c == '\r')
+				escaped += "\\r";
+			else if (c == '\t')
+				escaped += "\\t";
+			else if (c < 0x20 || c == 0x7f)
+				escaped += escapeUnicode(c);
+			else
+				escaped += *iter;
+		}
+		return escaped;
+	}
+	
+	bool isHex(const std::string& text)
+	{
+		return text.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos;
+	}
+	
+	std::string percentDecode(const std::string& text)
+	{
+		std::string decoded;
+		for (std::size_t i = 0; i < text.size(); ++i)
+		{
+			if (text[i] == '%' && i + 2 < text.size() && isHex(text.substr(i + 1, 2)))
+			{
+				decoded += static_cast<char>(std::stoi(text.substr(i + 1, 2), nullptr, 16));
+				i += 2;
+			}
+			else
+			{
+				decoded += text[i];
+			}
+		}
+		return decoded;
+	}
+	
+	// names which can be written after a Turtle prefix as they are
+	bool isLocalName(const std::string& name)
+	{
+		if (name.empty() || name.front() == '-')
+			return false;
+		for (auto iter = name.begin(); iter != name.end(); ++iter)
+			if (!std::isalnum(static_cast<unsigned char>(*iter)) && *iter != '_' && *iter != '-')
+				return false;
+		return true;
+	}
+	
+	bool isPrefixName(const std::string& name)
+	{
+		return !name.empty() && std::isalpha(static_cast<unsigned char>(name.front())) && isLocalName(name);
+	}
+	
+	// the terms of a line, one after another
+	class LineParser
+	{
+	private:
+		const std::string& line;
+		const std::size_t number;
+		const std::unordered_map<std::string, std::string>& namespaces;
+		std::size_t pos;
+		
+		// at a backslash
+		uint32_t readUnicode()
+		{
+			if (pos + 2 >= line.size() || (line[pos + 1] != 'u' && line[pos + 1] != 'U'))
+				throw error("invalid escape sequence");
+			std::size_t digits = line[pos + 1] == 'U' ? 8 : 4;
+			auto hex = line.substr(pos + 2, digits);
+			if (hex.size() != digits || !isHex(hex))
+				throw error("invalid escape sequence");
+			// the last digit, skipped by the caller
+			pos += digits + 1;
+			return std::stoul(hex, nullptr, 16);
+		}
+		
+		std::string resolve(const std::string& name)
+		{
+			auto colon = name.find(':');
+			if (colon == std::string::npos)
+				throw error("unexpected " + name);
+			auto ns = namespaces.find(name.substr(0, colon));
+			if (ns == namespaces.end())
+				throw error("undeclared prefix " + name.substr(0, colon));
+			return ns->second + name.substr(colon + 1);
+		}
+	
+	public:
+		LineParser(const std::string& line, std::size_t number, const std::unordered_map<std::string, std::string>& namespaces)
+		: line(line), number(number), namespaces(namespaces), pos(0)
+		{
+		}
+		
+		associative::Exception error(const std::string& message) const
+		{
+			return associative::formatException(boost::format("line %1%: %2%") % number % message);
+		}
+		
+		void skip()
+		{
+			while (pos < line.size() && std::isspace(static_cast<unsigned char>(line[pos])))
+				++pos;
+		}
+		
+		bool atEnd()
+		{
+			skip();
+			return pos == line.size() || line[pos] == '#';
+		}
+		
+		// up to the next space, without a final dot
+		std::string readWord()
+		{
+			skip();
+			auto start = pos;
+			while (pos < line.size() && !std::isspace(static_cast<unsigned char>(line[pos])))
+				++pos;
+			if (pos > start + 1 && line[pos - 1] == '.')
+				--pos;
+			return line.substr(start, pos - start);
+		}
+		
+		std::string readIRI()
+		{
+			skip();
+			if (pos == line.size() || line[pos] != '<')
+				throw error("IRI expected");
+			std::string iri;
+			for (++pos; pos < line.size() && line[pos] != '>'; ++pos)
+			{
+				if (line[pos] == '\\')
+					appendUTF8(iri, readUnicode());
+				else
+					iri += line[pos];
+			}
+			if (pos++ == line.size())
+				throw error("unterminated IRI");
+			return iri;
+		}
+		
+		std::string readResource(bool predicate)
+		{
+			skip();
+			if (pos == line.size())
+				throw error("incomplete statement");
+			if (line[pos] == '<')
+				return readIRI();
+			if (line.compare(pos, 2, "_:") == 0)
+				throw error("blank nodes are not supported");
+			auto name = readWord();
+			if (predicate && name == "a")
+				return rdfType;
+			return resolve(name);
+		}
+		
+		associative::RDFReader::Node readObject()
+		{
+			associative::RDFReader::Node node = { "", true, "", false };
+			skip();
+			if (pos == line.size())
+				throw error("incomplete statement");
+			if (line[pos] == '<' || line.compare(pos, 2, "_:") == 0)
+			{
+				node.value = readResource(false);
+				node.literal = false;
+				return node;
+			}
+			
+			if (line[pos] != '"')
+			{
+				// Turtle's numbers and booleans
+				auto word = readWord();
+				auto c = word.front();
+				if (std::isdigit(static_cast<unsigned char>(c)) || c == '+' || c == '-' || c == '.')
+				{
+					auto type = word.find_first_of("eE") != std::string::npos ? "double" : word.find('.') != std::string::npos ? "decimal" : "integer";
+					node.datatype = associative::RDF::xsd + type;
+				}
+				else if (word == "true" || word == "false")
+				{
+					node.datatype = associative::RDF::xsd + "boolean";
+				}
+				else
+				{
+					node.value = resolve(word);
+					node.literal = false;
+					return node;
+				}
+				node.value = word;
+				return node;
+			}
+			
+			if (line.compare(pos, 3, "\"\"\"") == 0)
+				throw error("long literals are not supported");
+			for (++pos; pos < line.size() && line[pos] != '"'; ++pos)
+			{
+				if (line[pos] != '\\')
+				{
+					node.value += line[pos];
+					continue;
+				}
+				if (pos + 1 == line.size())
+					break;
+				switch (line[pos + 1])
+				{
+					case 't': node.value += '\t'; break;
+					case 'b': node.value += '\b'; break;
+					case 'n': node.value += '\n'; break;
+					case 'r': node.value += '\r'; break;
+					case 'f': node.value += '\f'; break;
+					case '"': node.value += '"'; break;
+					case '\'': node.value += '\''; break;
+					case '\\': node.value += '\\'; break;
+					case 'u':
+					case 'U':
+						appendUTF8(node.value, readUnicode());
+						continue;
+					default:
+						throw error("invalid escape sequence");
+				}
+				++pos;
+			}
+			if (pos++ >= line.size())
+				throw error("unterminated literal");
+			
+			if (pos < line.size() && line[pos] == '@')
+			{
+				node.tagged = true;
+				for (++pos; pos < line.size() && (std::isalnum(static_cast<unsigned char>(line[pos])) || line[pos] == '-'); ++pos);
+			}
+			else if (line.compare(pos, 2, "^^") == 0)
+			{
+				pos += 2;
+				node.datatype = readResource(false);
+			}
+			return node;
+		}
+		
+		void finish(bool dot)
+		{
+			skip();
+			if (pos < line.size() && (line[pos] == ';' || line[pos] == ','))
+				throw error("predicate and object lists are not supported, one statement per line");
+			if (dot && (pos == line.size() || line[pos++] != '.'))
+				throw error("missing dot");
+			if (!atEnd())
+				throw error("unexpected " + line.substr(pos));
+		}
+	};
+
+}
+
+const std::string associative::RDF::blobScheme = "urn:uuid:";
+const std::string associative::RDF::xsd = "http://www.w3.org/2001/XMLSchema#";
+
+std::string associative::RDF::getBlobIRI(const std::string& uuid, const std::string& name)
+{
+	std::string iri = blobScheme + uuid + "#";
+	for (auto iter = name.begin(); iter != name.end(); ++iter)
+	{
+		auto c = static_cast<unsigned char>(*iter);
+		if (std::isalnum(c) || std::strchr("-._~", c))
+			iri += *iter;
+		else
+			iri += (boost::format("%%%02X") % static_cast<unsigned>(c)).str();
+	}
+	return iri;
+}
+
+const std::size_t associative::RDFReader::chunkSize = 65536;
+
+associative::RDFReader::RDFReader(associative::Environment& env, uint64_t batchSize)
+: env(env), batchSize(batchSize), prefixes(Prefix::getAll(env.getConnection()))
+{
+	// the usual names of prefixes yet to be added
+	names[RDF::xsd] = "xsd";
+	names["http://www.w3.org/1999/02/22-rdf-syntax-ns#"] = "rdf";
+}
+
+boost::optional<std::pair<std::string, std::string> > associative::RDFReader::parseDirective(const std::string& line, std::size_t number)
+{
+	LineParser parser(line, number, namespaces);
+	auto keyword = parser.readWord();
+	auto sparql = boost::iequals(keyword, "prefix");
+	if (keyword == "@base" || boost::iequals(keyword, "base"))
+		throw parser.error("base IRIs are not supported");
+	if (keyword != "@prefix" && !sparql)
+		return boost::none;
+	
+	auto name = parser.readWord();
+	if (name.empty() || name.back() != ':')
+		throw parser.error("prefix name expected");
+	name.pop_back();
+	auto uri = parser.readIRI();
+	parser.finish(!sparql);
+	return std::make_pair(name, uri);
+}
+
+std::pair<boost::shared_ptr<associative::Prefix>, std::string> associative::RDFReader::split(const std::string& iri)
+{
+	boost::shared_ptr<Prefix> best;
+	for (auto iter = prefixes.begin(); iter != prefixes.end(); ++iter)
+		if ((*iter)->uri.size() < iri.size() && (!best || (*iter)->uri.size() > best->uri.size()) && iri.compare(0, (*iter)->uri.size(), (*iter)->uri) == 0)
+			best = *iter;
+	if (best)
+		return std::make_pair(best, iri.substr(best->uri.size()));
+	
+	auto end = iri.find_last_of("#/:");
+	if (end == std::string::npos || end + 1 == iri.size())
+		throw formatException(boost::format("cannot split %1% into a prefix and a name") % iri);
+	auto uri = iri.substr(0, end + 1);
+	auto name = containsKey(names, uri) ? names[uri] : std::string("ns");
+	
+	// the name may be taken by another URI already
+	auto candidate = name;
+	for (unsigned i = 1; std::any_of(prefixes.begin(), prefixes.end(), [&](const boost::shared_ptr<Prefix>& prefix) { return prefix->name == candidate; }); ++i)
+		candidate = name + toString(i);
+	auto prefix = Prefix::get(env.getConnection(), candidate, uri);
+	prefixes.push_back(prefix);
+	return std::make_pair(prefix, iri.substr(uri.size()));
+}
+
+boost::shared_ptr<associative::Type> associative::RDFReader::getType(const std::string& datatype)
+{
+	auto found = types.find(datatype);
+	if (found != types.end())
+		return found->second;
+	
+	auto& conn = env.getConnection();
+	auto name = datatype.compare(0, RDF::xsd.size(), RDF::xsd) == 0 ? datatype.substr(RDF::xsd.size()) : std::string();
+	boost::shared_ptr<Type> type;
+	auto system = systemTypes.find(name);
+	if (system != systemTypes.end())
+		type = Type::fromID(conn, system->second);
+	else
+	{
+		auto parts = split(datatype.empty() ? RDF::xsd + "string" : datatype);
+		type = Type::get(conn, parts.second, parts.first);
+	}
+	types[datatype] = type;
+	return type;
+}
+
+associative::Blob& associative::RDFReader::getBlob(const std::string& iri)
+{
+	auto hash = iri.find('#');
+	if (iri.compare(0, RDF::blobScheme.size(), RDF::blobScheme) != 0 || hash == std::string::npos)
+		throw formatException(boost::format("%1% is no blob") % iri);
+	auto uuid = iri.substr(RDF::blobScheme.size(), hash - RDF::blobScheme.size());
+	return *env.getFile(uuid)->getBlob(percentDecode(iri.substr(hash + 1)));
+}
+
+uint64_t associative::RDFReader::add(const std::vector<std::string>& lines, std::size_t firstLine)
+{
+	if (lines.empty())
+		return 0;
+	
+	// a slice of lines per thread
+	auto threads = defaultThreadCount();
+	auto sliceSize = (lines.size() + threads - 1) / threads;
+	std::vector<std::pair<std::size_t, std::vector<Statement> > > slices;
+	for (std::size_t start = 0; start < lines.size(); start += sliceSize)
+		slices.push_back(std::make_pair(start, std::vector<Statement>()));
+	parallelForEach(slices, [&](std::pair<std::size_t, std::vector<Statement> >& slice) {
+		for (auto i = slice.first; i < std::min(slice.first + sliceSize, lines.size()); ++i)
+		{
+			auto statement = parse(lines[i], firstLine + i, namespaces);
+			if (statement)
+				slice.second.push_back(*statement);
+		}
+	}, threads);
+	
+	// the triples of each subject, in order of appearance
+	std::unordered_map<std::string, std::size_t> subjects;
+	std::vector<std::pair<std::string, std::vector<NewTriple> > > triples;
+	for (auto slice = slices.begin(); slice != slices.end(); ++slice)
+	{
+		for (auto statement = slice->second.begin(); statement != slice->second.end(); ++statement)
+		{
+			try
+			{
+				auto predicate = predicates.find(statement->predicate);
+				if (predicate == predicates.end())
+					predicate = predicates.insert(std::make_pair(statement->predicate, split(statement->predicate))).first;
+				auto& object = statement->object;
+				if (object.tagged)
+					throw Exception("language tags are not supported");
+				
+				auto index = subjects.insert(std::make_pair(statement->subject, triples.size()));
+				if (index.second)
+				{
+					// fails early if there is no such blob
+					getBlob(statement->subject);
+					triples.push_back(std::make_pair(statement->subject, std::vector<NewTriple>()));
+				}
+				auto& list = triples[index.first->second].second;
+				if (!object.literal)
+				{
+					list.push_back(NewTriple(predicate->second.first, predicate->second.second, getBlob(object.value)));
+					continue;
+				}
+				
+				auto type = getType(object.datatype);
+				auto column = Type::getColumn(type->id);
+				if (column != Type::Column::None)
+					Type::getColumnValue(column, object.value);
+				list.push_back(NewTriple(predicate->second.first, predicate->second.second, type, object.value));
+			}
+			catch (std::exception& e)
+			{
+				throw formatException(boost::format("line %1%: %2%") % statement->line % e.what());
+			}
+		}
+	}
+	
+	uint64_t count = 0;
+	for (auto iter = triples.begin(); iter != triples.end(); ++iter)
+		count += getBlob(iter->first).addTriples(iter->second).size();
+	return count;
+}
+
+uint64_t associative::RDFReader::read(std::istream& stream)
+{
+	uint64_t count = 0, pending = 0;
+	std::vector<std::string> lines;
+	std::size_t number = 0, first = 1;
+	// a line holds a triple at most, hence a chunk fits into a batch
+	auto limit = batchSize ? std::min<uint64_t>(chunkSize, batchSize) : chunkSize;
+	auto flush = [&]() {
+		if (batchSize && pending + lines.size() > batchSize)
+		{
+			env.commitSession(IsolationLevel::getIsolationLevel());
+			env.startSession();
+			pending = 0;
+		}
+		auto added = add(lines, first);
+		count += added;
+		pending += added;
+		lines.clear();
+		first = number + 1;
+	};
+	
+	std::string line;
+	while (std::getline(stream, line))
+	{
+		++number;
+		// directives only apply to the lines following them, so those
+		// buffered are added first
+		auto start = line.find_first_not_of(" \t");
+		auto directive = start != std::string::npos && std::strchr("@pPbB", line[start]) ? parseDirective(line, number) : boost::none;
+		if (directive)
+		{
+			flush();
+			namespaces[directive->first] = directive->second;
+			if (!directive->first.empty())
+				names[directive->second] = directive->first;
+			continue;
+		}
+		
+		lines.push_back(line);
+		if (lines.size() == limit)
+			flush();
+	}
+	flush();
+	return count;
+}
+
+boost::optional<associative::RDFReader::Statement> associative::RDFReader::parse(const std::string& line, std::size_t number, const std::unordered_map<std::string, std::string>& namespaces)
+{
+	LineParser parser(line, number, namespaces);
+	if (parser.atEnd())
+		return boost::none;
+	
+	Statement statement;
+	statement.line = number;
+	statement.subject = parser.readResource(false);
+	statement.predicate = parser.readResource(true);
+	statement.object = parser.readObject();
+	parser.finish(true);
+	return statement;
+}
+
+const std::size_t associative::RDFWriter::pageSize = 10000;
+
+associative::RDFWriter::RDFWriter(associative::Environment& env, associative::RDF::Format format)
+: env(env), format(format)
+{
+	if (format != RDF::Format::Turtle)
+		return;
+	
+	// relative URIs such as the system prefix's are written in full
+	bool xsd = false;
+	auto prefixes = Prefix::getAll(env.getConnection());
+	for (auto iter = prefixes.begin(); iter != prefixes.end(); ++iter)
+	{
+		xsd = xsd || (*iter)->name == "xsd";
+		if (isPrefixName((*iter)->name) && (*iter)->uri.find(':') != std::string::npos && !containsKey(names, (*iter)->uri))
+			names[(*iter)->uri] = (*iter)->name;
+	}
+	if (!xsd && !containsKey(names, RDF::xsd))
+		names[RDF::xsd] = "xsd";
+}
+
+std::string associative::RDFWriter::writeIRI(const std::string& uri, const std::string& name) const
+{
+	auto prefix = names.find(uri);
+	if (prefix != names.end() && isLocalName(name))
+		return prefix->second + ":" + name;
+	return "<" + escapeIRI(uri + name) + ">";
+}
+
+uint64_t associative::RDFWriter::write(std::ostream& stream)
+{
+	std::map<std::string, std::string> declarations;
+	for (auto iter = names.begin(); iter != names.end(); ++iter)
+		declarations[iter->second] = iter->first;
+	for (auto iter = declarations.begin(); iter != declarations.end(); ++iter)
+		stream << "@prefix " << iter->first << ": <" << escapeIRI(iter->second) << "> .\n";
+	
+	auto& conn = env.getConnection();
+	std::vector<std::string> conditionParameters;
+	auto conditions = env.getMetadataVisibility("m", conditionParameters);
+	auto query = conn.prepareQuery(
+		"select m.id, f.uuid, b.name, m.predicate_prefix_id, p.value, m.object_type_id, o.value, obf.uuid, ob.name from metadata m "
+		"inner join `blob` b on b.id = m.blob_id "
+		"inner join file f on f.id = b.file_id "
+		"inner join term p on p.id = m.predicate_id "
+		"inner join term o on o.id = m.object_id "
+		"left join `blob` ob on ob.id = m.object_blob_id "
+		"left join file obf on obf.id = ob.file_id "
+		"where " + conditions + " and m.id > ? order by m.id limit " + toString(pageSize),
+	"rdf.export" + std::string(env.getSessionID() ? "V" : ""));
+	
+	uint64_t count = 0;
+	std::string last = "-1";
+	for (bool more = true; more; )
+	{
+		auto parameters = conditionParameters;
+		parameters.push_back(last);
+		auto t = conn.transaction();
+		auto result = query->execute(parameters);
+		t->commit();
+		more = result.rows.size() == pageSize;
+		
+		for (auto row = result.rows.begin(); row != result.rows.end(); ++row)
+		{
+			last = row->at(0);
+			auto typeID = boost::lexical_cast<uint64_t>(row->at(5));
+			// blobs as objects which are gone
+			if (typeID == ASSOCIATIVE_SYS_BLOB_TYPE && row->at(7).empty())
+				continue;
+			
+			auto prefix = Prefix::fromID(conn, boost::lexical_cast<uint64_t>(row->at(3)));
+			stream << "<" << RDF::getBlobIRI(row->at(1), row->at(2)) << "> " << writeIRI(prefix->uri, row->at(4)) << " ";
+			if (typeID == ASSOCIATIVE_SYS_BLOB_TYPE)
+			{
+				stream << "<" << RDF::getBlobIRI(row->at(7), row->at(8)) << ">";
+			}
+			else
+			{
+				stream << "\"" << escapeLiteral(row->at(6)) << "\"";
+				auto type = Type::fromID(conn, typeID);
+				switch (Type::getColumn(typeID))
+				{
+					case Type::Column::Integer:
+						stream << "^^" << writeIRI(RDF::xsd, "integer");
+						break;
+					case Type::Column::Double:
+						stream << "^^" << writeIRI(RDF::xsd, "double");
+						break;
+					case Type::Column::Timestamp:
+						stream << "^^" << writeIRI(RDF::xsd, row->at(6).find('T') == std::string::npos ? "date" : "dateTime");
+						break;
+					default:
+						if (type->prefix->uri != RDF::xsd || type->name != "string")
+							stream << "^^" << writeIRI(type->prefix->uri, type->name);
+				}
+			}
+			// no flushing per line
+			stream << " .\n";
+			++count;
+		}
+	}
+	stream.flush();
+	return count;
+}
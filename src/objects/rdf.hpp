@@ -0,0 +1,126 @@
+#ifndef ASSOCIATIVE_RDF_HPP
+#define ASSOCIATIVE_RDF_HPP
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "triple.hpp"
+
+namespace associative
+{
+	
+	class Environment;
+	
+	// Metadata as RDF, in N-Triples or in Turtle with one statement per line.
+	// Blobs are <urn:uuid:UUID#name> with the name percent-encoded,
+	// predicates and types are the URIs of their prefixes followed by their
+	// names. The system types integer, double and timestamp are written as
+	// xsd:integer, xsd:double and xsd:dateTime resp. xsd:date, xsd:string
+	// as plain literals. Only these datatypes are read as the system types,
+	// any other is kept as a type of its own, so that literals are written
+	// back as they were read.
+	class RDF
+	{
+	public:
+		enum Format
+		{
+			NTriples,
+			Turtle
+		};
+		
+		static const std::string blobScheme;
+		static const std::string xsd;
+		
+		static std::string getBlobIRI(const std::string& uuid, const std::string& name);
+	};
+	
+	// Adds the statements read from a stream to the subject blobs. Lines are
+	// parsed in parallel, a chunk at a time, and the triples of each subject
+	// within a chunk are added at once. Predicates and types go to the
+	// known prefix with the longest matching URI; new prefixes are added
+	// under the names declared by @prefix, or as ns, ns1, ...
+	// With a batch size, the session is committed (at the default isolation
+	// level) and started anew before it would hold more triples than that,
+	// so that the journal of a session stays bounded. The last batch is
+	// left to the caller.
+	class RDFReader
+	{
+	public:
+		struct Node
+		{
+			// IRIs are resolved and unescaped, literals unescaped
+			std::string value;
+			bool literal;
+			// of literals, empty if plain
+			std::string datatype;
+			bool tagged;
+		};
+		
+		struct Statement
+		{
+			std::size_t line;
+			std::string subject;
+			std::string predicate;
+			Node object;
+		};
+	
+	private:
+		static const std::size_t chunkSize;
+		
+		Environment& env;
+		const uint64_t batchSize;
+		std::vector<boost::shared_ptr<Prefix> > prefixes;
+		// URIs by Turtle prefix name, and preferred names by URI
+		std::unordered_map<std::string, std::string> namespaces;
+		std::unordered_map<std::string, std::string> names;
+		std::unordered_map<std::string, std::pair<boost::shared_ptr<Prefix>, std::string> > predicates;
+		std::unordered_map<std::string, boost::shared_ptr<Type> > types;
+		
+		// the prefix name and URI declared by a directive, none for other lines
+		boost::optional<std::pair<std::string, std::string> > parseDirective(const std::string& line, std::size_t number);
+		// the known or a new prefix of 'iri' and the name following it
+		std::pair<boost::shared_ptr<Prefix>, std::string> split(const std::string& iri);
+		boost::shared_ptr<Type> getType(const std::string& datatype);
+		Blob& getBlob(const std::string& iri);
+		uint64_t add(const std::vector<std::string>& lines, std::size_t firstLine);
+	
+	public:
+		// 'batchSize' triples per commit at most, 0: all in the caller's
+		RDFReader(Environment& env, uint64_t batchSize = 0);
+		
+		// Throws at the first malformed or unsupported statement (blank
+		// nodes, language tags, IRIs other than blobs as subjects or objects,
+		// statements spanning lines), naming its line. The batches committed
+		// before stay. Returns the number of triples added.
+		uint64_t read(std::istream& stream);
+		
+		// the statement on a line, if any, with the prefix names declared in
+		// 'namespaces'
+		static boost::optional<Statement> parse(const std::string& line, std::size_t number, const std::unordered_map<std::string, std::string>& namespaces);
+	};
+	
+	// Writes all visible triples, a page at a time ordered by ID, so that
+	// memory use doesn't depend on the number of triples.
+	class RDFWriter
+	{
+	private:
+		static const std::size_t pageSize;
+		
+		Environment& env;
+		const RDF::Format format;
+		// Turtle prefix names by URI
+		std::unordered_map<std::string, std::string> names;
+		
+		std::string writeIRI(const std::string& uri, const std::string& name) const;
+	
+	public:
+		RDFWriter(Environment& env, RDF::Format format);
+		
+		// returns the number of triples written
+		uint64_t write(std::ostream& stream);
+	};
+
+}
+
+#endif
@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
+
+#include "term.hpp"
+
+const std::size_t associative::TermDictionary::batchSize;
+
+associative::TermDictionary::TermDictionary(associative::Connection& conn, const std::string& table)
+: conn(conn), table(table), cache(new Cache())
+{
+}
+
+void associative::TermDictionary::Cache::remember(uint64_t id, const std::string& value)
+{
+	if (values.size() >= capacity)
+	{
+		values.clear();
+		ids.clear();
+	}
+	values[id] = value;
+	ids[value] = id;
+}
+
+boost::optional<uint64_t> associative::TermDictionary::select(const associative::QueryResult& result, const std::string& value)
+{
+	for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+	{
+		if (iter->at(1) == value)
+			return boost::lexical_cast<uint64_t>(iter->at(0));
+	}
+	return boost::none;
+}
+
+void associative::TermDictionary::remember(const associative::TermDictionary::Terms& terms)
+{
+	if (terms.empty())
+		return;
+	
+	boost::weak_ptr<Cache> weak(cache);
+	conn.onCommit([weak, terms]()
+	{
+		auto cache = weak.lock();
+		if (!cache)
+			return;
+		boost::lock_guard<boost::mutex> guard(cache->mutex);
+		for (auto iter = terms.begin(); iter != terms.end(); ++iter)
+			cache->remember(iter->first, iter->second);
+	});
+}
+
+boost::optional<uint64_t> associative::TermDictionary::find(const std::string& value)
+{
+	{
+		boost::lock_guard<boost::mutex> guard(cache->mutex);
+		auto iter = cache->ids.find(value);
+		if (iter != cache->ids.end())
+			return iter->second;
+	}
+	
+	auto query = conn.prepareQuery("select id, value from " + table + " where value = ?", table + ".find");
+	auto id = select(query->execute(convertAll(value)), value);
+	if (id)
+		remember(Terms(1, std::make_pair(*id, value)));
+	return id;
+}
+
+uint64_t associative::TermDictionary::ensure(const std::string& value)
+{
+	auto id = find(value);
+	if (id)
+		return *id;
+	
+	auto newID = conn.nextID(table);
+	try
+	{
+		conn.prepareStatement("insert into " + table + " values (?, ?)", table + ".add")->execute(convertAll(newID, value));
+	}
+	catch (DBException&)
+	{
+		// another session has added the same term in the meantime
+		auto query = conn.prepareQuery("select id, value from " + table + " where value = ?", table + ".find");
+		auto existing = select(query->execute(convertAll(value)), value);
+		if (!existing)
+			throw;
+		newID = *existing;
+	}
+	remember(Terms(1, std::make_pair(newID, value)));
+	return newID;
+}
+
+std::vector<uint64_t> associative::TermDictionary::ensure(const std::vector<std::string>& values)
+{
+	std::unordered_map<std::string, uint64_t> found;
+	std::vector<std::string> missing;
+	{
+		boost::lock_guard<boost::mutex> guard(cache->mutex);
+		for (auto iter = values.begin(); iter != values.end(); ++iter)
+		{
+			auto cached = cache->ids.find(*iter);
+			if (cached != cache->ids.end())
+				found[*iter] = cached->second;
+			else if (!containsKey(found, *iter))
+			{
+				found[*iter] = 0;
+				missing.push_back(*iter);
+			}
+		}
+	}
+	
+	// those in the database already
+	Terms selected;
+	std::vector<std::string> added;
+	for (std::size_t start = 0; start < missing.size(); start += batchSize)
+	{
+		auto count = std::min(batchSize, missing.size() - start);
+		std::vector<std::string> batch(missing.begin() + start, missing.begin() + start + count);
+		std::string placeholders = "?";
+		for (std::size_t i = 1; i < count; ++i)
+			placeholders += ", ?";
+		auto query = conn.prepareQuery("select id, value from " + table + " where value in (" + placeholders + ")", table + ".find." + toString(count));
+		auto result = query->execute(batch);
+		std::unordered_map<std::string, uint64_t> existing;
+		for (auto row = result.rows.begin(); row != result.rows.end(); ++row)
+			existing[row->at(1)] = boost::lexical_cast<uint64_t>(row->at(0));
+		for (auto iter = batch.begin(); iter != batch.end(); ++iter)
+		{
+			auto known = existing.find(*iter);
+			if (known != existing.end())
+			{
+				found[*iter] = known->second;
+				selected.push_back(std::make_pair(known->second, *iter));
+			}
+			else
+			{
+				added.push_back(*iter);
+			}
+		}
+	}
+	remember(selected);
+	
+	// the others get a block of IDs
+	if (!added.empty())
+	{
+		auto first = conn.nextIDs(table, added.size());
+		try
+		{
+			for (std::size_t start = 0; start < added.size(); start += batchSize)
+			{
+				auto count = std::min(batchSize, added.size() - start);
+				std::string rows = "(?, ?)";
+				for (std::size_t i = 1; i < count; ++i)
+					rows += ", (?, ?)";
+				std::vector<std::string> parameters;
+				for (std::size_t i = start; i < start + count; ++i)
+				{
+					parameters.push_back(toString(first + i));
+					parameters.push_back(added[i]);
+				}
+				conn.prepareStatement("insert into " + table + " values " + rows, table + ".add." + toString(count))->execute(parameters);
+			}
+			
+			Terms inserted;
+			for (std::size_t i = 0; i < added.size(); ++i)
+			{
+				found[added[i]] = first + i;
+				inserted.push_back(std::make_pair(first + i, added[i]));
+			}
+			remember(inserted);
+		}
+		catch (DBException&)
+		{
+			// another session has added some of them in the meantime
+			for (auto iter = added.begin(); iter != added.end(); ++iter)
+				found[*iter] = ensure(*iter);
+		}
+	}
+	
+	std::vector<uint64_t> result;
+	for (auto iter = values.begin(); iter != values.end(); ++iter)
+		result.push_back(found[*iter]);
+	return result;
+}
+
+std::string associative::TermDictionary::get(uint64_t id)
+{
+	{
+		boost::lock_guard<boost::mutex> guard(cache->mutex);
+		auto iter = cache->values.find(id);
+		if (iter != cache->values.end())
+			return iter->second;
+	}
+	
+	auto query = conn.prepareQuery("select value from " + table + " where id = ?", table + ".get");
+	auto result = query->execute(convertAll(id));
+	if (result.rows.empty())
+		throw formatException(boost::format("%1% %2% doesn't exist") % table % id);
+	
+	auto value = result.rows.front().at(0);
+	remember(Terms(1, std::make_pair(id, value)));
+	return value;
+}
@@ -0,0 +1,70 @@
+#ifndef ASSOCIATIVE_TERM_HPP
+#define ASSOCIATIVE_TERM_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include "../db/connection.hpp"
+#include "../util/util.hpp"
+
+namespace associative
+{
+	
+	// The predicates and objects of triples, each stored once in the term
+	// table and referred to by its ID from the metadata. Terms are compared
+	// byte by byte. Committed terms seen are kept in memory, until there are
+	// more than 'capacity' of them and the cache starts over. The words of
+	// the text index are kept the same way, but in a table of their own.
+	class TermDictionary
+	{
+	private:
+		// Shared with the actions run when the transaction adding terms
+		// commits, which may come after the dictionary is gone.
+		struct Cache
+		{
+			boost::mutex mutex;
+			std::unordered_map<uint64_t, std::string> values;
+			std::unordered_map<std::string, uint64_t> ids;
+			
+			void remember(uint64_t id, const std::string& value);
+		};
+		
+		// IDs and values
+		typedef std::vector<std::pair<uint64_t, std::string> > Terms;
+		
+		Connection& conn;
+		// also the name of the IDs and the prefix of the statement names
+		const std::string table;
+		boost::shared_ptr<Cache> cache;
+		
+		// terms per statement when looking up or adding many
+		static const std::size_t batchSize = 100;
+		
+		// the ID of 'value' if it matches exactly, whatever the collation
+		static boost::optional<uint64_t> select(const QueryResult& result, const std::string& value);
+		// Terms read or added within a transaction are remembered only once
+		// it commits, so that no ID of a rolled back row is handed out from
+		// memory.
+		void remember(const Terms& terms);
+		
+	public:
+		static const std::size_t capacity = 1 << 16;
+		
+		TermDictionary(Connection& conn, const std::string& table = "term");
+		TermDictionary(TermDictionary&) = delete;
+		TermDictionary& operator=(TermDictionary&) = delete;
+		
+		boost::optional<uint64_t> find(const std::string& value);
+		// adds the term if it doesn't exist yet, within the caller's transaction
+		uint64_t ensure(const std::string& value);
+		// the same for many terms at once, with a statement per batch of them
+		std::vector<uint64_t> ensure(const std::vector<std::string>& values);
+		std::string get(uint64_t id);
+	};
+	
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
+
+#include "traversal.hpp"
+#include "../env/environment.hpp"
+
+const std::size_t associative::Traversal::batchSize = 500;
+
+associative::Traversal::Traversal(associative::Environment& env, associative::Traversal::Direction direction, const associative::TripleFilter& filter)
+: env(env), direction(direction), predicatePrefix(filter.predicatePrefix), predicate(filter.predicate)
+{
+}
+
+associative::TripleFilter associative::Traversal::getFilter() const
+{
+	TripleFilter filter;
+	filter.predicatePrefix = predicatePrefix;
+	filter.predicate = predicate;
+	filter.objectType = Type::getBlobType(env.getConnection());
+	return filter;
+}
+
+void associative::Traversal::fetch(const std::vector<uint64_t>& frontier, bool incoming, bool uncommitted, std::vector<Link>& links)
+{
+	auto filter = getFilter();
+	std::vector<std::string> conditionParameters;
+	auto conditions = env.getMetadataVisibility("m", conditionParameters, uncommitted);
+	conditions += filter.getConditions("m", conditionParameters);
+	std::string blobs = "?";
+	for (std::size_t i = 1; i < batchSize; ++i)
+		blobs += ", ?";
+	
+	auto query = env.getConnection().prepareQuery(
+		std::string(incoming ?
+			"select m.id, m.object_blob_id, b.id, f.uuid, b.name from metadata m "
+			"inner join `blob` b on b.id = m.blob_id " :
+			"select m.id, m.blob_id, b.id, f.uuid, b.name from metadata m "
+			"inner join `blob` b on b.id = m.object_blob_id ") +
+		"inner join file f on f.id = b.file_id "
+		"where " + conditions + " and " + (incoming ? "m.object_blob_id" : "m.blob_id") + " in (" + blobs + ")",
+	"traversal." + std::string(incoming ? "in" : "out") + filter.getShape() + (uncommitted ? "U" : env.getSessionID() ? "V" : ""));
+	
+	for (std::size_t start = 0; start < frontier.size(); start += batchSize)
+	{
+		// the last batch is padded with its last blob, so that all of them
+		// share the same statement
+		auto parameters = conditionParameters;
+		for (std::size_t i = start; i < start + batchSize; ++i)
+			parameters.push_back(toString(frontier[std::min(i, frontier.size() - 1)]));
+		
+		auto result = query->execute(parameters);
+		for (auto iter = result.rows.begin(); iter != result.rows.end(); ++iter)
+		{
+			Link link = {
+				boost::lexical_cast<uint64_t>(iter->at(0)), boost::lexical_cast<uint64_t>(iter->at(1)),
+				boost::lexical_cast<uint64_t>(iter->at(2)), iter->at(3), iter->at(4)
+			};
+			links.push_back(link);
+		}
+	}
+}
+
+void associative::Traversal::fetch(const std::vector<uint64_t>& frontier, bool incoming, TripleCache& cache, const std::unordered_set<uint64_t>& removed, std::vector<Link>& links)
+{
+	// the cache finds the links of every blob by binary search
+	auto& conn = env.getConnection();
+	auto filter = getFilter();
+	for (auto blob = frontier.begin(); blob != frontier.end(); ++blob)
+	{
+		if (incoming)
+			filter.object = toString(*blob);
+		auto matches = incoming ? cache.getTriples(conn, filter) : cache.getTriples(conn, filter, *blob);
+		for (auto iter = matches.begin(); iter != matches.end(); ++iter)
+		{
+			if (containsKey(removed, iter->id))
+				continue;
+			auto other = incoming ? iter->subject : boost::lexical_cast<uint64_t>(iter->object);
+			auto name = cache.getBlob(conn, other);
+			if (!name)
+				continue;
+			Link link = { iter->id, *blob, other, name->first, name->second };
+			links.push_back(link);
+		}
+	}
+	
+	// the session's own triples aren't cached
+	if (env.getSessionID())
+		fetch(frontier, incoming, true, links);
+}
+
+std::vector<associative::Traversal::Link> associative::Traversal::expand(const std::vector<uint64_t>& frontier, TripleCache* cache, const std::unordered_set<uint64_t>& removed)
+{
+	std::vector<Link> links;
+	for (auto incoming : { false, true })
+	{
+		if (direction != Direction::Both && incoming != (direction == Direction::Incoming))
+			continue;
+		if (cache)
+			fetch(frontier, incoming, *cache, removed, links);
+		else
+			fetch(frontier, incoming, false, links);
+	}
+	
+	std::sort(links.begin(), links.end(), [](const Link& a, const Link& b) {
+		return a.tripleID < b.tripleID || (a.tripleID == b.tripleID && a.from < b.from);
+	});
+	return links;
+}
+
+std::vector<associative::Traversal::Node> associative::Traversal::neighbors(uint64_t blob)
+{
+	auto& conn = env.getConnection();
+	auto t = conn.transaction();
+	auto cache = env.getTripleCache();
+	std::unordered_set<uint64_t> removed;
+	if (cache)
+		removed = env.getRemovedTriples();
+	auto links = expand(std::vector<uint64_t>(1, blob), cache, removed);
+	t->commit();
+	
+	std::vector<Node> nodes;
+	std::unordered_set<uint64_t> seen;
+	for (auto iter = links.begin(); iter != links.end(); ++iter)
+	{
+		if (!seen.insert(iter->to).second)
+			continue;
+		Node node = { iter->to, iter->uuid, iter->name, 1, iter->from, iter->tripleID };
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+void associative::Traversal::walk(uint64_t start, unsigned maxDepth, const std::function<bool(const Node&)>& callback)
+{
+	auto& conn = env.getConnection();
+	auto cache = env.getTripleCache();
+	std::unordered_set<uint64_t> removed;
+	if (cache)
+		removed = env.getRemovedTriples();
+	
+	std::unordered_set<uint64_t> visited = { start };
+	std::vector<uint64_t> frontier(1, start);
+	for (unsigned depth = 1; depth <= maxDepth && !frontier.empty(); ++depth)
+	{
+		// the callback may use the database itself, so each hop has a
+		// transaction of its own
+		auto t = conn.transaction();
+		auto links = expand(frontier, cache, removed);
+		t->commit();
+		
+		std::vector<uint64_t> next;
+		for (auto iter = links.begin(); iter != links.end(); ++iter)
+		{
+			if (!visited.insert(iter->to).second)
+				continue;
+			Node node = { iter->to, iter->uuid, iter->name, depth, iter->from, iter->tripleID };
+			if (!callback(node))
+				return;
+			next.push_back(iter->to);
+		}
+		frontier.swap(next);
+	}
+}
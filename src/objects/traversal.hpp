@@ -0,0 +1,89 @@
+#ifndef ASSOCIATIVE_TRAVERSAL_HPP
+#define ASSOCIATIVE_TRAVERSAL_HPP
+
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace associative
+{
+	
+	class Environment;
+	class Prefix;
+	class TripleCache;
+	class TripleFilter;
+	
+	// Walks the graph formed by the triples whose objects are blobs. Each hop
+	// expands the whole frontier at once, fetching the links of up to
+	// 'batchSize' blobs with a single query.
+	class Traversal
+	{
+	public:
+		enum Direction
+		{
+			// from subjects to objects
+			Outgoing,
+			Incoming,
+			Both
+		};
+		
+		// a blob reached
+		struct Node
+		{
+			uint64_t id;
+			std::string uuid;
+			std::string name;
+			// hops from the start
+			unsigned depth;
+			// the blob it has been reached from and the triple linking both
+			uint64_t parent;
+			uint64_t tripleID;
+		};
+	
+	private:
+		// a triple linking 'from' to 'to' in the direction of the traversal
+		struct Link
+		{
+			uint64_t tripleID;
+			uint64_t from;
+			uint64_t to;
+			std::string uuid;
+			std::string name;
+		};
+		
+		static const std::size_t batchSize;
+		
+		Environment& env;
+		const Direction direction;
+		boost::shared_ptr<Prefix> predicatePrefix;
+		boost::optional<std::string> predicate;
+		
+		TripleFilter getFilter() const;
+		void fetch(const std::vector<uint64_t>& frontier, bool incoming, bool uncommitted, std::vector<Link>& links);
+		void fetch(const std::vector<uint64_t>& frontier, bool incoming, TripleCache& cache, const std::unordered_set<uint64_t>& removed, std::vector<Link>& links);
+		// the links of all blobs in 'frontier', ordered by triple, from the
+		// cache (skipping the triples 'removed' by the session) if given
+		std::vector<Link> expand(const std::vector<uint64_t>& frontier, TripleCache* cache, const std::unordered_set<uint64_t>& removed);
+	
+	public:
+		// Follows triples matching the predicate (and its prefix) of 'filter',
+		// if given. The other conditions of the filter are ignored.
+		Traversal(Environment& env, Direction direction, const TripleFilter& filter);
+		
+		// the blobs linked to 'blob', each once
+		std::vector<Node> neighbors(uint64_t blob);
+		
+		// Calls 'callback' with each blob reachable from 'start' within
+		// 'maxDepth' hops, breadth first and until it returns false. Every
+		// blob is reported once, at its shortest distance, so cycles end the
+		// walk instead of repeating it. The start isn't reported.
+		void walk(uint64_t start, unsigned maxDepth, const std::function<bool(const Node&)>& callback);
+	};
+
+}
+
+#endif
@@ -3,17 +3,45 @@
 #include <boost/uuid/uuid_io.hpp>
 
 #include "triple.hpp"
+#include "term.hpp"
+
+namespace
+{
+	
+	// the smallest string greater than all strings starting with 'prefix',
+	// if there is one
+	boost::optional<std::string> successor(std::string prefix)
+	{
+		while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xff)
+			prefix.erase(prefix.size() - 1);
+		if (prefix.empty())
+			return boost::none;
+		prefix.back() = static_cast<char>(static_cast<unsigned char>(prefix.back()) + 1);
+		return prefix;
+	}
+	
+}
 
 associative::Triple::Triple(
-	const uint64_t id, const Blob* blob,
-	const boost::shared_ptr<associative::Prefix>& predicatePrefix, const std::string& predicate,
-	const boost::shared_ptr<associative::Type>& objectType, const std::string& object)
-: blob(blob), id(id),
-  predicatePrefix(predicatePrefix), predicate(predicate),
-  objectType(objectType), object(object)
+	const uint64_t id, const Blob* blob, associative::TermDictionary* terms,
+	const boost::shared_ptr<associative::Prefix>& predicatePrefix, const uint64_t predicateID,
+	const boost::shared_ptr<associative::Type>& objectType, const uint64_t objectID)
+: blob(blob), terms(terms), id(id),
+  predicatePrefix(predicatePrefix), predicateID(predicateID),
+  objectType(objectType), objectID(objectID)
 {
 }
 
+std::string associative::Triple::getPredicate() const
+{
+	return terms->get(predicateID);
+}
+
+std::string associative::Triple::getObject() const
+{
+	return terms->get(objectID);
+}
+
 std::string associative::Triple::toSimpleString() const
 {
 	return toString(false);
@@ -31,14 +59,157 @@ std::string associative::Triple::toString(bool verbose) const
 	stream << blob->getFile().uuid << ":" << blob->name;
 	stream << ",";
 	if (verbose)
-		stream << "<" << predicatePrefix->uri << predicate << ">";
+		stream << "<" << predicatePrefix->uri << getPredicate() << ">";
 	else
-		stream << predicatePrefix->name << ":" << predicate;
+		stream << predicatePrefix->name << ":" << getPredicate();
 	stream << ",";
 	if (verbose)
-		stream << object << " :: <" << objectType->prefix->uri << objectType->name << ">";
+		stream << getObject() << " :: <" << objectType->prefix->uri << objectType->name << ">";
 	else
-		stream << object;
+		stream << getObject();
 	stream << ")";
 	return stream.str();
 }
+
+associative::NewTriple::NewTriple(
+	const boost::shared_ptr<associative::Prefix>& predicatePrefix, const std::string& predicate,
+	const boost::shared_ptr<associative::Type>& objectType, const std::string& object)
+: predicatePrefix(predicatePrefix), predicate(predicate), objectType(objectType), object(object)
+{
+	if (objectType->id == ASSOCIATIVE_SYS_BLOB_TYPE)
+		throw Exception("cannot use a blob as an object for a tuple here, use other constructor instead");
+}
+
+associative::NewTriple::NewTriple(const boost::shared_ptr<associative::Prefix>& predicatePrefix, const std::string& predicate, associative::Blob& blobObject)
+: predicatePrefix(predicatePrefix), predicate(predicate), object(associative::toString(blobObject.getID()))
+{
+}
+
+associative::TripleFilter::TripleFilter()
+{
+}
+
+bool associative::TripleFilter::matches(const Triple& triple) const
+{
+	if (predicatePrefix && triple.predicatePrefix->id != predicatePrefix->id)
+		return false;
+	if (predicate && triple.getPredicate() != *predicate)
+		return false;
+	if (objectType && triple.objectType->id != objectType->id)
+		return false;
+	if (!object && !objectPrefix && !objectFrom && !objectTo)
+		return true;
+	return matchesObject(triple.objectType->id, triple.getObject());
+}
+
+bool associative::TripleFilter::matchesObject(const uint64_t typeID, const std::string& value) const
+{
+	if (object && value != *object)
+		return false;
+	if (objectPrefix && value.compare(0, objectPrefix->size(), *objectPrefix))
+		return false;
+	// bounds of a well-known type don't apply to other types
+	auto typed = objectType && Type::getColumn(objectType->id) != Type::Column::None;
+	if (objectFrom && (typed ? Type::less(typeID, value, *objectFrom) : value < *objectFrom))
+		return false;
+	if (objectTo && (typed ? Type::less(typeID, *objectTo, value) : value > *objectTo))
+		return false;
+	return true;
+}
+
+std::string associative::TripleFilter::getConditions(const std::string& table, std::vector<std::string>& parameters) const
+{
+	std::ostringstream conditions;
+	if (predicatePrefix)
+	{
+		conditions << " and " << table << ".predicate_prefix_id = ?";
+		parameters.push_back(associative::toString(predicatePrefix->id));
+	}
+	if (predicate)
+	{
+		conditions << " and " << table << ".predicate_id = (select id from term where value = ?)";
+		parameters.push_back(*predicate);
+	}
+	if (objectType)
+	{
+		conditions << " and " << table << ".object_type_id = ?";
+		parameters.push_back(associative::toString(objectType->id));
+	}
+	if (object)
+	{
+		conditions << " and " << table << ".object_id = (select id from term where value = ?)";
+		parameters.push_back(*object);
+	}
+	
+	// bounds of the well-known types are compared by their own columns
+	auto column = objectType ? Type::getColumn(objectType->id) : Type::Column::None;
+	if (column != Type::Column::None)
+	{
+		auto name = Type::getColumnName(column);
+		if (objectFrom)
+		{
+			conditions << " and " << table << "." << name << " >= ?";
+			parameters.push_back(Type::getColumnValue(column, *objectFrom));
+		}
+		if (objectTo)
+		{
+			conditions << " and " << table << "." << name << " <= ?";
+			parameters.push_back(Type::getColumnValue(column, *objectTo));
+		}
+	}
+	
+	// The terms in range, found by the term table's index. A prefix is a
+	// range as well, so that it compares bytes as 'matches' does (LIKE
+	// ignores case in SQLite and can't use the index there).
+	std::string range;
+	if (objectPrefix)
+	{
+		range += " and value >= ?";
+		parameters.push_back(*objectPrefix);
+		auto end = successor(*objectPrefix);
+		if (end)
+		{
+			range += " and value < ?";
+			parameters.push_back(*end);
+		}
+	}
+	if (column == Type::Column::None)
+	{
+		if (objectFrom)
+		{
+			range += " and value >= ?";
+			parameters.push_back(*objectFrom);
+		}
+		if (objectTo)
+		{
+			range += " and value <= ?";
+			parameters.push_back(*objectTo);
+		}
+	}
+	if (!range.empty())
+		conditions << " and " << table << ".object_id in (select id from term where " << range.substr(5) << ")";
+	return conditions.str();
+}
+
+std::string associative::TripleFilter::getShape() const
+{
+	std::string shape;
+	if (predicatePrefix)
+		shape += 'P';
+	if (predicate)
+		shape += 'p';
+	if (objectType)
+		shape += 't';
+	if (object)
+		shape += 'o';
+	// with or without an upper bound
+	if (objectPrefix)
+		shape += successor(*objectPrefix) ? 's' : 'S';
+	if (objectFrom)
+		shape += 'f';
+	if (objectTo)
+		shape += 'u';
+	if (objectType && (objectFrom || objectTo))
+		shape += toString(Type::getColumn(objectType->id));
+	return shape;
+}
@@ -12,6 +12,7 @@ namespace associative
 	class Environment;
 	class Type;
 	class Prefix;
+	class TermDictionary;
 	
 	class Triple
 	{
@@ -19,19 +20,24 @@ namespace associative
 		
 	private:
 		const Blob* const blob;
+		TermDictionary* const terms;
 		
 		Triple(
-			const uint64_t id, const Blob* blob,
-			const boost::shared_ptr<Prefix>& predicatePrefix, const std::string& predicate,
-			const boost::shared_ptr<Type>& objectType, const std::string& object
+			const uint64_t id, const Blob* blob, TermDictionary* terms,
+			const boost::shared_ptr<Prefix>& predicatePrefix, const uint64_t predicateID,
+			const boost::shared_ptr<Type>& objectType, const uint64_t objectID
 		);
 		
 	public:
 		const uint64_t id;
 		const boost::shared_ptr<Prefix> predicatePrefix;
-		const std::string predicate;
+		const uint64_t predicateID;
 		const boost::shared_ptr<Type> objectType;
-		const std::string object;
+		const uint64_t objectID;
+		
+		// the strings are looked up in the term dictionary when asked for
+		std::string getPredicate() const;
+		std::string getObject() const;
 		
 		enum Operation
 		{
@@ -44,9 +50,53 @@ namespace associative
 		std::string toString(bool verbose) const;
 	};
 	
+	// A triple yet to be added by Blob::addTriples. The object is either a
+	// value of a type or a blob.
+	class NewTriple
+	{
+	public:
+		boost::shared_ptr<Prefix> predicatePrefix;
+		std::string predicate;
+		// unset for blobs
+		boost::shared_ptr<Type> objectType;
+		std::string object;
+		
+		NewTriple(
+			const boost::shared_ptr<Prefix>& predicatePrefix, const std::string& predicate,
+			const boost::shared_ptr<Type>& objectType, const std::string& object
+		);
+		NewTriple(const boost::shared_ptr<Prefix>& predicatePrefix, const std::string& predicate, Blob& blobObject);
+	};
+	
+	// Conditions on triples, all of which have to hold. Unset members don't
+	// restrict anything. The conditions are evaluated by the database, so
+	// only matching triples are transferred.
 	class TripleFilter
 	{
-		// TODO implement
+	public:
+		boost::shared_ptr<Prefix> predicatePrefix;
+		boost::optional<std::string> predicate;
+		boost::shared_ptr<Type> objectType;
+		boost::optional<std::string> object;
+		boost::optional<std::string> objectPrefix;
+		// Inclusive bounds, compared as numbers resp. points in time if the
+		// object type is one of the well-known types, as strings otherwise.
+		boost::optional<std::string> objectFrom;
+		boost::optional<std::string> objectTo;
+		boost::optional<uint64_t> limit;
+		
+		TripleFilter();
+		
+		bool matches(const Triple& triple) const;
+		// the conditions on the value of an object of type 'typeID', not on
+		// the type itself
+		bool matchesObject(const uint64_t typeID, const std::string& value) const;
+		
+		// Appends the conditions on the columns of 'table' to a where clause
+		// (each starting with "and") and their parameters to 'parameters'.
+		std::string getConditions(const std::string& table, std::vector<std::string>& parameters) const;
+		// identifies the conditions (not their values), for prepared query keys
+		std::string getShape() const;
 	};
 	
 };
@@ -1,4 +1,109 @@
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+
+#include <boost/date_time/gregorian/gregorian_types.hpp>
+
 #include "type.hpp"
+#include "intern.hpp"
+
+namespace
+{
+	
+	int64_t parseInteger(const std::string& value)
+	{
+		try
+		{
+			return boost::lexical_cast<int64_t>(value);
+		}
+		catch (boost::bad_lexical_cast&)
+		{
+			throw associative::formatException(boost::format("%1% is no integer") % value);
+		}
+	}
+	
+	double parseDouble(const std::string& value)
+	{
+		double result;
+		try
+		{
+			result = boost::lexical_cast<double>(value);
+		}
+		catch (boost::bad_lexical_cast&)
+		{
+			throw associative::formatException(boost::format("%1% is no number") % value);
+		}
+		// NaN isn't ordered, and infinities aren't numbers to the databases
+		if (!std::isfinite(result))
+			throw associative::formatException(boost::format("%1% is no number") % value);
+		return result;
+	}
+	
+	// Microseconds since 1970 of an ISO 8601 timestamp, YYYY-MM-DD optionally
+	// followed by Thh:mm:ss with a fraction of a second and the time zone (Z
+	// or +hh:mm, UTC if not given).
+	int64_t parseTimestamp(const std::string& value)
+	{
+		auto invalid = [&value]() { return associative::formatException(boost::format("%1% is no timestamp") % value); };
+		auto digits = [&value](std::size_t start, std::size_t count) {
+			for (std::size_t i = start; i < start + count; ++i)
+				if (i >= value.size() || !std::isdigit(static_cast<unsigned char>(value[i])))
+					return false;
+			return true;
+		};
+		
+		unsigned year, month, day, hour = 0, minute = 0, second = 0;
+		if (!digits(0, 4) || !digits(5, 2) || !digits(8, 2) || value[4] != '-' || value[7] != '-' ||
+			std::sscanf(value.c_str(), "%4u-%2u-%2u", &year, &month, &day) != 3)
+			throw invalid();
+		std::size_t pos = 10;
+		int64_t fraction = 0;
+		if (pos < value.size() && value[pos] == 'T')
+		{
+			if (!digits(pos + 1, 2) || !digits(pos + 4, 2) || !digits(pos + 7, 2) || value[pos + 3] != ':' || value[pos + 6] != ':' ||
+				std::sscanf(value.c_str() + pos + 1, "%2u:%2u:%2u", &hour, &minute, &second) != 3 || hour > 23 || minute > 59 || second > 59)
+				throw invalid();
+			pos += 9;
+			if (pos < value.size() && value[pos] == '.')
+			{
+				if (!digits(++pos, 1))
+					throw invalid();
+				// digits beyond microseconds are cut off
+				for (int64_t scale = 100000; digits(pos, 1); ++pos, scale /= 10)
+					fraction += (value[pos] - '0') * scale;
+			}
+		}
+		
+		int64_t offset = 0;
+		if (pos < value.size() && value[pos] == 'Z')
+		{
+			++pos;
+		}
+		else if (pos < value.size() && (value[pos] == '+' || value[pos] == '-'))
+		{
+			if (!digits(pos + 1, 2) || !digits(pos + 4, 2) || value[pos + 3] != ':')
+				throw invalid();
+			offset = (std::stoi(value.substr(pos + 1, 2)) * 60 + std::stoi(value.substr(pos + 4, 2))) * 60;
+			if (value[pos] == '-')
+				offset = -offset;
+			pos += 6;
+		}
+		if (pos != value.size())
+			throw invalid();
+		
+		int64_t days;
+		try
+		{
+			days = (boost::gregorian::date(year, month, day) - boost::gregorian::date(1970, 1, 1)).days();
+		}
+		catch (std::out_of_range&)
+		{
+			throw invalid();
+		}
+		return ((days * 24 + hour) * 3600 + minute * 60 + second - offset) * 1000000 + fraction;
+	}
+	
+}
 
 associative::Type::Type(const uint64_t id, const std::string& name, const boost::shared_ptr<associative::Prefix>& prefix)
 : id(id), name(name), prefix(prefix)
@@ -10,40 +115,167 @@ associative::Type::Type(const associative::Type& type)
 {
 }
 
-boost::shared_ptr<associative::Type> associative::Type::get(associative::Connection& conn, const std::string& name, const boost::shared_ptr<associative::Prefix>& prefix)
+std::string associative::Type::getKey(const uint64_t prefixID, const std::string& name)
 {
-	auto query = conn.prepareQuery("select id from type where name = ? and prefix_id = ?", std::string("type.select"));
+	return toString(prefixID) + ":" + name;
+}
+
+boost::shared_ptr<associative::Type> associative::Type::intern(associative::Connection& conn, const std::vector<std::string>& row)
+{
+	boost::shared_ptr<Type> type(new Type(boost::lexical_cast<uint64_t>(row.at(0)), row.at(2), Prefix::fromID(conn, boost::lexical_cast<uint64_t>(row.at(1)))));
+	auto& cache = InternCache::get(conn);
+	// the row might have been inserted by the transaction it is read in
+	conn.onCommit([&cache, type]()
+	{
+		cache.typeIDs.set(type->id, cache.typeNames.set(getKey(type->prefix->id, type->name), type));
+	});
+	// the shared instance, unless interning waits for the commit
+	auto interned = cache.typeIDs.find(type->id);
+	return interned ? *interned : type;
+}
+
+boost::shared_ptr<associative::Type> associative::Type::find(associative::Connection& conn, const std::string& name, const boost::shared_ptr<associative::Prefix>& prefix)
+{
+	auto& cache = InternCache::get(conn);
+	auto key = getKey(prefix->id, name);
+	auto type = cache.typeNames.find(key);
+	if (type)
+		return *type;
+	if (cache.typeNames.missed(key))
+		return boost::shared_ptr<Type>();
+	
+	auto query = conn.prepareQuery("select id, prefix_id, name from type where name = ? and prefix_id = ?", std::string("type.select"));
 	auto result = query->execute(convertAll(name, prefix->id));
-	uint64_t id;
+	if (result.rows.size())
+		return intern(conn, result.rows.front());
 	
+	cache.typeNames.miss(key);
+	return boost::shared_ptr<Type>();
+}
+
+boost::shared_ptr<associative::Type> associative::Type::get(associative::Connection& conn, const std::string& name, const boost::shared_ptr<associative::Prefix>& prefix)
+{
+	auto& cache = InternCache::get(conn);
+	auto key = getKey(prefix->id, name);
+	auto type = cache.typeNames.find(key);
+	if (type)
+		return *type;
+	
+	auto query = conn.prepareQuery("select id, prefix_id, name from type where name = ? and prefix_id = ?", std::string("type.select"));
+	auto result = query->execute(convertAll(name, prefix->id));
 	if (result.rows.size())
+		return intern(conn, result.rows.front());
+	
+	auto id = conn.nextID("type");
+	try
 	{
-		id = boost::lexical_cast<uint64_t>(result.rows.front().at(0));
-	}
-	else
-	{
-		id = conn.nextID("type");
 		conn.prepareStatement(
 			"insert into type values (?, ?, ?)",
 		std::string("type.add"))->execute(convertAll(id, prefix->id, name));
 	}
+	catch (DBException&)
+	{
+		// added by another process in the meantime
+		auto existing = query->execute(convertAll(name, prefix->id));
+		if (existing.rows.empty())
+			throw;
+		return intern(conn, existing.rows.front());
+	}
 	
-	return boost::shared_ptr<Type>(new Type(id, name, prefix));
+	boost::shared_ptr<Type> added(new Type(id, name, prefix));
+	conn.onCommit([&cache, key, added]()
+	{
+		cache.typeIDs.set(added->id, cache.typeNames.set(key, added));
+	});
+	return added;
 }
 
-boost::shared_ptr<associative::Type> associative::Type::getBlobType(associative::Connection& conn)
+boost::shared_ptr<associative::Type> associative::Type::fromID(associative::Connection& conn, const uint64_t id)
 {
-	auto query = conn.prepareQuery(
-		"select prefix.id, prefix.name, prefix.uri, type.id, type.name "
-		"from prefix inner join type on type.prefix_id = prefix.id "
-		"where type.id = ? and prefix.id = ?",
-	std::string("type.fromid"));
-	auto result = query->execute(convertAll(ASSOCIATIVE_SYS_BLOB_TYPE, ASSOCIATIVE_SYS_PREFIX));
+	auto& cache = InternCache::get(conn);
+	auto type = cache.typeIDs.find(id);
+	if (type)
+		return *type;
 	
-	if (!result.rows.size())
+	if (!cache.typeIDs.missed(id))
+	{
+		auto query = conn.prepareQuery("select id, prefix_id, name from type where id = ?", std::string("type.fromid"));
+		auto result = query->execute(convertAll(id));
+		if (result.rows.size())
+			return intern(conn, result.rows.front());
+		cache.typeIDs.miss(id);
+	}
+	throw formatException(boost::format("type %1% doesn't exist") % id);
+}
+
+boost::shared_ptr<associative::Type> associative::Type::getBlobType(associative::Connection& conn)
+{
+	try
+	{
+		return fromID(conn, ASSOCIATIVE_SYS_BLOB_TYPE);
+	}
+	catch (Exception&)
+	{
 		throw Exception("internal error: blob type or system prefix not found");
-	
-	auto firstRow = result.rows.front();
-	boost::shared_ptr<Prefix> prefix(new Prefix(boost::lexical_cast<uint64_t>(firstRow.at(0)), firstRow.at(1), firstRow.at(2)));
-	return boost::shared_ptr<Type>(new Type(boost::lexical_cast<uint64_t>(firstRow.at(3)), firstRow.at(4), prefix));
+	}
+}
+
+associative::Type::Column associative::Type::getColumn(const uint64_t id)
+{
+	switch (id)
+	{
+		case ASSOCIATIVE_SYS_INTEGER_TYPE:
+			return Column::Integer;
+		case ASSOCIATIVE_SYS_DOUBLE_TYPE:
+			return Column::Double;
+		case ASSOCIATIVE_SYS_TIMESTAMP_TYPE:
+			return Column::Timestamp;
+		default:
+			return Column::None;
+	}
+}
+
+std::string associative::Type::getColumnName(const associative::Type::Column& column)
+{
+	switch (column)
+	{
+		case Column::Integer:
+			return "object_integer";
+		case Column::Double:
+			return "object_double";
+		case Column::Timestamp:
+			return "object_timestamp";
+		default:
+			return "";
+	}
+}
+
+std::string associative::Type::getColumnValue(const associative::Type::Column& column, const std::string& value)
+{
+	switch (column)
+	{
+		case Column::Integer:
+			return toString(parseInteger(value));
+		case Column::Double:
+			return toString(parseDouble(value));
+		case Column::Timestamp:
+			return toString(parseTimestamp(value));
+		default:
+			return value;
+	}
+}
+
+bool associative::Type::less(const uint64_t id, const std::string& a, const std::string& b)
+{
+	switch (getColumn(id))
+	{
+		case Column::Integer:
+			return parseInteger(a) < parseInteger(b);
+		case Column::Double:
+			return parseDouble(a) < parseDouble(b);
+		case Column::Timestamp:
+			return parseTimestamp(a) < parseTimestamp(b);
+		default:
+			return a < b;
+	}
 }
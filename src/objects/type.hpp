@@ -19,15 +19,45 @@ namespace associative
 	private:
 		Type(const uint64_t id, const std::string& name, const boost::shared_ptr<Prefix>& prefix);
 		
+		static std::string getKey(const uint64_t prefixID, const std::string& name);
+		// the type of a row (id, prefix_id, name), shared by everybody once the
+		// transaction it is read in commits
+		static boost::shared_ptr<Type> intern(Connection& conn, const std::vector<std::string>& row);
+		
 	public:
+		// The columns of the metadata table holding the values of the
+		// well-known types besides their terms, so that ranges of them are
+		// found by index.
+		enum Column
+		{
+			None,
+			Integer,
+			Double,
+			Timestamp
+		};
+		
 		Type(const Type& type);
 		
 		const uint64_t id;
 		const std::string name;
 		const boost::shared_ptr<Prefix> prefix;
 		
+		// the type if it exists, null otherwise
+		static boost::shared_ptr<Type> find(Connection& conn, const std::string& name, const boost::shared_ptr<Prefix>& prefix);
+		// adds the type if it doesn't exist
 		static boost::shared_ptr<Type> get(Connection& conn, const std::string& name, const boost::shared_ptr<Prefix>& prefix);
+		static boost::shared_ptr<Type> fromID(Connection& conn, const uint64_t id);
 		static boost::shared_ptr<Type> getBlobType(Connection& conn);
+		
+		static Column getColumn(const uint64_t id);
+		// the name of the column in the metadata table, empty for none
+		static std::string getColumnName(const Column& column);
+		// the column's value of 'value', throws if it isn't one of the type
+		static std::string getColumnValue(const Column& column, const std::string& value);
+		// Orders values of the type with the given ID, by their column's
+		// value if there is one, as strings otherwise. Throws if a value
+		// isn't one of the type.
+		static bool less(const uint64_t id, const std::string& a, const std::string& b);
 	};
 	
 }
@@ -1,4 +1,5 @@
 #include <sstream>
+#include <unordered_set>
 
 #include <boost/uuid/uuid_io.hpp>
 
@@ -6,6 +7,9 @@
 #include "../../util/io.hpp"
 #include "../../util/util.hpp"
 #include "../../objects/type.hpp"
+#include "../../objects/query.hpp"
+#include "../../objects/rdf.hpp"
+#include "../../objects/term.hpp"
 
 #include "gen/isolevel_impls.hpp"
 
@@ -33,12 +37,723 @@ TEST_F(Metadata, SimpleAdd)
 	auto triple = triples.front();
 	
 	ASSERT_EQ(Prefix::get(conn, "default")->id, triple.predicatePrefix->id);
-	ASSERT_EQ("test", triple.predicate);
+	ASSERT_EQ("test", triple.getPredicate());
 	ASSERT_EQ(Type::getBlobType(conn)->id, triple.objectType->id);
 	
 	env.commitSession(IsolationLevels::Full);
 }
 
+TEST_F(Metadata, Remove)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto file = env.createFile();
+	auto blob = file->addBlob("default", "text/plain");
+	auto uuid = toString(file->uuid);
+	auto prefix = Prefix::get(conn, "default", boost::make_optional(std::string("/")));
+	blob->addTriple(prefix, "kept", *blob);
+	blob->addTriple(prefix, "removed", *blob);
+	env.commitSession(IsolationLevels::Full);
+	
+	// removals are journaled like additions, and carried out by the commit
+	env.startSession();
+	TripleFilter filter;
+	filter.predicate = std::string("removed");
+	auto removed = env.getFile(uuid)->getBlob("default")->getTriples(filter).front().id;
+	conn.prepareStatement("insert into journal values (?, ?, ?, ?, ?, null, 0)")
+		->execute(convertAll(conn.nextID("journal"), *env.getSessionID(), Connection::Relation::Metadata, removed, Triple::Operation::Remove));
+	auto count = [&conn](const std::string& table, uint64_t id) {
+		return conn.prepareQuery("select count(*) from `" + table + "` where id = ?")->execute(convertAll(id)).rows.front().at(0);
+	};
+	auto blobs = count("blob", removed);
+	env.commitSession(IsolationLevels::Full);
+	
+	ASSERT_EQ("0", count("metadata", removed)) << "Removed triple not deleted";
+	ASSERT_EQ(blobs, count("blob", removed)) << "Blob with the ID of the removed triple deleted";
+	env.startSession();
+	auto triples = env.getFile(uuid)->getBlob("default")->getTriples(TripleFilter());
+	ASSERT_EQ((unsigned) 1, triples.size()) << "Wrong number of triples after removal";
+	ASSERT_EQ("kept", triples.front().getPredicate()) << "Wrong triple removed";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, Intern)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	auto& other = createBench()->env.getConnection();
+	
+	auto prefix = Prefix::get(conn, "intern", boost::make_optional(std::string("/intern/")));
+	auto type = Type::get(conn, "string", prefix);
+	ASSERT_EQ(prefix.get(), Prefix::get(other, "intern").get()) << "Added prefix not interned";
+	ASSERT_EQ(type.get(), Type::get(other, "string", prefix).get()) << "Added type not interned";
+	ASSERT_EQ(Prefix::get(conn, "intern").get(), Prefix::get(other, "intern").get()) << "Prefix not shared between connections";
+	ASSERT_EQ(Prefix::get(conn, "intern").get(), Prefix::fromID(conn, prefix->id).get()) << "Prefix by ID differs";
+	ASSERT_EQ(Type::get(conn, "string", prefix).get(), Type::fromID(other, type->id).get()) << "Type not shared between connections";
+	ASSERT_EQ(Type::getBlobType(conn).get(), Type::getBlobType(other).get());
+	
+	ASSERT_THROW(Prefix::get(conn, "missing"), Exception);
+	ASSERT_THROW(Prefix::get(conn, "missing"), Exception) << "Missing prefix found";
+	ASSERT_EQ("/missing/", Prefix::get(conn, "missing", boost::make_optional(std::string("/missing/")))->uri) << "Missing prefix not added";
+	ASSERT_THROW(Prefix::get(conn, "missing", boost::make_optional(std::string("/other/"))), Exception) << "Conflicting URI accepted";
+	
+	auto t = conn.transaction();
+	auto rolledBack = Prefix::get(conn, "rolled-back", boost::make_optional(std::string("/rolled-back/")));
+	auto rolledBackType = Type::get(conn, "string", rolledBack);
+	ASSERT_EQ(rolledBack->uri, Prefix::fromID(conn, rolledBack->id)->uri) << "Added prefix not found in its transaction";
+	ASSERT_EQ(rolledBackType->name, Type::fromID(conn, rolledBackType->id)->name) << "Added type not found in its transaction";
+	t->rollback();
+	ASSERT_THROW(Prefix::get(other, "rolled-back"), Exception) << "Rolled back prefix interned";
+	ASSERT_THROW(Prefix::fromID(other, rolledBack->id), Exception) << "Rolled back prefix interned by ID";
+	ASSERT_THROW(Type::fromID(other, rolledBackType->id), Exception) << "Rolled back type interned by ID";
+}
+
+TEST_F(Metadata, Filter)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto file = env.createFile();
+	auto blob = file->addBlob("default", "text/plain");
+	auto uuid = toString(file->uuid);
+	auto prefix = Prefix::get(conn, "default", boost::make_optional(std::string("/")));
+	auto type = Type::get(conn, "string", prefix);
+	blob->addTriple(prefix, "title", type, "alpha");
+	blob->addTriple(prefix, "title", type, "beta_1");
+	blob->addTriple(prefix, "size", type, "10");
+	blob->addTriple(prefix, "size", type, "20");
+	blob->addTriple(prefix, "self", *blob);
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	blob = env.getFile(uuid)->getBlob("default");
+	TripleFilter filter;
+	filter.predicate = std::string("title");
+	auto titles = blob->getTriples(filter);
+	ASSERT_EQ((unsigned) 2, titles.size()) << "Wrong number of triples with predicate";
+	ASSERT_EQ(titles.front().predicateID, titles.back().predicateID) << "Predicate not shared as a term";
+	ASSERT_EQ("beta_1", titles.back().getObject());
+	filter.objectPrefix = std::string("beta_");
+	ASSERT_EQ((unsigned) 1, blob->getTriples(filter).size()) << "Wrong number of triples with object prefix";
+	filter.objectPrefix = std::string("beta%");
+	ASSERT_EQ((unsigned) 0, blob->getTriples(filter).size()) << "Wildcard in object prefix not escaped";
+	filter.objectPrefix = std::string("BETA");
+	ASSERT_EQ((unsigned) 0, blob->getTriples(filter).size()) << "Object prefix matched another case";
+	filter.objectPrefix = std::string();
+	ASSERT_EQ((unsigned) 2, blob->getTriples(filter).size()) << "Empty object prefix didn't match all";
+	
+	filter = TripleFilter();
+	filter.predicate = std::string("size");
+	filter.objectFrom = std::string("10");
+	filter.objectTo = std::string("15");
+	auto triples = blob->getTriples(filter);
+	ASSERT_EQ((unsigned) 1, triples.size()) << "Wrong number of triples in range";
+	ASSERT_EQ("10", triples.front().getObject());
+	
+	filter = TripleFilter();
+	filter.objectType = Type::getBlobType(conn);
+	ASSERT_EQ((unsigned) 1, blob->getTriples(filter).size()) << "Wrong number of triples with object type";
+	
+	// triples added in this session count as well
+	filter = TripleFilter();
+	filter.predicatePrefix = prefix;
+	filter.object = std::string("gamma");
+	blob->addTriple(prefix, "title", type, "gamma");
+	ASSERT_EQ((unsigned) 1, blob->getTriples(filter).size()) << "New triple not matched";
+	filter = TripleFilter();
+	filter.limit = 3;
+	ASSERT_EQ((unsigned) 3, blob->getTriples(filter).size()) << "Limit not applied";
+	filter.limit = 2;
+	ASSERT_EQ((unsigned) 2, blob->getTriples(filter).size()) << "Other limit not applied";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, FindBlobs)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto prefix = Prefix::get(conn, "find", boost::make_optional(std::string("/find/")));
+	auto type = Type::get(conn, "string", prefix);
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	auto first = file->addBlob("first", "text/plain");
+	auto second = file->addBlob("second", "text/plain");
+	auto third = file->addBlob("third", "text/plain");
+	first->addTriple(prefix, "author", type, "alice");
+	first->addTriple(prefix, "author", type, "carol");
+	first->addTriple(prefix, "year", type, "2020");
+	second->addTriple(prefix, "author", type, "alice");
+	second->addTriple(prefix, "year", type, "2021");
+	third->addTriple(prefix, "author", type, "bob");
+	third->addTriple(prefix, "year", type, "2020");
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	std::vector<std::string> found;
+	auto collect = [&found, &uuid](const std::string& fileUUID, const std::string& name) {
+		if (fileUUID == uuid)
+			found.push_back(name);
+		return true;
+	};
+	
+	TripleFilter author;
+	author.predicatePrefix = prefix;
+	author.predicate = std::string("author");
+	author.object = std::string("alice");
+	env.findBlobs(std::vector<TripleFilter>(1, author), collect);
+	ASSERT_EQ((std::vector<std::string> { "first", "second" }), found) << "Wrong blobs found by one predicate";
+	
+	found.clear();
+	TripleFilter year;
+	year.predicatePrefix = prefix;
+	year.predicate = std::string("year");
+	year.object = std::string("2020");
+	env.findBlobs(std::vector<TripleFilter> { author, year }, collect);
+	ASSERT_EQ((std::vector<std::string> { "first" }), found) << "Wrong blobs found by two predicates";
+	
+	found.clear();
+	TripleFilter anyAuthor;
+	anyAuthor.predicatePrefix = prefix;
+	anyAuthor.predicate = std::string("author");
+	env.findBlobs(std::vector<TripleFilter>(1, anyAuthor), collect);
+	ASSERT_EQ((std::vector<std::string> { "first", "second", "third" }), found) << "Blob matching twice found twice";
+	
+	unsigned count = 0;
+	env.findBlobs(std::vector<TripleFilter>(1, author), [&count](const std::string&, const std::string&) { return ++count < 1; });
+	ASSERT_EQ((unsigned) 1, count) << "Finding didn't stop";
+	
+	found.clear();
+	env.findBlobs(std::vector<TripleFilter>(1, author), collect, (uint64_t) 1);
+	ASSERT_EQ((std::vector<std::string> { "first" }), found) << "Limit not applied";
+	found.clear();
+	env.findBlobs(std::vector<TripleFilter>(1, author), collect, (uint64_t) 0);
+	ASSERT_TRUE(found.empty()) << "Blobs found with a limit of 0";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, Query)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto prefix = Prefix::get(conn, "q", boost::make_optional(std::string("/q/")));
+	auto type = Type::get(conn, "string", prefix);
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	auto a = file->addBlob("a", "text/plain");
+	auto b = file->addBlob("b", "text/plain");
+	auto c = file->addBlob("c", "text/plain");
+	a->addTriple(prefix, "links", *b);
+	b->addTriple(prefix, "links", *c);
+	a->addTriple(prefix, "author", type, "alice");
+	c->addTriple(prefix, "author", type, "alice");
+	b->addTriple(prefix, "author", type, "bob");
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	std::vector<std::string> solutions;
+	auto collect = [&solutions](const std::vector<Query::Term>& terms) {
+		std::string solution;
+		for (auto iter = terms.begin(); iter != terms.end(); ++iter)
+			solution += (iter == terms.begin() ? "" : " ") + iter->text.substr(iter->text.find(':') + 1);
+		solutions.push_back(solution);
+		return true;
+	};
+	
+	Query path(env, "?x q:links ?y . ?y q:links ?z");
+	ASSERT_EQ((std::vector<std::string> { "x", "y", "z" }), path.getVariables());
+	path.execute(collect);
+	ASSERT_EQ((std::vector<std::string> { "a b c" }), solutions) << "Wrong solutions of a path";
+	
+	solutions.clear();
+	Query(env, "?x q:author \"alice\" . ?x q:links ?y").execute(collect);
+	ASSERT_EQ((std::vector<std::string> { "a b" }), solutions) << "Wrong solutions with a literal";
+	
+	// fewer partial solutions than triples fetch those of their blobs only
+	solutions.clear();
+	Query(env, "?x q:author \"bob\" . ?x q:links ?y").execute(collect);
+	ASSERT_EQ((std::vector<std::string> { "b c" }), solutions) << "Wrong solutions with bound subjects";
+	solutions.clear();
+	Query(env, "?y q:author \"bob\" . ?x q:links ?y").execute(collect);
+	ASSERT_EQ((std::vector<std::string> { "b a" }), solutions) << "Wrong solutions with bound objects";
+	
+	// uncommitted changes of the session are visible
+	solutions.clear();
+	file = env.getFile(uuid);
+	file->getBlob("c")->addTriple(prefix, "links", *file->getBlob("a"));
+	Query(env, "?x q:links <" + uuid + ":a>").execute(collect);
+	ASSERT_EQ((std::vector<std::string> { "c" }), solutions) << "Uncommitted triple not visible";
+	
+	// blobs added by the session can be referred to, removed ones not
+	solutions.clear();
+	file->addBlob("d", "text/plain")->addTriple(prefix, "links", *file->getBlob("a"));
+	Query(env, "<" + uuid + ":d> q:links ?y").execute(collect);
+	ASSERT_EQ((std::vector<std::string> { "a" }), solutions) << "Uncommitted blob not visible";
+	file->getBlob("b")->remove();
+	ASSERT_THROW(Query(env, "<" + uuid + ":b> q:links ?y"), Exception) << "Removed blob referred to";
+	
+	// unknown types aren't added
+	solutions.clear();
+	Query(env, "?x q:author \"alice\"^^q:unknown").execute(collect);
+	ASSERT_TRUE(solutions.empty()) << "Literal of an unknown type matched";
+	ASSERT_FALSE(Type::find(conn, "unknown", prefix)) << "Type added by a query";
+	
+	ASSERT_THROW(Query(env, "?x q:links"), Exception) << "Incomplete pattern accepted";
+	ASSERT_THROW(Query(env, "?x q:links ?y ?z"), Exception) << "Missing separator accepted";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, Cache)
+{
+	auto settings = StoreSettings::load(TestParameters::get().target);
+	settings.metadataCache = true;
+	auto& env = createBench(settings)->env;
+	auto& other = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto prefix = Prefix::get(conn, "cache", boost::make_optional(std::string("/cache/")));
+	auto type = Type::get(conn, "string", prefix);
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	file->addBlob("first", "text/plain")->addTriple(prefix, "author", type, "alice");
+	file->addBlob("second", "text/plain")->addTriple(prefix, "author", type, "bob");
+	env.commitSession(IsolationLevels::Full);
+	
+	TripleFilter alice;
+	alice.predicatePrefix = prefix;
+	alice.predicate = std::string("author");
+	alice.object = std::string("alice");
+	std::vector<std::string> found;
+	auto collect = [&found, &uuid](const std::string& fileUUID, const std::string& name) {
+		if (fileUUID == uuid)
+			found.push_back(name);
+		return true;
+	};
+	
+	env.startSession();
+	ASSERT_TRUE(env.getTripleCache()) << "Cache not enabled";
+	env.findBlobs(std::vector<TripleFilter>(1, alice), collect);
+	ASSERT_EQ((std::vector<std::string> { "first" }), found) << "Wrong blobs found in the cache";
+	auto triples = env.getFile(uuid)->getBlob("second")->getTriples(TripleFilter());
+	ASSERT_EQ((unsigned) 1, triples.size()) << "Wrong number of cached triples";
+	ASSERT_EQ("bob", triples.front().getObject());
+	ASSERT_EQ(type->id, triples.front().objectType->id);
+	
+	// predicates without prefix are looked up by name
+	TripleFilter author;
+	author.predicate = std::string("author");
+	found.clear();
+	env.findBlobs(std::vector<TripleFilter>(1, author), collect);
+	ASSERT_EQ((std::vector<std::string> { "first", "second" }), found) << "Wrong blobs found by predicate name";
+	env.commitSession(IsolationLevels::Full);
+	
+	// changes committed by another environment
+	other.startSession();
+	auto otherFile = other.getFile(uuid);
+	otherFile->getBlob("second")->addTriple(prefix, "author", type, "alice");
+	otherFile->removeBlob("first");
+	other.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	found.clear();
+	env.findBlobs(std::vector<TripleFilter>(1, alice), collect);
+	ASSERT_EQ((std::vector<std::string> { "second" }), found) << "Cache not updated";
+	triples = env.getFile(uuid)->getBlob("second")->getTriples(TripleFilter());
+	ASSERT_EQ((unsigned) 2, triples.size()) << "Added triple not in the cache";
+	ASSERT_EQ((unsigned) 2, env.getFile(uuid)->getBlob("second")->getTriples(author).size()) << "Wrong triples found by predicate name";
+	
+	Query query(env, "?blob cache:author \"alice\"^^cache:string");
+	unsigned count = 0;
+	query.execute([&count](const std::vector<Query::Term>&) { ++count; return true; });
+	ASSERT_EQ((unsigned) 1, count) << "Wrong number of solutions from the cache";
+	count = 0;
+	Query(env, "?blob cache:author \"alice\"^^cache:string . ?blob cache:author ?author").execute([&count](const std::vector<Query::Term>&) { ++count; return true; });
+	ASSERT_EQ((unsigned) 2, count) << "Wrong number of solutions with bound subjects from the cache";
+	env.commitSession(IsolationLevels::Full);
+	ASSERT_EQ(env.getTripleCache(), other.getTripleCache()) << "Cache not shared within the process";
+	
+	// a generation which becomes visible only after a later one
+	auto authors = [&](const std::string& author) {
+		TripleFilter filter(alice);
+		filter.object = author;
+		found.clear();
+		env.startSession();
+		env.findBlobs(std::vector<TripleFilter>(1, filter), collect);
+		env.commitSession(IsolationLevels::Full);
+		return found.size();
+	};
+	auto add = [&](const std::string& author) {
+		other.startSession();
+		other.getFile(uuid)->getBlob("second")->addTriple(prefix, "author", type, author);
+		other.commitSession(IsolationLevels::Full);
+	};
+	add("carol");
+	auto late = conn.prepareQuery("select max(generation) from metadata_log")->execute(convertAll()).rows.front().at(0);
+	auto entries = conn.prepareQuery("select relation, relation_id, operation from metadata_log where generation = ?")->execute(convertAll(late)).rows;
+	conn.prepareStatement("delete from metadata_log where generation = ?")->execute(convertAll(late));
+	add("dave");
+	ASSERT_EQ((std::size_t) 1, authors("dave")) << "Cache not updated";
+	
+	auto stmt = conn.prepareStatement("insert into metadata_log values (?, ?, ?, ?)");
+	for (auto iter = entries.begin(); iter != entries.end(); ++iter)
+		stmt->execute(convertAll(late, iter->at(0), iter->at(1), iter->at(2)));
+	add("erin");
+	ASSERT_EQ((std::size_t) 1, authors("carol")) << "Late generation not applied";
+	ASSERT_EQ((std::size_t) 1, authors("erin")) << "Cache not updated";
+	
+	// the terms of removed triples are dropped, and their slots reused
+	other.startSession();
+	other.getFile(uuid)->addBlob("third", "text/plain")->addTriple(prefix, "author", type, "frank");
+	other.commitSession(IsolationLevels::Full);
+	ASSERT_EQ((std::size_t) 1, authors("frank")) << "Cache not updated";
+	other.startSession();
+	other.getFile(uuid)->removeBlob("third");
+	other.commitSession(IsolationLevels::Full);
+	ASSERT_EQ((std::size_t) 0, authors("frank")) << "Triple of a removed blob still cached";
+	add("gina");
+	ASSERT_EQ((std::size_t) 1, authors("gina")) << "Term not cached in a reused slot";
+	ASSERT_EQ((std::size_t) 1, authors("erin")) << "Term still used dropped";
+}
+
+TEST_F(Metadata, AddBulk)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto prefix = Prefix::get(conn, "bulk", boost::make_optional(std::string("/bulk/")));
+	auto type = Type::get(conn, "string", prefix);
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	auto blob = file->addBlob("default", "text/plain");
+	auto other = file->addBlob("other", "text/plain");
+	
+	// more than a batch, with repeated and new terms
+	std::vector<NewTriple> triples;
+	for (unsigned i = 0; i < 250; ++i)
+		triples.push_back(NewTriple(prefix, i % 2 ? "odd" : "even", type, toString(i)));
+	triples.push_back(NewTriple(prefix, "links", *other));
+	auto added = blob->addTriples(triples);
+	ASSERT_EQ((unsigned) 251, added.size());
+	ASSERT_EQ(added.front().id + 250, added.back().id) << "IDs not reserved in a block";
+	ASSERT_EQ((unsigned) 251, blob->getTriples(TripleFilter()).size()) << "New triples not visible in the session";
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	blob = env.getFile(uuid)->getBlob("default");
+	TripleFilter filter;
+	filter.predicate = std::string("odd");
+	ASSERT_EQ((unsigned) 125, blob->getTriples(filter).size()) << "Wrong number of committed triples";
+	filter.predicate = std::string("links");
+	auto links = blob->getTriples(filter);
+	ASSERT_EQ((unsigned) 1, links.size());
+	ASSERT_EQ(Type::getBlobType(conn)->id, links.front().objectType->id);
+	ASSERT_EQ(toString(env.getFile(uuid)->getBlob("other")->getID()), links.front().getObject());
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, Terms)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	auto& terms = env.getTerms();
+	
+	// distinct terms, whatever the database's collation
+	auto ids = terms.ensure(convertAll("Alice", "alice", "alice ", "ALICE"));
+	ASSERT_EQ((unsigned) 4, std::unordered_set<uint64_t>(ids.begin(), ids.end()).size()) << "Case variants share a term";
+	ASSERT_EQ(ids[1], terms.ensure("alice"));
+	ASSERT_EQ(ids[2], terms.ensure("alice ")) << "Trailing space ignored";
+	ASSERT_EQ("alice ", TermDictionary(conn).get(ids[2]));
+	ASSERT_FALSE(TermDictionary(conn).find("aLiCe")) << "Term found by another case";
+	
+	auto t = conn.transaction();
+	terms.ensure("rolled back");
+	auto rolledBackBulk = terms.ensure(convertAll("rolled back 1", "rolled back 2"));
+	t->rollback();
+	ASSERT_FALSE(terms.find("rolled back")) << "Rolled back term still cached";
+	ASSERT_THROW(terms.get(rolledBackBulk[0]), Exception) << "Rolled back term still cached by ID";
+	auto id = terms.ensure("rolled back");
+	ASSERT_EQ("rolled back", TermDictionary(conn).get(id)) << "Term not added again";
+}
+
+TEST_F(Metadata, Traversal)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto prefix = Prefix::get(conn, "walk", boost::make_optional(std::string("/walk/")));
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	std::vector<std::string> names = { "a", "b", "c", "d", "e" };
+	for (auto iter = names.begin(); iter != names.end(); ++iter)
+		file->addBlob(*iter, "text/plain");
+	// a chain a -> b -> c -> d, which d closes to a cycle, and a shortcut
+	// of another predicate
+	for (std::size_t i = 0; i + 1 < names.size() - 1; ++i)
+		file->getBlob(names[i])->addTriple(prefix, "derived", *file->getBlob(names[i + 1]));
+	file->getBlob("d")->addTriple(prefix, "derived", *file->getBlob("a"));
+	file->getBlob("a")->addTriple(prefix, "cites", *file->getBlob("c"));
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	file = env.getFile(uuid);
+	TripleFilter derived;
+	derived.predicatePrefix = prefix;
+	derived.predicate = std::string("derived");
+	auto collect = [](const std::vector<Traversal::Node>& nodes) {
+		std::string result;
+		for (auto iter = nodes.begin(); iter != nodes.end(); ++iter)
+			result += iter->name + toString(iter->depth);
+		return result;
+	};
+	
+	ASSERT_EQ("b1", collect(file->getBlob("a")->neighbors(Traversal::Direction::Outgoing, derived)));
+	ASSERT_EQ("d1", collect(file->getBlob("a")->neighbors(Traversal::Direction::Incoming, derived)));
+	ASSERT_EQ("b1d1c1", collect(file->getBlob("a")->neighbors(Traversal::Direction::Both, TripleFilter())));
+	
+	std::vector<Traversal::Node> nodes;
+	auto append = [&nodes](const Traversal::Node& node) { nodes.push_back(node); return true; };
+	file->getBlob("a")->traverse(Traversal::Direction::Outgoing, derived, 100, append);
+	ASSERT_EQ("b1c2d3", collect(nodes)) << "Cycle not detected";
+	ASSERT_EQ(file->getBlob("c")->getID(), nodes.back().parent) << "Wrong parent";
+	
+	nodes.clear();
+	file->getBlob("a")->traverse(Traversal::Direction::Outgoing, TripleFilter(), 1, append);
+	ASSERT_EQ("b1c1", collect(nodes)) << "Depth limit ignored";
+	
+	// uncommitted links of the session are followed as well
+	nodes.clear();
+	file->getBlob("d")->addTriple(prefix, "derived", *file->getBlob("e"));
+	file->getBlob("a")->traverse(Traversal::Direction::Outgoing, derived, 100, append);
+	ASSERT_EQ("b1c2d3e4", collect(nodes)) << "Uncommitted link not followed";
+	
+	nodes.clear();
+	file->getBlob("e")->traverse(Traversal::Direction::Incoming, derived, 2, append);
+	ASSERT_EQ("d1c2", collect(nodes)) << "Wrong incoming walk";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, TypedRange)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto prefix = Prefix::get(conn, "typed", boost::make_optional(std::string("/typed/")));
+	auto system = Prefix::get(conn, "system");
+	auto integer = Type::get(conn, "integer", system);
+	auto timestamp = Type::get(conn, "timestamp", system);
+	auto real = Type::fromID(conn, ASSOCIATIVE_SYS_DOUBLE_TYPE);
+	ASSERT_EQ((uint64_t) ASSOCIATIVE_SYS_INTEGER_TYPE, integer->id);
+	
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	auto small = file->addBlob("small", "text/plain");
+	auto large = file->addBlob("large", "text/plain");
+	// compared as strings, "900" would be larger than "1073741824"
+	small->addTriple(prefix, "size", integer, "900");
+	large->addTriple(prefix, "size", integer, "5000000000");
+	small->addTriple(prefix, "created", timestamp, "2024-01-01T00:00:00Z");
+	large->addTriple(prefix, "created", timestamp, "2023-12-31T23:30:00-01:00");
+	ASSERT_THROW(small->addTriple(prefix, "size", integer, "large"), Exception) << "Invalid integer accepted";
+	ASSERT_THROW(small->addTriple(prefix, "created", timestamp, "2024-02-30"), Exception) << "Invalid timestamp accepted";
+	ASSERT_THROW(small->addTriple(prefix, "ratio", real, "nan"), Exception) << "NaN accepted";
+	ASSERT_THROW(small->addTriple(prefix, "ratio", real, "inf"), Exception) << "Infinity accepted";
+	ASSERT_THROW(small->addTriple(prefix, "ratio", real, "-inf"), Exception) << "Negative infinity accepted";
+	
+	TripleFilter size;
+	size.predicatePrefix = prefix;
+	size.predicate = std::string("size");
+	size.objectType = integer;
+	size.objectFrom = std::string("1073741824");
+	ASSERT_EQ((unsigned) 0, small->getTriples(size).size()) << "Uncommitted value compared as string";
+	ASSERT_EQ((unsigned) 1, large->getTriples(size).size());
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	std::vector<std::string> names;
+	auto collect = [&names](const std::string&, const std::string& name) { names.push_back(name); return true; };
+	env.findBlobs(std::vector<TripleFilter>(1, size), collect);
+	ASSERT_EQ((std::vector<std::string> { "large" }), names) << "Wrong blobs in integer range";
+	
+	// the second one is half an hour later in UTC
+	TripleFilter created;
+	created.predicatePrefix = prefix;
+	created.predicate = std::string("created");
+	created.objectType = timestamp;
+	created.objectFrom = std::string("2024-01-01T00:15:00+00:00");
+	created.objectTo = std::string("2024-01-02");
+	names.clear();
+	env.findBlobs(std::vector<TripleFilter>(1, created), collect);
+	ASSERT_EQ((std::vector<std::string> { "large" }), names) << "Wrong blobs in timestamp range";
+	
+	created.objectFrom = std::string("yesterday");
+	ASSERT_THROW(env.findBlobs(std::vector<TripleFilter>(1, created), collect), Exception) << "Invalid bound accepted";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, RDF)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	file->addBlob("a b", "text/plain");
+	file->addBlob("c", "text/plain");
+	env.commitSession(IsolationLevels::Full);
+	
+	auto a = RDF::getBlobIRI(uuid, "a b"), c = RDF::getBlobIRI(uuid, "c");
+	ASSERT_EQ("urn:uuid:" + uuid + "#a%20b", a) << "Blob name not encoded";
+	std::istringstream input(
+		"@prefix rdftest: <http://example.org/rdftest#> .\n"
+		"# a comment\n"
+		"<" + a + "> rdftest:size \"42\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n"
+		"<" + a + "> rdftest:count \"7\"^^<http://www.w3.org/2001/XMLSchema#int> .\n"
+		"<" + a + "> <http://example.org/rdftest#links> <" + c + "> .\n"
+		"\n"
+		"<" + c + "> rdftest:title \"say \\\"hi\\\"\\n\" .\n"
+		"<" + c + "> rdftest:ratio 0.5 .\n"
+	);
+	env.startSession();
+	ASSERT_EQ((uint64_t) 5, RDFReader(env).read(input)) << "Wrong number of triples read";
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	TripleFilter filter;
+	filter.predicatePrefix = Prefix::get(conn, "rdftest");
+	filter.objectType = Type::fromID(conn, ASSOCIATIVE_SYS_INTEGER_TYPE);
+	filter.objectFrom = std::string("0");
+	ASSERT_EQ((unsigned) 1, env.getFile(uuid)->getBlob("a b")->getTriples(filter).size()) << "Only xsd:integer to be stored as integer";
+	std::stringstream output;
+	RDFWriter(env, RDF::Format::NTriples).write(output);
+	env.commitSession(IsolationLevels::Full);
+	
+	// other tests' triples are written as well
+	std::string written, line;
+	while (std::getline(output, line))
+		if (line.find(uuid) != std::string::npos)
+			written += line + "\n";
+	ASSERT_EQ(
+		"<" + a + "> <http://example.org/rdftest#size> \"42\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n"
+		"<" + a + "> <http://example.org/rdftest#count> \"7\"^^<http://www.w3.org/2001/XMLSchema#int> .\n"
+		"<" + a + "> <http://example.org/rdftest#links> <" + c + "> .\n"
+		"<" + c + "> <http://example.org/rdftest#title> \"say \\\"hi\\\"\\n\" .\n"
+		"<" + c + "> <http://example.org/rdftest#ratio> \"0.5\"^^<http://www.w3.org/2001/XMLSchema#decimal> .\n",
+		written
+	) << "Triples written differently";
+	
+	std::istringstream tagged("<" + c + "> <http://example.org/rdftest#title> \"hi\"@en .\n");
+	env.startSession();
+	ASSERT_THROW(RDFReader(env).read(tagged), Exception) << "Language tag accepted";
+	env.rollbackSession();
+	
+	// a prefix may be bound again, but not used before it is bound
+	std::istringstream rebound(
+		"@prefix rb: <http://example.org/rdftest-first#> .\n"
+		"<" + c + "> rb:rebound \"1\" .\n"
+		"@prefix rb: <http://example.org/rdftest-second#> .\n"
+		"<" + c + "> rb:rebound \"2\" .\n"
+	);
+	env.startSession();
+	ASSERT_EQ((uint64_t) 2, RDFReader(env).read(rebound)) << "Wrong number of triples read with a rebound prefix";
+	std::stringstream reboundOutput;
+	RDFWriter(env, RDF::Format::NTriples).write(reboundOutput);
+	env.commitSession(IsolationLevels::Full);
+	auto reboundText = reboundOutput.str();
+	ASSERT_NE(std::string::npos, reboundText.find("<" + c + "> <http://example.org/rdftest-first#rebound> \"1\" .")) << "Rebinding applied to earlier lines";
+	ASSERT_NE(std::string::npos, reboundText.find("<" + c + "> <http://example.org/rdftest-second#rebound> \"2\" .")) << "Rebinding not applied to later lines";
+	std::istringstream early(
+		"<" + c + "> early:title \"hi\" .\n"
+		"@prefix early: <http://example.org/rdftest-early#> .\n"
+	);
+	env.startSession();
+	ASSERT_THROW(RDFReader(env).read(early), Exception) << "Prefix used before its directive";
+	env.rollbackSession();
+	
+	// all batches but the last are committed meanwhile
+	std::string batched;
+	for (unsigned i = 0; i < 5; ++i)
+		batched += "<" + c + "> <http://example.org/rdftest#batch> \"" + std::to_string(i) + "\" .\n";
+	std::istringstream batches(batched);
+	env.startSession();
+	ASSERT_EQ((uint64_t) 5, RDFReader(env, 2).read(batches)) << "Wrong number of triples read in batches";
+	env.rollbackSession();
+	env.startSession();
+	filter = TripleFilter();
+	filter.predicate = std::string("batch");
+	ASSERT_EQ((unsigned) 4, env.getFile(uuid)->getBlob("c")->getTriples(filter).size()) << "Batches not committed";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Metadata, ObjectBlobID)
+{
+	auto& env = createBench()->env;
+	auto& conn = env.getConnection();
+	
+	env.startSession();
+	auto prefix = Prefix::get(conn, "link", boost::make_optional(std::string("/link/")));
+	auto file = env.createFile();
+	auto uuid = toString(file->uuid);
+	auto source = file->addBlob("source", "text/plain");
+	auto target = file->addBlob("target", "text/plain");
+	auto single = source->addTriple(prefix, "links", *target);
+	auto bulk = source->addTriples(std::vector<NewTriple> {
+		NewTriple(prefix, "links", *target),
+		NewTriple(prefix, "title", Type::get(conn, "string", prefix), "source")
+	});
+	env.commitSession(IsolationLevels::Full);
+	
+	auto query = conn.prepareQuery("select object_blob_id from metadata where id = ?");
+	auto targetID = conn.prepareQuery("select blob.id from `blob` inner join file on file.id = blob.file_id where file.uuid = ? and blob.name = ?")
+		->execute(convertAll(uuid, "target")).rows.front().at(0);
+	ASSERT_EQ(targetID, query->execute(convertAll(single.id)).rows.front().at(0)) << "Blob object of a triple not stored";
+	ASSERT_EQ(targetID, query->execute(convertAll(bulk[0].id)).rows.front().at(0)) << "Blob object of bulk triples not stored";
+	ASSERT_EQ("", query->execute(convertAll(bulk[1].id)).rows.front().at(0)) << "Literal stored as blob object";
+	
+	// a handle on the object only conflicts with adding a link to it
+	auto& env1 = createBench()->env;
+	auto& env2 = createBench()->env;
+	env1.startSession();
+	env2.startSession();
+	auto file1 = env1.getFile(uuid);
+	file1->getBlob("source")->addTriple(prefix, "cites", *file1->getBlob("target"));
+	env2.getFile(uuid)->getBlob("target");
+	try
+	{
+		env1.commitSession(IsolationLevels::BlobExclusive);
+		FAIL() << "Handle on the object blob ignored";
+	}
+	catch (CommitException& e)
+	{
+		ASSERT_EQ(CommitException::Reason::ConflictingHandles, e.reason);
+	}
+	ASSERT_THROW(env1.commitSession(IsolationLevels::FileExclusive), CommitException) << "Handle on the object's file ignored";
+	
+	// removing the object invalidates the link
+	env2.getFile(uuid)->removeBlob("target");
+	env2.commitSession(IsolationLevels::Unsafe);
+	try
+	{
+		env1.commitSession(IsolationLevels::Unsafe);
+		FAIL() << "Link to a removed blob committed";
+	}
+	catch (CommitException& e)
+	{
+		ASSERT_EQ(CommitException::Reason::Invalidated, e.reason);
+	}
+	env1.rollbackSession();
+}
+
 TEST_F(Metadata, IsolationBlobExclusive)
 {
 	auto& env = createBench()->env;
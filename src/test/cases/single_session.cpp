@@ -1,10 +1,22 @@
 #include <sstream>
 
+extern "C"
+{
+	#include <fcntl.h>
+	#include <sys/stat.h>
+}
+
 #include <boost/uuid/uuid_io.hpp>
 
 #include "../test.hpp"
 #include "../../util/io.hpp"
 #include "../../util/util.hpp"
+#include "../../env/codec.hpp"
+#include "../../env/executor.hpp"
+#include "../../env/pack.hpp"
+#include "../../env/scrub.hpp"
+#include "../../env/search.hpp"
+#include "../../util/checksum.hpp"
 
 #include "gen/isolevel_impls.hpp"
 
@@ -39,13 +51,15 @@ TEST_F(Simple, CreateRollback)
 	auto file = env.createFile();
 	file->addBlob("default", "text/plain");
 	std::istringstream iss("content");
-	storeFile(file->getBlob("default")->getPath(true), iss);
+	auto path = file->getBlob("default")->getPath(true);
+	storeFile(path, iss);
 	auto uuid = boost::lexical_cast<std::string>(file->uuid);
 	env.rollbackSession();
 	
 	ASSERT_EQ((unsigned) 0, bench->conn->prepareQuery(
 		"select * from file where uuid = ?"
 	)->execute(convertAll(uuid)).rows.size()) << "Supposedly non-existing file exists";
+	ASSERT_FALSE(fs::exists(path)) << "Temporary file survived rollback";
 }
 
 TEST_F(Simple, RemoveFile)
@@ -72,4 +86,809 @@ TEST_F(Simple, RemoveFile)
 	env.rollbackSession();
 }
 
-}}
\ No newline at end of file
+TEST_F(Simple, Reshard)
+{
+	auto& env = bench->env;
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("default", "text/plain");
+	std::istringstream iss("content");
+	storeFile(file->getBlob("default")->getPath(true), iss);
+	auto uuid = toString(file->uuid);
+	env.commitSession(IsolationLevels::Full);
+	
+	// another process, which keeps using the store meanwhile
+	auto& other = createBench()->env;
+	other.startSession();
+	ASSERT_THROW(bench->vfs->reshard(env, 2, 2), Exception) << "Resharded while a session is open";
+	other.rollbackSession();
+	
+	// settings changed by others are kept
+	auto changed = StoreSettings::load(TestParameters::get().target);
+	changed.gcMinAge = bench->vfs->getSettings().gcMinAge + 1;
+	changed.save(TestParameters::get().target);
+	bench->vfs->reshard(env, 2, 2);
+	auto stored = StoreSettings::load(TestParameters::get().target);
+	ASSERT_EQ(changed.gcMinAge, stored.gcMinAge) << "Settings changed meanwhile overwritten by resharding";
+	ASSERT_EQ((unsigned) 2, stored.layoutLevels) << "Layout not saved";
+	
+	for (auto environment : { &env, &other })
+	{
+		environment->startSession();
+		auto path = environment->getFile(uuid)->getBlob("default")->getPath(false);
+		ASSERT_EQ(uuid.substr(2, 2), path.parent_path().parent_path().filename().string()) << "Blob not stored in sharded layout";
+		std::ostringstream oss;
+		readFile(path, oss);
+		ASSERT_EQ("content", oss.str()) << "Content in file differs after resharding";
+		environment->commitSession(IsolationLevels::Full);
+	}
+	
+	// from within a session, as the action does, with a blob yet to be committed
+	env.startSession();
+	file = env.getFile(uuid);
+	file->addBlob("second", "text/plain");
+	std::istringstream second("second");
+	storeFile(file->getBlob("second")->getPath(true), second);
+	bench->vfs->reshard(env, 1, 3);
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	file = env.getFile(uuid);
+	for (auto name : { "default", "second" })
+	{
+		auto path = file->getBlob(name)->getPath(false);
+		ASSERT_EQ(uuid.substr(0, 3), path.parent_path().parent_path().filename().string()) << "Blob not stored in the layout of the session's reshard";
+		ASSERT_TRUE(fs::exists(path)) << "Blob missing after resharding within a session";
+	}
+	env.commitSession(IsolationLevels::Full);
+	
+	bench->vfs->reshard(env, 0, 2);
+}
+
+TEST_F(Simple, Durability)
+{
+	auto settings = bench->vfs->getSettings();
+	// every blob a file of its own
+	settings.inlineThreshold = 0;
+	settings.packThreshold = 0;
+	
+	for (auto durability : { StoreSettings::Durability::None, StoreSettings::Durability::Commit, StoreSettings::Durability::Group })
+	{
+		settings.durability = durability;
+		auto& env = createBench(settings)->env;
+		auto name = StoreSettings::durabilityName(durability);
+		
+		env.startSession();
+		auto file = env.createFile();
+		file->addBlob("default", "text/plain");
+		std::istringstream iss("content");
+		storeFile(file->getBlob("default")->getPath(true), iss);
+		auto before = getSyncCounts();
+		env.commitSession(IsolationLevels::Full);
+		auto after = getSyncCounts();
+		
+		auto files = after.files - before.files, directories = after.directories - before.directories, fileSystems = after.fileSystems - before.fileSystems;
+		if (durability == StoreSettings::Durability::None)
+		{
+			ASSERT_EQ((uint64_t) 0, files + directories + fileSystems) << "Synced with durability " << name;
+		}
+		else if (durability == StoreSettings::Durability::Commit)
+		{
+			ASSERT_LE((uint64_t) 1, files) << "Blob not synced with durability " << name;
+			ASSERT_LE((uint64_t) 1, directories) << "Blob directory not synced with durability " << name;
+			ASSERT_EQ((uint64_t) 0, fileSystems) << "File system synced with durability " << name;
+		}
+		else
+		{
+			ASSERT_EQ((uint64_t) 1, fileSystems) << "File system not synced once with durability " << name;
+			ASSERT_EQ((uint64_t) 0, files + directories) << "Single files synced with durability " << name;
+		}
+	}
+	
+	// a blob going to a new pack
+	settings.durability = StoreSettings::Durability::Commit;
+	settings.packThreshold = 1024;
+	settings.packSize = 1;
+	auto& env = createBench(settings)->env;
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("default", "text/plain");
+	std::istringstream iss("content");
+	storeFile(file->getBlob("default")->getPath(true), iss);
+	auto uuid = toString(file->uuid);
+	auto before = getSyncCounts();
+	env.commitSession(IsolationLevels::Full);
+	auto after = getSyncCounts();
+	ASSERT_LE((uint64_t) 1, after.files - before.files) << "Pack not synced";
+	ASSERT_LE((uint64_t) 1, after.directories - before.directories) << "Directory of new pack not synced";
+	
+	// later tests start with packs of their own
+	env.startSession();
+	env.getFile(uuid)->getBlob("default")->remove();
+	env.commitSession(IsolationLevels::Full);
+	bench->vfs->compactPacks(env, 1);
+}
+
+TEST_F(Simple, Map)
+{
+	auto& env = bench->env;
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("default", "text/plain");
+	std::istringstream iss("content");
+	storeFile(file->getBlob("default")->getPath(true), iss);
+	
+	auto blob = file->getBlob("default");
+	auto mapping = blob->map();
+	ASSERT_EQ("content", std::string(mapping->begin(), mapping->end())) << "Mapped content differs from content written";
+	ASSERT_EQ(mapping, blob->map(Mapping::Advice::Random)) << "Mapping not reused";
+	
+	std::istringstream iss2("rewritten");
+	storeFile(blob->getPath(true), iss2);
+	ASSERT_EQ("content", std::string(mapping->begin(), mapping->end())) << "Existing mapping changed by rewrite";
+	auto remapped = blob->map();
+	ASSERT_EQ("rewritten", std::string(remapped->begin(), remapped->end())) << "Mapping not invalidated by rewrite";
+	auto uuid = toString(file->uuid);
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	mapping = env.getFile(uuid)->getBlob("default")->map();
+	ASSERT_EQ("rewritten", std::string(mapping->begin(), mapping->end())) << "Mapped content differs after commit";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Simple, Streams)
+{
+	auto& env = bench->env;
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("default", "text/plain");
+	auto writer = file->getBlob("default")->openWrite();
+	writer->write("content", 7);
+	writer->pwrite("C", 1, 0);
+	ASSERT_EQ((uint64_t) 7, writer->size()) << "Writer reports wrong size";
+	writer->close();
+	auto uuid = toString(file->uuid);
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	auto blob = env.getFile(uuid)->getBlob("default");
+	writer = blob->openWrite(BlobWriter::Mode::Append);
+	writer->write(" appended", 9);
+	writer->close();
+	
+	auto reader = blob->openRead();
+	ASSERT_EQ((uint64_t) 16, reader->size()) << "Reader reports wrong size";
+	char buffer[32];
+	ASSERT_EQ((std::size_t) 8, reader->pread(buffer, 8, 8)) << "Positional read incomplete";
+	ASSERT_EQ("appended", std::string(buffer, 8)) << "Positional read returned wrong content";
+	ASSERT_EQ((std::size_t) 16, reader->read(buffer, sizeof(buffer))) << "Read incomplete";
+	ASSERT_EQ("Content appended", std::string(buffer, 16)) << "Content differs from content written";
+	env.commitSession(IsolationLevels::Full);
+}
+
+TEST_F(Simple, Codec)
+{
+	auto dir = fs::temp_directory_path() / fs::unique_path();
+	fs::create_directories(dir);
+	std::string content;
+	for (int i = 0; i < 1000; ++i)
+		content += "compressible content ";
+	std::istringstream iss(content);
+	storeFile(dir / "plain", iss);
+	
+	ASSERT_FALSE(Codec::encode(dir / "plain", dir / "none", Codec::Type::None, 6)) << "Plain content encoded needlessly";
+	ASSERT_TRUE(Codec::encode(dir / "plain", dir / "zlib", Codec::Type::Zlib, 6)) << "Compressible content not encoded";
+	ASSERT_LT(fs::file_size(dir / "zlib"), content.size()) << "Encoded file not compressed";
+	
+	Codec::decode(dir / "zlib", dir / "decoded");
+	std::ostringstream oss;
+	readFile(dir / "decoded", oss);
+	ASSERT_EQ(content, oss.str()) << "Decoded content differs";
+	
+	fs::remove_all(dir);
+}
+
+TEST_F(Simple, EncodedBlobs)
+{
+	auto& target = TestParameters::get().target;
+	auto settings = bench->vfs->getSettings();
+	settings.inlineThreshold = 0;
+	settings.packThreshold = 0;
+	settings.compression.clear();
+	settings.compression["text/plain"] = Codec::Type::Zlib;
+	// room for a single decoded copy
+	settings.cacheSize = 1;
+	settings.gcMinAge = 0;
+	auto& env = createBench(settings)->env;
+	
+	std::string content;
+	for (int i = 0; i < 1000; ++i)
+		content += "compressible content ";
+	// plain contents which happen to start like an encoded file
+	auto header = std::string("\x89" "ASC\r\n\x1a\n\x01", 9) + std::string(15, '\0') + "plain";
+	
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("first", "text/plain");
+	file->addBlob("second", "text/plain");
+	file->addBlob("header", "application/octet-stream");
+	for (auto name : { "first", "second", "header" })
+	{
+		std::istringstream iss(name == std::string("header") ? header : content);
+		storeFile(file->getBlob(name)->getPath(true), iss);
+	}
+	auto uuid = toString(file->uuid);
+	auto ids = convertAll(file->getBlob("first")->getID(), file->getBlob("header")->getID());
+	env.commitSession(IsolationLevels::Full);
+	
+	auto query = bench->conn->prepareQuery("select codec from blob_codec where blob_id in (?, ?)");
+	auto rows = query->execute(ids).rows;
+	ASSERT_EQ((unsigned) 1, rows.size()) << "Wrong number of codecs recorded";
+	ASSERT_EQ("zlib", rows.front().at(0)) << "Wrong codec recorded";
+	ASSERT_LT(fs::file_size(target / "blobs" / uuid / "first"), content.size()) << "Blob not compressed";
+	
+	env.startSession();
+	file = env.getFile(uuid);
+	auto cached = [&target]() {
+		std::size_t count = 0;
+		for (fs::directory_iterator iter(target / "cache"), end; iter != end; ++iter)
+			++count;
+		return count;
+	};
+	for (auto name : { "first", "second" })
+	{
+		std::ostringstream oss;
+		readFile(file->getBlob(name)->getPath(), oss);
+		ASSERT_EQ(content, oss.str()) << "Decoded content differs from content written";
+		ASSERT_EQ((std::size_t) 1, cached()) << "Decoded copies not evicted";
+	}
+	auto mapping = file->getBlob("first")->map();
+	ASSERT_EQ(content, std::string(mapping->begin(), mapping->end())) << "Mapped content differs from content written";
+	
+	// streamed without another decoded copy
+	auto cachedNames = [&target]() {
+		std::set<std::string> names;
+		for (fs::directory_iterator iter(target / "cache"), end; iter != end; ++iter)
+			names.insert(iter->path().filename().string());
+		return names;
+	};
+	auto before = cachedNames();
+	std::ostringstream streamed;
+	file->getBlob("second")->copyTo(streamed);
+	ASSERT_EQ(content, streamed.str()) << "Streamed content differs from content written";
+	ASSERT_EQ(before, cachedNames()) << "Streaming decoded into the cache";
+	
+	ASSERT_EQ(target / "blobs" / uuid / "header", file->getBlob("header")->getPath()) << "Plain blob taken for an encoded one";
+	std::ostringstream oss;
+	readFile(file->getBlob("header")->getPath(), oss);
+	ASSERT_EQ(header, oss.str()) << "Plain content differs from content written";
+	
+	file->getBlob("first")->remove();
+	env.commitSession(IsolationLevels::Full);
+	ASSERT_EQ((unsigned) 0, query->execute(ids).rows.size()) << "Codec of removed blob still recorded";
+}
+
+TEST_F(Simple, InlineBlobs)
+{
+	auto settings = bench->vfs->getSettings();
+	settings.inlineThreshold = 64;
+	auto& env = createBench(settings)->env;
+	
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("default", "text/plain");
+	// binary contents are stored as they are
+	std::string content("con\0tent\xff", 9);
+	std::istringstream iss(content);
+	storeFile(file->getBlob("default")->getPath(true), iss);
+	auto uuid = toString(file->uuid);
+	auto id = file->getBlob("default")->getID();
+	env.commitSession(IsolationLevels::Full);
+	
+	auto query = bench->conn->prepareQuery("select content from blob_content where blob_id = ?");
+	auto rows = query->execute(convertAll(id)).rows;
+	ASSERT_EQ((unsigned) 1, rows.size()) << "Tiny blob not stored inline";
+	ASSERT_EQ(content, rows.front().at(0)) << "Inline content not stored as it is";
+	
+	env.startSession();
+	auto blob = env.getFile(uuid)->getBlob("default");
+	char buffer[16];
+	ASSERT_EQ((std::size_t) 9, blob->openRead()->read(buffer, sizeof(buffer))) << "Inline blob has wrong size";
+	ASSERT_EQ(content, std::string(buffer, 9)) << "Inline content differs from content written";
+	std::ostringstream oss;
+	readFile(blob->getPath(), oss);
+	ASSERT_EQ(content, oss.str()) << "Materialized content differs from content written";
+	blob->remove();
+	env.commitSession(IsolationLevels::Full);
+	
+	ASSERT_EQ((unsigned) 0, query->execute(convertAll(id)).rows.size()) << "Removed blob still stored inline";
+}
+
+TEST_F(Simple, Packs)
+{
+	auto settings = bench->vfs->getSettings();
+	settings.inlineThreshold = 0;
+	settings.packThreshold = 1024;
+	auto& env = createBench(settings)->env;
+	
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("first", "text/plain");
+	file->addBlob("second", "text/plain");
+	std::istringstream first("first content"), second("second content");
+	storeFile(file->getBlob("first")->getPath(true), first);
+	storeFile(file->getBlob("second")->getPath(true), second);
+	auto uuid = toString(file->uuid);
+	auto ids = convertAll(file->getBlob("first")->getID(), file->getBlob("second")->getID());
+	env.commitSession(IsolationLevels::Full);
+	
+	auto query = bench->conn->prepareQuery("select * from blob_pack where blob_id in (?, ?)");
+	ASSERT_EQ((unsigned) 2, query->execute(ids).rows.size()) << "Small blobs not packed";
+	
+	// replacing a blob leaves its previous range as garbage
+	env.startSession();
+	std::istringstream replaced("replaced");
+	storeFile(env.getFile(uuid)->getBlob("first")->getPath(true), replaced);
+	env.commitSession(IsolationLevels::Full);
+	
+	// a commit appending to the pack while it is being copied
+	PackStore packs(TestParameters::get().target / "packs", bench->logger);
+	auto count = packs.compact(*bench->conn, 0.3, settings.packSize, [&]() -> boost::shared_ptr<HandleBase> {
+		env.startSession();
+		auto file = env.getFile(uuid);
+		file->addBlob("third", "text/plain");
+		std::istringstream third("third");
+		storeFile(file->getBlob("third")->getPath(true), third);
+		env.commitSession(IsolationLevels::Full);
+		return bench->process->getMemLock("session")->timedLockOrThrow();
+	});
+	ASSERT_EQ((unsigned) 0, count) << "Pack compacted although appended to meanwhile";
+	
+	ASSERT_EQ((unsigned) 1, bench->vfs->compactPacks(env, 0.3)) << "Pack with garbage not compacted";
+	ASSERT_EQ((unsigned) 0, bench->vfs->compactPacks(env, 0.3)) << "Compacted pack compacted again";
+	
+	env.startSession();
+	auto blob = env.getFile(uuid)->getBlob("first");
+	auto mapping = blob->map();
+	ASSERT_EQ("replaced", std::string(mapping->begin(), mapping->end())) << "Mapped packed blob differs from content written";
+	std::ostringstream oss;
+	readFile(env.getFile(uuid)->getBlob("second")->getPath(), oss);
+	ASSERT_EQ("second content", oss.str()) << "Materialized packed blob differs from content written";
+	oss.str("");
+	readFile(env.getFile(uuid)->getBlob("third")->getPath(), oss);
+	ASSERT_EQ("third", oss.str()) << "Blob packed during compaction differs from content written";
+	char buffer[32];
+	auto reader = env.getFile(uuid)->getBlob("second")->openRead();
+	ASSERT_EQ((std::size_t) 14, reader->read(buffer, sizeof(buffer))) << "Packed blob has wrong size";
+	env.getFile(uuid)->getBlob("second")->remove();
+	env.commitSession(IsolationLevels::Full);
+	
+	ASSERT_EQ((unsigned) 1, query->execute(ids).rows.size()) << "Removed blob still packed";
+	
+	// a commit fills as many packs as it needs
+	settings.packSize = 16;
+	auto& full = createBench(settings)->env;
+	full.startSession();
+	file = full.getFile(uuid);
+	std::vector<std::string> moreIDs;
+	for (auto name : { "fourth", "fifth", "sixth" })
+	{
+		file->addBlob(name, "text/plain");
+		std::istringstream content("packed content");
+		storeFile(file->getBlob(name)->getPath(true), content);
+		moreIDs.push_back(toString(file->getBlob(name)->getID()));
+	}
+	full.commitSession(IsolationLevels::Full);
+	
+	auto used = bench->conn->prepareQuery("select count(distinct pack_id) from blob_pack where blob_id in (?, ?, ?)")->execute(moreIDs);
+	ASSERT_LE((unsigned) 2, boost::lexical_cast<unsigned>(used.rows.front()[0])) << "Commit appended beyond the pack size";
+}
+
+TEST_F(Simple, GarbageCollection)
+{
+	auto& env = bench->env;
+	// session ID 0 is the one of scratch files
+	uint64_t session = 0;
+	while (!session)
+	{
+		env.startSession();
+		session = *env.getSessionID();
+		env.rollbackSession();
+	}
+	
+	// leftovers of a crashed session and a fresh scratch file
+	auto temp = TestParameters::get().target / "temp";
+	auto orphan = temp / (boost::format("%1%-1-0-orphan") % session).str();
+	auto backup = temp / (boost::format("%1%-1-1-orphan.z.old") % session).str();
+	auto scratch = temp / "0-1-2-scratch";
+	createEmptyFile(orphan);
+	createEmptyFile(backup);
+	createEmptyFile(scratch);
+	
+	// a live session keeps its files
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("default", "text/plain");
+	auto path = file->getBlob("default")->getPath(true);
+	std::istringstream iss("content");
+	storeFile(path, iss);
+	
+	bench->vfs->collectGarbage(env, 0, 3600);
+	ASSERT_FALSE(fs::exists(orphan)) << "Orphaned temporary file not collected";
+	ASSERT_FALSE(fs::exists(backup)) << "Orphaned backup not collected";
+	ASSERT_TRUE(fs::exists(scratch)) << "Fresh scratch file collected";
+	ASSERT_TRUE(fs::exists(path)) << "Temporary file of a live session collected";
+	
+	bench->vfs->collectGarbage(env, 0, 0);
+	ASSERT_FALSE(fs::exists(scratch)) << "Old scratch file not collected";
+	env.rollbackSession();
+	
+	// decoded copies in the cache go once they are neither used nor mapped
+	auto settings = bench->vfs->getSettings();
+	settings.inlineThreshold = 0;
+	settings.packThreshold = 0;
+	settings.compression["text/plain"] = Codec::Type::Zlib;
+	auto& encoding = createBench(settings)->env;
+	encoding.startSession();
+	file = encoding.createFile();
+	for (auto name : { "used", "mapped", "unused" })
+	{
+		file->addBlob(name, "text/plain");
+		std::string content;
+		for (int i = 0; i < 100; ++i)
+			content += name;
+		std::istringstream stream(content);
+		storeFile(file->getBlob(name)->getPath(true), stream);
+	}
+	auto uuid = toString(file->uuid);
+	encoding.commitSession(IsolationLevels::Full);
+	
+	encoding.startSession();
+	file = encoding.getFile(uuid);
+	auto age = [](const fs::path& path) {
+		timespec times[2] = { { 0, UTIME_OMIT }, { time(nullptr) - 7200, 0 } };
+		ASSERT_EQ(0, utimensat(AT_FDCWD, path.c_str(), times, 0)) << "Couldn't age cached copy";
+	};
+	auto used = file->getBlob("used")->getPath();
+	auto mapping = file->getBlob("mapped")->map();
+	auto mapped = file->getBlob("mapped")->getPath();
+	auto unused = file->getBlob("unused")->getPath();
+	ASSERT_EQ(TestParameters::get().target / "cache", unused.parent_path()) << "Encoded blob not decoded to the cache";
+	age(used);
+	age(mapped);
+	age(unused);
+	ASSERT_EQ(used, file->getBlob("used")->getPath()) << "Cached copy not reused";
+	
+	encoding.getVFS().collectGarbage(encoding, 0, 3600);
+	ASSERT_FALSE(fs::exists(unused)) << "Unused cached copy not collected";
+	ASSERT_TRUE(fs::exists(used)) << "Recently used cached copy collected";
+	ASSERT_TRUE(fs::exists(mapped)) << "Mapped cached copy collected";
+	
+	mapping.reset();
+	encoding.getVFS().collectGarbage(encoding, 0, 3600);
+	ASSERT_FALSE(fs::exists(mapped)) << "Unmapped cached copy not collected";
+	encoding.rollbackSession();
+}
+
+TEST_F(Simple, Scrub)
+{
+	auto& target = TestParameters::get().target;
+	auto settings = bench->vfs->getSettings();
+	settings.inlineThreshold = 0;
+	settings.packThreshold = 0;
+	auto& env = createBench(settings)->env;
+	
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("first", "text/plain");
+	file->addBlob("second", "text/plain");
+	auto writer = file->getBlob("first")->openWrite();
+	writer->write("first content", 13);
+	writer.reset();
+	std::istringstream second("second content");
+	storeFile(file->getBlob("second")->getPath(true), second);
+	auto uuid = toString(file->uuid);
+	auto id = file->getBlob("first")->getID();
+	env.commitSession(IsolationLevels::Full);
+	
+	auto query = bench->conn->prepareQuery("select size, crc32c from blob_checksum where blob_id = ?");
+	auto rows = query->execute(convertAll(id)).rows;
+	ASSERT_EQ((unsigned) 1, rows.size()) << "No checksum stored";
+	ASSERT_EQ("13", rows.front()[0]) << "Wrong size stored";
+	ASSERT_EQ(toString(crc32c(0, "first content", 13)), rows.front()[1]) << "Wrong checksum stored";
+	
+	std::vector<Scrubber::Problem> problems;
+	auto report = [&problems](const Scrubber::Problem& problem) { problems.push_back(problem); };
+	Scrubber(env, 2, 0).run(true, report);
+	ASSERT_EQ((unsigned) 0, problems.size()) << "Intact blobs reported";
+	
+	// silent corruption and a lost file
+	auto dir = target / "blobs" / uuid;
+	std::istringstream corrupt("second contend");
+	storeFile(dir / "second", corrupt);
+	fs::remove(dir / "first");
+	Scrubber(env, 2, 0).run(true, report);
+	ASSERT_EQ((unsigned) 2, problems.size()) << "Damaged blobs not reported";
+	ASSERT_EQ(Scrubber::Problem::Kind::Missing, problems[0].kind) << "Lost file not reported as missing";
+	ASSERT_EQ(Scrubber::Problem::Kind::Mismatch, problems[1].kind) << "Corrupt file not reported as mismatch";
+	ASSERT_EQ("second", problems[1].name) << "Wrong blob reported";
+}
+
+TEST_F(Simple, Tiers)
+{
+	auto& target = TestParameters::get().target;
+	auto settings = bench->vfs->getSettings();
+	settings.inlineThreshold = 0;
+	settings.packThreshold = 0;
+	settings.tiers["cold"] = target / "cold";
+	settings.placement["application/x-archive"] = "cold";
+	settings.durability = StoreSettings::Durability::Group;
+	auto& env = createBench(settings)->env;
+	
+	env.startSession();
+	auto file = env.createFile();
+	file->addBlob("archived", "application/x-archive");
+	file->addBlob("plain", "text/plain");
+	std::istringstream archived("archived content"), plain("plain content");
+	storeFile(file->getBlob("archived")->getPath(true), archived);
+	storeFile(file->getBlob("plain")->getPath(true), plain);
+	auto uuid = toString(file->uuid);
+	auto ids = convertAll(file->getBlob("archived")->getID(), file->getBlob("plain")->getID());
+	auto before = getSyncCounts();
+	env.commitSession(IsolationLevels::Full);
+	// both tiers are on the same file system here
+	ASSERT_EQ((uint64_t) 1, getSyncCounts().fileSystems - before.fileSystems) << "File system not synced once";
+	
+	ASSERT_TRUE(fs::exists(target / "cold" / "blobs" / uuid / "archived")) << "Blob not placed in its tier";
+	ASSERT_TRUE(fs::exists(target / "blobs" / uuid / "plain")) << "Blob not placed in the default tier";
+	auto query = bench->conn->prepareQuery("select tier from blob_tier where blob_id in (?, ?)");
+	auto rows = query->execute(ids).rows;
+	ASSERT_EQ((unsigned) 1, rows.size()) << "Wrong number of tiers recorded";
+	ASSERT_EQ("cold", rows.front()[0]) << "Wrong tier recorded";
+	
+	// blobs which haven't been read for a while cool down, those never read
+	// since they have been stored go by when that was
+	settings.coldAfter = 3600;
+	settings.coldTier = "cold";
+	auto& migrating = createBench(settings)->env;
+	
+	auto path = target / "blobs" / uuid / "plain";
+	timespec times[2] = { { 0, UTIME_OMIT }, { time(nullptr) - 7200, 0 } };
+	ASSERT_EQ(0, utimensat(AT_FDCWD, path.c_str(), times, 0)) << "Couldn't age blob";
+	migrating.startSession();
+	migrating.getFile(uuid)->getBlob("plain")->map();
+	migrating.commitSession(IsolationLevels::Full);
+	ASSERT_EQ((uint64_t) 0, migrating.getVFS().migrate(migrating, 2, 0)) << "Blob read recently migrated";
+	bench->conn->prepareStatement("update blob_access set accessed = ? where blob_id = ?")->execute(convertAll(time(nullptr) - 7200, ids[1]));
+	ASSERT_EQ((uint64_t) 1, migrating.getVFS().migrate(migrating, 2, 0)) << "Wrong number of blobs migrated";
+	ASSERT_TRUE(fs::exists(target / "cold" / "blobs" / uuid / "plain")) << "Blob not migrated";
+	ASSERT_EQ((unsigned) 2, query->execute(ids).rows.size()) << "Migration not recorded";
+	ASSERT_EQ((uint64_t) 0, migrating.getVFS().migrate(migrating, 2, 0)) << "Blob migrated again";
+	
+	// readers which found the old copy may still open it until collected
+	ASSERT_TRUE(fs::exists(path)) << "Old copy removed right away";
+	migrating.getVFS().collectGarbage(migrating, 0, 0);
+	ASSERT_FALSE(fs::exists(path)) << "Migrated blob left behind";
+	ASSERT_TRUE(fs::exists(target / "cold" / "blobs" / uuid / "plain")) << "Migrated blob collected";
+	
+	migrating.startSession();
+	auto blob = migrating.getFile(uuid)->getBlob("plain");
+	auto mapping = blob->map();
+	ASSERT_EQ("plain content", std::string(mapping->begin(), mapping->end())) << "Migrated blob differs from content written";
+	mapping.reset();
+	auto writer = blob->openWrite();
+	writer->write("changed", 7);
+	writer.reset();
+	migrating.commitSession(IsolationLevels::Full);
+	
+	// rewritten blobs are hot again
+	ASSERT_TRUE(fs::exists(target / "blobs" / uuid / "plain")) << "Rewritten blob not placed in the default tier";
+	ASSERT_FALSE(fs::exists(target / "cold" / "blobs" / uuid / "plain")) << "Rewritten blob left behind";
+	ASSERT_EQ((unsigned) 1, query->execute(ids).rows.size()) << "Stale tier recorded";
+}
+
+TEST_F(Simple, TempPaths)
+{
+	auto& target = TestParameters::get().target;
+	auto settings = bench->vfs->getSettings();
+	settings.tiers["cold"] = target / "cold";
+	settings.placement["application/x-archive"] = "cold";
+	settings.durability = StoreSettings::Durability::Group;
+	auto& env = createBench(settings)->env;
+	
+	// the blobs of one file share the seed of their names
+	env.startSession();
+	auto session = toString(*env.getSessionID());
+	auto file = env.createFile();
+	std::unordered_set<std::string> names;
+	for (int i = 0; i < 8; ++i)
+	{
+		auto archived = i % 2 == 0;
+		auto name = toString(i);
+		file->addBlob(name, archived ? "application/x-archive" : "text/plain");
+		auto path = file->getBlob(name)->getPath(true);
+		ASSERT_TRUE(fs::equivalent(archived ? target / "cold" / "temp" : target / "temp", path.parent_path())) << "Temporary file not in the temporary directory of its tier";
+		ASSERT_EQ(session + "-", path.filename().string().substr(0, session.size() + 1)) << "Temporary file not named after its session";
+		ASSERT_TRUE(names.insert(path.filename().string()).second) << "Temporary file name used twice";
+	}
+	env.rollbackSession();
+}
+
+TEST_F(Simple, Executor)
+{
+	auto dir = TestParameters::get().target / "executor";
+	fs::create_directories(dir);
+	
+	// more requests than fit into the io_uring at once, and one which fails
+	const char* types[] = { "threads", "auto" };
+	for (auto type = std::begin(types); type != std::end(types); ++type)
+	{
+		auto executor = Executor::create(*type, 4);
+		std::vector<FileRequest> batch;
+		for (unsigned i = 0; i < 300; ++i)
+			batch.push_back(FileRequest(FileRequest::Type::MakeDirectory, dir / (std::string(*type) + boost::lexical_cast<std::string>(i))));
+		batch.push_back(FileRequest(FileRequest::Type::Unlink, dir / "missing"));
+		executor->execute(batch);
+		
+		for (unsigned i = 0; i < 300; ++i)
+		{
+			ASSERT_EQ(0, batch[i].result) << "Request failed with " << *type;
+			ASSERT_TRUE(fs::is_directory(batch[i].path)) << "Directory not created with " << *type;
+		}
+		ASSERT_EQ(-ENOENT, batch.back().result) << "Wrong result of failing request with " << *type;
+		ASSERT_THROW(batch.back().throwError(), Exception);
+		
+		// the workers outlive a batch and serve several callers at once
+		std::vector<FileRequest> first(batch.begin(), batch.begin() + 150), second(batch.begin() + 150, batch.end() - 1);
+		boost::thread other([&]() { executor->execute(first); });
+		executor->execute(second);
+		other.join();
+		for (auto request = first.begin(); request != first.end(); ++request)
+			ASSERT_EQ(-EEXIST, request->result) << "Wrong result of repeated request with " << *type;
+		for (auto request = second.begin(); request != second.end(); ++request)
+			ASSERT_EQ(-EEXIST, request->result) << "Wrong result of repeated request with " << *type;
+	}
+	
+	ASSERT_THROW(Executor::create("bogus", 1), Exception);
+	
+	// without io_uring, auto falls back to threads
+	bool uring = true;
+	try
+	{
+		Executor::create("uring", 1);
+	}
+	catch (const Exception&)
+	{
+		uring = false;
+	}
+	auto fallback = boost::dynamic_pointer_cast<ThreadPoolExecutor>(Executor::create("auto", 1));
+	ASSERT_EQ(uring, !fallback) << "Wrong executor chosen";
+}
+
+TEST_F(Simple, PartialCommit)
+{
+	auto& target = TestParameters::get().target;
+	auto settings = bench->vfs->getSettings();
+	settings.inlineThreshold = 0;
+	settings.packThreshold = 0;
+	auto& env = createBench(settings)->env;
+	auto read = [&target](const std::string& uuid)
+	{
+		std::ostringstream oss;
+		readFile(target / "blobs" / uuid / "blob", oss);
+		return oss.str();
+	};
+	
+	env.startSession();
+	std::vector<std::string> uuids;
+	for (unsigned i = 0; i < 2; ++i)
+	{
+		auto file = env.createFile();
+		file->addBlob("blob", "text/plain");
+		std::istringstream stream("old");
+		storeFile(file->getBlob("blob")->getPath(true), stream);
+		uuids.push_back(toString(file->uuid));
+	}
+	env.commitSession(IsolationLevels::Full);
+	
+	env.startSession();
+	for (auto iter = uuids.begin(); iter != uuids.end(); ++iter)
+	{
+		std::istringstream stream("new");
+		storeFile(env.getFile(*iter)->getBlob("blob")->getPath(true), stream);
+	}
+	
+	// the second blob can't be moved into place, since its directory is a file
+	auto blocked = target / "blobs" / uuids[1];
+	auto aside = target / "blobs" / "aside";
+	fs::rename(blocked, aside);
+	std::ofstream(blocked.c_str()).close();
+	ASSERT_THROW(env.commitSession(IsolationLevels::Full), Exception);
+	ASSERT_EQ("old", read(uuids[0])) << "Applied operation not undone";
+	
+	fs::remove(blocked);
+	fs::rename(aside, blocked);
+	env.commitSession(IsolationLevels::Full);
+	for (auto iter = uuids.begin(); iter != uuids.end(); ++iter)
+		ASSERT_EQ("new", read(*iter)) << "Blob not committed after undo";
+}
+
+TEST_F(Simple, Search)
+{
+	auto settings = bench->vfs->getSettings();
+	settings.textIndex = true;
+	auto& env = createBench(settings)->env;
+	env.startSession();
+	auto file = env.createFile();
+	const char* contents[][3] = {
+		{ "quick", "text/plain", "The quick brown fox jumps over the lazy dog" },
+		{ "brown", "text/plain", "brown fox, brown bear, Brown paper" },
+		{ "reversed", "text/html", "<p>fox brown</p>" },
+		{ "binary", "application/octet-stream", "brown fox" }
+	};
+	for (auto& content : contents)
+	{
+		file->addBlob(content[0], content[1]);
+		std::istringstream iss(content[2]);
+		storeFile(file->getBlob(content[0])->getPath(true), iss);
+	}
+	auto uuid = toString(file->uuid);
+	env.commitSession(IsolationLevels::Full);
+	
+	auto names = [&](const std::string& query) {
+		std::string names;
+		auto results = TextIndex::search(*bench->conn, query, 10);
+		for (auto iter = results.begin(); iter != results.end(); ++iter)
+			names += (names.empty() ? "" : " ") + iter->name;
+		return names;
+	};
+	ASSERT_EQ("brown reversed quick", names("BROWN")) << "Wrong blobs found or wrong ranking";
+	ASSERT_EQ("quick", names("lazy")) << "Wrong blobs found";
+	ASSERT_EQ("brown quick", names("\"brown fox\"")) << "Phrase not matched as such";
+	ASSERT_EQ("", names("\"fox jumps lazy\"")) << "Words apart matched as a phrase";
+	auto terms = bench->conn->prepareQuery("select count(*) from term where value = ?")->execute(convertAll("lazy"));
+	ASSERT_EQ("0", terms.rows.front().at(0)) << "Word added to the metadata terms";
+	
+	env.startSession();
+	env.getFile(uuid)->getBlob("brown")->remove();
+	auto writer = env.getFile(uuid)->getBlob("quick")->openWrite();
+	writer->write("slow", 4);
+	writer.reset();
+	env.commitSession(IsolationLevels::Full);
+	
+	ASSERT_EQ("reversed", names("brown")) << "Removed or rewritten blob still found";
+	ASSERT_EQ("quick", names("slow")) << "Rewritten blob not indexed anew";
+	
+	// a word too long to be indexed still separates its neighbours
+	env.startSession();
+	file = env.getFile(uuid);
+	file->addBlob("long", "text/plain");
+	auto longWord = std::string(TextIndex::maxWordLength + 1, 'x');
+	std::istringstream iss("brown " + longWord + " fox");
+	storeFile(file->getBlob("long")->getPath(true), iss);
+	env.commitSession(IsolationLevels::Full);
+	ASSERT_EQ("long reversed", names("fox brown")) << "Wrong blobs found";
+	ASSERT_EQ("", names("\"brown fox\"")) << "Words around a skipped word matched as a phrase";
+	ASSERT_EQ("long", names("\"brown " + longWord + " fox\"")) << "Phrase with a skipped word not matched";
+	
+	// reindexing honours the size limit
+	auto& conn = *bench->conn;
+	conn.prepareStatement("delete from text_posting")->execute(convertAll());
+	conn.prepareStatement("delete from text_document")->execute(convertAll());
+	settings.textIndexMaxSize = 20;
+	auto& reindexing = createBench(settings)->env;
+	reindexing.startSession();
+	auto indexed = reindexing.getVFS().reindex(reindexing);
+	reindexing.commitSession(IsolationLevels::Full);
+	auto documents = conn.prepareQuery("select count(*) from text_document")->execute(convertAll()).rows.front().at(0);
+	ASSERT_EQ(documents, boost::lexical_cast<std::string>(indexed)) << "Wrong number of blobs indexed";
+	ASSERT_EQ("", names("\"brown " + longWord + " fox\"")) << "Blob beyond the size limit indexed";
+	ASSERT_EQ("quick", names("slow")) << "Blob not indexed";
+	
+	settings.textIndex = false;
+	auto& disabled = createBench(settings)->env;
+	ASSERT_THROW(disabled.getVFS().reindex(disabled), Exception) << "Reindexed though disabled";
+}
+
+}}
@@ -13,6 +13,15 @@ associative::test::Bench* associative::test::Test::createBench()
 	return bench;
 }
 
+associative::test::Bench* associative::test::Test::createBench(const associative::StoreSettings& settings)
+{
+	auto& target = TestParameters::get().target;
+	if (!original)
+		original = StoreSettings::load(target);
+	settings.save(target);
+	return createBench();
+}
+
 void associative::test::Test::SetUp()
 {
 	testing::Test::SetUp();
@@ -23,6 +32,11 @@ void associative::test::Test::TearDown()
 {
 	forEach(benches, lambda::delete_ptr());
 	benches.clear();
+	if (original)
+	{
+		original->save(TestParameters::get().target);
+		original = boost::none;
+	}
 }
 
 void associative::test::SingleTest::SetUp()
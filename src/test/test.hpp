@@ -6,6 +6,7 @@
 #include <gtest/gtest.h>
 
 #include "bench.hpp"
+#include "../env/settings.hpp"
 
 namespace associative
 {
@@ -17,11 +18,17 @@ namespace associative
 		{
 		private:
 			std::unordered_set<Bench*> benches;
+			// the store's settings before the test changed them
+			boost::optional<StoreSettings> original;
 			
 		protected:
 			virtual void SetUp();
 			virtual void TearDown();
 			Bench* createBench();
+			// Saves 'settings' to the store and creates a bench with them. The
+			// original settings are restored when the test ends, also if it
+			// fails.
+			Bench* createBench(const StoreSettings& settings);
 		};
 		
 		class SingleTest : public Test
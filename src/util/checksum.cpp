@@ -0,0 +1,92 @@
+#include "checksum.hpp"
+
+namespace
+{
+	
+	// slicing-by-8, see "A Systematic Approach to Building High Performance,
+	// Software-based, CRC Generators" (Kounavis, Berry)
+	struct Table
+	{
+		uint32_t data[8][256];
+		
+		Table()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t crc = i;
+				for (int j = 0; j < 8; ++j)
+					crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+				data[0][i] = crc;
+			}
+			for (uint32_t i = 0; i < 256; ++i)
+				for (int j = 1; j < 8; ++j)
+					data[j][i] = (data[j - 1][i] >> 8) ^ data[0][data[j - 1][i] & 0xff];
+		}
+	};
+	
+	const Table table;
+	
+}
+
+uint32_t associative::crc32c(uint32_t crc, const char* data, std::size_t length)
+{
+	auto bytes = reinterpret_cast<const unsigned char*>(data);
+	auto& t = table.data;
+	crc = ~crc;
+	
+	for (; length >= 8; length -= 8, bytes += 8)
+	{
+		uint32_t low = crc ^ (bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24);
+		crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+			t[3][bytes[4]] ^ t[2][bytes[5]] ^ t[1][bytes[6]] ^ t[0][bytes[7]];
+	}
+	for (; length; --length, ++bytes)
+		crc = (crc >> 8) ^ t[0][(crc ^ *bytes) & 0xff];
+	
+	return ~crc;
+}
+
+associative::ChecksumBuffer::ChecksumBuffer(const Observer& observer)
+: buffer(65536), crc(0), length(0), observer(observer)
+{
+	setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+void associative::ChecksumBuffer::consume()
+{
+	std::size_t count = pptr() - pbase();
+	if (observer)
+		observer(count);
+	crc = crc32c(crc, pbase(), count);
+	length += count;
+	setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+associative::ChecksumBuffer::int_type associative::ChecksumBuffer::overflow(int_type c)
+{
+	consume();
+	if (!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+int associative::ChecksumBuffer::sync()
+{
+	consume();
+	return 0;
+}
+
+uint32_t associative::ChecksumBuffer::checksum()
+{
+	consume();
+	return crc;
+}
+
+uint64_t associative::ChecksumBuffer::size()
+{
+	consume();
+	return length;
+}
@@ -0,0 +1,47 @@
+#ifndef ASSOCIATIVE_CHECKSUM_HPP
+#define ASSOCIATIVE_CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include <vector>
+
+#include <boost/function.hpp>
+
+namespace associative
+{
+	
+	// CRC-32C (Castagnoli), continuing the checksum 'crc' of the preceding
+	// data; 0 is the checksum of no data at all
+	uint32_t crc32c(uint32_t crc, const char* data, std::size_t length);
+	
+	// Computes the checksum of everything written to a stream using it.
+	// The observer learns about each chunk before it is processed, e. g. to
+	// limit the rate.
+	class ChecksumBuffer : public std::streambuf
+	{
+	public:
+		typedef boost::function<void (std::size_t)> Observer;
+		
+	private:
+		std::vector<char> buffer;
+		uint32_t crc;
+		uint64_t length;
+		Observer observer;
+		
+		void consume();
+		
+	protected:
+		virtual int_type overflow(int_type c);
+		virtual int sync();
+		
+	public:
+		ChecksumBuffer(const Observer& observer = Observer());
+		
+		uint32_t checksum();
+		uint64_t size();
+	};
+	
+}
+
+#endif
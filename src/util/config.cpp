@@ -25,6 +25,11 @@ std::string associative::Configuration::defaultIsolationLevel()
 	return ASSOCIATIVE_DEFAULT_ISOLEVEL;
 }
 
+std::string associative::Configuration::defaultDurability()
+{
+	return ASSOCIATIVE_DEFAULT_DURABILITY;
+}
+
 boost::filesystem3::path associative::Configuration::defaultLogPath()
 {
 	return boost::filesystem3::path(ASSOCIATIVE_DEFAULT_LOG);
@@ -20,6 +20,7 @@ namespace associative
 		static boost::optional<uint64_t> maxLockTime();
 		static bool debug();
 		static std::string defaultIsolationLevel();
+		static std::string defaultDurability();
 		static fs::path defaultLogPath();
 	};
 
@@ -1,11 +1,135 @@
+extern "C"
+{
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/ioctl.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+}
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
 #include "io.hpp"
 
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+namespace
+{
+	
+	std::atomic<uint64_t> syncedFiles(0), syncedDirectories(0), syncedFileSystems(0);
+	
+	void syncPath(const fs::path& path, int flags, int (*sync)(int))
+	{
+		int fd = open(path.c_str(), flags);
+		if (fd < 0)
+			throw associative::formatException(boost::format("couldn't open %1%: %2%") % path % std::strerror(errno));
+		int ret = sync(fd);
+		int error = errno;
+		close(fd);
+		if (ret)
+			throw associative::formatException(boost::format("couldn't sync %1%: %2%") % path % std::strerror(error));
+	}
+	
+}
+
 void associative::createEmptyFile(const fs::path& path)
 {
 	fs::create_directories(path.parent_path());
 	std::ofstream(path.string(), std::ios_base::trunc);
 }
 
+void associative::cloneFile(const fs::path& src, const fs::path& dest)
+{
+	int in = open(src.c_str(), O_RDONLY);
+	if (in < 0)
+		throw formatException(boost::format("couldn't open %1%: %2%") % src % std::strerror(errno));
+	int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out < 0)
+	{
+		int error = errno;
+		close(in);
+		throw formatException(boost::format("couldn't open %1%: %2%") % dest % std::strerror(error));
+	}
+	
+	int error = 0;
+	if (ioctl(out, FICLONE, in))
+	{
+		bool kernelCopy = true;
+		char buffer[65536];
+		for (;;)
+		{
+			ssize_t copied = -1;
+#ifdef SYS_copy_file_range
+			if (kernelCopy)
+			{
+				copied = syscall(SYS_copy_file_range, in, 0, out, 0, 1 << 30, 0);
+				// e. g. crossing file systems on older kernels
+				if (copied < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+					kernelCopy = false;
+			}
+#else
+			kernelCopy = false;
+#endif
+			if (!kernelCopy)
+			{
+				copied = read(in, buffer, sizeof(buffer));
+				for (ssize_t written = 0; copied > 0 && written < copied; )
+				{
+					ssize_t ret = write(out, buffer + written, copied - written);
+					if (ret < 0)
+					{
+						copied = -1;
+						break;
+					}
+					written += ret;
+				}
+			}
+			
+			if (copied < 0 && errno == EINTR)
+				continue;
+			if (copied <= 0)
+			{
+				error = copied < 0 ? errno : 0;
+				break;
+			}
+		}
+	}
+	
+	close(in);
+	if (close(out) && !error)
+		error = errno;
+	if (error)
+		throw formatException(boost::format("couldn't copy %1% to %2%: %3%") % src % dest % std::strerror(error));
+}
+
+void associative::syncFile(const fs::path& path)
+{
+	syncPath(path, O_RDONLY, &fsync);
+	++syncedFiles;
+}
+
+void associative::syncDirectory(const fs::path& path)
+{
+	syncPath(path, O_RDONLY | O_DIRECTORY, &fsync);
+	++syncedDirectories;
+}
+
+void associative::syncFileSystem(const fs::path& path)
+{
+	syncPath(path, O_RDONLY, &syncfs);
+	++syncedFileSystems;
+}
+
+associative::SyncCounts associative::getSyncCounts()
+{
+	SyncCounts counts = { syncedFiles.load(), syncedDirectories.load(), syncedFileSystems.load() };
+	return counts;
+}
+
 std::istream& associative::operator>>(std::istream& istream, associative::Line& line)
 {
 	std::getline(istream, line.data);
@@ -36,6 +36,26 @@ namespace associative
 	
 	void createEmptyFile(const fs::path& path);
 	
+	// Copies 'src' to 'dest'. If the file system supports it, both share
+	// their data until either is modified, otherwise the kernel copies.
+	void cloneFile(const fs::path& src, const fs::path& dest);
+	
+	// flush file contents resp. directory entries to stable storage
+	void syncFile(const fs::path& path);
+	void syncDirectory(const fs::path& path);
+	
+	// flush everything on the file system containing 'path'
+	void syncFileSystem(const fs::path& path);
+	
+	// the syncs this process performed so far, by kind
+	struct SyncCounts
+	{
+		uint64_t files;
+		uint64_t directories;
+		uint64_t fileSystems;
+	};
+	SyncCounts getSyncCounts();
+	
 	class Line
 	{
 		// based on <http://stackoverflow.com/questions/1567082/how-do-i-iterate-over-cin-line-by-line-in-c/1567703#1567703>
@@ -0,0 +1,29 @@
+#include "threads.hpp"
+
+unsigned associative::defaultThreadCount()
+{
+	return std::max(1u, boost::thread::hardware_concurrency());
+}
+
+associative::RateLimiter::RateLimiter(double rate)
+: rate(rate)
+{
+}
+
+void associative::RateLimiter::acquire(double amount)
+{
+	if (rate <= 0)
+		return;
+
+	auto now = boost::posix_time::microsec_clock::universal_time();
+	boost::posix_time::ptime start;
+	{
+		boost::lock_guard<boost::mutex> guard(mutex);
+		if (next.is_not_a_date_time() || next < now)
+			next = now;
+		start = next;
+		next += boost::posix_time::microseconds(static_cast<int64_t>(amount * 1000000 / rate));
+	}
+	if (start > now)
+		boost::this_thread::sleep(start - now);
+}
@@ -0,0 +1,85 @@
+#ifndef ASSOCIATIVE_THREADS_HPP
+#define ASSOCIATIVE_THREADS_HPP
+
+#include <atomic>
+#include <exception>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "util.hpp"
+
+namespace associative
+{
+	
+	unsigned defaultThreadCount();
+	
+	// Spreads work over time so that at most 'rate' units are done per
+	// second (0: no limit), shared by all threads using it.
+	class RateLimiter
+	{
+	private:
+		const double rate;
+		boost::mutex mutex;
+		boost::posix_time::ptime next;
+		
+	public:
+		RateLimiter(double rate);
+		
+		// waits until 'amount' units may be done
+		void acquire(double amount = 1);
+	};
+	
+	// Applies 'func' to every element of 'coll' using up to 'threads' worker
+	// threads. The first exception thrown by 'func' is rethrown in the
+	// calling thread after all workers have finished; the remaining elements
+	// are skipped in that case.
+	template<typename Coll, typename Func>
+	void parallelForEach(Coll& coll, const Func& func, unsigned threads = defaultThreadCount())
+	{
+		std::vector<decltype(coll.begin())> items;
+		for (auto iter = coll.begin(); iter != coll.end(); ++iter)
+			items.push_back(iter);
+		
+		if (threads <= 1 || items.size() <= 1)
+		{
+			for (auto iter = items.begin(); iter != items.end(); ++iter)
+				func(**iter);
+			return;
+		}
+		
+		std::atomic<std::size_t> next(0);
+		std::atomic<bool> failed(false);
+		std::exception_ptr error;
+		boost::mutex errorMutex;
+		
+		auto worker = [&]() {
+			for (std::size_t i = next++; i < items.size() && !failed; i = next++)
+			{
+				try
+				{
+					func(*items[i]);
+				}
+				catch (...)
+				{
+					boost::lock_guard<boost::mutex> guard(errorMutex);
+					if (!error)
+						error = std::current_exception();
+					failed = true;
+				}
+			}
+		};
+		
+		boost::thread_group group;
+		for (unsigned i = 0; i < std::min<std::size_t>(threads, items.size()); ++i)
+			group.create_thread(worker);
+		group.join_all();
+		
+		if (error)
+			std::rethrow_exception(error);
+	}
+	
+}
+
+#endif